@@ -0,0 +1,187 @@
+/*
+ * @file ack_window.c
+ * @brief sliding window of messages sent to the server but not yet ACKed
+ *
+ * Every message is stamped with a monotonically increasing sequence number.
+ * Up to uiWindow messages may be in flight at once, so the send rate on a
+ * high-RTT link is no longer one tap per round trip. Each in-flight message
+ * has its own ACK deadline on the timer wheel; when it passes, the message is
+ * retransmitted and the deadline re-armed.
+ *
+ * The server processes messages in order, so an ACK for seq N acknowledges
+ * every message up to and including N.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "ack_window.h"
+
+// ---------------------------------------------------------------------------
+// Internal function - slot of a sequence number
+//
+static ack_slot *slotOf( ack_window *pWin, uint32_t uiSeq ){
+    return( &pWin->aSlots[uiSeq & (ACK_WINDOW_MAX - 1)] );
+}
+
+// ---------------------------------------------------------------------------
+// timer callback - no ACK within the deadline, send the message again
+//
+static void onAckDeadline( timer_entry *pTimer, void *pCtx ){
+    ack_window *pWin = (ack_window *)pCtx;
+    ack_slot *pSlot = (ack_slot *)((char *)pTimer - offsetof(ack_slot, deadline));
+
+    pSlot->nRetransmits++;
+    pWin->uiRetransmits++;
+    fprintf(stderr, "no ACK for message %u. retransmitting (attempt %d)\n",
+            pSlot->uiSeq, pSlot->nRetransmits + 1 );
+
+    if( pWin->fnRetransmit( pSlot->pMessage, pSlot->szLen, pWin->pCtx ) <= 0 )
+        fprintf(stderr, "Non-fatal Error retransmitting message %u\n", pSlot->uiSeq );
+
+    // the wheel's own clock is the time this callback was due
+    armTimer( pWin->pWheel, pTimer, pWin->pWheel->ullNowTick * TIMER_TICK_MS, pWin->uiTimeoutMs );
+}
+
+// ---------------------------------------------------------------------------
+// initialise an empty window
+//
+// returns: 0 if OK, -1 if uiWindow is out of range
+//
+int initAckWindow( ack_window *pWin, uint32_t uiWindow, uint32_t uiTimeoutMs,
+                   timer_wheel *pWheel, retransmit_fn fnRetransmit, void *pCtx ){
+    int i;
+
+    if( uiWindow < 1 || uiWindow > ACK_WINDOW_MAX )
+        return( -1 );
+
+    memset( pWin, 0, sizeof(*pWin) );
+    pWin->uiWindow = uiWindow;
+    pWin->uiTimeoutMs = uiTimeoutMs;
+    pWin->pWheel = pWheel;
+    pWin->fnRetransmit = fnRetransmit;
+    pWin->pCtx = pCtx;
+    for( i=0 ; i < ACK_WINDOW_MAX ; i++ )
+        initTimer( &pWin->aSlots[i].deadline, onAckDeadline, pWin );
+    return( 0 );
+}
+
+// ---------------------------------------------------------------------------
+// forget everything in flight and carry on from uiSeq, e.g. to resend
+// from the journal after a restart or reconnect
+//
+void resetAckWindow( ack_window *pWin, uint32_t uiSeq ){
+    int i;
+
+    for( i=0 ; i < ACK_WINDOW_MAX ; i++ )
+        cancelTimer( pWin->pWheel, &pWin->aSlots[i].deadline );
+    pWin->uiNextSeq = pWin->uiUnacked = uiSeq;
+}
+
+// ---------------------------------------------------------------------------
+// number of messages sent and not acknowledged yet
+//
+uint32_t ackWindowInFlight( const ack_window *pWin ){
+    return( pWin->uiNextSeq - pWin->uiUnacked );
+}
+
+// ---------------------------------------------------------------------------
+// returns true if another message may be sent now
+//
+bool ackWindowHasRoom( const ack_window *pWin ){
+    return( ackWindowInFlight( pWin ) < pWin->uiWindow );
+}
+
+// ---------------------------------------------------------------------------
+// sequence number to stamp on the next message
+//
+uint32_t nextAckSeq( const ack_window *pWin ){
+    return( pWin->uiNextSeq );
+}
+
+// ---------------------------------------------------------------------------
+// record a message, stamped with nextAckSeq(), that has just been sent
+//
+// returns: its sequence number, or -1 if the window is full or the
+//          message is too big to keep for retransmission
+//
+int trackMessage( ack_window *pWin, const char *pMessage, size_t szLen, uint64_t ullNowMs ){
+    ack_slot *pSlot;
+
+    if( !ackWindowHasRoom( pWin ) || szLen > ACK_MESSAGE_SIZE )
+        return( -1 );
+
+    pSlot = slotOf( pWin, pWin->uiNextSeq );
+    pSlot->uiSeq = pWin->uiNextSeq++;
+    pSlot->ullSentMs = ullNowMs;
+    pSlot->nRetransmits = 0;
+    pSlot->szLen = szLen;
+    memcpy( pSlot->acMessage, pMessage, szLen );
+    pSlot->pMessage = pSlot->acMessage;
+    armTimer( pWin->pWheel, &pSlot->deadline, ullNowMs, pWin->uiTimeoutMs );
+    pWin->uiSent++;
+    return( (int)pSlot->uiSeq );
+}
+
+// ---------------------------------------------------------------------------
+// as trackMessage(), but keep a reference to the message instead of a copy.
+// It must stay where it is until it's ACKed or the window is reset, e.g. a
+// record in the journal
+//
+// returns: its sequence number, or -1 if the window is full
+//
+int trackMessageRef( ack_window *pWin, const char *pMessage, size_t szLen, uint64_t ullNowMs ){
+    ack_slot *pSlot;
+
+    if( !ackWindowHasRoom( pWin ) )
+        return( -1 );
+
+    pSlot = slotOf( pWin, pWin->uiNextSeq );
+    pSlot->uiSeq = pWin->uiNextSeq++;
+    pSlot->ullSentMs = ullNowMs;
+    pSlot->nRetransmits = 0;
+    pSlot->szLen = szLen;
+    pSlot->pMessage = pMessage;
+    armTimer( pWin->pWheel, &pSlot->deadline, ullNowMs, pWin->uiTimeoutMs );
+    pWin->uiSent++;
+    return( (int)pSlot->uiSeq );
+}
+
+// ---------------------------------------------------------------------------
+// the server ACKed uiSeq: release it and every message before it.
+// Duplicate and stale ACKs are ignored. bRttFresh says whether a message
+// released had never been retransmitted, so uiLastRttMs was measured now
+//
+// returns: number of messages released from the window
+//
+int ackReceived( ack_window *pWin, uint32_t uiSeq, uint64_t ullNowMs ){
+    ack_slot *pSlot;
+    int n = 0;
+
+    // out of range (already ACKed, or never sent)
+    pWin->bRttFresh = false;
+    if( uiSeq - pWin->uiUnacked >= ackWindowInFlight( pWin ) )
+        return( 0 );
+
+    while( pWin->uiUnacked != uiSeq + 1 ){
+        pSlot = slotOf( pWin, pWin->uiUnacked++ );
+        cancelTimer( pWin->pWheel, &pSlot->deadline );
+        if( pSlot->nRetransmits == 0 ){     // RTT is ambiguous after a retransmit
+            pWin->uiLastRttMs = (uint32_t)(ullNowMs - pSlot->ullSentMs);
+            pWin->bRttFresh = true;
+        }
+        pWin->uiAcked++;
+        n++;
+    }
+    return( n );
+}
+
+// ---------------------------------------------------------------------------
+// an ACK without a sequence number (older servers) releases the oldest message
+//
+// returns: number of messages released from the window (0 or 1)
+//
+int ackOldest( ack_window *pWin, uint64_t ullNowMs ){
+    if( ackWindowInFlight( pWin ) == 0 )
+        return( 0 );
+    return( ackReceived( pWin, pWin->uiUnacked, ullNowMs ) );
+}
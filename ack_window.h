@@ -0,0 +1,63 @@
+/*
+ * @file ack_window.h
+ * @brief public interface of ack_window.c
+ */
+#ifndef _ACK_WINDOW_H_
+#define _ACK_WINDOW_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "timer_wheel.h"
+
+// Definitions
+#define ACK_WINDOW_MAX      64      // largest configurable window. power of 2
+#define ACK_MESSAGE_SIZE  1024      // largest message kept for retransmission
+
+// called when a message's ACK deadline passes, to send it again
+// returns: number of bytes written, else < 1 on error
+typedef int (*retransmit_fn)( const char *pMessage, size_t szLen, void *pCtx );
+
+// a message sent but not acknowledged yet
+typedef struct {
+    uint32_t    uiSeq;
+    uint64_t    ullSentMs;          // first transmission, for the round trip time
+    int         nRetransmits;
+    timer_entry deadline;
+    size_t      szLen;
+    const char *pMessage;           // acMessage, or the caller's copy
+    char        acMessage[ACK_MESSAGE_SIZE];
+} ack_slot;
+
+typedef struct {
+    ack_slot      aSlots[ACK_WINDOW_MAX];   // indexed by seq % ACK_WINDOW_MAX
+    uint32_t      uiNextSeq;        // stamped on the next message sent
+    uint32_t      uiUnacked;        // oldest seq not acknowledged yet
+    uint32_t      uiWindow;         // max messages in flight
+    uint32_t      uiTimeoutMs;      // ACK deadline per message
+    timer_wheel  *pWheel;
+    retransmit_fn fnRetransmit;
+    void         *pCtx;
+
+    // counters
+    uint32_t      uiSent;
+    uint32_t      uiAcked;
+    uint32_t      uiRetransmits;
+    uint32_t      uiLastRttMs;
+    bool          bRttFresh;        // the last ackReceived() measured uiLastRttMs
+} ack_window;
+
+// function prototypes
+int      initAckWindow( ack_window *pWin, uint32_t uiWindow, uint32_t uiTimeoutMs,
+                        timer_wheel *pWheel, retransmit_fn fnRetransmit, void *pCtx );
+void     resetAckWindow( ack_window *pWin, uint32_t uiSeq );
+bool     ackWindowHasRoom( const ack_window *pWin );
+uint32_t ackWindowInFlight( const ack_window *pWin );
+uint32_t nextAckSeq( const ack_window *pWin );
+int      trackMessage( ack_window *pWin, const char *pMessage, size_t szLen, uint64_t ullNowMs );
+int      trackMessageRef( ack_window *pWin, const char *pMessage, size_t szLen, uint64_t ullNowMs );
+int      ackReceived( ack_window *pWin, uint32_t uiSeq, uint64_t ullNowMs );
+int      ackOldest( ack_window *pWin, uint64_t ullNowMs );
+
+#endif // _ACK_WINDOW_H_
@@ -0,0 +1,166 @@
+/*
+ * @file ack_window_test.c
+ * @brief unit test for ack_window.c
+ *
+ * runs standalone - no server needed. Retransmissions are captured by a
+ * stand-in send function and the timer wheel is driven by a simulated clock.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ack_window.h"
+#include "unit_test.h"
+
+#define TEST_TIMEOUT    5000
+
+static timer_wheel wheel;
+static ack_window  window;
+static uint64_t    ullClockMs;
+static int         nRetransmits;
+static char        szLastRetransmit[ACK_MESSAGE_SIZE];
+
+// ---------------------------------------------------------------------------
+// stand-in for sendTCPmessage()
+//
+int captureRetransmit( const char *pMessage, size_t szLen, void *pCtx ){
+    nRetransmits++;
+    memcpy( szLastRetransmit, pMessage, szLen );
+    szLastRetransmit[szLen] = '\0';
+    return( (int)szLen );
+}
+
+// ---------------------------------------------------------------------------
+// send a message through the window
+//
+int sendMessage( const char *szMessage ){
+    return( trackMessage( &window, szMessage, strlen(szMessage), ullClockMs ) );
+}
+
+// ---------------------------------------------------------------------------
+// step the simulated clock
+//
+void advanceBy( uint64_t ullMs ){
+    ullClockMs += ullMs;
+    expireTimers( &wheel, ullClockMs );
+}
+
+// ---------------------------------------------------------------------------
+// the window fills up, and cumulative ACKs open it again
+//
+void testWindow( void ){
+    ullClockMs = 0;
+    initTimerWheel( &wheel, ullClockMs );
+    CHECK( initAckWindow( &window, 0, TEST_TIMEOUT, &wheel, captureRetransmit, NULL ) != 0 );
+    CHECK( initAckWindow( &window, 3, TEST_TIMEOUT, &wheel, captureRetransmit, NULL ) == 0 );
+
+    CHECK( nextAckSeq( &window ) == 0 );
+    CHECK( sendMessage("m0") == 0 );
+    CHECK( sendMessage("m1") == 1 );
+    CHECK( sendMessage("m2") == 2 );
+    CHECK( !ackWindowHasRoom( &window ) );
+    CHECK( sendMessage("m3") == -1 );           // full
+
+    advanceBy( 40 );
+    CHECK( ackReceived( &window, 1, ullClockMs ) == 2 );  // ACKs m0 and m1
+    CHECK( window.uiLastRttMs == 40 && window.bRttFresh );
+    CHECK( ackWindowInFlight( &window ) == 1 );
+    CHECK( ackReceived( &window, 1, ullClockMs ) == 0 );  // duplicate
+    CHECK( !window.bRttFresh );
+    CHECK( ackReceived( &window, 7, ullClockMs ) == 0 );  // never sent
+    CHECK( sendMessage("m3") == 3 );
+    CHECK( sendMessage("m4") == 4 );
+    CHECK( ackOldest( &window, ullClockMs ) == 1 );        // legacy ACK releases m2
+    CHECK( ackReceived( &window, 4, ullClockMs ) == 2 );
+    CHECK( ackWindowInFlight( &window ) == 0 );
+    CHECK( ackOldest( &window, ullClockMs ) == 0 );
+    CHECK( window.uiAcked == 5 );
+
+    // all deadlines were cancelled
+    advanceBy( 2 * TEST_TIMEOUT );
+    CHECK( nRetransmits == 0 );
+    CHECK( wheel.szArmed == 0 );
+}
+
+// ---------------------------------------------------------------------------
+// messages past their deadline are retransmitted until ACKed
+//
+void testRetransmit( void ){
+    static const char szKept[] = "kept by the caller";
+
+    ullClockMs = 100000;
+    nRetransmits = 0;
+    initTimerWheel( &wheel, ullClockMs );
+    initAckWindow( &window, 4, TEST_TIMEOUT, &wheel, captureRetransmit, NULL );
+
+    sendMessage("first");
+    advanceBy( 1000 );
+    sendMessage("second");
+
+    advanceBy( TEST_TIMEOUT - 1000 );
+    CHECK( nRetransmits == 1 );
+    CHECK( strcmp( szLastRetransmit, "first" ) == 0 );
+
+    ackReceived( &window, 0, ullClockMs );
+    advanceBy( 1000 );
+    CHECK( nRetransmits == 2 );
+    CHECK( strcmp( szLastRetransmit, "second" ) == 0 );
+
+    advanceBy( TEST_TIMEOUT );                  // still no ACK - again
+    CHECK( nRetransmits == 3 );
+    CHECK( window.aSlots[1].nRetransmits == 2 );
+
+    CHECK( ackReceived( &window, 1, ullClockMs ) == 1 );
+    CHECK( !window.bRttFresh );                 // retransmitted: no sample
+    advanceBy( 2 * TEST_TIMEOUT );
+    CHECK( nRetransmits == 3 );
+    CHECK( window.uiRetransmits == 3 );
+
+    // kept by reference: retransmitted from the caller's copy
+    CHECK( trackMessageRef( &window, szKept, strlen(szKept), ullClockMs ) == 2 );
+    CHECK( window.aSlots[2].pMessage == szKept );
+    advanceBy( TEST_TIMEOUT );
+    CHECK( nRetransmits == 4 );
+    CHECK( strcmp( szLastRetransmit, szKept ) == 0 );
+    ackReceived( &window, 2, ullClockMs );
+}
+
+// ---------------------------------------------------------------------------
+// sequence numbers keep counting past the size of the slot array
+//
+void testWrap( void ){
+    uint32_t i;
+
+    ullClockMs = 0;
+    initTimerWheel( &wheel, ullClockMs );
+    initAckWindow( &window, ACK_WINDOW_MAX, TEST_TIMEOUT, &wheel, captureRetransmit, NULL );
+    for( i=0 ; i < 10 * ACK_WINDOW_MAX ; i++ ){
+        CHECK( sendMessage("tap") == (int)i );
+        if( i % 3 == 2 )
+            CHECK( ackReceived( &window, i, ullClockMs ) == 3 );
+    }
+    CHECK( ackWindowInFlight( &window ) == (10 * ACK_WINDOW_MAX) % 3 );
+
+    // start over from the oldest unACKed message, as after a reconnect
+    resetAckWindow( &window, window.uiUnacked );
+    CHECK( ackWindowInFlight( &window ) == 0 );
+    CHECK( wheel.szArmed == 0 );
+    CHECK( sendMessage("replayed") == (int)(10 * ACK_WINDOW_MAX - (10 * ACK_WINDOW_MAX) % 3) );
+}
+
+// ===========================================================================
+// main
+//
+int main( int argc, char *argv[] )
+{
+    testWindow();
+    testRetransmit();
+    testWrap();
+
+    if( nFailures ){
+        printf("%d check(s) FAILED\n", nFailures );
+        exit( EXIT_FAILURE );
+    }
+    printf("all ACK window tests passed\n");
+    exit( EXIT_SUCCESS );
+}
@@ -0,0 +1,5 @@
+#!/bin/bash
+
+echo gcc -o ack_window_test ack_window_test.c ack_window.c timer_wheel.c
+
+gcc -o ack_window_test ack_window_test.c ack_window.c timer_wheel.c
@@ -0,0 +1,5 @@
+#!/bin/bash
+
+echo gcc -O2 -o dedup_cache_test dedup_cache_test.c dedup_cache.c nfc_encode.c nfc_record.c nfc-utils.c
+
+gcc -O2 -o dedup_cache_test dedup_cache_test.c dedup_cache.c nfc_encode.c nfc_record.c nfc-utils.c
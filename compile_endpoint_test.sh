@@ -0,0 +1,5 @@
+#!/bin/bash
+
+echo gcc -o endpoint_test endpoint_test.c endpoint.c
+
+gcc -o endpoint_test endpoint_test.c endpoint.c
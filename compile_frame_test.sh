@@ -0,0 +1,5 @@
+#!/bin/bash
+
+echo gcc -o frame_test frame_test.c frame.c
+
+gcc -o frame_test frame_test.c frame.c
@@ -0,0 +1,5 @@
+#!/bin/bash
+
+echo gcc -o journal_test journal_test.c journal.c
+
+gcc -o journal_test journal_test.c journal.c
@@ -1,4 +1,4 @@
 #!/bin/bash
-echo gcc -o nfc_driver_test nfc_driver_test.c nfc_driver.c nfc-utils.c -lnfc
+echo gcc -o nfc_driver_test nfc_driver_test.c nfc_driver.c nfc_encode.c nfc_record.c nfc-utils.c -lnfc
 
-gcc -o nfc_driver_test nfc_driver_test.c nfc_driver.c nfc-utils.c -lnfc
+gcc -o nfc_driver_test nfc_driver_test.c nfc_driver.c nfc_encode.c nfc_record.c nfc-utils.c -lnfc
@@ -0,0 +1,5 @@
+#!/bin/bash
+
+echo gcc -O2 -o nfc_encode_test nfc_encode_test.c nfc_encode.c nfc_record.c nfc-utils.c
+
+gcc -O2 -o nfc_encode_test nfc_encode_test.c nfc_encode.c nfc_record.c nfc-utils.c
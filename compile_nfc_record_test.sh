@@ -0,0 +1,5 @@
+#!/bin/bash
+
+echo gcc -O2 -o nfc_record_test nfc_record_test.c nfc_record.c nfc_encode.c nfc-utils.c
+
+gcc -O2 -o nfc_record_test nfc_record_test.c nfc_record.c nfc_encode.c nfc-utils.c
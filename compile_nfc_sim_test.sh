@@ -0,0 +1,5 @@
+#!/bin/bash
+
+echo gcc -O2 -o nfc_sim_test nfc_sim_test.c nfc_sim.c nfc_driver.c nfc_encode.c nfc_record.c nfc-utils.c -lpthread -lm
+
+gcc -O2 -o nfc_sim_test nfc_sim_test.c nfc_sim.c nfc_driver.c nfc_encode.c nfc_record.c nfc-utils.c -lpthread -lm
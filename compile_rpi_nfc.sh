@@ -1,5 +1,5 @@
 #!/bin/bash
 
-echo gcc -o rpi_nfc rpi_nfc.c tcp_client.c nfc_driver.c led_driver.c nfc-utils.c -lnfc ../wiringPi/wiringPi/libwiringPi.so.2.0
+echo gcc -o rpi_nfc rpi_nfc.c tcp_client.c event_loop.c timer_wheel.c spsc_ring.c ack_window.c journal.c frame.c rx_buffer.c endpoint.c uring.c tx_queue.c dedup_cache.c nfc_driver.c nfc_encode.c nfc_record.c led_driver.c nfc-utils.c -lnfc -lpthread ../wiringPi/wiringPi/libwiringPi.so.2.0
 
-gcc -o rpi_nfc rpi_nfc.c tcp_client.c nfc_driver.c led_driver.c nfc-utils.c -lnfc ../wiringPi/wiringPi/libwiringPi.so.2.0
+gcc -o rpi_nfc rpi_nfc.c tcp_client.c event_loop.c timer_wheel.c spsc_ring.c ack_window.c journal.c frame.c rx_buffer.c endpoint.c uring.c tx_queue.c dedup_cache.c nfc_driver.c nfc_encode.c nfc_record.c led_driver.c nfc-utils.c -lnfc -lpthread ../wiringPi/wiringPi/libwiringPi.so.2.0
@@ -0,0 +1,5 @@
+#!/bin/bash
+
+echo gcc -DLED_NO_GPIO -o rpi_nfc_sim rpi_nfc.c tcp_client.c event_loop.c timer_wheel.c spsc_ring.c ack_window.c journal.c frame.c rx_buffer.c endpoint.c uring.c tx_queue.c dedup_cache.c nfc_driver.c nfc_encode.c nfc_record.c led_driver.c nfc-utils.c nfc_sim.c -lpthread -lm
+
+gcc -DLED_NO_GPIO -o rpi_nfc_sim rpi_nfc.c tcp_client.c event_loop.c timer_wheel.c spsc_ring.c ack_window.c journal.c frame.c rx_buffer.c endpoint.c uring.c tx_queue.c dedup_cache.c nfc_driver.c nfc_encode.c nfc_record.c led_driver.c nfc-utils.c nfc_sim.c -lpthread -lm
@@ -0,0 +1,5 @@
+#!/bin/bash
+
+echo gcc -o rx_buffer_test rx_buffer_test.c rx_buffer.c
+
+gcc -o rx_buffer_test rx_buffer_test.c rx_buffer.c
@@ -0,0 +1,5 @@
+#!/bin/bash
+
+echo gcc -O2 -o spsc_ring_test spsc_ring_test.c spsc_ring.c -lpthread
+
+gcc -O2 -o spsc_ring_test spsc_ring_test.c spsc_ring.c -lpthread
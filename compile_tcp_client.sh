@@ -1,5 +1,5 @@
 #!/bin/bash
 
-echo gcc -o tcp_client_test tcp_client_test.c tcp_client.c 
+echo gcc -o tcp_client_test tcp_client_test.c tcp_client.c uring.c -lpthread
 
-gcc -o tcp_client_test tcp_client_test.c tcp_client.c 
+gcc -o tcp_client_test tcp_client_test.c tcp_client.c uring.c -lpthread
@@ -0,0 +1,5 @@
+#!/bin/bash
+
+echo gcc -O2 -o timer_wheel_test timer_wheel_test.c timer_wheel.c
+
+gcc -O2 -o timer_wheel_test timer_wheel_test.c timer_wheel.c
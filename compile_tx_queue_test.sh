@@ -0,0 +1,5 @@
+#!/bin/bash
+
+echo gcc -O2 -o tx_queue_test tx_queue_test.c tx_queue.c nfc_encode.c nfc_record.c nfc-utils.c
+
+gcc -O2 -o tx_queue_test tx_queue_test.c tx_queue.c nfc_encode.c nfc_record.c nfc-utils.c
@@ -0,0 +1,5 @@
+#!/bin/bash
+
+echo gcc -o uring_test uring_test.c uring.c
+
+gcc -o uring_test uring_test.c uring.c
@@ -0,0 +1,196 @@
+/*
+ * @file dedup_cache.c
+ * @brief cards seen recently, so repeat taps are ignored before they're encoded
+ *
+ * A tap of a card seen at the same reader less than the TTL ago is a repeat.
+ * Cards are looked up by reader, modulation type and UID - not by the message
+ * built from them, so a repeat costs a hash and a probe or two, and no
+ * encoding. Every card seen within the TTL is remembered, so two cards tapped
+ * in turn are each still caught.
+ *
+ * The entries are a fixed pool, found through an open-addressing table of
+ * twice as many slots. When the pool is full the least recently seen card
+ * makes room; an expired entry stays until then, or until its card comes
+ * back. Removal from the table shifts the probe run back, so there are no
+ * tombstones and lookups stay short however long it runs.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "dedup_cache.h"
+
+// ---------------------------------------------------------------------------
+// Internal function - FNV-1a hash of a key
+//
+static uint64_t hashKey( uint8_t btReader, uint8_t btModulation, const uint8_t *pbtUid, size_t szUid ){
+    uint64_t ullHash = 0xcbf29ce484222325ull;
+    size_t i;
+
+    ullHash = (ullHash ^ btReader) * 0x100000001b3ull;
+    ullHash = (ullHash ^ btModulation) * 0x100000001b3ull;
+    for( i=0 ; i < szUid ; i++ )
+        ullHash = (ullHash ^ pbtUid[i]) * 0x100000001b3ull;
+    return( ullHash );
+}
+
+// ---------------------------------------------------------------------------
+// allocate a cache of up to uiCapacity cards, each remembered for uiTtlMs
+//
+// returns: 0 if OK, else -1 (no capacity, or out of memory)
+//
+int initDedupCache( dedup_cache *pC, uint32_t uiCapacity, uint32_t uiTtlMs ){
+    uint32_t uiSlots = 1, i;
+
+    memset( pC, 0, sizeof(*pC) );
+    if( uiCapacity == 0 || uiCapacity > UINT32_MAX / 4 )
+        return( -1 );
+    while( uiSlots < 2 * uiCapacity )
+        uiSlots <<= 1;
+
+    pC->aEntries = calloc( uiCapacity, sizeof(dedup_entry) );
+    pC->auiSlots = malloc( uiSlots * sizeof(uint32_t) );
+    if( pC->aEntries == NULL || pC->auiSlots == NULL ){
+        freeDedupCache( pC );
+        return( -1 );
+    }
+    for( i=0 ; i < uiSlots ; i++ )
+        pC->auiSlots[i] = DEDUP_NONE;
+    pC->uiCapacity = uiCapacity;
+    pC->uiMask = uiSlots - 1;
+    pC->uiNewest = pC->uiOldest = DEDUP_NONE;
+    pC->uiTtlMs = uiTtlMs;
+    return( 0 );
+}
+
+// ---------------------------------------------------------------------------
+// free the cache
+//
+void freeDedupCache( dedup_cache *pC ){
+    free( pC->aEntries );
+    free( pC->auiSlots );
+    pC->aEntries = NULL;
+    pC->auiSlots = NULL;
+    pC->uiCount = 0;
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - take an entry out of the LRU list
+//
+static void unlinkEntry( dedup_cache *pC, uint32_t uiEntry ){
+    dedup_entry *pE = &pC->aEntries[uiEntry];
+
+    if( pE->uiNewer != DEDUP_NONE )
+        pC->aEntries[pE->uiNewer].uiOlder = pE->uiOlder;
+    else
+        pC->uiNewest = pE->uiOlder;
+    if( pE->uiOlder != DEDUP_NONE )
+        pC->aEntries[pE->uiOlder].uiNewer = pE->uiNewer;
+    else
+        pC->uiOldest = pE->uiNewer;
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - put an entry at the newest end of the LRU list
+//
+static void linkNewest( dedup_cache *pC, uint32_t uiEntry ){
+    dedup_entry *pE = &pC->aEntries[uiEntry];
+
+    pE->uiNewer = DEDUP_NONE;
+    pE->uiOlder = pC->uiNewest;
+    if( pC->uiNewest != DEDUP_NONE )
+        pC->aEntries[pC->uiNewest].uiNewer = uiEntry;
+    else
+        pC->uiOldest = uiEntry;
+    pC->uiNewest = uiEntry;
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - take an entry out of the table. The entries after it
+// in its probe run move back to fill the gap, where their hash allows
+//
+static void removeSlot( dedup_cache *pC, uint32_t uiEntry ){
+    uint32_t i = (uint32_t)pC->aEntries[uiEntry].ullHash & pC->uiMask;
+    uint32_t j, k;
+
+    while( pC->auiSlots[i] != uiEntry )
+        i = (i + 1) & pC->uiMask;
+
+    for( j = i ; ; ){
+        j = (j + 1) & pC->uiMask;
+        if( pC->auiSlots[j] == DEDUP_NONE )
+            break;
+        k = (uint32_t)pC->aEntries[pC->auiSlots[j]].ullHash & pC->uiMask;
+        // leave it if its home slot is cyclically in (i, j]
+        if( i <= j ? (i < k && k <= j) : (i < k || k <= j) )
+            continue;
+        pC->auiSlots[i] = pC->auiSlots[j];
+        i = j;
+    }
+    pC->auiSlots[i] = DEDUP_NONE;
+}
+
+// ---------------------------------------------------------------------------
+// is this tap of a card a repeat - the same card seen at the same reader
+// less than the TTL ago? If not it's remembered from now. A repeat doesn't
+// extend the TTL, so a card held to the reader counts again once it's
+// passed. A card without a UID is never a repeat
+//
+// returns: true if it's a repeat
+//
+bool dedupRepeat( dedup_cache *pC, uint8_t btReader, uint8_t btModulation,
+                  const uint8_t *pbtUid, size_t szUid, uint64_t ullNowMs ){
+    uint64_t ullHash;
+    uint32_t i, uiEntry;
+    dedup_entry *pE;
+
+    if( szUid == 0 || szUid > DEDUP_UID_MAX )
+        return( false );
+    pC->uiLookups++;
+    ullHash = hashKey( btReader, btModulation, pbtUid, szUid );
+
+    for( i = (uint32_t)ullHash & pC->uiMask ; (uiEntry = pC->auiSlots[i]) != DEDUP_NONE ;
+         i = (i + 1) & pC->uiMask ){
+        pE = &pC->aEntries[uiEntry];
+        if( pE->ullHash != ullHash || pE->btReader != btReader || pE->btModulation != btModulation ||
+            pE->btUidLen != szUid || memcmp( pE->abtUid, pbtUid, szUid ) != 0 )
+            continue;
+        unlinkEntry( pC, uiEntry );
+        linkNewest( pC, uiEntry );
+        if( ullNowMs < pE->ullExpiresMs ){
+            pC->uiRepeats++;
+            return( true );
+        }
+        pE->ullExpiresMs = ullNowMs + pC->uiTtlMs;
+        return( false );
+    }
+
+    // a new card. When full, the least recently seen makes room
+    if( pC->uiCount < pC->uiCapacity )
+        uiEntry = pC->uiCount++;
+    else {
+        uiEntry = pC->uiOldest;
+        unlinkEntry( pC, uiEntry );
+        removeSlot( pC, uiEntry );
+        pC->uiEvictions++;
+        // the slot found empty may have moved: probe again
+        for( i = (uint32_t)ullHash & pC->uiMask ; pC->auiSlots[i] != DEDUP_NONE ; i = (i + 1) & pC->uiMask )
+            ;
+    }
+    pE = &pC->aEntries[uiEntry];
+    pE->ullHash = ullHash;
+    pE->ullExpiresMs = ullNowMs + pC->uiTtlMs;
+    pE->btReader = btReader;
+    pE->btModulation = btModulation;
+    pE->btUidLen = (uint8_t)szUid;
+    memcpy( pE->abtUid, pbtUid, szUid );
+    pC->auiSlots[i] = uiEntry;
+    linkNewest( pC, uiEntry );
+    return( false );
+}
+
+// ---------------------------------------------------------------------------
+// cards remembered, expired or not
+//
+uint32_t dedupCount( const dedup_cache *pC ){
+    return( pC->uiCount );
+}
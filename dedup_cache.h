@@ -0,0 +1,56 @@
+/*
+ * @file dedup_cache.h
+ * @brief public interface of dedup_cache.c - cards seen recently, by UID
+ *
+ * Self-contained: keyed on the reader, modulation type and UID bytes, so it
+ * needs nothing from libnfc.
+ */
+#ifndef _DEDUP_CACHE_H_
+#define _DEDUP_CACHE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Definitions
+#define DEDUP_UID_MAX       10          // longest UID kept (an NFCID3)
+#define DEDUP_NONE          UINT32_MAX  // no entry: an empty slot, or the end of the LRU list
+
+// a card seen, and until when a repeat is ignored
+typedef struct {
+    uint64_t  ullHash;
+    uint64_t  ullExpiresMs;
+    uint32_t  uiNewer;          // LRU list, by entry number
+    uint32_t  uiOlder;
+    uint8_t   btReader;
+    uint8_t   btModulation;
+    uint8_t   btUidLen;
+    uint8_t   abtUid[DEDUP_UID_MAX];
+} dedup_entry;
+
+// Open-addressing hash table (linear probing) of entry numbers, at most
+// half full, over a fixed pool of entries kept in least recently used order
+typedef struct {
+    dedup_entry *aEntries;
+    uint32_t    *auiSlots;      // entry number, or DEDUP_NONE
+    uint32_t    uiCapacity;     // entries
+    uint32_t    uiMask;         // slots - 1
+    uint32_t    uiCount;
+    uint32_t    uiNewest;
+    uint32_t    uiOldest;
+    uint32_t    uiTtlMs;
+
+    // counters
+    uint32_t    uiLookups;
+    uint32_t    uiRepeats;
+    uint32_t    uiEvictions;
+} dedup_cache;
+
+// function prototypes
+int   initDedupCache( dedup_cache *pC, uint32_t uiCapacity, uint32_t uiTtlMs );
+void  freeDedupCache( dedup_cache *pC );
+bool  dedupRepeat( dedup_cache *pC, uint8_t btReader, uint8_t btModulation,
+                   const uint8_t *pbtUid, size_t szUid, uint64_t ullNowMs );
+uint32_t dedupCount( const dedup_cache *pC );
+
+#endif // _DEDUP_CACHE_H_
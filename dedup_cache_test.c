@@ -0,0 +1,229 @@
+/*
+ * @file dedup_cache_test.c
+ * @brief unit test for dedup_cache.c
+ *
+ * runs standalone - no NFC device needed. Checks repeats are caught per card
+ * and reader until they expire, that the least recently seen card makes
+ * room, and the table against a plain list through many evictions. Then
+ * benchmarks lookups among 10k cards against encoding a tap as JSON, which
+ * the quarantine did to every tap before.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "dedup_cache.h"
+#include "nfc_encode.h"
+#include "unit_test.h"
+
+#define TTL_MS          5000
+#define MODEL_CARDS     8           // capacity of the cache checked against the list
+#define MODEL_TAPS      200000
+#define BENCH_CARDS     10000
+#define BENCH_ROUNDS    100
+#define BUFSIZE         256
+
+// ---------------------------------------------------------------------------
+// a 7 byte MIFARE UID for card number uiCard
+//
+void makeUid( uint8_t abtUid[7], uint32_t uiCard ){
+    abtUid[0] = 0x04;
+    abtUid[1] = (uint8_t)(uiCard >> 24);
+    abtUid[2] = (uint8_t)(uiCard >> 16);
+    abtUid[3] = (uint8_t)(uiCard >> 8);
+    abtUid[4] = (uint8_t)uiCard;
+    abtUid[5] = 0x2B;
+    abtUid[6] = 0x80;
+}
+
+// ---------------------------------------------------------------------------
+// a tap of card uiCard at reader 0
+//
+bool tap( dedup_cache *pC, uint32_t uiCard, uint64_t ullMs ){
+    uint8_t abtUid[7];
+
+    makeUid( abtUid, uiCard );
+    return( dedupRepeat( pC, 0, 1, abtUid, sizeof(abtUid), ullMs ) );
+}
+
+// ---------------------------------------------------------------------------
+// a card is a repeat within the TTL, at the same reader, as the same type
+//
+void testRepeats( void ){
+    dedup_cache c;
+    uint8_t abtUid[7];
+
+    CHECK( initDedupCache( &c, 0, TTL_MS ) == -1 );
+    CHECK( initDedupCache( &c, 16, TTL_MS ) == 0 );
+    CHECK( !tap( &c, 1, 1000 ) );
+    CHECK( tap( &c, 1, 1000 ) );
+    CHECK( tap( &c, 1, 1000 + TTL_MS - 1 ) );
+
+    // two cards tapped in turn are both still caught
+    CHECK( !tap( &c, 2, 1100 ) );
+    CHECK( tap( &c, 1, 1200 ) && tap( &c, 2, 1300 ) && tap( &c, 1, 1400 ) );
+
+    // a repeat doesn't extend the TTL: a held card counts again once it's passed
+    CHECK( !tap( &c, 1, 1000 + TTL_MS ) );
+    CHECK( tap( &c, 1, 1000 + 2 * TTL_MS - 1 ) );
+
+    // another reader, another type, another length
+    makeUid( abtUid, 2 );
+    CHECK( !dedupRepeat( &c, 1, 1, abtUid, 7, 1500 ) );
+    CHECK( !dedupRepeat( &c, 0, 7, abtUid, 7, 1500 ) );
+    CHECK( !dedupRepeat( &c, 0, 1, abtUid, 4, 1500 ) );
+    CHECK( dedupRepeat( &c, 1, 1, abtUid, 7, 1600 ) );
+
+    // no UID, no telling
+    CHECK( !dedupRepeat( &c, 0, 1, abtUid, 0, 1600 ) && !dedupRepeat( &c, 0, 1, abtUid, 0, 1600 ) );
+    CHECK( !dedupRepeat( &c, 0, 1, abtUid, DEDUP_UID_MAX + 1, 1600 ) );
+
+    CHECK( dedupCount( &c ) == 5 && c.uiEvictions == 0 );
+    freeDedupCache( &c );
+}
+
+// ---------------------------------------------------------------------------
+// full, the least recently seen card makes room
+//
+void testEviction( void ){
+    dedup_cache c;
+    uint32_t i;
+
+    CHECK( initDedupCache( &c, 4, TTL_MS ) == 0 );
+    for( i=0 ; i < 4 ; i++ )
+        CHECK( !tap( &c, i, 0 ) );
+    CHECK( tap( &c, 0, 10 ) );              // seen again: now the newest
+    CHECK( !tap( &c, 4, 20 ) );             // card 1 makes room
+    CHECK( c.uiEvictions == 1 && dedupCount( &c ) == 4 );
+    CHECK( tap( &c, 0, 30 ) && tap( &c, 2, 30 ) && tap( &c, 3, 30 ) && tap( &c, 4, 30 ) );
+    CHECK( !tap( &c, 1, 40 ) );             // forgotten, and back. card 0 makes room
+    CHECK( !tap( &c, 0, 50 ) );
+    freeDedupCache( &c );
+}
+
+// ---------------------------------------------------------------------------
+// random taps of more cards than fit, against a plain list of the cards
+// remembered in LRU order. Evictions shift the table's probe runs about
+//
+void testAgainstList( void ){
+    dedup_cache c;
+    uint32_t auiCard[MODEL_CARDS];
+    uint64_t aullExpires[MODEL_CARDS];
+    uint32_t uiCard, n = 0, i, j;
+    uint64_t ullMs = 0, ullExpires;
+    bool bRepeat;
+    int nTap, nMismatches = 0;
+
+    srand( 7 );
+    CHECK( initDedupCache( &c, MODEL_CARDS, 50 ) == 0 );
+    for( nTap=0 ; nTap < MODEL_TAPS ; nTap++ ){
+        uiCard = (uint32_t)rand() % (3 * MODEL_CARDS);
+        ullMs += (uint64_t)rand() % 4;
+
+        // the list: newest first
+        for( i=0 ; i < n && auiCard[i] != uiCard ; i++ )
+            ;
+        bRepeat = i < n && ullMs < aullExpires[i];
+        if( i == n ){
+            if( n < MODEL_CARDS )
+                n++;
+            i = n - 1;          // in place of the oldest, if full
+            aullExpires[i] = ullMs + 50;
+        } else if( !bRepeat )
+            aullExpires[i] = ullMs + 50;
+        ullExpires = aullExpires[i];
+        for( j=i ; j > 0 ; j-- ){
+            auiCard[j] = auiCard[j-1];
+            aullExpires[j] = aullExpires[j-1];
+        }
+        auiCard[0] = uiCard;
+        aullExpires[0] = ullExpires;
+
+        if( tap( &c, uiCard, ullMs ) != bRepeat )
+            nMismatches++;
+    }
+    CHECK( nMismatches == 0 );
+    CHECK( dedupCount( &c ) == MODEL_CARDS && c.uiEvictions > MODEL_TAPS / 2 );
+    CHECK( c.uiLookups == MODEL_TAPS );
+    freeDedupCache( &c );
+}
+
+// ---------------------------------------------------------------------------
+// nanoseconds on CLOCK_MONOTONIC
+//
+uint64_t nanosecs( void ){
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return( (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec );
+}
+
+// ---------------------------------------------------------------------------
+// time a repeat tap among 10k cards, against building the JSON message the
+// quarantine compared
+//
+void benchmark( void ){
+    dedup_cache c;
+    nfc_target nt;
+    char szBuffer[BUFSIZE];
+    volatile int nSink = 0;
+    uint64_t ullStart, ullInsert, ullRepeat, ullEncode;
+    uint32_t i;
+    int r;
+
+    CHECK( initDedupCache( &c, 2 * BENCH_CARDS, TTL_MS ) == 0 );
+
+    ullStart = nanosecs();
+    for( i=0 ; i < BENCH_CARDS ; i++ )
+        nSink += tap( &c, i * 2654435761u, 0 );
+    ullInsert = nanosecs() - ullStart;
+
+    ullStart = nanosecs();
+    for( r=0 ; r < BENCH_ROUNDS ; r++ ){
+        for( i=0 ; i < BENCH_CARDS ; i++ )
+            nSink += tap( &c, i * 2654435761u, 1 );
+    }
+    ullRepeat = nanosecs() - ullStart;
+    CHECK( c.uiRepeats == BENCH_ROUNDS * BENCH_CARDS );
+
+    memset( &nt, 0, sizeof(nt) );
+    nt.nm.nmt = NMT_ISO14443A;
+    nt.nm.nbr = NBR_106;
+    nt.nti.nai.abtAtqa[1] = 0x44;
+    nt.nti.nai.btSak = 0x08;
+    nt.nti.nai.szUidLen = 7;
+    ullStart = nanosecs();
+    for( r=0 ; r < BENCH_ROUNDS ; r++ ){
+        for( i=0 ; i < BENCH_CARDS ; i++ ){
+            makeUid( nt.nti.nai.abtUid, i * 2654435761u );
+            nSink += constructJSONstringNFC( nt, szBuffer, BUFSIZE );
+        }
+    }
+    ullEncode = nanosecs() - ullStart;
+
+    printf("benchmark: %d distinct 7 byte UIDs\n", BENCH_CARDS );
+    printf("  first tap, remembered     %8.1f ns/tap\n", (double)ullInsert / BENCH_CARDS );
+    printf("  repeat tap, caught        %8.1f ns/tap\n", (double)ullRepeat / (BENCH_ROUNDS * BENCH_CARDS) );
+    printf("  JSON-encoding the tap     %8.1f ns/tap (before the quarantine could compare)\n",
+           (double)ullEncode / (BENCH_ROUNDS * BENCH_CARDS) );
+    freeDedupCache( &c );
+}
+
+// ===========================================================================
+// main
+//
+int main( int argc, char *argv[] )
+{
+    testRepeats();
+    testEviction();
+    testAgainstList();
+    benchmark();
+
+    if( nFailures ){
+        printf("%d check(s) FAILED\n", nFailures );
+        exit( EXIT_FAILURE );
+    }
+    printf("all dedup cache tests passed\n");
+    exit( EXIT_SUCCESS );
+}
@@ -0,0 +1,193 @@
+/*
+ * @file endpoint.c
+ * @brief choice between redundant servers by health and latency
+ *
+ * Keeps, per server, a smoothed round trip time (from connection
+ * handshakes, including probes of the servers not in use, and heartbeats)
+ * and how much longer than that its ACKs take. A server's score is the sum:
+ * the time a tap takes to be acknowledged there. The client uses the
+ * healthy server with the lowest score, and only moves to another that is
+ * clearly faster, so two similar servers don't flap.
+ *
+ * A server that fails is unhealthy for a backoff that doubles with each
+ * failure in a row, jittered, and is healthy again once that has passed.
+ * Needs no network: the caller supplies the samples and the clock.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "endpoint.h"
+
+#define UNMEASURED_SCORE    (UINT32_MAX / 2)    // ranks after any measured server
+
+// ---------------------------------------------------------------------------
+// an empty set of servers
+//
+void initEndpoints( endpoint_set *pSet ){
+    memset( pSet, 0, sizeof(*pSet) );
+    pSet->nActive = -1;
+}
+
+// ---------------------------------------------------------------------------
+// add a server. Until measured, servers are preferred in the order added
+//
+// returns: its index, else -1 if there are ENDPOINT_MAX already
+//
+int addEndpoint( endpoint_set *pSet ){
+    if( pSet->nEndpoints >= ENDPOINT_MAX )
+        return( -1 );
+    memset( &pSet->aEndpoints[pSet->nEndpoints], 0, sizeof(endpoint) );
+    return( pSet->nEndpoints++ );
+}
+
+// ---------------------------------------------------------------------------
+// a round trip to server n took uiRttMs. Smoothed as TCP does (RFC 6298):
+// srtt = 7/8 srtt + 1/8 sample, rttvar = 3/4 rttvar + 1/4 |srtt - sample|
+//
+void endpointRttSample( endpoint_set *pSet, int n, uint32_t uiRttMs ){
+    endpoint *pEp = &pSet->aEndpoints[n];
+    uint32_t uiDelta;
+
+    if( pEp->uiRttSamples++ == 0 ){
+        pEp->uiSrttMs = uiRttMs;
+        pEp->uiRttVarMs = uiRttMs / 2;
+        return;
+    }
+    uiDelta = (pEp->uiSrttMs > uiRttMs) ? pEp->uiSrttMs - uiRttMs : uiRttMs - pEp->uiSrttMs;
+    pEp->uiRttVarMs = (3 * pEp->uiRttVarMs + uiDelta) / 4;
+    pEp->uiSrttMs = (7 * pEp->uiSrttMs + uiRttMs) / 8;
+}
+
+// ---------------------------------------------------------------------------
+// a message sent to server n was ACKed after uiAckMs. What it took beyond
+// the round trip (the server's own time) is smoothed the same way
+//
+void endpointAckSample( endpoint_set *pSet, int n, uint32_t uiAckMs ){
+    endpoint *pEp = &pSet->aEndpoints[n];
+    uint32_t uiExtra = (uiAckMs > pEp->uiSrttMs) ? uiAckMs - pEp->uiSrttMs : 0;
+
+    if( pEp->uiAckSamples++ == 0 )
+        pEp->uiAckExtraMs = uiExtra;
+    else
+        pEp->uiAckExtraMs = (7 * pEp->uiAckExtraMs + uiExtra) / 8;
+}
+
+// ---------------------------------------------------------------------------
+// server n was connected to: it's healthy, and its backoff starts over
+//
+void endpointSucceeded( endpoint_set *pSet, int n ){
+    endpoint *pEp = &pSet->aEndpoints[n];
+
+    pEp->uiFailures = 0;
+    pEp->uiBackoffMs = 0;
+    pEp->ullRetryAtMs = 0;
+    pEp->uiSelected++;
+}
+
+// ---------------------------------------------------------------------------
+// server n failed (connect refused or timed out, connection lost). It's
+// not healthy again for ENDPOINT_RETRY_MIN at first, doubling for each
+// failure in a row up to ENDPOINT_RETRY_MAX, jittered between half and all
+// of that so readers cut off together don't all come back at the same moment
+//
+void endpointFailed( endpoint_set *pSet, int n, uint64_t ullNowMs ){
+    endpoint *pEp = &pSet->aEndpoints[n];
+
+    if( pEp->uiBackoffMs == 0 )
+        pEp->uiBackoffMs = ENDPOINT_RETRY_MIN;
+    else if( (pEp->uiBackoffMs *= 2) > ENDPOINT_RETRY_MAX )
+        pEp->uiBackoffMs = ENDPOINT_RETRY_MAX;
+    pEp->ullRetryAtMs = ullNowMs + pEp->uiBackoffMs / 2 + (uint32_t)rand() % (pEp->uiBackoffMs / 2 + 1);
+    pEp->uiFailures++;
+    pEp->uiFailed++;
+}
+
+// ---------------------------------------------------------------------------
+// is server n worth trying now?
+//
+bool endpointHealthy( const endpoint_set *pSet, int n, uint64_t ullNowMs ){
+    return( ullNowMs >= pSet->aEndpoints[n].ullRetryAtMs );
+}
+
+// ---------------------------------------------------------------------------
+// expected time for a tap sent to server n to be ACKed, in ms
+//
+uint32_t endpointScore( const endpoint_set *pSet, int n ){
+    const endpoint *pEp = &pSet->aEndpoints[n];
+
+    if( pEp->uiRttSamples == 0 )
+        return( UNMEASURED_SCORE );
+    return( pEp->uiSrttMs + pEp->uiAckExtraMs );
+}
+
+// ---------------------------------------------------------------------------
+// pick the healthy server with the lowest score (the first added, among
+// equals) and make it the active one
+//
+// returns: its index, else -1 if none is healthy now
+//
+int chooseEndpoint( endpoint_set *pSet, uint64_t ullNowMs ){
+    int n, nBest = -1;
+
+    for( n=0 ; n < pSet->nEndpoints ; n++ ){
+        if( !endpointHealthy( pSet, n, ullNowMs ) )
+            continue;
+        if( nBest < 0 || endpointScore( pSet, n ) < endpointScore( pSet, nBest ) )
+            nBest = n;
+    }
+    pSet->nActive = nBest;
+    return( nBest );
+}
+
+// ---------------------------------------------------------------------------
+// is a healthy server clearly faster than the active one: by at least
+// ENDPOINT_SWITCH_MARGIN ms and a quarter of the active one's score?
+//
+// returns: the fastest such server, else -1
+//
+int fasterEndpoint( const endpoint_set *pSet, uint64_t ullNowMs ){
+    uint32_t uiActive, uiMargin;
+    int n, nBest = -1;
+
+    if( pSet->nActive < 0 || pSet->aEndpoints[pSet->nActive].uiRttSamples == 0 )
+        return( -1 );
+    uiActive = endpointScore( pSet, pSet->nActive );
+    uiMargin = uiActive / 4 > ENDPOINT_SWITCH_MARGIN ? uiActive / 4 : ENDPOINT_SWITCH_MARGIN;
+
+    for( n=0 ; n < pSet->nEndpoints ; n++ ){
+        if( n == pSet->nActive || !endpointHealthy( pSet, n, ullNowMs ) ||
+            pSet->aEndpoints[n].uiRttSamples == 0 )
+            continue;
+        if( endpointScore( pSet, n ) + uiMargin < uiActive &&
+            (nBest < 0 || endpointScore( pSet, n ) < endpointScore( pSet, nBest )) )
+            nBest = n;
+    }
+    return( nBest );
+}
+
+// ---------------------------------------------------------------------------
+// number of healthy servers besides the active one, to fail over to
+//
+int healthyStandbys( const endpoint_set *pSet, uint64_t ullNowMs ){
+    int n, nHealthy = 0;
+
+    for( n=0 ; n < pSet->nEndpoints ; n++ )
+        if( n != pSet->nActive && endpointHealthy( pSet, n, ullNowMs ) )
+            nHealthy++;
+    return( nHealthy );
+}
+
+// ---------------------------------------------------------------------------
+// when the first server backing off becomes healthy again
+//
+// returns: time on the caller's clock - not after now if one is healthy
+//
+uint64_t nextEndpointRetry( const endpoint_set *pSet ){
+    uint64_t ullFirst = UINT64_MAX;
+    int n;
+
+    for( n=0 ; n < pSet->nEndpoints ; n++ )
+        if( pSet->aEndpoints[n].ullRetryAtMs < ullFirst )
+            ullFirst = pSet->aEndpoints[n].ullRetryAtMs;
+    return( pSet->nEndpoints > 0 ? ullFirst : 0 );
+}
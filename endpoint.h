@@ -0,0 +1,53 @@
+/*
+ * @file endpoint.h
+ * @brief public interface of endpoint.c
+ */
+#ifndef _ENDPOINT_H_
+#define _ENDPOINT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Definitions
+#define ENDPOINT_MAX             8      // servers the client can fail over between
+#define ENDPOINT_RETRY_MIN     250      // first wait after a server fails. doubles each time,
+#define ENDPOINT_RETRY_MAX   30000      // up to 30s, with jitter so readers don't retry in lockstep
+#define ENDPOINT_SWITCH_MARGIN  20      // ms (and a quarter) faster another must be to switch to it
+
+// what's known of one server
+typedef struct {
+    uint32_t uiSrttMs;          // smoothed round trip time (RFC 6298), if uiRttSamples
+    uint32_t uiRttVarMs;
+    uint32_t uiAckExtraMs;      // smoothed time its ACKs take beyond the round trip
+    uint32_t uiRttSamples;
+    uint32_t uiAckSamples;
+    uint32_t uiFailures;        // in a row
+    uint32_t uiBackoffMs;       // before jitter
+    uint64_t ullRetryAtMs;      // not healthy again until then
+
+    // counters
+    uint32_t uiSelected;
+    uint32_t uiFailed;
+} endpoint;
+
+typedef struct {
+    endpoint aEndpoints[ENDPOINT_MAX];
+    int      nEndpoints;
+    int      nActive;           // the one in use, else -1
+} endpoint_set;
+
+// function prototypes
+void     initEndpoints( endpoint_set *pSet );
+int      addEndpoint( endpoint_set *pSet );
+void     endpointRttSample( endpoint_set *pSet, int n, uint32_t uiRttMs );
+void     endpointAckSample( endpoint_set *pSet, int n, uint32_t uiAckMs );
+void     endpointSucceeded( endpoint_set *pSet, int n );
+void     endpointFailed( endpoint_set *pSet, int n, uint64_t ullNowMs );
+bool     endpointHealthy( const endpoint_set *pSet, int n, uint64_t ullNowMs );
+uint32_t endpointScore( const endpoint_set *pSet, int n );
+int      chooseEndpoint( endpoint_set *pSet, uint64_t ullNowMs );
+int      fasterEndpoint( const endpoint_set *pSet, uint64_t ullNowMs );
+int      healthyStandbys( const endpoint_set *pSet, uint64_t ullNowMs );
+uint64_t nextEndpointRetry( const endpoint_set *pSet );
+
+#endif // _ENDPOINT_H_
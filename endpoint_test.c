@@ -0,0 +1,139 @@
+/*
+ * @file endpoint_test.c
+ * @brief unit test for endpoint.c
+ *
+ * runs standalone - no server needed. Round trip and ACK times are made
+ * up, and the clock is simulated.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "endpoint.h"
+#include "unit_test.h"
+
+static endpoint_set set;
+
+// ---------------------------------------------------------------------------
+// unmeasured servers go in the order given; then the fastest wins
+//
+void testChoice( void ){
+    int i;
+
+    initEndpoints( &set );
+    CHECK( set.nActive == -1 );
+    CHECK( chooseEndpoint( &set, 0 ) == -1 );
+    for( i=0 ; i < ENDPOINT_MAX ; i++ )
+        CHECK( addEndpoint( &set ) == i );
+    CHECK( addEndpoint( &set ) == -1 );
+    set.nEndpoints = 3;
+
+    CHECK( chooseEndpoint( &set, 0 ) == 0 );
+    CHECK( set.nActive == 0 );
+
+    endpointRttSample( &set, 0, 80 );
+    endpointRttSample( &set, 1, 30 );
+    CHECK( chooseEndpoint( &set, 0 ) == 1 );
+    CHECK( endpointScore( &set, 1 ) == 30 );
+
+    // smoothed: one slow sample moves it an eighth of the way
+    endpointRttSample( &set, 1, 110 );
+    CHECK( set.aEndpoints[1].uiSrttMs == 40 );
+    CHECK( chooseEndpoint( &set, 0 ) == 1 );
+
+    // a server that takes its time to ACK scores worse than its RTT
+    endpointAckSample( &set, 1, 140 );
+    CHECK( set.aEndpoints[1].uiAckExtraMs == 100 );
+    CHECK( endpointScore( &set, 1 ) == 140 );
+    CHECK( chooseEndpoint( &set, 0 ) == 0 );
+}
+
+// ---------------------------------------------------------------------------
+// a failed server sits out a jittered backoff that doubles each time
+//
+void testBackoff( void ){
+    uint64_t ullNow = 1000000;
+    uint32_t uiExpected = ENDPOINT_RETRY_MIN;
+    int i;
+
+    initEndpoints( &set );
+    addEndpoint( &set );
+    addEndpoint( &set );
+    CHECK( chooseEndpoint( &set, ullNow ) == 0 );
+    CHECK( healthyStandbys( &set, ullNow ) == 1 );
+
+    // the first fails: fail over to the second at once
+    endpointFailed( &set, 0, ullNow );
+    CHECK( !endpointHealthy( &set, 0, ullNow ) );
+    CHECK( chooseEndpoint( &set, ullNow ) == 1 );
+    CHECK( healthyStandbys( &set, ullNow ) == 0 );
+
+    // both down: wait for the first back. each failure doubles the wait
+    for( i=0 ; i < 12 ; i++ ){
+        endpointFailed( &set, 1, ullNow );
+        CHECK( chooseEndpoint( &set, ullNow ) == -1 );
+        CHECK( set.aEndpoints[1].uiBackoffMs == uiExpected );
+        CHECK( set.aEndpoints[1].ullRetryAtMs >= ullNow + uiExpected / 2 );
+        CHECK( set.aEndpoints[1].ullRetryAtMs <= ullNow + uiExpected );
+        uiExpected = uiExpected * 2 > ENDPOINT_RETRY_MAX ? ENDPOINT_RETRY_MAX : uiExpected * 2;
+    }
+    CHECK( nextEndpointRetry( &set ) == set.aEndpoints[0].ullRetryAtMs );
+    CHECK( set.aEndpoints[1].uiBackoffMs == ENDPOINT_RETRY_MAX );
+    CHECK( set.aEndpoints[1].uiFailures == 12 );
+
+    // once back, the backoff starts over
+    ullNow = nextEndpointRetry( &set );
+    CHECK( chooseEndpoint( &set, ullNow ) >= 0 );
+    endpointSucceeded( &set, 1 );
+    CHECK( endpointHealthy( &set, 1, ullNow ) );
+    endpointFailed( &set, 1, ullNow );
+    CHECK( set.aEndpoints[1].uiBackoffMs == ENDPOINT_RETRY_MIN );
+}
+
+// ---------------------------------------------------------------------------
+// the active server only gives way to one that's clearly faster
+//
+void testHysteresis( void ){
+    initEndpoints( &set );
+    addEndpoint( &set );
+    addEndpoint( &set );
+    addEndpoint( &set );
+    endpointRttSample( &set, 0, 100 );
+    CHECK( chooseEndpoint( &set, 0 ) == 0 );
+    CHECK( fasterEndpoint( &set, 0 ) == -1 );       // no others measured
+
+    endpointRttSample( &set, 1, 90 );               // a little faster: stay
+    CHECK( fasterEndpoint( &set, 0 ) == -1 );
+    endpointRttSample( &set, 2, 60 );               // much faster: move
+    CHECK( fasterEndpoint( &set, 0 ) == 2 );
+
+    endpointFailed( &set, 2, 0 );                   // but not to a failed one
+    CHECK( fasterEndpoint( &set, 0 ) == -1 );
+
+    // a few ms apart on a LAN is no reason to move either
+    initEndpoints( &set );
+    addEndpoint( &set );
+    addEndpoint( &set );
+    endpointRttSample( &set, 0, 12 );
+    endpointRttSample( &set, 1, 2 );
+    CHECK( chooseEndpoint( &set, 0 ) == 1 );
+    set.nActive = 0;
+    CHECK( fasterEndpoint( &set, 0 ) == -1 );
+}
+
+// ===========================================================================
+// main
+//
+int main( int argc, char *argv[] )
+{
+    testChoice();
+    testBackoff();
+    testHysteresis();
+
+    if( nFailures ){
+        printf("%d check(s) FAILED\n", nFailures );
+        exit( EXIT_FAILURE );
+    }
+    printf("all endpoint tests passed\n");
+    exit( EXIT_SUCCESS );
+}
@@ -0,0 +1,182 @@
+/*
+ * @file event_loop.c
+ * @brief epoll/timerfd based reactor for the rpi_nfc main loop
+ *
+ * The main loop used to spin on gettimeofday() waiting for its interval timers,
+ * which kept one core at 100%. Instead the caller arms a single timerfd for its
+ * next deadline and blocks in epoll_wait() until either that deadline passes or
+ * one of the watched file descriptors (e.g. the TCP socket) becomes ready.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "event_loop.h"
+
+// Definitions
+#define MAX_EVENT_SOURCES   16      // file descriptors watched at any one time
+#define MAX_EVENTS_PER_WAIT  8      // events collected per epoll_wait() call
+
+typedef struct {
+    int           fd;               // -1 if the slot is free
+    event_handler fnHandler;
+    void         *pCtx;
+} event_source;
+
+// STATIC GLOBALS (referenceable within this file only)
+static int          epollfd = -1;
+static int          timerfd = -1;
+static event_source aSources[MAX_EVENT_SOURCES];
+
+
+// ---------------------------------------------------------------------------
+// create the epoll instance and the deadline timer
+//
+// returns: 0 if OK, else -1
+//
+int initEventLoop( void ){
+    struct epoll_event ev;
+    int i;
+
+    for( i=0 ; i < MAX_EVENT_SOURCES ; i++ )
+        aSources[i].fd = -1;
+
+    if( (epollfd = epoll_create1( EPOLL_CLOEXEC )) < 0 )
+        return( -1 );
+
+    if( (timerfd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC )) < 0 ){
+        closeEventLoop();
+        return( -1 );
+    }
+
+    // the timer is tagged with a NULL pointer so it can't be confused with a source
+    memset( &ev, 0, sizeof(ev) );
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if( epoll_ctl( epollfd, EPOLL_CTL_ADD, timerfd, &ev ) < 0 ){
+        closeEventLoop();
+        return( -1 );
+    }
+    return( 0 );
+}
+
+// ---------------------------------------------------------------------------
+// watch a file descriptor. fnHandler is called with the ready events
+// (EPOLLIN, EPOLLOUT, EPOLLHUP...) whenever fd becomes ready.
+// Watching an fd that is already watched updates its events and handler.
+//
+// returns: 0 if OK, else -1
+//
+int watchEventFd( int fd, uint32_t uiEvents, event_handler fnHandler, void *pCtx ){
+    struct epoll_event ev;
+    event_source *pFree = NULL;
+    int i, op = EPOLL_CTL_ADD;
+
+    for( i=0 ; i < MAX_EVENT_SOURCES ; i++ ){
+        if( aSources[i].fd == fd ){
+            pFree = &aSources[i];
+            op = EPOLL_CTL_MOD;
+            break;
+        }
+        if( pFree == NULL && aSources[i].fd < 0 )
+            pFree = &aSources[i];
+    }
+    if( pFree == NULL ){
+        errno = ENOSPC;
+        return( -1 );
+    }
+
+    memset( &ev, 0, sizeof(ev) );
+    ev.events = uiEvents;
+    ev.data.ptr = pFree;
+    if( epoll_ctl( epollfd, op, fd, &ev ) < 0 )
+        return( -1 );
+
+    pFree->fd = fd;
+    pFree->fnHandler = fnHandler;
+    pFree->pCtx = pCtx;
+    return( 0 );
+}
+
+// ---------------------------------------------------------------------------
+// stop watching a file descriptor. Call this before closing the fd.
+//
+// returns: 0 if OK, else -1
+//
+int unwatchEventFd( int fd ){
+    int i;
+
+    for( i=0 ; i < MAX_EVENT_SOURCES ; i++ ){
+        if( aSources[i].fd == fd ){
+            aSources[i].fd = -1;
+            return( epoll_ctl( epollfd, EPOLL_CTL_DEL, fd, NULL ) );
+        }
+    }
+    errno = ENOENT;
+    return( -1 );
+}
+
+// ---------------------------------------------------------------------------
+// arm the deadline timer: runEventLoopOnce() returns no later than
+// lMilliseconds from now. 0 means "due now", < 0 disarms the timer.
+//
+// returns: 0 if OK, else -1
+//
+int setEventTimeout( long lMilliseconds ){
+    struct itimerspec its;
+
+    memset( &its, 0, sizeof(its) );
+    if( lMilliseconds > 0 ){
+        its.it_value.tv_sec  = lMilliseconds / 1000;
+        its.it_value.tv_nsec = (lMilliseconds % 1000) * 1000000L;
+    }
+    else if( lMilliseconds == 0 )
+        its.it_value.tv_nsec = 1;   // an all-zero it_value would disarm the timer
+
+    return( timerfd_settime( timerfd, 0, &its, NULL ) );
+}
+
+// ---------------------------------------------------------------------------
+// sleep until a watched fd is ready or the deadline timer expires, then
+// dispatch the handlers of the ready fds
+//
+// returns: number of events dispatched (the timer counts as one), or -1 on error
+//
+int runEventLoopOnce( void ){
+    struct epoll_event aEvents[MAX_EVENTS_PER_WAIT];
+    event_source *pSource;
+    uint64_t ullExpirations;
+    int i, n;
+
+    do{
+        n = epoll_wait( epollfd, aEvents, MAX_EVENTS_PER_WAIT, -1 );
+    } while( n < 0 && errno == EINTR );
+
+    for( i=0 ; i < n ; i++ ){
+        pSource = (event_source *)aEvents[i].data.ptr;
+
+        if( pSource == NULL ){
+            // deadline reached. drain the timerfd so it stops reporting readable
+            if( read( timerfd, &ullExpirations, sizeof(ullExpirations) ) < 0 && errno != EAGAIN )
+                perror("timerfd read");
+        }
+        else if( pSource->fd >= 0 && pSource->fnHandler != NULL )
+            pSource->fnHandler( pSource->fd, aEvents[i].events, pSource->pCtx );
+    }
+    return( n );
+}
+
+// ---------------------------------------------------------------------------
+// close the epoll instance and the deadline timer
+//
+void closeEventLoop( void ){
+    if( timerfd >= 0 )
+        close( timerfd );
+    if( epollfd >= 0 )
+        close( epollfd );
+    timerfd = epollfd = -1;
+}
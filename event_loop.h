@@ -0,0 +1,22 @@
+/*
+ * @file event_loop.h
+ * @brief public interface of event_loop.c
+ */
+#ifndef _EVENT_LOOP_H_
+#define _EVENT_LOOP_H_
+
+#include <stdint.h>
+#include <sys/epoll.h>
+
+// called from runEventLoopOnce() when a watched file descriptor is ready
+typedef void (*event_handler)( int fd, uint32_t uiEvents, void *pCtx );
+
+// function prototypes
+int  initEventLoop( void );
+int  watchEventFd( int fd, uint32_t uiEvents, event_handler fnHandler, void *pCtx );
+int  unwatchEventFd( int fd );
+int  setEventTimeout( long lMilliseconds );
+int  runEventLoopOnce( void );
+void closeEventLoop( void );
+
+#endif // _EVENT_LOOP_H_
@@ -0,0 +1,163 @@
+/*
+ * @file frame.c
+ * @brief length-prefixed frames carrying several records at once
+ *
+ * The uplink packs whatever is queued into one frame, so a burst of taps
+ * costs one write instead of one each, and the server can separate records
+ * however TCP splits or joins them. The layout is described in frame.h.
+ */
+#include <string.h>
+
+#include "frame.h"
+
+// ---------------------------------------------------------------------------
+// start an empty frame in pbtBuffer
+//
+void initFrame( frame_builder *pFrame, uint8_t *pbtBuffer, size_t szCapacity ){
+    pFrame->pbtBuffer = pbtBuffer;
+    pFrame->szCapacity = szCapacity > FRAME_MAX_SIZE ? FRAME_MAX_SIZE : szCapacity;
+    pFrame->szUsed = FRAME_HEADER_SIZE;
+    pFrame->uiRecords = 0;
+}
+
+// ---------------------------------------------------------------------------
+// append a record to the frame
+//
+// returns: true if added, else false if it doesn't fit (the frame is unchanged)
+//
+bool frameAddRecord( frame_builder *pFrame, const void *pRecord, size_t szLen ){
+    uint8_t *p;
+
+    if( szLen > UINT16_MAX || pFrame->uiRecords == UINT16_MAX ||
+        pFrame->szUsed + FRAME_PREFIX_SIZE + szLen > pFrame->szCapacity )
+        return( false );
+
+    p = pFrame->pbtBuffer + pFrame->szUsed;
+    p[0] = (uint8_t)(szLen >> 8);
+    p[1] = (uint8_t)szLen;
+    memcpy( p + FRAME_PREFIX_SIZE, pRecord, szLen );
+    pFrame->szUsed += FRAME_PREFIX_SIZE + szLen;
+    pFrame->uiRecords++;
+    return( true );
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - write a frame header
+//
+static void putHeader( uint8_t *p, uint16_t uiRecords, uint32_t uiPayload ){
+    p[0] = FRAME_MAGIC;
+    p[1] = FRAME_VERSION;
+    p[2] = (uint8_t)(uiRecords >> 8);
+    p[3] = (uint8_t)uiRecords;
+    p[4] = (uint8_t)(uiPayload >> 24);
+    p[5] = (uint8_t)(uiPayload >> 16);
+    p[6] = (uint8_t)(uiPayload >> 8);
+    p[7] = (uint8_t)uiPayload;
+}
+
+// ---------------------------------------------------------------------------
+// write the frame header, ready to send
+//
+// returns: length of the whole frame
+//
+size_t finishFrame( frame_builder *pFrame ){
+    putHeader( pFrame->pbtBuffer, pFrame->uiRecords, (uint32_t)(pFrame->szUsed - FRAME_HEADER_SIZE) );
+    return( pFrame->szUsed );
+}
+
+// ---------------------------------------------------------------------------
+// start an empty frame of references
+//
+void initFrameVector( frame_vector *pFrame ){
+    pFrame->aIov[0].iov_base = pFrame->abtHeader;
+    pFrame->aIov[0].iov_len = FRAME_HEADER_SIZE;
+    pFrame->nIov = 1;
+    pFrame->uiRecords = 0;
+    pFrame->szUsed = FRAME_HEADER_SIZE;
+}
+
+// ---------------------------------------------------------------------------
+// add a record to the frame without copying it. It must stay where it is
+// until the frame has been sent
+//
+// returns: true if added, else false if the frame is full (it is unchanged)
+//
+bool frameVectorAdd( frame_vector *pFrame, const void *pRecord, size_t szLen ){
+    uint8_t *pbtPrefix;
+
+    if( szLen > UINT16_MAX || pFrame->uiRecords == FRAME_VECTOR_RECORDS ||
+        pFrame->szUsed + FRAME_PREFIX_SIZE + szLen > FRAME_MAX_SIZE )
+        return( false );
+
+    pbtPrefix = pFrame->abtPrefixes[pFrame->uiRecords];
+    pbtPrefix[0] = (uint8_t)(szLen >> 8);
+    pbtPrefix[1] = (uint8_t)szLen;
+    pFrame->aIov[pFrame->nIov].iov_base = pbtPrefix;
+    pFrame->aIov[pFrame->nIov].iov_len = FRAME_PREFIX_SIZE;
+    pFrame->aIov[pFrame->nIov + 1].iov_base = (void *)pRecord;
+    pFrame->aIov[pFrame->nIov + 1].iov_len = szLen;
+    pFrame->nIov += 2;
+    pFrame->szUsed += FRAME_PREFIX_SIZE + szLen;
+    pFrame->uiRecords++;
+    return( true );
+}
+
+// ---------------------------------------------------------------------------
+// write the frame header, ready to send aIov[0..nIov)
+//
+// returns: length of the whole frame
+//
+size_t finishFrameVector( frame_vector *pFrame ){
+    putHeader( pFrame->abtHeader, pFrame->uiRecords, (uint32_t)(pFrame->szUsed - FRAME_HEADER_SIZE) );
+    return( pFrame->szUsed );
+}
+
+// ---------------------------------------------------------------------------
+// length of the frame at the start of pbtData, from its header. Lets a
+// stream reader know how much to wait for.
+//
+// returns: frame length, 0 if the header isn't all there yet, else -1 if
+//          this isn't a frame
+//
+int frameLength( const uint8_t *pbtData, size_t szAvail ){
+    uint32_t uiPayload;
+
+    if( szAvail < FRAME_HEADER_SIZE )
+        return( (szAvail > 0 && pbtData[0] != FRAME_MAGIC) ? -1 : 0 );
+    if( pbtData[0] != FRAME_MAGIC || pbtData[1] != FRAME_VERSION )
+        return( -1 );
+    uiPayload = ((uint32_t)pbtData[4] << 24) | ((uint32_t)pbtData[5] << 16) |
+                ((uint32_t)pbtData[6] << 8)  |  (uint32_t)pbtData[7];
+    if( uiPayload > FRAME_MAX_SIZE - FRAME_HEADER_SIZE )
+        return( -1 );
+    return( (int)(FRAME_HEADER_SIZE + uiPayload) );
+}
+
+// ---------------------------------------------------------------------------
+// call fnRecord for each record in a whole frame, in order
+//
+// returns: number of records, else -1 if the frame is malformed (in which
+//          case fnRecord may have been called for the records before the fault)
+//
+int parseFrame( const uint8_t *pbtFrame, size_t szLen, frame_record_fn fnRecord, void *pCtx ){
+    const uint8_t *p, *pEnd = pbtFrame + szLen;
+    int nRecords, i;
+    size_t szRecord;
+
+    if( szLen < FRAME_HEADER_SIZE || frameLength( pbtFrame, szLen ) != (int)szLen )
+        return( -1 );
+    nRecords = (pbtFrame[2] << 8) | pbtFrame[3];
+
+    p = pbtFrame + FRAME_HEADER_SIZE;
+    for( i=0 ; i < nRecords ; i++ ){
+        if( pEnd - p < FRAME_PREFIX_SIZE )
+            return( -1 );
+        szRecord = (p[0] << 8) | p[1];
+        p += FRAME_PREFIX_SIZE;
+        if( szRecord > (size_t)(pEnd - p) )
+            return( -1 );
+        fnRecord( p, szRecord, pCtx );
+        p += szRecord;
+    }
+    return( p == pEnd ? nRecords : -1 );
+}
@@ -0,0 +1,65 @@
+/*
+ * @file frame.h
+ * @brief public interface of frame.c - length-prefixed frames of records
+ *
+ * Frame layout, all integers big-endian:
+ *
+ *   0  magic      FRAME_MAGIC. never '{' or NFC_RECORD_MAGIC
+ *   1  version    FRAME_VERSION
+ *   2  records    uint16, number of records in the frame
+ *   4  length     uint32, bytes after this header
+ *   8  records    each a uint16 length then the record (a JSON message or
+ *                 a binary record)
+ *
+ * Self-contained, so the server side can build frame.c too.
+ */
+#ifndef _FRAME_H_
+#define _FRAME_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+// Definitions
+#define FRAME_MAGIC         0xFA
+#define FRAME_VERSION       1
+#define FRAME_HEADER_SIZE   8
+#define FRAME_PREFIX_SIZE   2           // length before each record
+#define FRAME_MAX_SIZE      (64 * 1024) // largest frame a receiver must take
+#define FRAMING_NAME        "frame1"    // as negotiated with the server
+#define FRAME_VECTOR_RECORDS 64         // most records in a frame_vector
+
+// a frame being filled
+typedef struct {
+    uint8_t  *pbtBuffer;
+    size_t    szCapacity;
+    size_t    szUsed;
+    uint16_t  uiRecords;
+} frame_builder;
+
+// a frame gathered by reference, for writev()/sendmsg(): the header and
+// length prefixes live here, the records stay where they are
+typedef struct {
+    uint8_t       abtHeader[FRAME_HEADER_SIZE];
+    uint8_t       abtPrefixes[FRAME_VECTOR_RECORDS][FRAME_PREFIX_SIZE];
+    struct iovec  aIov[1 + 2 * FRAME_VECTOR_RECORDS];
+    int           nIov;
+    uint16_t      uiRecords;
+    size_t        szUsed;           // whole frame so far, header included
+} frame_vector;
+
+// called by parseFrame() for each record in a frame
+typedef void (*frame_record_fn)( const uint8_t *pbtRecord, size_t szLen, void *pCtx );
+
+// function prototypes
+void   initFrame( frame_builder *pFrame, uint8_t *pbtBuffer, size_t szCapacity );
+bool   frameAddRecord( frame_builder *pFrame, const void *pRecord, size_t szLen );
+size_t finishFrame( frame_builder *pFrame );
+void   initFrameVector( frame_vector *pFrame );
+bool   frameVectorAdd( frame_vector *pFrame, const void *pRecord, size_t szLen );
+size_t finishFrameVector( frame_vector *pFrame );
+int    frameLength( const uint8_t *pbtData, size_t szAvail );
+int    parseFrame( const uint8_t *pbtFrame, size_t szLen, frame_record_fn fnRecord, void *pCtx );
+
+#endif // _FRAME_H_
@@ -0,0 +1,174 @@
+/*
+ * @file frame_test.c
+ * @brief unit test for frame.c
+ *
+ * runs standalone - no server needed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "frame.h"
+#include "unit_test.h"
+
+#define BUFSIZE 4096
+
+static char szRecords[BUFSIZE];  // the records parsed so far, separated by '|'
+
+// ---------------------------------------------------------------------------
+// record callback for parseFrame()
+//
+void collectRecord( const uint8_t *pbtRecord, size_t szLen, void *pCtx ){
+    int *pnCalls = pCtx;
+
+    strncat( szRecords, (const char *)pbtRecord, szLen );
+    strcat( szRecords, "|" );
+    (*pnCalls)++;
+}
+
+// ---------------------------------------------------------------------------
+// records go in, the same records come out
+//
+void testRoundTrip( void ){
+    uint8_t abtBuffer[BUFSIZE];
+    frame_builder frame;
+    size_t szLen;
+    int nCalls = 0;
+
+    initFrame( &frame, abtBuffer, sizeof(abtBuffer) );
+    CHECK( frameAddRecord( &frame, "{\"seq\":1}", 9 ) );
+    CHECK( frameAddRecord( &frame, "", 0 ) );
+    CHECK( frameAddRecord( &frame, "{\"seq\":2}", 9 ) );
+    szLen = finishFrame( &frame );
+    CHECK( szLen == FRAME_HEADER_SIZE + 3 * FRAME_PREFIX_SIZE + 18 );
+    CHECK( abtBuffer[0] == FRAME_MAGIC && abtBuffer[3] == 3 );
+    CHECK( frameLength( abtBuffer, szLen ) == (int)szLen );
+
+    szRecords[0] = '\0';
+    CHECK( parseFrame( abtBuffer, szLen, collectRecord, &nCalls ) == 3 );
+    CHECK( nCalls == 3 );
+    CHECK( strcmp( szRecords, "{\"seq\":1}||{\"seq\":2}|" ) == 0 );
+
+    // an empty frame is valid
+    initFrame( &frame, abtBuffer, sizeof(abtBuffer) );
+    szLen = finishFrame( &frame );
+    CHECK( szLen == FRAME_HEADER_SIZE );
+    CHECK( parseFrame( abtBuffer, szLen, collectRecord, &nCalls ) == 0 );
+}
+
+// ---------------------------------------------------------------------------
+// a full frame refuses records, and bad frames are rejected
+//
+void testLimits( void ){
+    uint8_t abtBuffer[64], abtRecord[40] = { 0 };
+    frame_builder frame;
+    size_t szLen;
+    int nCalls = 0, i;
+
+    initFrame( &frame, abtBuffer, sizeof(abtBuffer) );
+    CHECK( frameAddRecord( &frame, abtRecord, 40 ) );
+    CHECK( !frameAddRecord( &frame, abtRecord, 40 ) );     // doesn't fit
+    CHECK( frameAddRecord( &frame, abtRecord, 64 - 8 - 42 - 2 ) );  // exactly fits
+    CHECK( frame.uiRecords == 2 && frame.szUsed == 64 );
+    szLen = finishFrame( &frame );
+
+    // not all there yet
+    for( i=0 ; i < FRAME_HEADER_SIZE ; i++ )
+        CHECK( frameLength( abtBuffer, i ) == 0 );
+    CHECK( parseFrame( abtBuffer, szLen - 1, collectRecord, &nCalls ) == -1 );
+
+    // a record count that doesn't match the contents
+    abtBuffer[3] = 3;
+    CHECK( parseFrame( abtBuffer, szLen, collectRecord, &nCalls ) == -1 );
+    abtBuffer[3] = 1;
+    CHECK( parseFrame( abtBuffer, szLen, collectRecord, &nCalls ) == -1 );
+    abtBuffer[3] = 2;
+    CHECK( parseFrame( abtBuffer, szLen, collectRecord, &nCalls ) == 2 );
+
+    // not a frame
+    CHECK( frameLength( (const uint8_t *)"{\"msg\"", 6 ) == -1 );
+    abtBuffer[4] = 0xFF;        // longer than any frame may be
+    CHECK( frameLength( abtBuffer, szLen ) == -1 );
+}
+
+// ---------------------------------------------------------------------------
+// a frame gathered by reference is the same, byte for byte
+//
+void testVector( void ){
+    uint8_t abtBuffer[BUFSIZE], abtGathered[BUFSIZE];
+    frame_builder frame;
+    frame_vector vector;
+    char szRecord[16];
+    size_t szLen, szUsed = 0;
+    int i;
+
+    initFrame( &frame, abtBuffer, sizeof(abtBuffer) );
+    initFrameVector( &vector );
+    for( i=0 ; i < FRAME_VECTOR_RECORDS ; i++ ){
+        snprintf( szRecord, sizeof(szRecord), "{\"seq\":%d}", i );
+        frameAddRecord( &frame, szRecord, strlen(szRecord) );
+        CHECK( frameVectorAdd( &vector, strdup( szRecord ), strlen(szRecord) ) );
+    }
+    CHECK( !frameVectorAdd( &vector, "full", 4 ) );
+    szLen = finishFrame( &frame );
+    CHECK( finishFrameVector( &vector ) == szLen );
+    CHECK( vector.nIov == 1 + 2 * FRAME_VECTOR_RECORDS );
+
+    for( i=0 ; i < vector.nIov ; i++ ){
+        memcpy( abtGathered + szUsed, vector.aIov[i].iov_base, vector.aIov[i].iov_len );
+        szUsed += vector.aIov[i].iov_len;
+    }
+    CHECK( szUsed == szLen && memcmp( abtGathered, abtBuffer, szLen ) == 0 );
+    for( i=0 ; i < FRAME_VECTOR_RECORDS ; i++ )
+        free( vector.aIov[2 + 2 * i].iov_base );
+}
+
+// ---------------------------------------------------------------------------
+// frames joined together in one read are split by their length
+//
+void testStream( void ){
+    uint8_t abtStream[BUFSIZE];
+    frame_builder frame;
+    char szRecord[16];
+    size_t szUsed = 0, szOffset;
+    int i, n, nFrames = 0, nCalls = 0;
+
+    for( i=0 ; i < 10 ; i++ ){
+        initFrame( &frame, abtStream + szUsed, sizeof(abtStream) - szUsed );
+        for( n=0 ; n <= i ; n++ ){
+            snprintf( szRecord, sizeof(szRecord), "r%d.%d", i, n );
+            frameAddRecord( &frame, szRecord, strlen(szRecord) );
+        }
+        szUsed += finishFrame( &frame );
+    }
+
+    szRecords[0] = '\0';
+    for( szOffset = 0 ; szOffset < szUsed ; szOffset += n ){
+        CHECK( (n= frameLength( abtStream + szOffset, szUsed - szOffset )) > 0 );
+        if( n <= 0 )
+            break;
+        CHECK( parseFrame( abtStream + szOffset, n, collectRecord, &nCalls ) > 0 );
+        nFrames++;
+    }
+    CHECK( nFrames == 10 );
+    CHECK( nCalls == 55 );
+    CHECK( strncmp( szRecords, "r0.0|r1.0|r1.1|r2.0|", 20 ) == 0 );
+}
+
+// ===========================================================================
+// main
+//
+int main( int argc, char *argv[] )
+{
+    testRoundTrip();
+    testLimits();
+    testStream();
+    testVector();
+
+    if( nFailures ){
+        printf("%d check(s) FAILED\n", nFailures );
+        exit( EXIT_FAILURE );
+    }
+    printf("all frame tests passed\n");
+    exit( EXIT_SUCCESS );
+}
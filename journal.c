@@ -0,0 +1,652 @@
+/*
+ * @file journal.c
+ * @brief persistent store-and-forward journal of transactions
+ *
+ * Every message is appended here before it is sent, and stays until the
+ * server ACKs it, so transactions survive a dead TCP connection, a restart
+ * and a power cut.
+ *
+ * The journal is a directory of fixed-size segment files, memory-mapped and
+ * written append-only. Each record is
+ *      magic | seq | length | crc32 | payload (padded to 8 bytes)
+ * The CRC covers seq, length and payload, so a record torn by a power cut is
+ * detected on recovery, and everything after it in that segment is discarded.
+ * Sequence numbers must also run on from the previous record, so stale
+ * records beyond a recovered tail can't be mistaken for new ones.
+ *
+ * Writes are group-committed: journalSync() msyncs everything appended since
+ * the last sync in one go, which keeps SD card write amplification low.
+ * The first unACKed seq is kept in a small checkpoint file, updated by the
+ * same sync. Segments whose records have all been ACKed are deleted.
+ * The syncs can also be handed to a syncer (e.g. io_uring) to run in the
+ * background, so the uplink never waits on the SD card. A segment stays
+ * open, and on disk, until its background syncs have finished.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "journal.h"
+
+// Definitions
+#define RECORD_MAGIC        0x43464E52      // "RNFC"
+#define CHECKPOINT_MAGIC    0x544B4843      // "CHKT"
+#define CHECKPOINT_FILE     "checkpoint"
+#define SEGMENT_SUFFIX      ".jnl"
+#define ALIGN8(n)           (((n) + 7) & ~(size_t)7)
+
+typedef struct {
+    uint32_t uiMagic;
+    uint32_t uiSeq;
+    uint32_t uiLen;
+    uint32_t uiCrc;
+} record_header;
+
+typedef struct {
+    uint32_t uiMagic;
+    uint32_t uiAckedSeq;
+    uint32_t uiCrc;
+} checkpoint_record;
+
+// local function prototypes
+static uint32_t crc32Update( uint32_t uiCrc, const void *pData, size_t szLen );
+
+// STATIC GLOBALS (referenceable within this file only)
+static uint32_t auiCrcTable[256];
+static bool     bCrcTableReady = false;
+
+// ---------------------------------------------------------------------------
+// Internal function - CRC-32 (IEEE 802.3), table driven
+//
+static uint32_t crc32Update( uint32_t uiCrc, const void *pData, size_t szLen ){
+    const uint8_t *pbt = (const uint8_t *)pData;
+    uint32_t c;
+    int i, k;
+
+    if( !bCrcTableReady ){
+        for( i=0 ; i < 256 ; i++ ){
+            c = (uint32_t)i;
+            for( k=0 ; k < 8 ; k++ )
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            auiCrcTable[i] = c;
+        }
+        bCrcTableReady = true;
+    }
+
+    uiCrc = ~uiCrc;
+    while( szLen-- )
+        uiCrc = auiCrcTable[(uiCrc ^ *pbt++) & 0xFF] ^ (uiCrc >> 8);
+    return( ~uiCrc );
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - CRC of a record's seq, length and payload
+//
+static uint32_t recordCrc( uint32_t uiSeq, uint32_t uiLen, const void *pPayload ){
+    uint32_t uiCrc = crc32Update( 0, &uiSeq, sizeof(uiSeq) );
+
+    uiCrc = crc32Update( uiCrc, &uiLen, sizeof(uiLen) );
+    return( crc32Update( uiCrc, pPayload, uiLen ) );
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - true if seq a comes after seq b (allowing for wrap)
+//
+static bool seqAfter( uint32_t a, uint32_t b ){
+    return( (int32_t)(a - b) > 0 );
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - path of a file in the journal directory
+//
+static void journalPath( const journal *pJ, char *szPath, size_t szPathLen, const char *szName ){
+    snprintf( szPath, szPathLen, "%s/%s", pJ->szDir, szName );
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - path of a segment file
+//
+static void segmentPath( const journal *pJ, char *szPath, size_t szPathLen, uint32_t uiIndex ){
+    snprintf( szPath, szPathLen, "%s/%08u" SEGMENT_SUFFIX, pJ->szDir, uiIndex );
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - map a segment file, creating it if bCreate
+//
+// returns: 0 if OK, else -1
+//
+static int mapSegment( journal *pJ, journal_segment *pSeg, bool bCreate ){
+    char szPath[300];
+    struct stat st;
+    void *pMap;
+    int fd;
+
+    segmentPath( pJ, szPath, sizeof(szPath), pSeg->uiIndex );
+    if( (fd = open( szPath, O_RDWR | O_CLOEXEC | (bCreate ? O_CREAT | O_EXCL : 0), 0644 )) < 0 )
+        return( -1 );
+
+    // new segments are zero-filled, so the first zero header marks the end
+    if( bCreate && ftruncate( fd, pJ->szSegmentSize ) < 0 ){
+        close( fd );
+        unlink( szPath );
+        return( -1 );
+    }
+
+    // a segment written with another segment size would fault past its end
+    if( !bCreate && (fstat( fd, &st ) < 0 || (size_t)st.st_size != pJ->szSegmentSize) ){
+        close( fd );
+        errno = EINVAL;
+        return( -1 );
+    }
+
+    pMap = mmap( NULL, pJ->szSegmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    if( pMap == MAP_FAILED ){
+        close( fd );
+        return( -1 );
+    }
+
+    // the mapping would keep the file open anyway. the fd is for syncing it
+    pSeg->pbtMap = (uint8_t *)pMap;
+    pSeg->fd = fd;
+    return( 0 );
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - unmap and delete a segment file, and drop it from the list
+//
+static void removeSegment( journal *pJ, int nSegment ){
+    journal_segment *pSeg = &pJ->aSegments[nSegment];
+    char szPath[300];
+
+    if( pSeg->pbtMap != NULL )
+        munmap( pSeg->pbtMap, pJ->szSegmentSize );
+    if( pSeg->fd >= 0 )
+        close( pSeg->fd );
+    segmentPath( pJ, szPath, sizeof(szPath), pSeg->uiIndex );
+    if( unlink( szPath ) < 0 )
+        perror("Non-fatal Error deleting journal segment");
+
+    memmove( pSeg, pSeg + 1, (pJ->nSegments - nSegment - 1) * sizeof(journal_segment) );
+    pJ->nSegments--;
+    pJ->bDirDirty = true;
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - add a segment to the end of the list
+//
+// returns: pointer to the new segment, or NULL if out of memory
+//
+static journal_segment *appendSegment( journal *pJ, uint32_t uiIndex ){
+    journal_segment *pSeg;
+
+    if( pJ->nSegments == pJ->nAllocated ){
+        pSeg = realloc( pJ->aSegments, (pJ->nAllocated + 16) * sizeof(journal_segment) );
+        if( pSeg == NULL )
+            return( NULL );
+        pJ->aSegments = pSeg;
+        pJ->nAllocated += 16;
+    }
+    pSeg = &pJ->aSegments[pJ->nSegments++];
+    memset( pSeg, 0, sizeof(*pSeg) );
+    pSeg->uiIndex = uiIndex;
+    pSeg->fd = -1;
+    return( pSeg );
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - walk a segment's records to find where the valid data
+// ends. Anything after a torn or out-of-sequence record is zeroed.
+//
+// returns: true if the segment holds at least one valid record
+//
+static bool recoverSegment( journal *pJ, journal_segment *pSeg, bool bHaveSeq, uint32_t uiExpectedSeq ){
+    record_header hdr;
+    size_t szOffset = 0, szRecord;
+
+    pSeg->uiRecords = 0;
+    while( szOffset + sizeof(hdr) <= pJ->szSegmentSize ){
+        memcpy( &hdr, pSeg->pbtMap + szOffset, sizeof(hdr) );
+        if( hdr.uiMagic == 0 )
+            break;  // clean end of segment
+
+        szRecord = ALIGN8( sizeof(hdr) + hdr.uiLen );
+        if( hdr.uiMagic != RECORD_MAGIC || hdr.uiLen > JOURNAL_MAX_RECORD ||
+            szOffset + szRecord > pJ->szSegmentSize ||
+            (bHaveSeq && hdr.uiSeq != uiExpectedSeq) ||
+            hdr.uiCrc != recordCrc( hdr.uiSeq, hdr.uiLen, pSeg->pbtMap + szOffset + sizeof(hdr) ) ){
+
+            fprintf(stderr, "journal: discarding torn record in segment %u at offset %lu\n",
+                    pSeg->uiIndex, (unsigned long)szOffset );
+            pJ->uiTornRecords++;
+            memset( pSeg->pbtMap + szOffset, 0, pJ->szSegmentSize - szOffset );
+            msync( pSeg->pbtMap, pJ->szSegmentSize, MS_SYNC );
+            break;
+        }
+
+        if( pSeg->uiRecords == 0 )
+            pSeg->uiFirstSeq = hdr.uiSeq;
+        pSeg->uiRecords++;
+        uiExpectedSeq = hdr.uiSeq + 1;
+        bHaveSeq = true;
+        szOffset += szRecord;
+    }
+    pSeg->szUsed = szOffset;
+    return( pSeg->uiRecords > 0 );
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - qsort comparison of segment file numbers
+//
+static int compareIndex( const void *a, const void *b ){
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+    return( (x > y) - (x < y) );
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - read the checkpoint file
+//
+// returns: true if it holds a valid checkpoint
+//
+static bool readCheckpoint( journal *pJ, uint32_t *puiAckedSeq ){
+    checkpoint_record cp;
+
+    if( pread( pJ->checkpointfd, &cp, sizeof(cp), 0 ) != sizeof(cp) )
+        return( false );
+    if( cp.uiMagic != CHECKPOINT_MAGIC ||
+        cp.uiCrc != crc32Update( 0, &cp.uiAckedSeq, sizeof(cp.uiAckedSeq) ) )
+        return( false );
+
+    *puiAckedSeq = cp.uiAckedSeq;
+    return( true );
+}
+
+// ---------------------------------------------------------------------------
+// open the journal in directory szDir (created if needed) and recover it:
+// torn records are discarded, and fully ACKed segments deleted.
+// szSegmentSize 0 means JOURNAL_SEGMENT_SIZE.
+//
+// returns: 0 if OK, else -1
+//
+int openJournal( journal *pJ, const char *szDir, size_t szSegmentSize ){
+    char szPath[300];
+    DIR *pDir;
+    struct dirent *pEntry;
+    uint32_t *auiIndexes = NULL, uiCheckpointSeq = 0, uiIndex;
+    int nIndexes = 0, nMax = 0, i;
+    bool bCheckpoint, bHaveSeq = false;
+    uint32_t uiExpectedSeq = 0;
+    char *pEnd;
+
+    memset( pJ, 0, sizeof(*pJ) );
+    pJ->bOpened = true;
+    pJ->dirfd = pJ->checkpointfd = -1;
+    pJ->szSegmentSize = szSegmentSize ? szSegmentSize : JOURNAL_SEGMENT_SIZE;
+    snprintf( pJ->szDir, sizeof(pJ->szDir), "%s", szDir );
+
+    if( mkdir( szDir, 0755 ) < 0 && errno != EEXIST )
+        return( -1 );
+    if( (pJ->dirfd = open( szDir, O_RDONLY | O_DIRECTORY | O_CLOEXEC )) < 0 )
+        return( -1 );
+    journalPath( pJ, szPath, sizeof(szPath), CHECKPOINT_FILE );
+    if( (pJ->checkpointfd = open( szPath, O_RDWR | O_CREAT | O_CLOEXEC, 0644 )) < 0 ){
+        closeJournal( pJ );
+        return( -1 );
+    }
+    bCheckpoint = readCheckpoint( pJ, &uiCheckpointSeq );
+
+    // list the segment files, oldest first
+    if( (pDir = opendir( szDir )) == NULL ){
+        closeJournal( pJ );
+        return( -1 );
+    }
+    while( (pEntry = readdir( pDir )) != NULL ){
+        uiIndex = (uint32_t)strtoul( pEntry->d_name, &pEnd, 10 );
+        if( pEnd == pEntry->d_name || strcmp( pEnd, SEGMENT_SUFFIX ) != 0 )
+            continue;
+        if( nIndexes == nMax ){
+            nMax += 64;
+            if( (auiIndexes = realloc( auiIndexes, nMax * sizeof(uint32_t) )) == NULL ){
+                closedir( pDir );
+                closeJournal( pJ );
+                return( -1 );
+            }
+        }
+        auiIndexes[nIndexes++] = uiIndex;
+    }
+    closedir( pDir );
+    if( nIndexes > 1 )
+        qsort( auiIndexes, nIndexes, sizeof(uint32_t), compareIndex );
+
+    // map and recover each segment. Empty ones (other than the last) are deleted
+    for( i=0 ; i < nIndexes ; i++ ){
+        journal_segment *pSeg = appendSegment( pJ, auiIndexes[i] );
+
+        if( pSeg == NULL || mapSegment( pJ, pSeg, false ) < 0 ){
+            free( auiIndexes );
+            closeJournal( pJ );
+            return( -1 );
+        }
+        if( recoverSegment( pJ, pSeg, bHaveSeq, uiExpectedSeq ) ){
+            bHaveSeq = true;
+            uiExpectedSeq = pSeg->uiFirstSeq + pSeg->uiRecords;
+        }
+        else if( i < nIndexes - 1 )
+            removeSegment( pJ, pJ->nSegments - 1 );
+    }
+    free( auiIndexes );
+
+    // where the records run up to, and how far the server has ACKed them
+    pJ->uiNextSeq = bHaveSeq ? uiExpectedSeq : uiCheckpointSeq;
+    if( bCheckpoint )
+        pJ->uiAckedSeq = uiCheckpointSeq;
+    else if( pJ->nSegments > 0 && pJ->aSegments[0].uiRecords > 0 )
+        pJ->uiAckedSeq = pJ->aSegments[0].uiFirstSeq;    // resend everything
+    else
+        pJ->uiAckedSeq = pJ->uiNextSeq;
+    if( seqAfter( pJ->uiAckedSeq, pJ->uiNextSeq ) )
+        pJ->uiNextSeq = pJ->uiAckedSeq;
+    pJ->uiCheckpointSeq = bCheckpoint ? uiCheckpointSeq : pJ->uiAckedSeq - 1;
+
+    if( pJ->nSegments > 0 )
+        pJ->szDirtyFrom = pJ->aSegments[pJ->nSegments - 1].szUsed;
+
+    // drop segments that were ACKed before the last shutdown
+    journalTrim( pJ, pJ->uiAckedSeq );
+    return( 0 );
+}
+
+// ---------------------------------------------------------------------------
+// sync and close the journal
+//
+void closeJournal( journal *pJ ){
+    int i;
+
+    // e.g. zeroed, as a static journal is until opened: its fds aren't 0
+    if( !pJ->bOpened )
+        return;
+
+    // the last sync is done in place: nothing is left to finish it
+    pJ->fnSync = NULL;
+    if( pJ->dirfd >= 0 && pJ->checkpointfd >= 0 )
+        journalSync( pJ );
+
+    for( i=0 ; i < pJ->nSegments ; i++ ){
+        if( pJ->aSegments[i].pbtMap != NULL )
+            munmap( pJ->aSegments[i].pbtMap, pJ->szSegmentSize );
+        if( pJ->aSegments[i].fd >= 0 )
+            close( pJ->aSegments[i].fd );
+    }
+    free( pJ->aSegments );
+    pJ->aSegments = NULL;
+    pJ->nSegments = pJ->nAllocated = 0;
+
+    if( pJ->checkpointfd >= 0 )
+        close( pJ->checkpointfd );
+    if( pJ->dirfd >= 0 )
+        close( pJ->dirfd );
+    pJ->checkpointfd = pJ->dirfd = -1;
+    pJ->bOpened = false;
+}
+
+// ---------------------------------------------------------------------------
+// append a record, with seq journalNextSeq(). It is in the page cache at once
+// and on disk after the next journalSync().
+//
+// returns: 0 if OK, else -1 (record too big, journal full, or I/O error)
+//
+int journalAppend( journal *pJ, const void *pData, size_t szLen ){
+    journal_segment *pTail = pJ->nSegments ? &pJ->aSegments[pJ->nSegments - 1] : NULL;
+    size_t szRecord = ALIGN8( sizeof(record_header) + szLen );
+    record_header hdr;
+    uint32_t uiIndex;
+
+    if( szLen > JOURNAL_MAX_RECORD || szRecord > pJ->szSegmentSize )
+        return( -1 );
+
+    // start a new segment if the tail is full
+    if( pTail == NULL || pTail->szUsed + szRecord > pJ->szSegmentSize ){
+        if( pJ->nSegments >= JOURNAL_MAX_SEGMENTS )
+            return( -1 );
+        if( pTail != NULL && journalSync( pJ ) < 0 )   // finish off the old tail
+            return( -1 );
+
+        uiIndex = pTail ? pTail->uiIndex + 1 : 0;
+        if( (pTail = appendSegment( pJ, uiIndex )) == NULL )
+            return( -1 );
+        if( mapSegment( pJ, pTail, true ) < 0 ){
+            pJ->nSegments--;
+            return( -1 );
+        }
+        pJ->szDirtyFrom = 0;
+        pJ->bDirDirty = true;
+    }
+
+    // payload first, header last, though the CRC is what really protects it
+    hdr.uiMagic = RECORD_MAGIC;
+    hdr.uiSeq = pJ->uiNextSeq;
+    hdr.uiLen = (uint32_t)szLen;
+    hdr.uiCrc = recordCrc( hdr.uiSeq, hdr.uiLen, pData );
+    memcpy( pTail->pbtMap + pTail->szUsed + sizeof(hdr), pData, szLen );
+    memcpy( pTail->pbtMap + pTail->szUsed, &hdr, sizeof(hdr) );
+
+    if( pTail->uiRecords++ == 0 )
+        pTail->uiFirstSeq = hdr.uiSeq;
+    pTail->szUsed += szRecord;
+    pJ->uiNextSeq++;
+    pJ->uiUnsynced++;
+    pJ->uiAppended++;
+    return( 0 );
+}
+
+// ---------------------------------------------------------------------------
+// have journalSync() start its syncs in the background with fnSync, instead
+// of waiting for each. NULL goes back to syncing in place
+//
+void setJournalSyncer( journal *pJ, journal_sync_fn fnSync, void *pCtx ){
+    pJ->fnSync = fnSync;
+    pJ->pSyncCtx = pCtx;
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - fdatasync fd, in the background if there's a syncer
+//
+// returns: 0 if OK or started, else -1
+//
+static int syncFile( journal *pJ, int fd ){
+    if( pJ->fnSync != NULL && pJ->fnSync( fd, pJ->pSyncCtx ) == 0 )
+        return( 0 );
+    return( fd == pJ->dirfd ? fsync( fd ) : fdatasync( fd ) );
+}
+
+// ---------------------------------------------------------------------------
+// group commit: write everything appended since the last sync to disk with
+// one msync, plus the directory and checkpoint if they changed. With a
+// syncer (setJournalSyncer()) they are fdatasyncs started in the background
+// instead, and this returns without waiting
+//
+// returns: 0 if OK, else -1
+//
+int journalSync( journal *pJ ){
+    journal_segment *pTail = pJ->nSegments ? &pJ->aSegments[pJ->nSegments - 1] : NULL;
+    checkpoint_record cp;
+    size_t szPage = (size_t)sysconf( _SC_PAGESIZE );
+    size_t szFrom;
+    int res = 0;
+
+    if( pTail != NULL && pJ->uiUnsynced > 0 ){
+        szFrom = pJ->szDirtyFrom & ~(szPage - 1);   // msync wants a page-aligned start
+        if( pJ->fnSync != NULL ){
+            // the file's dirty pages are the mapping's, so this writes them too
+            if( pJ->fnSync( pTail->fd, pJ->pSyncCtx ) == 0 )
+                pTail->nSyncing++;
+            else if( fdatasync( pTail->fd ) < 0 )
+                res = -1;
+        }
+        else if( msync( pTail->pbtMap + szFrom, pTail->szUsed - szFrom, MS_SYNC ) < 0 )
+            res = -1;
+        pJ->szDirtyFrom = pTail->szUsed;
+        pJ->uiUnsynced = 0;
+        pJ->uiSyncs++;
+    }
+
+    if( pJ->bDirDirty ){
+        if( syncFile( pJ, pJ->dirfd ) < 0 )
+            res = -1;
+        pJ->bDirDirty = false;
+    }
+
+    if( pJ->uiCheckpointSeq != pJ->uiAckedSeq ){
+        cp.uiMagic = CHECKPOINT_MAGIC;
+        cp.uiAckedSeq = pJ->uiAckedSeq;
+        cp.uiCrc = crc32Update( 0, &cp.uiAckedSeq, sizeof(cp.uiAckedSeq) );
+        if( pwrite( pJ->checkpointfd, &cp, sizeof(cp), 0 ) != sizeof(cp) ||
+            syncFile( pJ, pJ->checkpointfd ) < 0 )
+            res = -1;
+        else
+            pJ->uiCheckpointSeq = pJ->uiAckedSeq;
+    }
+    return( res );
+}
+
+// ---------------------------------------------------------------------------
+// a background sync started by the syncer has finished. A segment trimmed
+// while it ran can go now
+//
+void journalSyncDone( journal *pJ, int fd ){
+    int i;
+
+    for( i=0 ; i < pJ->nSegments ; i++ ){
+        if( pJ->aSegments[i].fd == fd && pJ->aSegments[i].nSyncing > 0 ){
+            if( --pJ->aSegments[i].nSyncing == 0 && i == 0 )
+                journalTrim( pJ, pJ->uiAckedSeq );
+            return;
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// the server has ACKed every record before uiAckedSeq. Segments holding only
+// ACKed records are deleted (except the tail, which is still being written,
+// and any with a background sync still running, till journalSyncDone()).
+//
+// returns: number of segments deleted
+//
+int journalTrim( journal *pJ, uint32_t uiAckedSeq ){
+    journal_segment *pSeg;
+    int n = 0;
+
+    if( seqAfter( uiAckedSeq, pJ->uiNextSeq ) )
+        uiAckedSeq = pJ->uiNextSeq;
+    if( seqAfter( uiAckedSeq, pJ->uiAckedSeq ) )
+        pJ->uiAckedSeq = uiAckedSeq;
+
+    while( pJ->nSegments > 1 ){
+        pSeg = &pJ->aSegments[0];
+        if( pSeg->uiRecords > 0 && seqAfter( pSeg->uiFirstSeq + pSeg->uiRecords, pJ->uiAckedSeq ) )
+            break;
+        if( pSeg->nSyncing > 0 )
+            break;
+        removeSegment( pJ, 0 );
+        n++;
+    }
+    return( n );
+}
+
+// ---------------------------------------------------------------------------
+// number of records appended that a cursor hasn't read yet
+//
+uint32_t journalUnread( const journal *pJ, const journal_cursor *pCur ){
+    if( seqAfter( pJ->uiAckedSeq, pCur->uiSeq ) )
+        return( pJ->uiNextSeq - pJ->uiAckedSeq );
+    return( pJ->uiNextSeq - pCur->uiSeq );
+}
+
+// ---------------------------------------------------------------------------
+// seq that the next appended record will get
+//
+uint32_t journalNextSeq( const journal *pJ ){
+    return( pJ->uiNextSeq );
+}
+
+// ---------------------------------------------------------------------------
+// number of records not ACKed yet
+//
+uint32_t journalPending( const journal *pJ ){
+    return( pJ->uiNextSeq - pJ->uiAckedSeq );
+}
+
+// ---------------------------------------------------------------------------
+// position a cursor at the first record with seq >= uiSeq, e.g. the first
+// unACKed record when replaying after a reconnect
+//
+// returns: 0 if OK, -1 if the journal is empty (the cursor is then at the
+//          end, and picks up records appended later)
+//
+int journalSeek( journal *pJ, journal_cursor *pCur, uint32_t uiSeq ){
+    journal_segment *pSeg;
+    record_header hdr;
+    int i;
+
+    memset( pCur, 0, sizeof(*pCur) );
+    pCur->uiSeq = uiSeq;
+    if( pJ->nSegments == 0 )
+        return( -1 );
+
+    // the last segment that starts at or before uiSeq
+    for( i = pJ->nSegments - 1 ; i > 0 ; i-- )
+        if( pJ->aSegments[i].uiRecords > 0 && !seqAfter( pJ->aSegments[i].uiFirstSeq, uiSeq ) )
+            break;
+    pSeg = &pJ->aSegments[i];
+    pCur->nSegment = i;
+
+    while( pCur->szOffset < pSeg->szUsed ){
+        memcpy( &hdr, pSeg->pbtMap + pCur->szOffset, sizeof(hdr) );
+        if( !seqAfter( uiSeq, hdr.uiSeq ) )
+            break;
+        pCur->szOffset += ALIGN8( sizeof(hdr) + hdr.uiLen );
+    }
+    return( 0 );
+}
+
+// ---------------------------------------------------------------------------
+// read the record at the cursor and advance it. The payload is returned in
+// place in the mapped segment; it stays valid until the record is trimmed.
+//
+// returns: pointer to the payload, or NULL if there are no more records yet
+//
+const uint8_t *journalRead( journal *pJ, journal_cursor *pCur, uint32_t *puiSeq, size_t *pszLen ){
+    journal_segment *pSeg;
+    record_header hdr;
+
+    // trimming shifts the segment list, so resync from the seq if needed
+    if( pCur->nSegment >= pJ->nSegments ||
+        (pJ->aSegments[pCur->nSegment].uiRecords > 0 &&
+         seqAfter( pJ->aSegments[pCur->nSegment].uiFirstSeq, pCur->uiSeq )) ||
+        seqAfter( pJ->uiAckedSeq, pCur->uiSeq ) ){
+        if( journalSeek( pJ, pCur, seqAfter( pJ->uiAckedSeq, pCur->uiSeq ) ? pJ->uiAckedSeq : pCur->uiSeq ) < 0 )
+            return( NULL );
+    }
+
+    pSeg = &pJ->aSegments[pCur->nSegment];
+    while( pCur->szOffset >= pSeg->szUsed ){
+        if( pCur->nSegment + 1 >= pJ->nSegments )
+            return( NULL );
+        pSeg = &pJ->aSegments[++pCur->nSegment];
+        pCur->szOffset = 0;
+    }
+
+    memcpy( &hdr, pSeg->pbtMap + pCur->szOffset, sizeof(hdr) );
+    *puiSeq = hdr.uiSeq;
+    *pszLen = hdr.uiLen;
+    pCur->uiSeq = hdr.uiSeq + 1;
+    pCur->szOffset += ALIGN8( sizeof(hdr) + hdr.uiLen );
+    return( pSeg->pbtMap + pCur->szOffset - ALIGN8( sizeof(hdr) + hdr.uiLen ) + sizeof(hdr) );
+}
@@ -0,0 +1,83 @@
+/*
+ * @file journal.h
+ * @brief public interface of journal.c
+ */
+#ifndef _JOURNAL_H_
+#define _JOURNAL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Definitions
+#define JOURNAL_SEGMENT_SIZE   (1024 * 1024)    // default bytes per segment file
+#define JOURNAL_MAX_SEGMENTS    256             // cap on disk use during an outage
+#define JOURNAL_MAX_RECORD     4096             // largest payload
+
+// starts a background fdatasync() of fd rather than waiting for it, e.g.
+// on io_uring. Any error is the caller's to report, and journalSyncDone()
+// is called when it finishes
+// returns: 0 if started, else -1 to sync in place
+typedef int (*journal_sync_fn)( int fd, void *pCtx );
+
+// a segment file. Every live segment stays mapped, so records are read in place
+typedef struct {
+    uint32_t  uiIndex;          // file name number
+    uint32_t  uiFirstSeq;
+    uint32_t  uiRecords;
+    size_t    szUsed;           // bytes of valid records
+    uint8_t  *pbtMap;           // NULL if not mapped
+    int       fd;               // kept open for background syncs
+    int       nSyncing;         // background syncs not finished: not trimmed till 0
+} journal_segment;
+
+// position of the replay/send cursor
+typedef struct {
+    int       nSegment;         // index into aSegments
+    size_t    szOffset;
+    uint32_t  uiSeq;            // seq of the record at the cursor
+} journal_cursor;
+
+typedef struct {
+    bool              bOpened;          // by openJournal(), till closeJournal()
+    char              szDir[256];
+    int               dirfd;
+    int               checkpointfd;
+    size_t            szSegmentSize;
+
+    journal_segment  *aSegments;
+    int               nSegments;
+    int               nAllocated;
+
+    uint32_t          uiNextSeq;        // seq of the next record appended
+    uint32_t          uiAckedSeq;       // first record not ACKed by the server
+    uint32_t          uiCheckpointSeq;  // uiAckedSeq as last written to disk
+
+    // group commit: dirty byte range of the tail segment not msync'ed yet
+    size_t            szDirtyFrom;
+    uint32_t          uiUnsynced;       // records appended since the last sync
+    bool              bDirDirty;        // segment files created or removed
+    journal_sync_fn   fnSync;           // NULL to sync in place
+    void             *pSyncCtx;
+
+    // counters
+    uint32_t          uiAppended;
+    uint32_t          uiSyncs;
+    uint32_t          uiTornRecords;    // invalid records found by recovery
+} journal;
+
+// function prototypes
+int   openJournal( journal *pJ, const char *szDir, size_t szSegmentSize );
+void  closeJournal( journal *pJ );
+int   journalAppend( journal *pJ, const void *pData, size_t szLen );
+int   journalSync( journal *pJ );
+void  setJournalSyncer( journal *pJ, journal_sync_fn fnSync, void *pCtx );
+void  journalSyncDone( journal *pJ, int fd );
+int   journalTrim( journal *pJ, uint32_t uiAckedSeq );
+uint32_t journalNextSeq( const journal *pJ );
+uint32_t journalPending( const journal *pJ );
+uint32_t journalUnread( const journal *pJ, const journal_cursor *pCur );
+int   journalSeek( journal *pJ, journal_cursor *pCur, uint32_t uiSeq );
+const uint8_t *journalRead( journal *pJ, journal_cursor *pCur, uint32_t *puiSeq, size_t *pszLen );
+
+#endif // _JOURNAL_H_
@@ -0,0 +1,418 @@
+/*
+ * @file journal_test.c
+ * @brief unit test for journal.c
+ *
+ * runs standalone in a scratch directory (argv[1], default /tmp/journal_test).
+ * Covers append/replay, recovery after restart, trimming of ACKed segments,
+ * torn records, and times group-committed appends.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+
+#include "journal.h"
+#include "unit_test.h"
+
+#define SEGMENT_SIZE    (16 * 1024)     // small segments, so the tests roll over
+#define SYNC_BATCH      32              // records per group commit in the benchmark
+#define BENCH_RECORDS   10000
+
+static const char *szDir = "/tmp/journal_test";
+
+// ---------------------------------------------------------------------------
+// empty the scratch directory
+//
+void cleanDir( void ){
+    char szPath[512];
+    DIR *pDir;
+    struct dirent *pEntry;
+
+    if( (pDir = opendir( szDir )) == NULL )
+        return;
+    while( (pEntry = readdir( pDir )) != NULL ){
+        if( pEntry->d_name[0] == '.' )
+            continue;
+        snprintf( szPath, sizeof(szPath), "%s/%s", szDir, pEntry->d_name );
+        unlink( szPath );
+    }
+    closedir( pDir );
+}
+
+// ---------------------------------------------------------------------------
+// number of segment files on disk
+//
+int countSegments( void ){
+    DIR *pDir;
+    struct dirent *pEntry;
+    int n = 0;
+
+    if( (pDir = opendir( szDir )) == NULL )
+        return( 0 );
+    while( (pEntry = readdir( pDir )) != NULL )
+        if( strstr( pEntry->d_name, ".jnl" ) != NULL )
+            n++;
+    closedir( pDir );
+    return( n );
+}
+
+// ---------------------------------------------------------------------------
+// append records "tap <seq>"
+//
+void appendRecords( journal *pJ, int nRecords ){
+    char szRecord[64];
+    int i;
+
+    for( i=0 ; i < nRecords ; i++ ){
+        snprintf( szRecord, sizeof(szRecord), "tap %u", journalNextSeq( pJ ) );
+        CHECK( journalAppend( pJ, szRecord, strlen(szRecord) ) == 0 );
+    }
+}
+
+// ---------------------------------------------------------------------------
+// read from uiFrom to the end, checking every record is there in order
+//
+// returns: number of records read
+//
+int replayFrom( journal *pJ, uint32_t uiFrom ){
+    journal_cursor cur;
+    char szExpected[64];
+    const uint8_t *pRecord;
+    uint32_t uiSeq;
+    size_t szLen;
+    int n = 0;
+
+    journalSeek( pJ, &cur, uiFrom );
+    while( (pRecord = journalRead( pJ, &cur, &uiSeq, &szLen )) != NULL ){
+        snprintf( szExpected, sizeof(szExpected), "tap %u", uiFrom + n );
+        CHECK( uiSeq == uiFrom + n );
+        CHECK( szLen == strlen(szExpected) && memcmp( pRecord, szExpected, szLen ) == 0 );
+        n++;
+    }
+    return( n );
+}
+
+// ---------------------------------------------------------------------------
+// records survive close/open, and ACKed segments are deleted
+//
+void testReplayAndTrim( void ){
+    journal j;
+    journal_cursor cur;
+    uint32_t uiSeq;
+    size_t szLen;
+
+    cleanDir();
+    CHECK( openJournal( &j, szDir, SEGMENT_SIZE ) == 0 );
+    CHECK( journalNextSeq( &j ) == 0 );
+    appendRecords( &j, 2000 );
+    CHECK( journalPending( &j ) == 2000 );
+    CHECK( replayFrom( &j, 0 ) == 2000 );
+    CHECK( replayFrom( &j, 1234 ) == 766 );
+    CHECK( countSegments() > 2 );
+    closeJournal( &j );
+
+    // restart: everything is still pending
+    CHECK( openJournal( &j, szDir, SEGMENT_SIZE ) == 0 );
+    CHECK( journalNextSeq( &j ) == 2000 );
+    CHECK( journalPending( &j ) == 2000 );
+    CHECK( j.uiTornRecords == 0 );
+
+    // server ACKs up to 1499: only the segments holding 1500.. remain
+    journalTrim( &j, 1500 );
+    CHECK( journalPending( &j ) == 500 );
+    CHECK( replayFrom( &j, 1500 ) == 500 );
+    journalSeek( &j, &cur, 0 );                 // ACKed records are skipped
+    CHECK( journalRead( &j, &cur, &uiSeq, &szLen ) != NULL && uiSeq == 1500 );
+    CHECK( j.aSegments[0].uiFirstSeq <= 1500 );
+    closeJournal( &j );
+
+    // the checkpoint remembers the ACKs
+    CHECK( openJournal( &j, szDir, SEGMENT_SIZE ) == 0 );
+    CHECK( journalPending( &j ) == 500 );
+    CHECK( replayFrom( &j, 1500 ) == 500 );
+
+    // everything ACKed: only the tail segment is left, and seq carries on
+    journalTrim( &j, journalNextSeq( &j ) );
+    CHECK( countSegments() == 1 );
+    closeJournal( &j );
+    CHECK( openJournal( &j, szDir, SEGMENT_SIZE ) == 0 );
+    CHECK( journalPending( &j ) == 0 );
+    CHECK( journalNextSeq( &j ) == 2000 );
+    appendRecords( &j, 3 );
+    CHECK( replayFrom( &j, 2000 ) == 3 );
+    closeJournal( &j );
+}
+
+// ---------------------------------------------------------------------------
+// a cursor keeps its place while segments ahead of it are trimmed
+//
+void testCursorAcrossTrim( void ){
+    journal j;
+    journal_cursor cur;
+    uint32_t uiSeq = 0;
+    size_t szLen;
+    int i;
+
+    cleanDir();
+    CHECK( openJournal( &j, szDir, SEGMENT_SIZE ) == 0 );
+    appendRecords( &j, 1500 );
+    journalSeek( &j, &cur, 0 );
+    CHECK( journalUnread( &j, &cur ) == 1500 );
+    for( i=0 ; i < 1000 ; i++ )
+        journalRead( &j, &cur, &uiSeq, &szLen );
+    CHECK( uiSeq == 999 );
+    CHECK( journalUnread( &j, &cur ) == 500 );
+    journalTrim( &j, 900 );
+    CHECK( journalRead( &j, &cur, &uiSeq, &szLen ) != NULL );
+    CHECK( uiSeq == 1000 );
+    closeJournal( &j );
+}
+
+// ---------------------------------------------------------------------------
+// a record torn by a power cut is discarded, with everything after it
+//
+void testTornRecord( void ){
+    journal j;
+    char szPath[512];
+    uint8_t btGarbage = 0x5A;
+    int fd;
+
+    cleanDir();
+    CHECK( openJournal( &j, szDir, SEGMENT_SIZE ) == 0 );
+    appendRecords( &j, 10 );
+    closeJournal( &j );
+
+    // corrupt one payload byte of record 7. records are 16 + 8 bytes here
+    snprintf( szPath, sizeof(szPath), "%s/%08u.jnl", szDir, 0 );
+    CHECK( (fd = open( szPath, O_RDWR )) >= 0 );
+    CHECK( pwrite( fd, &btGarbage, 1, 7 * 24 + 17 ) == 1 );
+    close( fd );
+
+    CHECK( openJournal( &j, szDir, SEGMENT_SIZE ) == 0 );
+    CHECK( j.uiTornRecords == 1 );
+    CHECK( journalNextSeq( &j ) == 7 );
+    CHECK( replayFrom( &j, 0 ) == 7 );
+
+    // new records take over from the torn one
+    appendRecords( &j, 5 );
+    CHECK( replayFrom( &j, 0 ) == 12 );
+    closeJournal( &j );
+    CHECK( openJournal( &j, szDir, SEGMENT_SIZE ) == 0 );
+    CHECK( j.uiTornRecords == 0 );
+    CHECK( replayFrom( &j, 0 ) == 12 );
+    closeJournal( &j );
+}
+
+// ---------------------------------------------------------------------------
+// stand-in syncer: notes the fds it's given, and starts none of them if
+// nSyncerResult is -1
+//
+static int anSyncedFds[8];
+static int nSyncedFds;
+static int nSyncerResult;
+
+int captureSync( int fd, void *pCtx ){
+    if( nSyncedFds < 8 )
+        anSyncedFds[nSyncedFds++] = fd;
+    return( nSyncerResult );
+}
+
+// ---------------------------------------------------------------------------
+// with a syncer, the group commit hands it the tail segment, the directory
+// and the checkpoint instead of syncing them in place
+//
+void testSyncer( void ){
+    journal j;
+    int i;
+    bool bTail = false, bDir = false, bCheckpoint = false;
+
+    cleanDir();
+    CHECK( openJournal( &j, szDir, SEGMENT_SIZE ) == 0 );
+    appendRecords( &j, 1 );
+    journalSync( &j );
+    setJournalSyncer( &j, captureSync, NULL );
+    nSyncedFds = 0;
+    nSyncerResult = 0;
+
+    appendRecords( &j, 9 );
+    journalTrim( &j, 5 );
+    CHECK( journalSync( &j ) == 0 );
+    for( i=0 ; i < nSyncedFds ; i++ ){
+        bTail |= anSyncedFds[i] == j.aSegments[j.nSegments - 1].fd;
+        bDir |= anSyncedFds[i] == j.dirfd;
+        bCheckpoint |= anSyncedFds[i] == j.checkpointfd;
+    }
+    CHECK( bTail && bCheckpoint && !bDir );
+    CHECK( j.uiUnsynced == 0 );
+    CHECK( j.uiCheckpointSeq == 5 );
+
+    // a new segment dirties the directory
+    appendRecords( &j, 1000 );
+    nSyncedFds = 0;
+    CHECK( journalSync( &j ) == 0 );
+    for( i=0 ; i < nSyncedFds ; i++ )
+        bDir |= anSyncedFds[i] == j.dirfd;
+    CHECK( bDir );
+
+    // a syncer that can't start them leaves them to be done in place
+    appendRecords( &j, 3 );
+    nSyncedFds = 0;
+    nSyncerResult = -1;
+    CHECK( journalSync( &j ) == 0 );
+    CHECK( nSyncedFds == 1 );
+    CHECK( j.uiUnsynced == 0 );
+
+    // and closing doesn't leave the last one to it
+    appendRecords( &j, 3 );
+    nSyncedFds = 0;
+    closeJournal( &j );
+    CHECK( nSyncedFds == 0 );
+    CHECK( openJournal( &j, szDir, SEGMENT_SIZE ) == 0 );
+    CHECK( journalPending( &j ) == 1011 );
+    closeJournal( &j );
+}
+
+// ---------------------------------------------------------------------------
+// a segment synced in the background stays open, and on disk, until its sync
+// is done, however soon it's ACKed
+//
+void testSyncDone( void ){
+    journal j;
+    int anFds[8], nSegments, i;
+
+    cleanDir();
+    CHECK( openJournal( &j, szDir, SEGMENT_SIZE ) == 0 );
+    setJournalSyncer( &j, captureSync, NULL );
+    nSyncerResult = 0;
+    appendRecords( &j, 3 );
+    CHECK( journalSync( &j ) == 0 );
+    CHECK( j.aSegments[0].nSyncing == 1 );
+
+    // on to more segments, each synced as it fills
+    appendRecords( &j, 1500 );
+    nSegments = j.nSegments;
+    CHECK( nSegments > 2 && nSegments <= 8 );
+    for( i=0 ; i < nSegments && i < 8 ; i++ )
+        anFds[i] = j.aSegments[i].fd;
+    CHECK( j.aSegments[0].nSyncing == 2 && j.aSegments[1].nSyncing == 1 );
+    CHECK( journalTrim( &j, journalNextSeq( &j ) ) == 0 );
+    CHECK( j.nSegments == nSegments && fcntl( anFds[0], F_GETFD ) >= 0 );
+    journalSyncDone( &j, j.checkpointfd );      // not a segment's
+    CHECK( j.nSegments == nSegments );
+
+    // a segment done waits for those before it, and goes with them
+    journalSyncDone( &j, anFds[1] );
+    journalSyncDone( &j, anFds[0] );
+    CHECK( j.nSegments == nSegments );
+    journalSyncDone( &j, anFds[0] );
+    CHECK( j.nSegments == nSegments - 2 );
+    CHECK( fcntl( anFds[0], F_GETFD ) < 0 && fcntl( anFds[1], F_GETFD ) < 0 );
+    for( i=2 ; i < nSegments - 1 ; i++ )
+        journalSyncDone( &j, anFds[i] );
+    CHECK( j.nSegments == 1 && countSegments() == 1 );
+    closeJournal( &j );
+}
+
+// ---------------------------------------------------------------------------
+// closing a journal never opened, or closed already, closes nothing
+//
+void testCloseUnopened( void ){
+    static journal jStatic;
+    journal j;
+    int fd;
+
+    fd = open( "/dev/null", O_RDONLY );         // whatever fd 0 is, a known one
+    CHECK( fd >= 0 );
+    if( fd < 0 )
+        return;
+    CHECK( dup2( fd, 0 ) == 0 );
+    closeJournal( &jStatic );
+    CHECK( fcntl( 0, F_GETFD ) >= 0 );
+
+    cleanDir();
+    CHECK( openJournal( &j, szDir, SEGMENT_SIZE ) == 0 );
+    appendRecords( &j, 3 );
+    closeJournal( &j );
+    close( fd );
+    fd = open( "/dev/null", O_RDONLY );         // likely one the journal had
+    closeJournal( &j );
+    CHECK( fcntl( 0, F_GETFD ) >= 0 && fcntl( fd, F_GETFD ) >= 0 );
+    close( fd );
+}
+
+// ---------------------------------------------------------------------------
+// wall time in nanoseconds, for the benchmark
+//
+uint64_t nanosecs( void ){
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return( (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec );
+}
+
+// ---------------------------------------------------------------------------
+// time appends with a sync per record, and group-committed
+//
+void benchmark( void ){
+    journal j;
+    uint64_t ullStart, ullEach, ullGroup;
+    char szRecord[160];
+    int i;
+
+    memset( szRecord, 'x', sizeof(szRecord) );  // about the size of a JSON tap
+
+    cleanDir();
+    openJournal( &j, szDir, 0 );
+    ullStart = nanosecs();
+    for( i=0 ; i < BENCH_RECORDS / 10 ; i++ ){
+        journalAppend( &j, szRecord, sizeof(szRecord) );
+        journalSync( &j );
+    }
+    ullEach = (nanosecs() - ullStart) / (BENCH_RECORDS / 10);
+    closeJournal( &j );
+
+    cleanDir();
+    openJournal( &j, szDir, 0 );
+    ullStart = nanosecs();
+    for( i=0 ; i < BENCH_RECORDS ; i++ ){
+        journalAppend( &j, szRecord, sizeof(szRecord) );
+        if( j.uiUnsynced >= SYNC_BATCH )
+            journalSync( &j );
+    }
+    journalSync( &j );
+    ullGroup = (nanosecs() - ullStart) / BENCH_RECORDS;
+    CHECK( j.uiSyncs < BENCH_RECORDS / SYNC_BATCH + 4 );  // + one per segment rolled over
+    closeJournal( &j );
+
+    printf("benchmark: %d byte records\n", (int)sizeof(szRecord) );
+    printf("  sync every record    %8.1f us/record\n", ullEach / 1e3 );
+    printf("  group commit of %-3d  %8.1f us/record\n", SYNC_BATCH, ullGroup / 1e3 );
+}
+
+// ===========================================================================
+// main
+//
+int main( int argc, char *argv[] )
+{
+    if( argc > 1 )
+        szDir = argv[1];
+
+    testReplayAndTrim();
+    testCursorAcrossTrim();
+    testTornRecord();
+    testSyncer();
+    testSyncDone();
+    testCloseUnopened();
+    benchmark();
+    cleanDir();
+
+    if( nFailures ){
+        printf("%d check(s) FAILED\n", nFailures );
+        exit( EXIT_FAILURE );
+    }
+    printf("all journal tests passed\n");
+    exit( EXIT_SUCCESS );
+}
@@ -2,7 +2,8 @@
  * @file led_driver.c:
  * @brief control an LED driven by a pin of the RPi GPIO
  *
- * uses the wiringPi RPi GPIO driver library 
+ * uses the wiringPi RPi GPIO driver library. Built with -DLED_NO_GPIO the LED
+ * is only remembered, not driven, for builds off the RPi (see nfc_sim.c)
  *
  * Mapping the physical pin numbers on the RPi header to the pin names 
  * used by the wiring Pi library:
@@ -28,7 +29,9 @@
 #include <stdlib.h>
 #include <stdbool.h>
 
+#ifndef LED_NO_GPIO
 #include <wiringPi.h>
+#endif
 
 #include "led_driver.h"
 
@@ -45,7 +48,9 @@ bool isLEDon( void ){
  * switch ON the LED
  */
 void turnOnLED( void ){
+#ifndef LED_NO_GPIO
     digitalWrite (LED_PIN, 1) ;       // ON
+#endif
     bLEDisOn = true;
 }
 
@@ -53,7 +58,9 @@ void turnOnLED( void ){
  * switch OFF the LED
  */
 void turnOffLED( void ){
+#ifndef LED_NO_GPIO
     digitalWrite (LED_PIN, 0) ;       // OFF
+#endif
     bLEDisOn = false;
 }
 
@@ -63,10 +70,12 @@ void turnOffLED( void ){
  * returns: 0 if OK, -1 if failed
  */
 int initLED( void ){
+#ifndef LED_NO_GPIO
   if (wiringPiSetup () == -1)
     return( -1 );
 
   pinMode (LED_PIN, OUTPUT) ;         // aka BCM_GPIO pin 17
+#endif
   turnOffLED();
 
   return( 0 ) ;
@@ -2,10 +2,28 @@
  * @file nfc_driver.c
  * @brief Polling the RPi NFC board
  *
- * uses the libnfc platform independent Near Field Communication (NFC) library 
+ * uses the libnfc platform independent Near Field Communication (NFC) library
+ *
+ * Each reader is an nfc_reader: its own libnfc context, device, list of
+ * target types and counters, with nothing shared between readers, so each
+ * can be polled on a thread of its own. listNFCtargets() reads every card
+ * in the field at once, through anticollision, where polling stops at the
+ * first. checkNFCtarget() tells whether a card found is still there, by
+ * selecting it alone, and checkNFCpresence() follows the cards at a reader
+ * that way, listing now and then for any that join them. abortNFCreader()
+ * cancels a poll in progress through nfc_abort_command() - it is safe in a
+ * signal handler - and the caller decides what happens next, rather than
+ * the driver exiting the process.
+ *
+ * Each target type costs a poll cycle its share of the wait, so a reader
+ * learns which ones its site sees: types are polled most found first, and
+ * types never found drop out of the cycle, to be probed only every
+ * NFC_PROBE_INTERVAL cycles. The counts halve every NFC_HITS_HALF_LIFE
+ * cycles, so a type no longer seen drops out in time. A site profile set
+ * with setNFCmodulations( ..., true ) is polled as given, every cycle.
  *
  * @author Robert Drummond
- * Copyright (c) 2013 Pink Pelican NZ Ltd <bob@pink-pelican.com> 
+ * Copyright (c) 2013 Pink Pelican NZ Ltd <bob@pink-pelican.com>
  */
 
 #ifdef HAVE_CONFIG_H
@@ -13,266 +31,578 @@
 #endif // HAVE_CONFIG_H
 
 #include <err.h>
-#include <signal.h>
 #include <stdio.h>
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <time.h>
 
 #include "nfc.h"
 #include "nfc-types.h"
 #include "nfc-utils.h"
 
 #include "nfc_driver.h"
-
-// local function prototypes
-static int stringify_nfc_iso14443a_info (const nfc_iso14443a_info nai, char *szBffer );
+#include "nfc_encode.h"
+#include "nfc_record.h"
 
 // Definitions
-#define MAX_DEVICE_COUNT 16
-
-// STATIC GLOBALS (referenceable within this file only) 
-static nfc_device *pnd = NULL;
+#define NFC_NO_TARGET   -90     // what polling returns when no target was found
+#define NFC_HITS_HALF_LIFE  1024    // cycles between halvings of the counts by type
+
+// the tag types polled for unless setNFCmodulations() says otherwise
+static const nfc_modulation anmDefaultModulations[] = {
+  { .nmt = NMT_ISO14443A, .nbr = NBR_106 },
+  { .nmt = NMT_ISO14443B, .nbr = NBR_106 },
+  { .nmt = NMT_FELICA, .nbr = NBR_212 },
+  { .nmt = NMT_FELICA, .nbr = NBR_424 },
+  { .nmt = NMT_JEWEL, .nbr = NBR_106 },
+};
+
+// names of the target types, for site profiles and logs
+static const struct {
+  const char     *szName;
+  nfc_modulation  nm;
+} aNamedModulations[] = {
+  { "14443a",    { .nmt = NMT_ISO14443A, .nbr = NBR_106 } },
+  { "14443b",    { .nmt = NMT_ISO14443B, .nbr = NBR_106 } },
+  { "felica212", { .nmt = NMT_FELICA, .nbr = NBR_212 } },
+  { "felica424", { .nmt = NMT_FELICA, .nbr = NBR_424 } },
+  { "jewel",     { .nmt = NMT_JEWEL, .nbr = NBR_106 } },
+};
+#define NAMED_MODULATIONS   (sizeof(aNamedModulations) / sizeof(aNamedModulations[0]))
 
 // ---------------------------------------------------------------------------
-// stop polling the NFC board
+// Internal function - microseconds on CLOCK_MONOTONIC
 //
-void stop_polling (int sig)
-{
-  (void) sig;
-
-  fprintf(stderr,"\nNFC polling aborted by user\n");
-  if (pnd)
-    nfc_abort_command (pnd);
-  exit (EXIT_FAILURE);
+static uint64_t monotonicMicrosecs( void ){
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return( (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000 );
 }
 
 // ---------------------------------------------------------------------------
-// Initialize NFC device 
+// find the NFC readers attached, with a libnfc context of its own
 //
-// returns: 0 if OK, else -1 
+// returns: number of connection strings written to aConnstrings
 //
-int initNFC(void){
-  nfc_init (NULL);
-
-  pnd = nfc_open (NULL, NULL);
+size_t listNFCreaders( nfc_connstring aConnstrings[], size_t szMax ){
+  nfc_context context = NULL;
+  size_t szFound;
+
+  nfc_init (&context);
+  szFound = nfc_list_devices (&context, aConnstrings, szMax);
+  nfc_exit (&context);
+  return(szFound);
+}
 
-  if (pnd == NULL) {
-    fprintf(stderr, "ERROR: Unable to open NFC device\n");
-    return(-1); // exit (EXIT_FAILURE);
+// ---------------------------------------------------------------------------
+// open a reader and make it an initiator. szConnstring NULL opens libnfc's
+// default device - the only way to reach one it can't scan for, e.g. on a UART
+//
+// returns: 0 if OK, else -1
+//
+int openNFCreader( nfc_reader *pReader, int nId, const char *szConnstring ){
+  memset( pReader, 0, sizeof(*pReader) );
+  pReader->nId = nId;
+  setNFCmodulations( pReader, anmDefaultModulations,
+                     sizeof(anmDefaultModulations) / sizeof(anmDefaultModulations[0]), false );
+  atomic_init( &pReader->bAborted, false );
+
+  nfc_init (&pReader->context);
+
+  if ((pReader->pnd = nfc_open (&pReader->context, szConnstring)) == NULL) {
+    fprintf(stderr, "ERROR: Unable to open NFC device %s\n", szConnstring ? szConnstring : "");
+    closeNFCreader( pReader );
+    return(-1);
   }
 
-  if (nfc_initiator_init (pnd) < 0) {
-    nfc_perror (pnd, "nfc_initiator_init");
-    return(-1); // exit (EXIT_FAILURE);    
+  if (nfc_initiator_init (pReader->pnd) < 0) {
+    nfc_perror (pReader->pnd, "nfc_initiator_init");
+    closeNFCreader( pReader );
+    return(-1);
   }
 
   // Enable field so more power consuming cards can power themselves up
   // nfc_configure (pnd, NDO_ACTIVATE_FIELD, true);
 
-  printf("NFC reader: %s opened\n", nfc_device_get_name (pnd));
+  // a select comes back when there's no card, for checkNFCtarget()
+  if (nfc_device_set_property_bool (pReader->pnd, NP_INFINITE_SELECT, false) < 0)
+    nfc_perror (pReader->pnd, "nfc_device_set_property_bool");
 
-  if (signal (SIGINT, stop_polling) == SIG_ERR)   // set interupt handler on Ctl-C 
-    perror("ERROR: can't catch SIGINT");
-  
-  // Display libnfc version
-  const char *acLibnfcVersion = nfc_version ();
+  printf("NFC reader %d: %s opened\n", nId, nfc_device_get_name (pReader->pnd));
+  return(0);
+}
 
-  printf ("using libnfc %s\n\n", acLibnfcVersion);
+// ---------------------------------------------------------------------------
+// close a reader, and its libnfc context. Its thread must have stopped polling
+//
+void closeNFCreader( nfc_reader *pReader ){
+  if( pReader->pnd != NULL )
+    nfc_close (pReader->pnd);
+  pReader->pnd = NULL;
+  nfc_exit (&pReader->context);
+  pReader->context = NULL;
+}
 
+// ---------------------------------------------------------------------------
+// set the tag types the reader polls for. Pinned, they are polled in the
+// order given every cycle; else that order only breaks ties between types
+// found as often, and the counts start again
+//
+// returns: 0 if OK, else -1 (more than NFC_MAX_MODULATIONS, or none)
+//
+int setNFCmodulations( nfc_reader *pReader, const nfc_modulation *pnm, size_t szCount, bool bPinned ){
+  size_t i;
+
+  if( szCount == 0 || szCount > NFC_MAX_MODULATIONS )
+    return(-1);
+  memcpy( pReader->aModulations, pnm, szCount * sizeof(*pnm) );
+  pReader->szModulations = szCount;
+  pReader->bPinned = bPinned;
+  pReader->uiCycles = 0;
+  for( i=0 ; i < NFC_MAX_MODULATIONS ; i++ )
+    atomic_store (&pReader->auiHits[i], 0);
   return(0);
-} // initNFC
+}
+
+// ---------------------------------------------------------------------------
+// read a site profile: target type names separated by commas, in the order
+// to poll them, e.g. "felica424,14443a". The start of a name will do, and
+// takes every type it starts: "felica" is both baud rates
+//
+// returns: number of types written to anm[], else -1 (unknown name, or too many)
+//
+int parseNFCmodulations( const char *szProfile, nfc_modulation anm[], size_t szMax ){
+  const char *szName = szProfile;
+  size_t szCount = 0, szLen, i, j;
+  bool bKnown;
+
+  while( *szName != '\0' ){
+    szLen = strcspn( szName, "," );
+    bKnown = false;
+    for( i=0 ; szLen > 0 && i < NAMED_MODULATIONS ; i++ ){
+      if( strncasecmp( aNamedModulations[i].szName, szName, szLen ) != 0 )
+        continue;
+      bKnown = true;
+      for( j=0 ; j < szCount ; j++ ){
+        if( anm[j].nmt == aNamedModulations[i].nm.nmt && anm[j].nbr == aNamedModulations[i].nm.nbr )
+          break;    // named twice
+      }
+      if( j < szCount )
+        continue;
+      if( szCount == szMax )
+        return(-1);
+      anm[szCount++] = aNamedModulations[i].nm;
+    }
+    if( !bKnown )
+      return(-1);
+    szName += szLen;
+    if( *szName == ',' )
+      szName++;
+  }
+  return( szCount > 0 ? (int)szCount : -1 );
+}
+
+// ---------------------------------------------------------------------------
+// name of a target type, as in site profiles
+//
+const char *getNFCmodulationName( const nfc_modulation *pnm ){
+  size_t i;
+
+  for( i=0 ; i < NAMED_MODULATIONS ; i++ ){
+    if( aNamedModulations[i].nm.nmt == pnm->nmt && aNamedModulations[i].nm.nbr == pnm->nbr )
+      return( aNamedModulations[i].szName );
+  }
+  return( "?" );
+}
+
+// ---------------------------------------------------------------------------
+// the target types to poll this cycle, in order: those found before, most
+// found first, then - until one is found, and every NFC_PROBE_INTERVAL
+// cycles after - those never found. Called once per cycle
+//
+// returns: number of types written to anm[]
+//
+size_t selectNFCmodulations( nfc_reader *pReader, nfc_modulation anm[] ){
+  uint32_t auiHits[NFC_MAX_MODULATIONS];
+  size_t aszOrder[NFC_MAX_MODULATIONS];
+  size_t szFound = 0, szCount = 0, i, j;
+  uint32_t uiCycle;
+
+  pReader->bProbing = false;
+  if( pReader->bPinned ){
+    memcpy( anm, pReader->aModulations, pReader->szModulations * sizeof(*anm) );
+    return( pReader->szModulations );
+  }
+
+  uiCycle = pReader->uiCycles++;
+  for( i=0 ; i < pReader->szModulations ; i++ ){
+    auiHits[i] = atomic_load (&pReader->auiHits[i]);
+    if( uiCycle > 0 && uiCycle % NFC_HITS_HALF_LIFE == 0 )
+      atomic_store (&pReader->auiHits[i], auiHits[i] / 2);
+    if( auiHits[i] == 0 )
+      continue;
+    // insertion sort, most found first. Ties keep the order given
+    for( j=szFound ; j > 0 && auiHits[aszOrder[j-1]] < auiHits[i] ; j-- )
+      aszOrder[j] = aszOrder[j-1];
+    aszOrder[j] = i;
+    szFound++;
+  }
+  for( i=0 ; i < szFound ; i++ )
+    anm[szCount++] = pReader->aModulations[aszOrder[i]];
+
+  if( szFound == 0 || uiCycle % NFC_PROBE_INTERVAL == 0 ){
+    pReader->bProbing = szCount < pReader->szModulations;
+    for( i=0 ; i < pReader->szModulations ; i++ ){
+      if( auiHits[i] == 0 )
+        anm[szCount++] = pReader->aModulations[i];
+    }
+  }
+  return( szCount );
+}
+
+// ---------------------------------------------------------------------------
+// count a target found, against its type. A FeliCa card may answer at a
+// baud rate the reader wasn't asked for: then it counts for its type
+//
+void noteNFChit( nfc_reader *pReader, const nfc_modulation *pnm ){
+  size_t i, szMatch = pReader->szModulations;
+
+  for( i=0 ; i < pReader->szModulations ; i++ ){
+    if( pReader->aModulations[i].nmt != pnm->nmt )
+      continue;
+    if( pReader->aModulations[i].nbr == pnm->nbr ){
+      szMatch = i;
+      break;
+    }
+    if( szMatch == pReader->szModulations )
+      szMatch = i;
+  }
+  if( szMatch < pReader->szModulations )
+    atomic_fetch_add (&pReader->auiHits[szMatch], 1);
+}
 
 // ---------------------------------------------------------------------------
-// poll NFC device for transactions
-// 
-// returns: result
+// poll the reader for a target, nPolls times nInterval * 150ms per type.
+// With NFC_POLL_ENDLESS the PN532 polls on its own until a target comes -
+// but only one round when probing for types never found, which would
+// slow it down for as long as it waits, and only NFC_PROBE_INTERVAL rounds
+// when they are left out, which would never find them: then the next cycle
+// probes
 //
-int pollNFC( nfc_target *pTarget , int nPolls, int nInterval ){
+// returns: > 0 if a target was found, 0 if not, else < 0 (NFC_EOPABORTED
+//          once the reader has been aborted)
+//
+int pollNFCreader( nfc_reader *pReader, nfc_target *pTarget , int nPolls, int nInterval ){
   int res = 0;
   uint8_t uiPollNr; // number of time to poll
   uint8_t uiPeriod;  // time between polls in 150ms units
-  const nfc_modulation nmModulations[5] = { // list of tag types you will accept
-    { .nmt = NMT_ISO14443A, .nbr = NBR_106 },
-    { .nmt = NMT_ISO14443B, .nbr = NBR_106 },
-    { .nmt = NMT_FELICA, .nbr = NBR_212 },
-    { .nmt = NMT_FELICA, .nbr = NBR_424 },
-    { .nmt = NMT_JEWEL, .nbr = NBR_106 },
-  };
-  const size_t szModulations = 5; // number of tag types in the list
+  nfc_modulation anm[NFC_MAX_MODULATIONS];
+  size_t szModulations;
+  uint64_t ullStartUs;
+
+  if (atomic_load (&pReader->bAborted))
+    return(NFC_EOPABORTED);
 
   uiPollNr = (uint8_t )nPolls;
   uiPeriod = (uint8_t )nInterval;
+  atomic_fetch_add (&pReader->uiPolls, 1);
+  szModulations = selectNFCmodulations( pReader, anm );
+  if( pReader->bProbing && uiPollNr == NFC_POLL_ENDLESS )
+    uiPollNr = 1;
+  else if( uiPollNr == NFC_POLL_ENDLESS && szModulations < pReader->szModulations )
+    uiPollNr = NFC_PROBE_INTERVAL;
 
   // printf ("NFC device will poll for %ld ms (%u pollings of %lu ms for %zd modulations)\n", (unsigned long) (uiPollNr * szModulations * uiPeriod * 150), uiPollNr, (unsigned long) uiPeriod * 150, szModulations);
 
-  if ((res = nfc_initiator_poll_target (pnd, nmModulations, szModulations, uiPollNr, uiPeriod, pTarget))  < 0) {
-    if( res == -90 )
+  ullStartUs = monotonicMicrosecs();
+  res = nfc_initiator_poll_target (pReader->pnd, anm, szModulations, uiPollNr, uiPeriod, pTarget);
+  atomic_fetch_add (&pReader->ullPollUs, monotonicMicrosecs() - ullStartUs);
+  if (res < 0) {
+    if( res == NFC_NO_TARGET ){
       res = 0; // return code signifying no target found - not an error
+      if( nPolls == NFC_POLL_ENDLESS && !pReader->bProbing )
+        pReader->uiCycles += NFC_PROBE_INTERVAL - pReader->uiCycles % NFC_PROBE_INTERVAL;
+    }
+    else if( res == NFC_EOPABORTED || atomic_load (&pReader->bAborted) ){
+      atomic_fetch_add (&pReader->uiAborts, 1);
+      res = NFC_EOPABORTED;
+    }
     else{
-      nfc_perror (pnd, "nfc_initiator_poll_target");
+      atomic_fetch_add (&pReader->uiErrors, 1);
+      nfc_perror (pReader->pnd, "nfc_initiator_poll_target");
       fprintf(stderr,"return value %d\n", res);
-      // nfc_close (pnd);
-      // nfc_exit (NULL);
     }
   }
+  else if( res > 0 ){
+    atomic_fetch_add (&pReader->uiTargets, 1);
+    noteNFChit( pReader, &pTarget->nm );
+  }
   return(res);
-} // pollNFC
+} // pollNFCreader
 
 // ---------------------------------------------------------------------------
-// close NFC device 
+// Internal function - was this card already listed, under another of the
+// reader's target types (e.g. FeliCa at 212 and 424 kbps)?
 //
-void closeNFC( void ){
-  if( pnd != NULL )
-    nfc_close (pnd);
-  nfc_exit (NULL);
-}
+static bool isListed( const nfc_target ant[], size_t szListed, const nfc_target *pnt ){
+  size_t i;
 
+  for( i=0 ; i < szListed ; i++ ){
+    if( sameTarget( &ant[i], pnt ) )
+      return( true );
+  }
+  return( false );
+}
 
 // ---------------------------------------------------------------------------
-// create JSON-encoded nfc_target struct in buffer to send to server
+// Internal function - list the targets of the types given, up to szMax, with
+// none of a poll's bookkeeping: no counts, and nothing learned about the site
 //
-// returns : number of chars written into buffer
+// returns: number of targets written to ant[], else < 0 (NFC_EOPABORTED
+//          once the reader has been aborted)
 //
-int constructJSONstringNFC( const nfc_target nfcTarget, char *szBuffer, int nBufLen ){
-
-  char element[256];
-
-  bzero(szBuffer, nBufLen);
-
-  sprintf(szBuffer, "{" );
-
-  // nfc_modulation_type
-  // and baudRate
-  //
-  switch(nfcTarget.nm.nmt) {
-    case NMT_ISO14443A:
-      sprintf(element, "\"nfcModulationType\":\"%s\"", "ISO/IEC 14443A");
-      strcat(szBuffer, element);
-
-      sprintf(element, ",\"baudRate\":\"%s\"",str_nfc_baud_rate(nfcTarget.nm.nbr) );
-      strcat(szBuffer, element);
-
-      stringify_nfc_iso14443a_info (nfcTarget.nti.nai, element);
-      strcat(szBuffer, element);
-
-    break;
-    case NMT_JEWEL:
-      sprintf(element, "\"nfcModulationType\":\"%s\"", "Innovision Jewel");
-      strcat(szBuffer, element);
-
-      sprintf(element, ",\"baudRate\":\"%s\"",str_nfc_baud_rate(nfcTarget.nm.nbr) );
-      strcat(szBuffer, element);
-
-      //stringify_nfc_jewel_info (nfcTarget.nti.nji, verbose);
-    break;
-    case NMT_FELICA:
-      sprintf(element, "\"nfcModulationType\":\"%s\"", "FeliCa");
-      strcat(szBuffer, element);
-
-      sprintf(element, ",\"baudRate\":\"%s\"",str_nfc_baud_rate(nfcTarget.nm.nbr) );
-      strcat(szBuffer, element);
-
-      //stringify_nfc_felica_info (nfcTarget.nti.nfi, verbose);
-    break;
-    case NMT_ISO14443B:
-      sprintf(element, "\"nfcModulationType\":\"%s\"", "ISO/IEC 14443-4B");
-      strcat(szBuffer, element);
-
-      sprintf(element, ",\"baudRate\":\"%s\"",str_nfc_baud_rate(nfcTarget.nm.nbr) );
-      strcat(szBuffer, element);
-
-      //stringify_nfc_iso14443b_info (nfcTarget.nti.nbi, verbose);
-    break;
-    case NMT_ISO14443BI:
-      sprintf(element, "\"nfcModulationType\":\"%s\"", "ISO/IEC 14443-4Bi");
-      strcat(szBuffer, element);
-
-      sprintf(element, ",\"baudRate\":\"%s\"",str_nfc_baud_rate(nfcTarget.nm.nbr) );
-      strcat(szBuffer, element);
-
-      //stringify_nfc_iso14443bi_info (nfcTarget.nti.nii, verbose);
-    break;
-    case NMT_ISO14443B2SR:
-      sprintf(element, "\"nfcModulationType\":\"%s\"", "ISO/IEC 14443-2B ST SRx");
-      strcat(szBuffer, element);
-
-      sprintf(element, ",\"baudRate\":\"%s\"",str_nfc_baud_rate(nfcTarget.nm.nbr) );
-      strcat(szBuffer, element);
-
-      //stringify_nfc_iso14443b2sr_info (nfcTarget.nti.nsi, verbose);
-    break;
-    case NMT_ISO14443B2CT:
-      sprintf(element, "\"nfcModulationType\":\"%s\"", "ISO/IEC 14443-2B ASK CTx");
-      strcat(szBuffer, element);
-
-      sprintf(element, ",\"baudRate\":\"%s\"",str_nfc_baud_rate(nfcTarget.nm.nbr) );
-      strcat(szBuffer, element);
-
-      //stringify_nfc_iso14443b2ct_info (nfcTarget.nti.nci, verbose);
-    break;
-    case NMT_DEP:
-      
-      sprintf(element, "\"nfcModulationType\":\"%s %s\"", "D.E.P.",
-                       (nfcTarget.nti.ndi.ndm == NDM_ACTIVE)? "active mode" : "passive mode");
-      strcat(szBuffer, element);
-
-      sprintf(element, ",\"baudRate\":\"%s\"",str_nfc_baud_rate(nfcTarget.nm.nbr) );
-      strcat(szBuffer, element);
-
-      //stringify_nfc_dep_info (nfcTarget.nti.ndi, verbose);
-    break;
+static int listTargetsOf( nfc_reader *pReader, const nfc_modulation anm[], size_t szModulations,
+                          nfc_target ant[], size_t szMax ){
+  nfc_target anFound[NFC_MAX_TARGETS];
+  size_t szListed = 0, m;
+  int res, i;
+
+  for( m=0 ; m < szModulations && szListed < szMax ; m++ ){
+    res = nfc_initiator_list_passive_targets (pReader->pnd, anm[m], anFound, szMax - szListed);
+    if( res < 0 ){
+      if( res == NFC_EOPABORTED || atomic_load (&pReader->bAborted) ){
+        atomic_fetch_add (&pReader->uiAborts, 1);
+        return(NFC_EOPABORTED);
+      }
+      if( res == NFC_NO_TARGET )
+        continue;
+      atomic_fetch_add (&pReader->uiErrors, 1);
+      nfc_perror (pReader->pnd, "nfc_initiator_list_passive_targets");
+      return(res);
+    }
+    for( i=0 ; i < res && szListed < szMax ; i++ ){
+      if( !isListed( ant, szListed, &anFound[i] ) )
+        ant[szListed++] = anFound[i];
+    }
   }
-  strcat(szBuffer, "}" );
-  return( strlen(szBuffer) );
+  return((int)szListed);
 }
 
 // ---------------------------------------------------------------------------
-// convert a sequence of bytes into a Hex string
+// read every target in the field, up to szMax: each of the reader's target
+// types is listed in turn, with anticollision, so two cards held together
+// both come back from one cycle. Unlike a poll it doesn't wait for a card
+//
+// returns: number of targets written to ant[], else < 0 (NFC_EOPABORTED
+//          once the reader has been aborted)
+//
+int listNFCtargets( nfc_reader *pReader, nfc_target ant[], size_t szMax ){
+  nfc_modulation anm[NFC_MAX_MODULATIONS];
+  size_t szModulations;
+  uint64_t ullStartUs;
+  int res, i;
+
+  if (atomic_load (&pReader->bAborted))
+    return(NFC_EOPABORTED);
+  atomic_fetch_add (&pReader->uiPolls, 1);
+  if( szMax > NFC_MAX_TARGETS )
+    szMax = NFC_MAX_TARGETS;
+  szModulations = selectNFCmodulations( pReader, anm );
+
+  ullStartUs = monotonicMicrosecs();
+  res = listTargetsOf( pReader, anm, szModulations, ant, szMax );
+  atomic_fetch_add (&pReader->ullPollUs, monotonicMicrosecs() - ullStartUs);
+  if( res < 0 )
+    return(res);
+  for( i=0 ; i < res ; i++ )
+    noteNFChit( pReader, &ant[i].nm );
+  atomic_fetch_add (&pReader->uiTargets, (uint32_t)res);
+  return(res);
+} // listNFCtargets
+
+// ---------------------------------------------------------------------------
+// is a card found before still on the reader? A type A card is selected by
+// its UID, so no other card answers; other types are selected by type, and
+// the card that answers compared. Much less RF time than a poll
 //
+// returns: 1 if it's there, 0 if not, else < 0 (NFC_EOPABORTED once the
+//          reader has been aborted)
+//
+int checkNFCtarget( nfc_reader *pReader, const nfc_target *pnt ){
+  nfc_target nt;
+  const uint8_t *pbtUid = NULL;
+  size_t szUid = 0;
+  int res;
+
+  if (atomic_load (&pReader->bAborted))
+    return(NFC_EOPABORTED);
+  if( pnt->nm.nmt == NMT_ISO14443A )
+    szUid = targetUID( pnt, &pbtUid );
+
+  nfc_initiator_deselect_target (pReader->pnd);
+  if ((res = nfc_initiator_select_passive_target (pReader->pnd, pnt->nm, pbtUid, szUid, &nt)) < 0) {
+    if( res == NFC_NO_TARGET )
+      return(0);
+    if( res == NFC_EOPABORTED || atomic_load (&pReader->bAborted) ){
+      atomic_fetch_add (&pReader->uiAborts, 1);
+      return(NFC_EOPABORTED);
+    }
+    atomic_fetch_add (&pReader->uiErrors, 1);
+    nfc_perror (pReader->pnd, "nfc_initiator_select_passive_target");
+    return(res);
+  }
+  return( res > 0 && sameTarget( pnt, &nt ) ? 1 : 0 );
+} // checkNFCtarget
+
+// ---------------------------------------------------------------------------
+// start following the cards that just arrived at a reader
 //
-void stringifyToHex(char *szBuffer, const uint8_t *pbtData, const size_t szBytes )
-{
-  size_t  szPos;
-  char szElement[4];
-
-  strcpy(szBuffer, "");
-  for (szPos = 0; szPos < szBytes; szPos++){
-    if ( szPos != 0 )
-      strcat(szBuffer,"-");
-    sprintf(szElement, "%02X", pbtData[szPos]); 
-    strcat(szBuffer, szElement);
+void startNFCpresence( nfc_presence *pPresence, const nfc_target ant[], int nCards, uint64_t ullArrivedMs ){
+  int i;
+
+  for( i=0 ; i < nCards && i < NFC_MAX_TARGETS ; i++ ){
+    pPresence->ant[i] = ant[i];
+    pPresence->aullArrivedMs[i] = ullArrivedMs;
+    pPresence->aullSeenMs[i] = ullArrivedMs;
+    pPresence->anMisses[i] = 0;
   }
+  pPresence->nCards = pPresence->nPresent = i;
+  pPresence->uiChecks = 0;
 }
+
 // ---------------------------------------------------------------------------
-// Internal function to JSON-encode the ISO 14443A structure 
+// Internal function - the target types of the cards still followed, each once
 //
-// returns : number of characters written into buffer
+// returns: number of types written to anm[]
 //
-static int stringify_nfc_iso14443a_info (const nfc_iso14443a_info nai, char *szBuffer )
-{
-  char szElement[256];
-  unsigned long ulUID;
+static size_t presenceModulations( const nfc_presence *pPresence, nfc_modulation anm[] ){
+  size_t szModulations = 0, m;
   int i;
 
-  // ATQA (Answer to Request)
-  strcat( szBuffer,",\"ATQA\":\"" );
-  stringifyToHex(szElement, nai.abtAtqa , 2 );
-  strcat( szBuffer, szElement );
-  strcat( szBuffer,"\"" );
- 
-  // UID (Unique Identifier)
-  strcat(szBuffer, ",\"UID\":\"");
-  stringifyToHex(szElement, nai.abtUid, nai.szUidLen );
-
-  strcat( szBuffer, szElement );
-  if ( nai.abtUid[0] == 0x08 )
-    strcat( szBuffer," (Random UID)");
-  strcat(szBuffer, "\"" );
-
-  // ATS (Answer to Select)
-  // TODO if required
-
-  return( strlen( szBuffer) );
+  for( i=0 ; i < pPresence->nCards ; i++ ){
+    if( pPresence->anMisses[i] == NFC_PRESENCE_MISSES )
+      continue;
+    for( m=0 ; m < szModulations ; m++ ){
+      if( anm[m].nmt == pPresence->ant[i].nm.nmt && anm[m].nbr == pPresence->ant[i].nm.nbr )
+        break;
+    }
+    if( m == szModulations && szModulations < NFC_MAX_MODULATIONS )
+      anm[szModulations++] = pPresence->ant[i].nm;
+  }
+  return( szModulations );
 }
 
+// ---------------------------------------------------------------------------
+// one check of the cards followed at a reader, every NFC_PRESENCE_INTERVAL
+// or so. Each card is selected alone (by UID for type A), and has gone after
+// NFC_PRESENCE_MISSES checks without an answer. Every NFC_PRESENCE_LIST
+// checks the types followed are listed too, for cards placed beside them,
+// and every NFC_PRESENCE_PROBE lists of those, all the reader's types. None
+// of it counts as polling, or changes the order types are polled in.
+// Writes a removal for each card gone, with how long it stayed (from
+// arriving to the last check that found it), then an arrival for each new
+// card, which is followed from then on. atx[] has room for
+// 2 * NFC_MAX_TARGETS
+//
+// returns: number of transactions written to atx[], else NFC_EOPABORTED
+//          once the reader has been aborted
+//
+int checkNFCpresence( nfc_reader *pReader, nfc_presence *pPresence, nfc_transaction atx[] ){
+  nfc_target antListed[NFC_MAX_TARGETS];
+  nfc_modulation anm[NFC_MAX_MODULATIONS];
+  size_t szModulations;
+  uint64_t ullNowMs;
+  int nListed = 0, nTx = 0, i, j, res;
+
+  if (atomic_load (&pReader->bAborted))
+    return(NFC_EOPABORTED);
+
+  // the cards followed, each asked for alone
+  for( i=0 ; i < pPresence->nCards ; i++ ){
+    if( pPresence->anMisses[i] == NFC_PRESENCE_MISSES )
+      continue;         // gone already
+    if( (res = checkNFCtarget( pReader, &pPresence->ant[i] )) > 0 ){
+      pPresence->aullSeenMs[i] = monotonicMicrosecs() / 1000;
+      pPresence->anMisses[i] = 0;
+      continue;
+    }
+    if( res < 0 && atomic_load (&pReader->bAborted) )
+      return(NFC_EOPABORTED);
+    if( ++pPresence->anMisses[i] < NFC_PRESENCE_MISSES )
+      continue;
+    memset( &atx[nTx], 0, sizeof(atx[nTx]) );
+    atx[nTx].nt = pPresence->ant[i];
+    atx[nTx].ullDetectedMs = monotonicMicrosecs() / 1000;
+    atx[nTx].btReader = (uint8_t)pReader->nId;
+    atx[nTx].btEvent = NFC_EVENT_REMOVED;
+    atx[nTx++].uiDwellMs = (uint32_t)(pPresence->aullSeenMs[i] - pPresence->aullArrivedMs[i]);
+    pPresence->nPresent--;
+  }
+
+  // now and then, look for cards placed since. An RF error is no card
+  if( pPresence->nPresent > 0 && ++pPresence->uiChecks % NFC_PRESENCE_LIST == 0 ){
+    if( pPresence->uiChecks % (NFC_PRESENCE_LIST * NFC_PRESENCE_PROBE) == 0 )
+      nListed = listTargetsOf( pReader, pReader->aModulations, pReader->szModulations, antListed, NFC_MAX_TARGETS );
+    else {
+      szModulations = presenceModulations( pPresence, anm );
+      nListed = listTargetsOf( pReader, anm, szModulations, antListed, NFC_MAX_TARGETS );
+    }
+    if( nListed < 0 && atomic_load (&pReader->bAborted) )
+      return(NFC_EOPABORTED);
+  }
+  ullNowMs = monotonicMicrosecs() / 1000;
+
+  // cards listed that aren't followed have just arrived. They take the
+  // slot of one gone, else a new one
+  for( j=0 ; j < nListed ; j++ ){
+    for( i=0 ; i < pPresence->nCards ; i++ ){
+      if( pPresence->anMisses[i] < NFC_PRESENCE_MISSES && sameTarget( &pPresence->ant[i], &antListed[j] ) )
+        break;
+    }
+    if( i < pPresence->nCards )
+      continue;         // followed already
+    for( i=0 ; i < pPresence->nCards && pPresence->anMisses[i] < NFC_PRESENCE_MISSES ; i++ )
+      ;
+    if( i == NFC_MAX_TARGETS )
+      break;
+    if( i == pPresence->nCards )
+      pPresence->nCards++;
+    pPresence->ant[i] = antListed[j];
+    pPresence->aullArrivedMs[i] = pPresence->aullSeenMs[i] = ullNowMs;
+    pPresence->anMisses[i] = 0;
+    pPresence->nPresent++;
+    memset( &atx[nTx], 0, sizeof(atx[nTx]) );
+    atx[nTx].nt = antListed[j];
+    atx[nTx].ullDetectedMs = ullNowMs;
+    atx[nTx].btReader = (uint8_t)pReader->nId;
+    atx[nTx++].btEvent = NFC_EVENT_ARRIVED;
+  }
+  return( nTx );
+} // checkNFCpresence
+
+// ---------------------------------------------------------------------------
+// cancel the reader's poll in progress, and any after it. Safe to call from
+// a signal handler or another thread
+//
+void abortNFCreader( nfc_reader *pReader ){
+  atomic_store (&pReader->bAborted, true);
+  if (pReader->pnd != NULL)
+    nfc_abort_command (pReader->pnd);
+}
+
+// ---------------------------------------------------------------------------
+// name of the reader's device, for logs
+//
+const char *getNFCreaderName( nfc_reader *pReader ){
+  return( pReader->pnd != NULL ? nfc_device_get_name (pReader->pnd) : "closed" );
+}
+
+// ---------------------------------------------------------------------------
+// version of libnfc in use
+//
+const char *getNFCversion( void ){
+  return( nfc_version () );
+}
@@ -1,16 +1,87 @@
-
 /*
  * @file nfc_driver.h
  * @brief Public Interface to nfc_driver.c
  *
  * @author Robert Drummond
- * Copyright (c) 2013 Pink Pelican NZ Ltd <bob@pink-pelican.com> 
+ * Copyright (c) 2013 Pink Pelican NZ Ltd <bob@pink-pelican.com>
  */
+#ifndef _NFC_DRIVER_H_
+#define _NFC_DRIVER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
 
 #include "nfc-types.h"
 
+// Definitions
+#define MAX_DEVICE_COUNT    16      // readers opened at most
+#define NFC_MAX_MODULATIONS  8      // target types a reader polls for
+#define NFC_MAX_TARGETS      8      // targets listed in one cycle at most
+#define NFC_PROBE_INTERVAL  16      // cycles between probes of target types never seen
+#define NFC_POLL_ENDLESS  0xFF      // nPolls: poll until a target comes, or the poll is aborted
+#define NFC_PRESENCE_MISSES  2      // a card followed has gone after 2 checks without it
+#define NFC_PRESENCE_LIST    5      // every 5th check lists the types followed, for cards placed beside them
+#define NFC_PRESENCE_PROBE   4      // and every 4th of those lists all the reader's types
+
+// a detected target, as queued between the NFC poller and the uplink
+typedef struct {
+  nfc_target nt;
+  uint64_t   ullDetectedMs;     // monotonic time the target was detected
+  uint8_t    btReader;          // which reader, numbered from 0
+  uint8_t    btEvent;           // NFC_EVENT_... of nfc_record.h, with presence tracking
+  uint32_t   uiDwellMs;         // how long the card stayed, with NFC_EVENT_REMOVED
+} nfc_transaction;
+
+// the cards at a reader followed by checkNFCpresence(), until they have all gone
+typedef struct {
+  nfc_target ant[NFC_MAX_TARGETS];
+  uint64_t   aullArrivedMs[NFC_MAX_TARGETS];
+  uint64_t   aullSeenMs[NFC_MAX_TARGETS];   // the last check that found it
+  int        anMisses[NFC_MAX_TARGETS];     // NFC_PRESENCE_MISSES once it has gone
+  int        nCards;                        // slots used, gone or not
+  int        nPresent;
+  uint32_t   uiChecks;
+} nfc_presence;
+
+// An open NFC reader. Everything about it is in here, so readers can be
+// polled from threads of their own; each is polled from one thread only
+typedef struct {
+  nfc_context     context;      // libnfc's state, for this reader alone
+  nfc_device     *pnd;          // NULL if not open
+  int             nId;          // number the records are tagged with
+  nfc_modulation  aModulations[NFC_MAX_MODULATIONS];  // target types polled for
+  size_t          szModulations;
+  bool            bPinned;      // poll them in the order given, every cycle
+  uint32_t        uiCycles;     // for the background probes
+  bool            bProbing;     // this cycle tries the types never found too
+  atomic_bool     bAborted;     // set by abortNFCreader(): polls fail at once
+
+  // counters
+  _Atomic uint32_t uiPolls;
+  _Atomic uint32_t uiTargets;
+  _Atomic uint32_t uiErrors;
+  _Atomic uint32_t uiAborts;
+  _Atomic uint32_t auiHits[NFC_MAX_MODULATIONS];      // targets found, by type. decays
+  _Atomic uint64_t ullPollUs;   // time spent polling, for the mean cycle time
+} nfc_reader;
+
 // Function prototypes
-int  initNFC( void );
-int  pollNFC( nfc_target *nt , int nPolls, int nInterval );
-void closeNFC( void );
-int  constructJSONstringNFC( const nfc_target nfcTarget, char *szBuffer, int nBufLen );
+size_t listNFCreaders( nfc_connstring aConnstrings[], size_t szMax );
+int  openNFCreader( nfc_reader *pReader, int nId, const char *szConnstring );
+void closeNFCreader( nfc_reader *pReader );
+int  setNFCmodulations( nfc_reader *pReader, const nfc_modulation *pnm, size_t szCount, bool bPinned );
+int  parseNFCmodulations( const char *szProfile, nfc_modulation anm[], size_t szMax );
+const char *getNFCmodulationName( const nfc_modulation *pnm );
+size_t selectNFCmodulations( nfc_reader *pReader, nfc_modulation anm[] );
+void noteNFChit( nfc_reader *pReader, const nfc_modulation *pnm );
+int  pollNFCreader( nfc_reader *pReader, nfc_target *pnt, int nPolls, int nInterval );
+int  listNFCtargets( nfc_reader *pReader, nfc_target ant[], size_t szMax );
+int  checkNFCtarget( nfc_reader *pReader, const nfc_target *pnt );
+void startNFCpresence( nfc_presence *pPresence, const nfc_target ant[], int nCards, uint64_t ullArrivedMs );
+int  checkNFCpresence( nfc_reader *pReader, nfc_presence *pPresence, nfc_transaction atx[] );
+void abortNFCreader( nfc_reader *pReader );
+const char *getNFCreaderName( nfc_reader *pReader );
+const char *getNFCversion( void );
+
+#endif // _NFC_DRIVER_H_
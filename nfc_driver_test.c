@@ -20,11 +20,72 @@
 #include <string.h>
 
 #include "nfc-types.h"
+#include "nfc-utils.h"
 
 #include "nfc_driver.h"
+#include "nfc_encode.h"
+#include "unit_test.h"
 
 #define BUFSIZE 256
 
+// ---------------------------------------------------------------------------
+// standalone test of site profiles, and of the target types polled each
+// cycle as the reader learns what its site sees. No NFC device needed
+//
+void testModulations( void ){
+  nfc_reader reader;
+  nfc_modulation anm[NFC_MAX_MODULATIONS], anmFound = { .nmt = NMT_FELICA, .nbr = NBR_424 };
+  size_t sz;
+  int i;
+
+  CHECK( parseNFCmodulations( "felica424,14443A", anm, NFC_MAX_MODULATIONS ) == 2 );
+  CHECK( anm[0].nmt == NMT_FELICA && anm[0].nbr == NBR_424 && anm[1].nmt == NMT_ISO14443A );
+  CHECK( parseNFCmodulations( "felica,14443,felica212", anm, NFC_MAX_MODULATIONS ) == 4 );
+  CHECK( anm[1].nbr == NBR_424 && anm[3].nmt == NMT_ISO14443B );
+  CHECK( parseNFCmodulations( "14443a,mifare", anm, NFC_MAX_MODULATIONS ) == -1 );
+  CHECK( parseNFCmodulations( "", anm, NFC_MAX_MODULATIONS ) == -1 );
+  CHECK( parseNFCmodulations( "felica", anm, 1 ) == -1 );
+  CHECK( strcmp( getNFCmodulationName( &anmFound ), "felica424" ) == 0 );
+
+  // all five types, in the default order, until a card is found
+  memset( &reader, 0, sizeof(reader) );
+  CHECK( parseNFCmodulations( "14443a,14443b,felica,jewel", anm, NFC_MAX_MODULATIONS ) == 5 );
+  CHECK( setNFCmodulations( &reader, anm, 5, false ) == 0 );
+  CHECK( selectNFCmodulations( &reader, anm ) == 5 && anm[0].nmt == NMT_ISO14443A );
+  CHECK( selectNFCmodulations( &reader, anm ) == 5 );
+
+  // then the types found, most found first. The rest are probed now and then
+  noteNFChit( &reader, &anmFound );
+  noteNFChit( &reader, &anmFound );
+  anmFound.nmt = NMT_ISO14443A;
+  anmFound.nbr = NBR_106;
+  noteNFChit( &reader, &anmFound );
+  CHECK( (sz = selectNFCmodulations( &reader, anm )) == 2 );
+  CHECK( anm[0].nmt == NMT_FELICA && anm[0].nbr == NBR_424 && anm[1].nmt == NMT_ISO14443A );
+  for( i=3 ; i < NFC_PROBE_INTERVAL ; i++ )
+    CHECK( selectNFCmodulations( &reader, anm ) == 2 );
+  CHECK( selectNFCmodulations( &reader, anm ) == 5 && anm[2].nmt == NMT_ISO14443B );
+
+  // a FeliCa card answering at 212 kbps when polled at 424 still counts
+  anmFound.nmt = NMT_FELICA;
+  anmFound.nbr = NBR_212;
+  noteNFChit( &reader, &anmFound );
+  CHECK( atomic_load( &reader.auiHits[2] ) == 1 );
+
+  // a type not found for a while drops out again: the counts have halved
+  while( reader.uiCycles <= 1024 )
+    selectNFCmodulations( &reader, anm );
+  CHECK( selectNFCmodulations( &reader, anm ) == 1 && anm[0].nbr == NBR_424 );
+
+  // pinned, the profile is polled as given
+  CHECK( setNFCmodulations( &reader, anm, 1, true ) == 0 );
+  CHECK( parseNFCmodulations( "jewel,14443b", anm, NFC_MAX_MODULATIONS ) == 2 );
+  CHECK( setNFCmodulations( &reader, anm, 2, true ) == 0 );
+  noteNFChit( &reader, &anm[1] );
+  CHECK( selectNFCmodulations( &reader, anm ) == 2 && anm[0].nmt == NMT_JEWEL );
+  CHECK( setNFCmodulations( &reader, anm, NFC_MAX_MODULATIONS + 1, true ) == -1 );
+}
+
 // ===========================================================================
 // main
 //
@@ -34,26 +95,38 @@ int main (int argc, const char *argv[])
   int res = 0;
   int n;
   char buffer[BUFSIZE];
+  nfc_connstring aConnstrings[MAX_DEVICE_COUNT];
+  nfc_reader reader;
 
   if (argc != 1) {
     if ((argc == 2) && (0 == strcmp ("-nv", argv[1]))) {
       verbose = true;
+    } else if ((argc == 2) && (0 == strcmp ("-m", argv[1]))) {
+      testModulations();
+      if( nFailures ){
+        printf("%d check(s) FAILED\n", nFailures );
+        exit( EXIT_FAILURE );
+      }
+      printf("all target type tests passed\n");
+      exit( EXIT_SUCCESS );
     } else {
-      printf ("usage: %s [-v]\n", argv[0]);
+      printf ("usage: %s [-v] [-m]\n", argv[0]);
       printf ("  -nv\t not verbose display\n");
+      printf ("  -m\t standalone test of target type profiles and ordering\n");
       exit (EXIT_FAILURE);
     }
   }
 
   
-  if( initNFC() < 0) {
+  // the first reader found, else libnfc's default
+  if( openNFCreader( &reader, 0, listNFCreaders( aConnstrings, MAX_DEVICE_COUNT ) > 0 ? aConnstrings[0] : NULL ) < 0) {
     exit(EXIT_FAILURE);
   }
   if ( verbose )
     printf("NFC device Initialized successfully.");
 
   nfc_target nt;
-  res = pollNFC( &nt, 20, 2 ); // do 20 polls at 2s intervals
+  res = pollNFCreader( &reader, &nt, 20, 2 ); // do 20 polls at 2s intervals
 
   // display results from NFC target device
   if (res > 0) {
@@ -70,6 +143,6 @@ int main (int argc, const char *argv[])
   }
 
   // close NFC device and end program
-  closeNFC();
+  closeNFCreader( &reader );
   exit (EXIT_SUCCESS);
 }
@@ -0,0 +1,423 @@
+/*
+ * @file nfc_encode.c
+ * @brief Encoding detected NFC targets for the server
+ *
+ * kept apart from nfc_driver.c so it needs no NFC device, and can be
+ * tested and benchmarked anywhere
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__ARM_NEON) && !defined(NFC_HEX_NO_SIMD)
+#  include <arm_neon.h>
+#  define HEX_NEON
+#elif defined(__SSE2__) && !defined(NFC_HEX_NO_SIMD)
+#  include <emmintrin.h>
+#  define HEX_SSE2
+#endif
+
+#include "nfc-types.h"
+#include "nfc-utils.h"
+
+#include "nfc_encode.h"
+#include "nfc_record.h"
+
+// the binary format sends libnfc's enum values as they are
+_Static_assert( NMT_ISO14443A == NFC_MOD_ISO14443A && NMT_JEWEL == NFC_MOD_JEWEL &&
+                NMT_ISO14443B == NFC_MOD_ISO14443B && NMT_ISO14443BI == NFC_MOD_ISO14443BI &&
+                NMT_ISO14443B2SR == NFC_MOD_ISO14443B2SR && NMT_ISO14443B2CT == NFC_MOD_ISO14443B2CT &&
+                NMT_FELICA == NFC_MOD_FELICA && NMT_DEP == NFC_MOD_DEP, "modulation numbering" );
+_Static_assert( NBR_UNDEFINED == NFC_BAUD_UNDEFINED && NBR_106 == NFC_BAUD_106 &&
+                NBR_212 == NFC_BAUD_212 && NBR_424 == NFC_BAUD_424 && NBR_847 == NFC_BAUD_847,
+                "baud rate numbering" );
+_Static_assert( NDM_PASSIVE == NFC_DEP_PASSIVE && NDM_ACTIVE == NFC_DEP_ACTIVE, "D.E.P. mode numbering" );
+
+// Definitions
+#define JSON_HEX_SEPARATOR '-'  // between the bytes of ATQA, UID and ATS
+
+// the two hex digits of every byte value, in memory order
+static const char acHexPairs[256][2] = {
+#define HEX_ROW(h) \
+  {h,'0'},{h,'1'},{h,'2'},{h,'3'},{h,'4'},{h,'5'},{h,'6'},{h,'7'}, \
+  {h,'8'},{h,'9'},{h,'A'},{h,'B'},{h,'C'},{h,'D'},{h,'E'},{h,'F'}
+  HEX_ROW('0'), HEX_ROW('1'), HEX_ROW('2'), HEX_ROW('3'),
+  HEX_ROW('4'), HEX_ROW('5'), HEX_ROW('6'), HEX_ROW('7'),
+  HEX_ROW('8'), HEX_ROW('9'), HEX_ROW('A'), HEX_ROW('B'),
+  HEX_ROW('C'), HEX_ROW('D'), HEX_ROW('E'), HEX_ROW('F')
+#undef HEX_ROW
+};
+
+// a cursor writing into a caller's buffer. Everything is appended in one
+// pass; once something doesn't fit, the rest is dropped and bTruncated is set
+typedef struct {
+  char *pCur;
+  char *pEnd;           // last byte of the buffer, kept for the terminating NUL
+  bool  bTruncated;
+} json_writer;
+
+// ---------------------------------------------------------------------------
+// Internal function - start writing at szBuffer
+//
+static void initWriter( json_writer *pW, char *szBuffer, int nBufLen ){
+  if( nBufLen < 1 ){   // not even room for the NUL
+    pW->pCur = pW->pEnd = NULL;
+    pW->bTruncated = true;
+    return;
+  }
+  pW->pCur = szBuffer;
+  pW->pEnd = szBuffer + nBufLen - 1;
+  pW->bTruncated = false;
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - append szLen bytes
+//
+static void writeBytes( json_writer *pW, const char *pData, size_t szLen ){
+  if( pW->bTruncated || szLen > (size_t)(pW->pEnd - pW->pCur) ){
+    pW->bTruncated = true;
+    return;
+  }
+  memcpy( pW->pCur, pData, szLen );
+  pW->pCur += szLen;
+}
+
+// append a string literal, without measuring it at run time
+#define writeLiteral(pW, s)   writeBytes( (pW), (s), sizeof(s) - 1 )
+
+// ---------------------------------------------------------------------------
+// Internal function - append a string. The values written here are fixed
+// names and hex digits, so nothing needs escaping
+//
+static void writeString( json_writer *pW, const char *sz ){
+  writeBytes( pW, sz, strlen( sz ) );
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - append bytes as hex digits, e.g. 04-A2-1B
+//
+static void writeHex( json_writer *pW, const uint8_t *pbtData, size_t szBytes ){
+  if( pW->bTruncated || hexLength( szBytes, JSON_HEX_SEPARATOR ) > (size_t)(pW->pEnd - pW->pCur) ){
+    pW->bTruncated = true;
+    return;
+  }
+  pW->pCur += encodeHex( pW->pCur, pbtData, szBytes, JSON_HEX_SEPARATOR );
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - finish with a NUL
+//
+// returns : number of characters written, else -1 if they didn't all fit
+//
+static int finishWriter( json_writer *pW, char *szBuffer ){
+  if( pW->pCur != NULL )
+    *pW->pCur = '\0';
+  return( pW->bTruncated ? -1 : (int)(pW->pCur - szBuffer) );
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - the "nfcModulationType" value of a target
+//
+// returns : name, else NULL if the modulation type is unknown
+//
+static const char *modulationName( const nfc_target *pnt ){
+  switch( pnt->nm.nmt ) {
+    case NMT_ISO14443A:    return( "ISO/IEC 14443A" );
+    case NMT_JEWEL:        return( "Innovision Jewel" );
+    case NMT_FELICA:       return( "FeliCa" );
+    case NMT_ISO14443B:    return( "ISO/IEC 14443-4B" );
+    case NMT_ISO14443BI:   return( "ISO/IEC 14443-4Bi" );
+    case NMT_ISO14443B2SR: return( "ISO/IEC 14443-2B ST SRx" );
+    case NMT_ISO14443B2CT: return( "ISO/IEC 14443-2B ASK CTx" );
+    case NMT_DEP:
+      return( (pnt->nti.ndi.ndm == NDM_ACTIVE) ? "D.E.P. active mode" : "D.E.P. passive mode" );
+  }
+  return( NULL );
+}
+
+// ---------------------------------------------------------------------------
+// Internal function to JSON-encode the ISO 14443A structure 
+//
+static void stringify_nfc_iso14443a_info( json_writer *pW, const nfc_iso14443a_info *pnai )
+{
+  // ATQA (Answer to Request)
+  writeLiteral( pW, ",\"ATQA\":\"" );
+  writeHex( pW, pnai->abtAtqa, 2 );
+ 
+  // UID (Unique Identifier)
+  writeLiteral( pW, "\",\"UID\":\"" );
+  writeHex( pW, pnai->abtUid, pnai->szUidLen );
+  if ( pnai->abtUid[0] == 0x08 )
+    writeLiteral( pW, " (Random UID)" );
+  writeLiteral( pW, "\"" );
+
+  // ATS (Answer to Select), if the card is ISO 14443-4 compliant
+  if( pnai->szAtsLen > 0 ){
+    writeLiteral( pW, ",\"ATS\":\"" );
+    writeHex( pW, pnai->abtAts, pnai->szAtsLen );
+    writeLiteral( pW, "\"" );
+  }
+}
+
+// ---------------------------------------------------------------------------
+// create JSON-encoded nfc_target struct in buffer to send to server
+//
+// returns : number of chars written into buffer, else -1 if nBufLen is too
+//           small (the buffer then holds as much as fitted, NUL-terminated)
+//
+int constructJSONstringNFC( const nfc_target nfcTarget, char *szBuffer, int nBufLen ){
+  json_writer w;
+  const char *szModulation = modulationName( &nfcTarget );
+
+  initWriter( &w, szBuffer, nBufLen );
+  writeLiteral( &w, "{" );
+
+  if( szModulation != NULL ){
+    // nfc_modulation_type and baudRate
+    writeLiteral( &w, "\"nfcModulationType\":\"" );
+    writeString( &w, szModulation );
+    writeLiteral( &w, "\",\"baudRate\":\"" );
+    writeString( &w, str_nfc_baud_rate( nfcTarget.nm.nbr ) );
+    writeLiteral( &w, "\"" );
+
+    // the other target types aren't encoded yet, see print_nfc_target()
+    if( nfcTarget.nm.nmt == NMT_ISO14443A )
+      stringify_nfc_iso14443a_info( &w, &nfcTarget.nti.nai );
+  }
+
+  writeLiteral( &w, "}" );
+  return( finishWriter( &w, szBuffer ) );
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - append a tag-length-value field
+//
+static uint8_t *putField( uint8_t *p, uint8_t btTag, const uint8_t *pbtValue, size_t szLen ){
+  p[0] = btTag;
+  p[1] = (uint8_t)szLen;
+  memcpy( p + 2, pbtValue, szLen );
+  return( p + 2 + szLen );
+}
+
+// ---------------------------------------------------------------------------
+// create a binary record of the nfc_target struct in buffer to send to
+// server, in the format of nfc_record.h. The seq is left 0, for
+// stampNFCrecordSeq()
+//
+// returns : number of bytes written into buffer, else -1 if nBufLen is too small
+//
+int constructBinaryRecordNFC( const nfc_target *pnt, uint8_t *pbtBuffer, int nBufLen ){
+  const nfc_iso14443a_info *pnai = &pnt->nti.nai;
+  uint8_t *p = pbtBuffer + NFC_RECORD_HEADER_SIZE;
+  uint8_t bt;
+  size_t szLen;
+
+  // header, modulation and baud rate, then the fields of the target type
+  szLen = NFC_RECORD_HEADER_SIZE + 3 + 3;
+  if( pnt->nm.nmt == NMT_ISO14443A ){
+    // only a type A target has these: the union holds another type's info
+    if( pnai->szUidLen > sizeof(pnai->abtUid) || pnai->szAtsLen > sizeof(pnai->abtAts) )
+      return( -1 );
+    szLen += 4 + 3 + 2 + pnai->szUidLen + (pnai->szAtsLen ? 2 + pnai->szAtsLen : 0);
+  }
+  else if( pnt->nm.nmt == NMT_DEP )
+    szLen += 3;
+  if( nBufLen < 0 || szLen > (size_t)nBufLen )
+    return( -1 );
+
+  bt = (uint8_t)pnt->nm.nmt;
+  p = putField( p, NFC_TAG_MODULATION, &bt, 1 );
+  bt = (uint8_t)pnt->nm.nbr;
+  p = putField( p, NFC_TAG_BAUD, &bt, 1 );
+
+  switch( pnt->nm.nmt ){
+    case NMT_ISO14443A:
+      p = putField( p, NFC_TAG_ATQA, pnai->abtAtqa, 2 );
+      p = putField( p, NFC_TAG_SAK, &pnai->btSak, 1 );
+      p = putField( p, NFC_TAG_UID, pnai->abtUid, pnai->szUidLen );
+      if( pnai->szAtsLen > 0 )
+        p = putField( p, NFC_TAG_ATS, pnai->abtAts, pnai->szAtsLen );
+      break;
+    case NMT_DEP:
+      bt = (uint8_t)pnt->nti.ndi.ndm;
+      p = putField( p, NFC_TAG_DEP_MODE, &bt, 1 );
+      break;
+    default:    // the other target types aren't encoded yet, as in the JSON
+      break;
+  }
+
+  szLen = p - pbtBuffer;
+  pbtBuffer[0] = NFC_RECORD_MAGIC;
+  pbtBuffer[1] = NFC_RECORD_VERSION;
+  pbtBuffer[2] = (uint8_t)(szLen >> 8);
+  pbtBuffer[3] = (uint8_t)szLen;
+  stampNFCrecordSeq( pbtBuffer, 0 );
+  return( (int)szLen );
+}
+
+// ---------------------------------------------------------------------------
+// find the bytes that identify the card: the UID, or what its type has in
+// its place (FeliCa IDm, type B PUPI, NFCID3...)
+//
+// returns : number of bytes at *ppbtUid, 0 if the target has none
+//
+size_t targetUID( const nfc_target *pnt, const uint8_t **ppbtUid ){
+  const nfc_target_info *pnti = &pnt->nti;
+
+  switch( pnt->nm.nmt ){
+    case NMT_ISO14443A:
+      *ppbtUid = pnti->nai.abtUid;
+      return( pnti->nai.szUidLen <= sizeof(pnti->nai.abtUid) ? pnti->nai.szUidLen : 0 );
+    case NMT_JEWEL:
+      *ppbtUid = pnti->nji.btId;
+      return( sizeof(pnti->nji.btId) );
+    case NMT_ISO14443B:
+      *ppbtUid = pnti->nbi.abtPupi;
+      return( sizeof(pnti->nbi.abtPupi) );
+    case NMT_ISO14443BI:
+      *ppbtUid = pnti->nii.abtDIV;
+      return( sizeof(pnti->nii.abtDIV) );
+    case NMT_ISO14443B2SR:
+      *ppbtUid = pnti->nsi.abtUID;
+      return( sizeof(pnti->nsi.abtUID) );
+    case NMT_ISO14443B2CT:
+      *ppbtUid = pnti->nci.abtUID;
+      return( sizeof(pnti->nci.abtUID) );
+    case NMT_FELICA:
+      *ppbtUid = pnti->nfi.abtId;
+      return( sizeof(pnti->nfi.abtId) );
+    case NMT_DEP:
+      *ppbtUid = pnti->ndi.abtNFCID3;
+      return( sizeof(pnti->ndi.abtNFCID3) );
+    default:
+      *ppbtUid = NULL;
+      return( 0 );
+  }
+}
+
+// ---------------------------------------------------------------------------
+// are two targets the same card? Of the same type, with the same UID. A
+// target without one is like no other
+//
+bool sameTarget( const nfc_target *pnt1, const nfc_target *pnt2 ){
+  const uint8_t *pbtUid1, *pbtUid2;
+  size_t szUid;
+
+  if( pnt1->nm.nmt != pnt2->nm.nmt || (szUid = targetUID( pnt1, &pbtUid1 )) == 0 )
+    return( false );
+  return( targetUID( pnt2, &pbtUid2 ) == szUid && memcmp( pbtUid1, pbtUid2, szUid ) == 0 );
+}
+
+// ---------------------------------------------------------------------------
+// number of characters encodeHex() writes for szBytes bytes
+//
+size_t hexLength( size_t szBytes, char cSeparator ){
+  if( szBytes == 0 )
+    return( 0 );
+  return( cSeparator ? 3 * szBytes - 1 : 2 * szBytes );
+}
+
+// ---------------------------------------------------------------------------
+// encode bytes as upper case hex digits, with cSeparator between the bytes
+// ('\0' for none). One table lookup per byte. Writes no NUL.
+// pOut must have room for hexLength( szBytes, cSeparator ) characters
+//
+// returns : number of characters written
+//
+size_t encodeHexScalar( char *pOut, const uint8_t *pbtData, size_t szBytes, char cSeparator )
+{
+  char *p = pOut;
+  size_t szPos;
+
+  if( szBytes == 0 )
+    return( 0 );
+
+  if( cSeparator ){
+    for( szPos = 0 ; szPos < szBytes - 1 ; szPos++ ){
+      memcpy( p, acHexPairs[pbtData[szPos]], 2 );
+      p[2] = cSeparator;
+      p += 3;
+    }
+  } else {
+    for( szPos = 0 ; szPos < szBytes - 1 ; szPos++, p += 2 )
+      memcpy( p, acHexPairs[pbtData[szPos]], 2 );
+  }
+  memcpy( p, acHexPairs[pbtData[szBytes - 1]], 2 );
+  return( p + 2 - pOut );
+}
+
+// ---------------------------------------------------------------------------
+// as encodeHexScalar(), but 16 bytes at a time with NEON (both with and
+// without a separator) or SSE2 (without a separator only). Long inputs like
+// the ATS benefit; a UID is shorter than one vector and takes the table path
+//
+// returns : number of characters written
+//
+size_t encodeHex( char *pOut, const uint8_t *pbtData, size_t szBytes, char cSeparator )
+{
+  size_t szPos = 0;
+  char *p = pOut;
+
+#if defined(HEX_NEON)
+  const uint8x16_t vNine = vdupq_n_u8( 9 ), vSeven = vdupq_n_u8( 7 ), vZero = vdupq_n_u8( '0' );
+  uint8x16x2_t vPairs;
+  uint8x16x3_t vTriples;
+  uint8x16_t v;
+
+  // all but the last byte, so the separator after each vector is wanted
+  for( ; szPos + 16 < szBytes ; szPos += 16 ){
+    v = vld1q_u8( pbtData + szPos );
+    vPairs.val[0] = vshrq_n_u8( v, 4 );
+    vPairs.val[1] = vandq_u8( v, vdupq_n_u8( 0x0F ) );
+    // digit = nibble + '0', + 7 more for A..F
+    vPairs.val[0] = vaddq_u8( vaddq_u8( vPairs.val[0], vZero ), vandq_u8( vcgtq_u8( vPairs.val[0], vNine ), vSeven ) );
+    vPairs.val[1] = vaddq_u8( vaddq_u8( vPairs.val[1], vZero ), vandq_u8( vcgtq_u8( vPairs.val[1], vNine ), vSeven ) );
+    if( cSeparator ){
+      vTriples.val[0] = vPairs.val[0];
+      vTriples.val[1] = vPairs.val[1];
+      vTriples.val[2] = vdupq_n_u8( (uint8_t)cSeparator );
+      vst3q_u8( (uint8_t *)p, vTriples );
+      p += 48;
+    } else {
+      vst2q_u8( (uint8_t *)p, vPairs );
+      p += 32;
+    }
+  }
+#elif defined(HEX_SSE2)
+  const __m128i vMask = _mm_set1_epi8( 0x0F ), vNine = _mm_set1_epi8( 9 );
+  const __m128i vSeven = _mm_set1_epi8( 7 ), vZero = _mm_set1_epi8( '0' );
+  __m128i v, vHi, vLo;
+
+  if( !cSeparator ){
+    for( ; szPos + 16 <= szBytes ; szPos += 16, p += 32 ){
+      v = _mm_loadu_si128( (const __m128i *)(pbtData + szPos) );
+      vHi = _mm_and_si128( _mm_srli_epi16( v, 4 ), vMask );
+      vLo = _mm_and_si128( v, vMask );
+      // digit = nibble + '0', + 7 more for A..F
+      vHi = _mm_add_epi8( _mm_add_epi8( vHi, vZero ), _mm_and_si128( _mm_cmpgt_epi8( vHi, vNine ), vSeven ) );
+      vLo = _mm_add_epi8( _mm_add_epi8( vLo, vZero ), _mm_and_si128( _mm_cmpgt_epi8( vLo, vNine ), vSeven ) );
+      _mm_storeu_si128( (__m128i *)p, _mm_unpacklo_epi8( vHi, vLo ) );
+      _mm_storeu_si128( (__m128i *)(p + 16), _mm_unpackhi_epi8( vHi, vLo ) );
+    }
+  }
+#endif
+
+  if( szPos < szBytes )
+    p += encodeHexScalar( p, pbtData + szPos, szBytes - szPos, cSeparator );
+  return( p - pOut );
+}
+
+// ---------------------------------------------------------------------------
+// convert a sequence of bytes into a Hex string, e.g. 04-A2-1B.
+// szBuffer must have room for 3 * szBytes characters
+//
+// returns : length of the string, not counting its NUL
+//
+size_t stringifyToHex( char *szBuffer, const uint8_t *pbtData, const size_t szBytes )
+{
+  size_t szLen = encodeHex( szBuffer, pbtData, szBytes, '-' );
+
+  szBuffer[szLen] = '\0';
+  return( szLen );
+}
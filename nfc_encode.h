@@ -0,0 +1,24 @@
+/*
+ * @file nfc_encode.h
+ * @brief Public Interface to nfc_encode.c
+ */
+#ifndef _NFC_ENCODE_H_
+#define _NFC_ENCODE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nfc-types.h"
+
+// Function prototypes
+int    constructJSONstringNFC( const nfc_target nfcTarget, char *szBuffer, int nBufLen );
+int    constructBinaryRecordNFC( const nfc_target *pnt, uint8_t *pbtBuffer, int nBufLen );
+size_t targetUID( const nfc_target *pnt, const uint8_t **ppbtUid );
+bool   sameTarget( const nfc_target *pnt1, const nfc_target *pnt2 );
+size_t stringifyToHex( char *szBuffer, const uint8_t *pbtData, const size_t szBytes );
+size_t hexLength( size_t szBytes, char cSeparator );
+size_t encodeHex( char *pOut, const uint8_t *pbtData, size_t szBytes, char cSeparator );
+size_t encodeHexScalar( char *pOut, const uint8_t *pbtData, size_t szBytes, char cSeparator );
+
+#endif // _NFC_ENCODE_H_
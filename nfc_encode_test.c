@@ -0,0 +1,365 @@
+/*
+ * @file nfc_encode_test.c
+ * @brief unit test for nfc_encode.c
+ *
+ * runs standalone - no NFC device needed. Also times constructJSONstringNFC()
+ * against the sprintf/strcat encoder it replaced.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "nfc-types.h"
+#include "nfc-utils.h"
+
+#include "nfc_encode.h"
+#include "unit_test.h"
+
+#define BUFSIZE         1024
+#define BENCH_ENCODES   1000000
+#define BENCH_HEX_BYTES 10000000        // bytes hex-encoded per size in the benchmark
+#define UID_SIZE        7
+#define ATS_SIZE        254             // the largest an ATS can be
+#define FRAME_SIZE      264             // the largest PN53x frame
+
+// ---------------------------------------------------------------------------
+// a MIFARE Classic 1K card, as in white.output.txt
+//
+void makeMifare( nfc_target *pnt ){
+    static const uint8_t abtUid[] = { 0x04, 0x93, 0x2A, 0x1A, 0x3E, 0x2B, 0x80 };
+
+    memset( pnt, 0, sizeof(*pnt) );
+    pnt->nm.nmt = NMT_ISO14443A;
+    pnt->nm.nbr = NBR_106;
+    pnt->nti.nai.abtAtqa[1] = 0x44;
+    pnt->nti.nai.btSak = 0x08;
+    pnt->nti.nai.szUidLen = sizeof(abtUid);
+    memcpy( pnt->nti.nai.abtUid, abtUid, sizeof(abtUid) );
+}
+
+// ---------------------------------------------------------------------------
+// the hex encoder before the single-pass writer
+//
+void legacyStringifyToHex( char *szBuffer, const uint8_t *pbtData, const size_t szBytes ){
+    size_t  szPos;
+    char szElement[4];
+
+    strcpy(szBuffer, "");
+    for (szPos = 0; szPos < szBytes; szPos++){
+        if ( szPos != 0 )
+            strcat(szBuffer,"-");
+        sprintf(szElement, "%02X", pbtData[szPos]);
+        strcat(szBuffer, szElement);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// the encoder before the single-pass writer, kept as the benchmark baseline.
+// (it wrote "baudRate" twice for ISO 14443A targets)
+//
+int legacyConstructJSON( const nfc_target nfcTarget, char *szBuffer, int nBufLen ){
+    char element[256], szHex[64];
+
+    bzero(szBuffer, nBufLen);
+    sprintf(szBuffer, "{" );
+    sprintf(element, "\"nfcModulationType\":\"%s\"", "ISO/IEC 14443A");
+    strcat(szBuffer, element);
+    sprintf(element, ",\"baudRate\":\"%s\"",str_nfc_baud_rate(nfcTarget.nm.nbr) );
+    strcat(szBuffer, element);
+
+    strcat( element,",\"ATQA\":\"" );
+    legacyStringifyToHex( szHex, nfcTarget.nti.nai.abtAtqa, 2 );
+    strcat( element, szHex );
+    strcat( element,"\"" );
+    strcat( element, ",\"UID\":\"");
+    legacyStringifyToHex( szHex, nfcTarget.nti.nai.abtUid, nfcTarget.nti.nai.szUidLen );
+    strcat( element, szHex );
+    strcat( element, "\"" );
+    strcat(szBuffer, element);
+
+    strcat(szBuffer, "}" );
+    return( strlen(szBuffer) );
+}
+
+// ---------------------------------------------------------------------------
+// ISO 14443A targets, and the other modulation types
+//
+void testEncode( void ){
+    nfc_target nt;
+    char szBuffer[BUFSIZE];
+    const char *szExpected =
+        "{\"nfcModulationType\":\"ISO/IEC 14443A\",\"baudRate\":\"106 kbps\","
+        "\"ATQA\":\"00-44\",\"UID\":\"04-93-2A-1A-3E-2B-80\"}";
+
+    makeMifare( &nt );
+    CHECK( constructJSONstringNFC( nt, szBuffer, BUFSIZE ) == (int)strlen(szExpected) );
+    CHECK( strcmp( szBuffer, szExpected ) == 0 );
+
+    nt.nti.nai.abtUid[0] = 0x08;
+    nt.nti.nai.szUidLen = 4;
+    constructJSONstringNFC( nt, szBuffer, BUFSIZE );
+    CHECK( strstr( szBuffer, "\"UID\":\"08-93-2A-1A (Random UID)\"}" ) != NULL );
+
+    memset( &nt, 0, sizeof(nt) );
+    nt.nm.nmt = NMT_FELICA;
+    nt.nm.nbr = NBR_424;
+    constructJSONstringNFC( nt, szBuffer, BUFSIZE );
+    CHECK( strcmp( szBuffer, "{\"nfcModulationType\":\"FeliCa\",\"baudRate\":\"424 kbps\"}" ) == 0 );
+
+    nt.nm.nmt = NMT_DEP;
+    nt.nti.ndi.ndm = NDM_ACTIVE;
+    constructJSONstringNFC( nt, szBuffer, BUFSIZE );
+    CHECK( strstr( szBuffer, "\"D.E.P. active mode\"" ) != NULL );
+}
+
+// ---------------------------------------------------------------------------
+// the ATS is exported for ISO 14443-4 cards
+//
+void testATS( void ){
+    nfc_target nt;
+    char szBuffer[BUFSIZE];
+    int i;
+
+    makeMifare( &nt );
+    nt.nti.nai.szAtsLen = 4;
+    memcpy( nt.nti.nai.abtAts, "\x75\x77\x81\x02", 4 );
+    constructJSONstringNFC( nt, szBuffer, BUFSIZE );
+    CHECK( strstr( szBuffer, ",\"ATS\":\"75-77-81-02\"}" ) != NULL );
+
+    // the largest ATS still fits the uplink's buffer
+    nt.nti.nai.szAtsLen = ATS_SIZE;
+    for( i=0 ; i < ATS_SIZE ; i++ )
+        nt.nti.nai.abtAts[i] = (uint8_t)i;
+    CHECK( constructJSONstringNFC( nt, szBuffer, BUFSIZE ) > 3 * ATS_SIZE );
+    CHECK( strstr( szBuffer, "-FC-FD\"}" ) != NULL );
+}
+
+// ---------------------------------------------------------------------------
+// the identifying bytes of each target type
+//
+void testUID( void ){
+    nfc_target nt;
+    const uint8_t *pbtUid;
+
+    makeMifare( &nt );
+    CHECK( targetUID( &nt, &pbtUid ) == 7 );
+    CHECK( pbtUid == nt.nti.nai.abtUid && pbtUid[0] == 0x04 && pbtUid[6] == 0x80 );
+
+    nt.nti.nai.szUidLen = 11;           // corrupt: more than the field holds
+    CHECK( targetUID( &nt, &pbtUid ) == 0 );
+
+    memset( &nt, 0, sizeof(nt) );
+    nt.nm.nmt = NMT_FELICA;
+    CHECK( targetUID( &nt, &pbtUid ) == 8 && pbtUid == nt.nti.nfi.abtId );
+    nt.nm.nmt = NMT_ISO14443B;
+    CHECK( targetUID( &nt, &pbtUid ) == 4 && pbtUid == nt.nti.nbi.abtPupi );
+    nt.nm.nmt = 0;
+    CHECK( targetUID( &nt, &pbtUid ) == 0 && pbtUid == NULL );
+}
+
+// ---------------------------------------------------------------------------
+// the same card is the same type with the same UID
+//
+void testSameTarget( void ){
+    nfc_target nt1, nt2;
+
+    makeMifare( &nt1 );
+    makeMifare( &nt2 );
+    CHECK( sameTarget( &nt1, &nt2 ) );
+    nt2.nti.nai.abtUid[6]++;
+    CHECK( !sameTarget( &nt1, &nt2 ) );
+    nt2.nti.nai.abtUid[6]--;
+    nt2.nti.nai.szUidLen = 4;
+    CHECK( !sameTarget( &nt1, &nt2 ) );
+
+    // the same bytes on another type of card
+    memset( &nt2, 0, sizeof(nt2) );
+    nt2.nm.nmt = NMT_FELICA;
+    memcpy( nt2.nti.nfi.abtId, nt1.nti.nai.abtUid, 7 );
+    CHECK( !sameTarget( &nt1, &nt2 ) );
+
+    // nothing to tell cards apart by
+    nt1.nm.nmt = nt2.nm.nmt = 0;
+    CHECK( !sameTarget( &nt1, &nt2 ) );
+}
+
+// ---------------------------------------------------------------------------
+// the vector path matches the table path for every length and separator
+//
+void testHex( void ){
+    uint8_t abtData[FRAME_SIZE + 40];
+    char szSimd[4 * sizeof(abtData)], szScalar[4 * sizeof(abtData)];
+    const char acSeparators[] = { '-', ':', '\0' };
+    size_t szLen, szOut;
+    int i, nSep;
+
+    for( i=0 ; i < (int)sizeof(abtData) ; i++ )
+        abtData[i] = (uint8_t)(i * 37 + 11);
+    abtData[0] = 0x00;
+    abtData[1] = 0xFF;
+
+    for( nSep=0 ; nSep < (int)sizeof(acSeparators) ; nSep++ ){
+        for( szLen=0 ; szLen <= sizeof(abtData) ; szLen++ ){
+            memset( szSimd, '#', sizeof(szSimd) );
+            szOut = encodeHex( szSimd, abtData, szLen, acSeparators[nSep] );
+            CHECK( szOut == hexLength( szLen, acSeparators[nSep] ) );
+            CHECK( szSimd[szOut] == '#' );      // nothing past the end
+            CHECK( encodeHexScalar( szScalar, abtData, szLen, acSeparators[nSep] ) == szOut );
+            CHECK( memcmp( szSimd, szScalar, szOut ) == 0 );
+        }
+    }
+    CHECK( encodeHex( szSimd, abtData, 4, '\0' ) == 8 );
+    CHECK( memcmp( szSimd, "00FF557A", 8 ) == 0 );
+    CHECK( stringifyToHex( szSimd, abtData, 3 ) == 8 );
+    CHECK( strcmp( szSimd, "00-FF-55" ) == 0 );
+    CHECK( stringifyToHex( szSimd, abtData, 0 ) == 0 && szSimd[0] == '\0' );
+}
+
+// ---------------------------------------------------------------------------
+// a buffer too small is never overrun, and the truncation is reported
+//
+void testBound( void ){
+    nfc_target nt;
+    char szBuffer[BUFSIZE];
+    int nFull, nLen;
+
+    makeMifare( &nt );
+    nFull = constructJSONstringNFC( nt, szBuffer, BUFSIZE );
+
+    // exactly big enough, including the NUL
+    CHECK( constructJSONstringNFC( nt, szBuffer, nFull + 1 ) == nFull );
+
+    for( nLen = nFull ; nLen >= 0 ; nLen-- ){
+        memset( szBuffer, '#', sizeof(szBuffer) );
+        CHECK( constructJSONstringNFC( nt, szBuffer, nLen ) == -1 );
+        CHECK( szBuffer[nLen] == '#' );
+        if( nLen > 0 )
+            CHECK( strlen( szBuffer ) < (size_t)nLen );
+    }
+}
+
+// ---------------------------------------------------------------------------
+// wall time in nanoseconds, for the benchmark
+//
+uint64_t nanosecs( void ){
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return( (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec );
+}
+
+// ---------------------------------------------------------------------------
+// time hex-encoding szBytes at a time with each encoder
+//
+void benchmarkHex( const char *szName, size_t szBytes ){
+    static uint8_t abtData[FRAME_SIZE];
+    static char szBuffer[4 * FRAME_SIZE];
+    volatile size_t szSink = 0;
+    uint64_t ullStart, ullLegacy, ullTable, ullDash, ullPlain;
+    int i, nRounds = BENCH_HEX_BYTES / szBytes;
+
+    for( i=0 ; i < FRAME_SIZE ; i++ )
+        abtData[i] = (uint8_t)(i * 37 + 11);
+
+    ullStart = nanosecs();
+    for( i=0 ; i < nRounds / 10 ; i++ ){    // slow - fewer rounds
+        abtData[0] = (uint8_t)i;
+        legacyStringifyToHex( szBuffer, abtData, szBytes );
+        szSink += szBuffer[1];
+    }
+    ullLegacy = (nanosecs() - ullStart) * 10;
+
+    ullStart = nanosecs();
+    for( i=0 ; i < nRounds ; i++ ){
+        abtData[0] = (uint8_t)i;
+        szSink += encodeHexScalar( szBuffer, abtData, szBytes, '-' );
+    }
+    ullTable = nanosecs() - ullStart;
+
+    ullStart = nanosecs();
+    for( i=0 ; i < nRounds ; i++ ){
+        abtData[0] = (uint8_t)i;
+        szSink += encodeHex( szBuffer, abtData, szBytes, '-' );
+    }
+    ullDash = nanosecs() - ullStart;
+
+    ullStart = nanosecs();
+    for( i=0 ; i < nRounds ; i++ ){
+        abtData[0] = (uint8_t)i;
+        szSink += encodeHex( szBuffer, abtData, szBytes, '\0' );
+    }
+    ullPlain = nanosecs() - ullStart;
+
+    printf("  %-6s %3d bytes %10.1f %10.1f %10.1f %10.1f ns\n", szName, (int)szBytes,
+           (double)ullLegacy / nRounds, (double)ullTable / nRounds,
+           (double)ullDash / nRounds, (double)ullPlain / nRounds );
+}
+
+// ---------------------------------------------------------------------------
+// time encoding one target, before and after
+//
+void benchmark( void ){
+    nfc_target nt;
+    char szBuffer[BUFSIZE];
+    volatile int nSink = 0;
+    uint64_t ullStart, ullLegacy, ullWriter;
+    int i;
+
+    makeMifare( &nt );
+
+    ullStart = nanosecs();
+    for( i=0 ; i < BENCH_ENCODES ; i++ ){
+        nt.nti.nai.abtUid[6] = (uint8_t)i;
+        nSink += legacyConstructJSON( nt, szBuffer, BUFSIZE );
+    }
+    ullLegacy = nanosecs() - ullStart;
+
+    ullStart = nanosecs();
+    for( i=0 ; i < BENCH_ENCODES ; i++ ){
+        nt.nti.nai.abtUid[6] = (uint8_t)i;
+        nSink += constructJSONstringNFC( nt, szBuffer, BUFSIZE );
+    }
+    ullWriter = nanosecs() - ullStart;
+
+    printf("benchmark: JSON-encode a MIFARE target into a %d byte buffer\n", BUFSIZE );
+    printf("  sprintf/strcat       %8.1f ns/target\n", (double)ullLegacy / BENCH_ENCODES );
+    printf("  single-pass writer   %8.1f ns/target\n", (double)ullWriter / BENCH_ENCODES );
+
+    printf("benchmark: hex-encode (%s)\n",
+#if defined(__ARM_NEON) && !defined(NFC_HEX_NO_SIMD)
+           "NEON"
+#elif defined(__SSE2__) && !defined(NFC_HEX_NO_SIMD)
+           "SSE2"
+#else
+           "no SIMD"
+#endif
+           );
+    printf("                    sprintf      table  encodeHex  encodeHex\n");
+    printf("                    strcat \"-\"    \"-\"        \"-\"        none\n");
+    benchmarkHex( "UID", UID_SIZE );
+    benchmarkHex( "ATS", ATS_SIZE );
+    benchmarkHex( "frame", FRAME_SIZE );
+}
+
+// ===========================================================================
+// main
+//
+int main( int argc, char *argv[] )
+{
+    testEncode();
+    testATS();
+    testUID();
+    testSameTarget();
+    testHex();
+    testBound();
+    benchmark();
+
+    if( nFailures ){
+        printf("%d check(s) FAILED\n", nFailures );
+        exit( EXIT_FAILURE );
+    }
+    printf("all NFC encoding tests passed\n");
+    exit( EXIT_SUCCESS );
+}
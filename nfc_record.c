@@ -0,0 +1,172 @@
+/*
+ * @file nfc_record.c
+ * @brief decoding the binary NFC record format described in nfc_record.h
+ *
+ * self-contained - the server side can build it without libnfc or the rest
+ * of this client
+ */
+#include <string.h>
+
+#include "nfc_record.h"
+
+// ---------------------------------------------------------------------------
+// length of the record at the start of pbtData, from its header. Lets a
+// stream reader know how much to wait for.
+//
+// returns: record length, 0 if the header isn't all there yet, else -1 if
+//          this isn't a record
+//
+int nfcRecordLength( const uint8_t *pbtData, size_t szAvail ){
+    int nLen;
+
+    if( szAvail < NFC_RECORD_HEADER_SIZE )
+        return( (szAvail > 0 && pbtData[0] != NFC_RECORD_MAGIC) ? -1 : 0 );
+    if( pbtData[0] != NFC_RECORD_MAGIC || pbtData[1] != NFC_RECORD_VERSION )
+        return( -1 );
+    nLen = (pbtData[2] << 8) | pbtData[3];
+    if( nLen < NFC_RECORD_HEADER_SIZE )
+        return( -1 );
+    return( nLen );
+}
+
+// ---------------------------------------------------------------------------
+// decode the record at the start of pbtData
+//
+// returns: bytes used, 0 if the record isn't all there yet, else -1 if it's
+//          malformed
+//
+int decodeNFCrecord( const uint8_t *pbtData, size_t szAvail, nfc_record *pRec ){
+    const uint8_t *p, *pEnd;
+    uint8_t btTag, btLen;
+    int nLen;
+
+    if( (nLen = nfcRecordLength( pbtData, szAvail )) <= 0 )
+        return( nLen );
+    if( (size_t)nLen > szAvail )
+        return( 0 );
+
+    memset( pRec, 0, sizeof(*pRec) );
+    pRec->btVersion = pbtData[1];
+    pRec->uiSeq = ((uint32_t)pbtData[4] << 24) | ((uint32_t)pbtData[5] << 16) |
+                  ((uint32_t)pbtData[6] << 8)  |  (uint32_t)pbtData[7];
+
+    pEnd = pbtData + nLen;
+    for( p = pbtData + NFC_RECORD_HEADER_SIZE ; p < pEnd ; p += 2 + btLen ){
+        if( pEnd - p < 2 )
+            return( -1 );
+        btTag = p[0];
+        btLen = p[1];
+        if( btLen > pEnd - p - 2 )
+            return( -1 );
+
+        switch( btTag ){
+          case NFC_TAG_MODULATION:
+            if( btLen != 1 ) return( -1 );
+            pRec->btModulation = p[2];
+            break;
+          case NFC_TAG_BAUD:
+            if( btLen != 1 ) return( -1 );
+            pRec->btBaud = p[2];
+            break;
+          case NFC_TAG_DEP_MODE:
+            if( btLen != 1 ) return( -1 );
+            pRec->btDepMode = p[2];
+            break;
+          case NFC_TAG_READER:
+            if( btLen != 1 ) return( -1 );
+            pRec->btReader = p[2];
+            pRec->bHasReader = true;
+            break;
+          case NFC_TAG_EVENT:
+            if( btLen != 1 ) return( -1 );
+            pRec->btEvent = p[2];
+            break;
+          case NFC_TAG_DWELL:
+            if( btLen != 4 ) return( -1 );
+            pRec->uiDwellMs = (uint32_t)p[2] << 24 | (uint32_t)p[3] << 16 | (uint32_t)p[4] << 8 | p[5];
+            break;
+          case NFC_TAG_ATQA:
+            if( btLen != 2 ) return( -1 );
+            memcpy( pRec->abtAtqa, p + 2, 2 );
+            pRec->bHasAtqa = true;
+            break;
+          case NFC_TAG_SAK:
+            if( btLen != 1 ) return( -1 );
+            pRec->btSak = p[2];
+            pRec->bHasSak = true;
+            break;
+          case NFC_TAG_UID:
+            if( btLen > sizeof(pRec->abtUid) ) return( -1 );
+            memcpy( pRec->abtUid, p + 2, btLen );
+            pRec->szUidLen = btLen;
+            break;
+          case NFC_TAG_ATS:
+            if( btLen > sizeof(pRec->abtAts) ) return( -1 );
+            memcpy( pRec->abtAts, p + 2, btLen );
+            pRec->szAtsLen = btLen;
+            break;
+          default:      // added by a later version
+            break;
+        }
+    }
+    return( nLen );
+}
+
+// ---------------------------------------------------------------------------
+// write the sequence number into an encoded record's header
+//
+void stampNFCrecordSeq( uint8_t *pbtRecord, uint32_t uiSeq ){
+    pbtRecord[4] = (uint8_t)(uiSeq >> 24);
+    pbtRecord[5] = (uint8_t)(uiSeq >> 16);
+    pbtRecord[6] = (uint8_t)(uiSeq >> 8);
+    pbtRecord[7] = (uint8_t)uiSeq;
+}
+
+// ---------------------------------------------------------------------------
+// add a field to the end of an encoded record, and update its length
+//
+// returns: new length of the record, else -1 if nBufLen is too small
+//
+int addNFCrecordField( uint8_t *pbtRecord, int nBufLen, uint8_t btTag, const uint8_t *pbtValue, size_t szLen ){
+    size_t szRecord = ((size_t)pbtRecord[2] << 8) | pbtRecord[3];
+
+    if( szLen > 255 || nBufLen < 0 || szRecord + 2 + szLen > (size_t)nBufLen ||
+        szRecord + 2 + szLen > 0xFFFF )
+        return( -1 );
+    pbtRecord[szRecord] = btTag;
+    pbtRecord[szRecord + 1] = (uint8_t)szLen;
+    memcpy( pbtRecord + szRecord + 2, pbtValue, szLen );
+    szRecord += 2 + szLen;
+    pbtRecord[2] = (uint8_t)(szRecord >> 8);
+    pbtRecord[3] = (uint8_t)szRecord;
+    return( (int)szRecord );
+}
+
+// ---------------------------------------------------------------------------
+// name of a modulation type, as used in the JSON messages
+//
+const char *nfcModulationName( uint8_t btModulation ){
+    switch( btModulation ){
+      case NFC_MOD_ISO14443A:    return( "ISO/IEC 14443A" );
+      case NFC_MOD_JEWEL:        return( "Innovision Jewel" );
+      case NFC_MOD_FELICA:       return( "FeliCa" );
+      case NFC_MOD_ISO14443B:    return( "ISO/IEC 14443-4B" );
+      case NFC_MOD_ISO14443BI:   return( "ISO/IEC 14443-4Bi" );
+      case NFC_MOD_ISO14443B2SR: return( "ISO/IEC 14443-2B ST SRx" );
+      case NFC_MOD_ISO14443B2CT: return( "ISO/IEC 14443-2B ASK CTx" );
+      case NFC_MOD_DEP:          return( "D.E.P." );
+    }
+    return( "unknown" );
+}
+
+// ---------------------------------------------------------------------------
+// name of a presence event, as used in the JSON messages
+//
+const char *nfcEventName( uint8_t btEvent ){
+    switch( btEvent ){
+      case NFC_EVENT_TAP:        return( "tap" );
+      case NFC_EVENT_ARRIVED:    return( "arrived" );
+      case NFC_EVENT_REMOVED:    return( "removed" );
+    }
+    return( "unknown" );
+}
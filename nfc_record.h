@@ -0,0 +1,100 @@
+/*
+ * @file nfc_record.h
+ * @brief the binary NFC record format, and the decoder in nfc_record.c
+ *
+ * A compact alternative to the JSON messages, offered to the server with -b.
+ * Needs nothing from libnfc, so the server can build nfc_record.c on its own.
+ *
+ * Record layout, all integers big-endian:
+ *
+ *   0  magic      NFC_RECORD_MAGIC. never '{', so records and JSON messages
+ *                 can share a connection
+ *   1  version    NFC_RECORD_VERSION
+ *   2  length     uint16, whole record including this header
+ *   4  seq        uint32, for the server to ACK
+ *   8  fields     tag (1 byte), length (1 byte), value. Tags the decoder
+ *                 doesn't know are skipped
+ *
+ * A MIFARE Classic tap with a 7 byte UID takes 30 bytes.
+ */
+#ifndef _NFC_RECORD_H_
+#define _NFC_RECORD_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Definitions
+#define NFC_RECORD_MAGIC        0xCB
+#define NFC_RECORD_VERSION      1
+#define NFC_RECORD_HEADER_SIZE  8
+#define NFC_RECORD_FORMAT_NAME  "tlv1"  // as negotiated with the server
+
+// field tags
+#define NFC_TAG_MODULATION      0x01    // 1 byte, NFC_MOD_...
+#define NFC_TAG_BAUD            0x02    // 1 byte, NFC_BAUD_...
+#define NFC_TAG_ATQA            0x03    // 2 bytes
+#define NFC_TAG_SAK             0x04    // 1 byte
+#define NFC_TAG_UID             0x05    // up to 10 bytes
+#define NFC_TAG_ATS             0x06    // up to 254 bytes
+#define NFC_TAG_DEP_MODE        0x07    // 1 byte, NFC_DEP_...
+#define NFC_TAG_READER          0x08    // 1 byte, which of the Pi's readers. only with more than one
+#define NFC_TAG_EVENT           0x09    // 1 byte, NFC_EVENT_... only with presence tracking
+#define NFC_TAG_DWELL           0x0A    // uint32, ms the card was on the reader. with NFC_EVENT_REMOVED
+
+// modulation types. Same numbering as libnfc's nfc_modulation_type
+#define NFC_MOD_ISO14443A       1
+#define NFC_MOD_JEWEL           2
+#define NFC_MOD_ISO14443B       3
+#define NFC_MOD_ISO14443BI      4
+#define NFC_MOD_ISO14443B2SR    5
+#define NFC_MOD_ISO14443B2CT    6
+#define NFC_MOD_FELICA          7
+#define NFC_MOD_DEP             8
+
+// baud rates. Same numbering as libnfc's nfc_baud_rate
+#define NFC_BAUD_UNDEFINED      0
+#define NFC_BAUD_106            1
+#define NFC_BAUD_212            2
+#define NFC_BAUD_424            3
+#define NFC_BAUD_847            4
+
+// D.E.P. modes. Same numbering as libnfc's nfc_dep_mode
+#define NFC_DEP_PASSIVE         1
+#define NFC_DEP_ACTIVE          2
+
+// presence events. A record without one is a tap
+#define NFC_EVENT_TAP           0
+#define NFC_EVENT_ARRIVED       1
+#define NFC_EVENT_REMOVED       2
+
+// a decoded record. Fields not present in the record are left zero
+typedef struct {
+    uint32_t  uiSeq;
+    uint8_t   btVersion;
+    uint8_t   btModulation;
+    uint8_t   btBaud;
+    uint8_t   btDepMode;
+    bool      bHasReader;
+    uint8_t   btReader;
+    uint8_t   btEvent;
+    uint32_t  uiDwellMs;
+    bool      bHasAtqa;
+    uint8_t   abtAtqa[2];
+    bool      bHasSak;
+    uint8_t   btSak;
+    size_t    szUidLen;
+    uint8_t   abtUid[10];
+    size_t    szAtsLen;
+    uint8_t   abtAts[254];
+} nfc_record;
+
+// function prototypes
+int  nfcRecordLength( const uint8_t *pbtData, size_t szAvail );
+int  decodeNFCrecord( const uint8_t *pbtData, size_t szAvail, nfc_record *pRec );
+void stampNFCrecordSeq( uint8_t *pbtRecord, uint32_t uiSeq );
+int  addNFCrecordField( uint8_t *pbtRecord, int nBufLen, uint8_t btTag, const uint8_t *pbtValue, size_t szLen );
+const char *nfcModulationName( uint8_t btModulation );
+const char *nfcEventName( uint8_t btEvent );
+
+#endif // _NFC_RECORD_H_
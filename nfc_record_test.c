@@ -0,0 +1,246 @@
+/*
+ * @file nfc_record_test.c
+ * @brief unit test for nfc_record.c, with the encoder from nfc_encode.c
+ *
+ * runs standalone - no NFC device needed. Also times encoding and decoding
+ * a record, and compares its size with the JSON message.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nfc-types.h"
+
+#include "nfc_encode.h"
+#include "nfc_record.h"
+#include "unit_test.h"
+
+#define BUFSIZE         1024
+#define BENCH_RECORDS   1000000
+
+// ---------------------------------------------------------------------------
+// a MIFARE Classic 1K card, as in white.output.txt
+//
+void makeMifare( nfc_target *pnt ){
+    static const uint8_t abtUid[] = { 0x04, 0x93, 0x2A, 0x1A, 0x3E, 0x2B, 0x80 };
+
+    memset( pnt, 0, sizeof(*pnt) );
+    pnt->nm.nmt = NMT_ISO14443A;
+    pnt->nm.nbr = NBR_106;
+    pnt->nti.nai.abtAtqa[1] = 0x44;
+    pnt->nti.nai.btSak = 0x08;
+    pnt->nti.nai.szUidLen = sizeof(abtUid);
+    memcpy( pnt->nti.nai.abtUid, abtUid, sizeof(abtUid) );
+}
+
+// ---------------------------------------------------------------------------
+// what's encoded comes back out
+//
+void testRoundTrip( void ){
+    nfc_target nt;
+    nfc_record rec;
+    uint8_t abtBuffer[BUFSIZE];
+    int n;
+
+    makeMifare( &nt );
+    CHECK( (n= constructBinaryRecordNFC( &nt, abtBuffer, BUFSIZE )) == 30 );
+    stampNFCrecordSeq( abtBuffer, 0x01020304 );
+    CHECK( nfcRecordLength( abtBuffer, n ) == n );
+    CHECK( decodeNFCrecord( abtBuffer, n, &rec ) == n );
+    CHECK( rec.uiSeq == 0x01020304 );
+    CHECK( rec.btModulation == NFC_MOD_ISO14443A && rec.btBaud == NFC_BAUD_106 );
+    CHECK( strcmp( nfcModulationName( rec.btModulation ), "ISO/IEC 14443A" ) == 0 );
+    CHECK( rec.bHasAtqa && rec.abtAtqa[0] == 0x00 && rec.abtAtqa[1] == 0x44 );
+    CHECK( rec.bHasSak && rec.btSak == 0x08 );
+    CHECK( rec.szUidLen == 7 && memcmp( rec.abtUid, nt.nti.nai.abtUid, 7 ) == 0 );
+    CHECK( rec.szAtsLen == 0 && !rec.bHasReader );
+
+    // tagged with the reader it was seen on
+    CHECK( addNFCrecordField( abtBuffer, n + 2, NFC_TAG_READER, (const uint8_t *)"\x03", 1 ) == -1 );
+    CHECK( (n= addNFCrecordField( abtBuffer, BUFSIZE, NFC_TAG_READER, (const uint8_t *)"\x03", 1 )) == 33 );
+    CHECK( decodeNFCrecord( abtBuffer, n, &rec ) == n );
+    CHECK( rec.bHasReader && rec.btReader == 3 && rec.uiSeq == 0x01020304 && rec.szUidLen == 7 );
+    CHECK( rec.btEvent == NFC_EVENT_TAP && rec.uiDwellMs == 0 );
+
+    // and as a card leaving the reader, after how long
+    CHECK( (n= addNFCrecordField( abtBuffer, BUFSIZE, NFC_TAG_EVENT, (const uint8_t *)"\x02", 1 )) == 36 );
+    CHECK( (n= addNFCrecordField( abtBuffer, BUFSIZE, NFC_TAG_DWELL, (const uint8_t *)"\x00\x01\x02\x03", 4 )) == 42 );
+    CHECK( decodeNFCrecord( abtBuffer, n, &rec ) == n );
+    CHECK( rec.btEvent == NFC_EVENT_REMOVED && rec.uiDwellMs == 0x010203 );
+    CHECK( strcmp( nfcEventName( rec.btEvent ), "removed" ) == 0 );
+    abtBuffer[n-5] = 3;     // a dwell time is 4 bytes
+    CHECK( decodeNFCrecord( abtBuffer, n, &rec ) == -1 );
+
+    // a 4 byte UID is smaller still, and the largest ATS still fits
+    nt.nti.nai.szUidLen = 4;
+    CHECK( constructBinaryRecordNFC( &nt, abtBuffer, BUFSIZE ) == 27 );
+    nt.nti.nai.szAtsLen = 254;
+    memset( nt.nti.nai.abtAts, 0xA5, 254 );
+    CHECK( (n= constructBinaryRecordNFC( &nt, abtBuffer, BUFSIZE )) == 27 + 2 + 254 );
+    CHECK( decodeNFCrecord( abtBuffer, n, &rec ) == n );
+    CHECK( rec.szAtsLen == 254 && rec.abtAts[253] == 0xA5 );
+
+    memset( &nt, 0, sizeof(nt) );
+    nt.nm.nmt = NMT_DEP;
+    nt.nm.nbr = NBR_424;
+    nt.nti.ndi.ndm = NDM_ACTIVE;
+    CHECK( (n= constructBinaryRecordNFC( &nt, abtBuffer, BUFSIZE )) == 17 );
+    CHECK( decodeNFCrecord( abtBuffer, n, &rec ) == n );
+    CHECK( rec.btModulation == NFC_MOD_DEP && rec.btDepMode == NFC_DEP_ACTIVE && !rec.bHasAtqa );
+}
+
+// ---------------------------------------------------------------------------
+// the other target types come back as their type and baud rate, whatever
+// their info would look like read as type A info
+//
+void testOtherTypes( void ){
+    static const uint8_t abtFelicaId[] = { 0x01, 0x2E, 0x3C, 0xA5, 0x17, 0x0B, 0x9D, 0x44 };
+    nfc_target nt;
+    nfc_record rec;
+    uint8_t abtBuffer[BUFSIZE];
+    int n;
+
+    memset( &nt, 0, sizeof(nt) );
+    nt.nm.nmt = NMT_FELICA;
+    nt.nm.nbr = NBR_424;
+    nt.nti.nfi.szLen = 18;
+    nt.nti.nfi.btResCode = 0x01;
+    memcpy( nt.nti.nfi.abtId, abtFelicaId, sizeof(abtFelicaId) );
+    memset( nt.nti.nfi.abtPad, 0xFF, sizeof(nt.nti.nfi.abtPad) );
+    CHECK( nt.nti.nai.szUidLen > sizeof(nt.nti.nai.abtUid) );     // as type A info, nonsense
+    CHECK( (n= constructBinaryRecordNFC( &nt, abtBuffer, BUFSIZE )) == 14 );
+    CHECK( decodeNFCrecord( abtBuffer, n, &rec ) == n );
+    CHECK( rec.btModulation == NFC_MOD_FELICA && rec.btBaud == NFC_BAUD_424 );
+    CHECK( !rec.bHasAtqa && !rec.bHasSak && rec.szUidLen == 0 && rec.szAtsLen == 0 );
+
+    memset( &nt, 0, sizeof(nt) );
+    nt.nm.nmt = NMT_ISO14443B;
+    nt.nm.nbr = NBR_106;
+    memcpy( nt.nti.nbi.abtPupi, "\x9A\x3B\xC4\x71", 4 );
+    memset( nt.nti.nbi.abtApplicationData, 0xEE, 4 );
+    nt.nti.nbi.abtProtocolInfo[1] = 0x81;
+    nt.nti.nbi.abtProtocolInfo[2] = 0x71;
+    CHECK( (n= constructBinaryRecordNFC( &nt, abtBuffer, BUFSIZE )) == 14 );
+    CHECK( decodeNFCrecord( abtBuffer, n, &rec ) == n );
+    CHECK( rec.btModulation == NFC_MOD_ISO14443B && rec.btBaud == NFC_BAUD_106 && !rec.bHasAtqa );
+
+    memset( &nt, 0, sizeof(nt) );
+    nt.nm.nmt = NMT_JEWEL;
+    nt.nm.nbr = NBR_106;
+    nt.nti.nji.btSensRes[0] = 0x0C;
+    memcpy( nt.nti.nji.btId, "\xD5\x6E\x02\xF3", 4 );
+    CHECK( (n= constructBinaryRecordNFC( &nt, abtBuffer, BUFSIZE )) == 14 );
+    CHECK( decodeNFCrecord( abtBuffer, n, &rec ) == n );
+    CHECK( rec.btModulation == NFC_MOD_JEWEL && rec.btBaud == NFC_BAUD_106 && !rec.bHasAtqa );
+    CHECK( constructBinaryRecordNFC( &nt, abtBuffer, 13 ) == -1 );
+}
+
+// ---------------------------------------------------------------------------
+// partial, malformed and newer records
+//
+void testDecodeErrors( void ){
+    nfc_target nt;
+    nfc_record rec;
+    uint8_t abtBuffer[BUFSIZE];
+    int n, i;
+
+    makeMifare( &nt );
+    n = constructBinaryRecordNFC( &nt, abtBuffer, BUFSIZE );
+    CHECK( constructBinaryRecordNFC( &nt, abtBuffer, n - 1 ) == -1 );
+    n = constructBinaryRecordNFC( &nt, abtBuffer, BUFSIZE );
+
+    // not all there yet - wait for more
+    for( i=0 ; i < n ; i++ )
+        CHECK( decodeNFCrecord( abtBuffer, i, &rec ) == 0 );
+
+    // a JSON message isn't a record
+    CHECK( nfcRecordLength( (const uint8_t *)"{\"msg\"", 6 ) == -1 );
+    CHECK( nfcRecordLength( (const uint8_t *)"{", 1 ) == -1 );
+
+    // a field running past the end of the record
+    abtBuffer[n - 8] = 9;
+    CHECK( decodeNFCrecord( abtBuffer, n, &rec ) == -1 );
+    abtBuffer[n - 8] = 7;
+
+    // unknown fields are skipped
+    memcpy( abtBuffer + n, "\x7F\x02\xAA\xBB", 4 );
+    abtBuffer[3] += 4;
+    CHECK( decodeNFCrecord( abtBuffer, n + 4, &rec ) == n + 4 );
+    CHECK( rec.szUidLen == 7 );
+
+    // a record followed by the next one in the same read
+    CHECK( decodeNFCrecord( abtBuffer, BUFSIZE, &rec ) == n + 4 );
+}
+
+// ---------------------------------------------------------------------------
+// wall time in nanoseconds, for the benchmark
+//
+uint64_t nanosecs( void ){
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return( (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec );
+}
+
+// ---------------------------------------------------------------------------
+// time encoding and decoding, against the JSON message
+//
+void benchmark( void ){
+    nfc_target nt;
+    nfc_record rec;
+    uint8_t abtBuffer[BUFSIZE];
+    char szJSON[BUFSIZE];
+    volatile int nSink = 0;
+    uint64_t ullStart, ullEncode, ullDecode, ullJSON;
+    int i, nBinary;
+
+    makeMifare( &nt );
+    nBinary = constructBinaryRecordNFC( &nt, abtBuffer, BUFSIZE );
+
+    ullStart = nanosecs();
+    for( i=0 ; i < BENCH_RECORDS ; i++ ){
+        nt.nti.nai.abtUid[6] = (uint8_t)i;
+        nSink += constructBinaryRecordNFC( &nt, abtBuffer, BUFSIZE );
+        stampNFCrecordSeq( abtBuffer, i );
+    }
+    ullEncode = nanosecs() - ullStart;
+
+    ullStart = nanosecs();
+    for( i=0 ; i < BENCH_RECORDS ; i++ ){
+        abtBuffer[7] = (uint8_t)i;
+        nSink += decodeNFCrecord( abtBuffer, BUFSIZE, &rec );
+    }
+    ullDecode = nanosecs() - ullStart;
+
+    ullStart = nanosecs();
+    for( i=0 ; i < BENCH_RECORDS ; i++ ){
+        nt.nti.nai.abtUid[6] = (uint8_t)i;
+        nSink += constructJSONstringNFC( nt, szJSON, BUFSIZE );
+    }
+    ullJSON = nanosecs() - ullStart;
+
+    printf("benchmark: MIFARE target with a 7 byte UID\n");
+    printf("  binary record   %4d bytes  encode %6.1f ns  decode %6.1f ns\n",
+           nBinary, (double)ullEncode / BENCH_RECORDS, (double)ullDecode / BENCH_RECORDS );
+    printf("  JSON message    %4d bytes  encode %6.1f ns  (before the seq is stamped)\n",
+           (int)strlen( szJSON ), (double)ullJSON / BENCH_RECORDS );
+}
+
+// ===========================================================================
+// main
+//
+int main( int argc, char *argv[] )
+{
+    testRoundTrip();
+    testOtherTypes();
+    testDecodeErrors();
+    benchmark();
+
+    if( nFailures ){
+        printf("%d check(s) FAILED\n", nFailures );
+        exit( EXIT_FAILURE );
+    }
+    printf("all NFC record tests passed\n");
+    exit( EXIT_SUCCESS );
+}
@@ -0,0 +1,761 @@
+/*
+ * @file nfc_sim.c
+ * @brief a simulated PN532, behind the part of the libnfc API nfc_driver.c uses
+ *
+ * Linked in place of -lnfc, so the driver, the pollers and the uplink can be
+ * run, timed and tested on machines with no reader. Configured through the
+ * environment variables listed in nfc_sim.h.
+ *
+ * Each reader has a timeline of taps: the gaps between them are random
+ * (exponential, for NFC_SIM_RATE taps a minute), and each card stays between
+ * half and one and a half times NFC_SIM_HOLD. The second of two cards held
+ * together comes NFC_SIM_STAGGER ms after the first, on average, and they
+ * leave together. The cards are drawn from
+ * NFC_SIM_CARDS by weight: made up cards numbered at random from a pool of
+ * NFC_SIM_POOL, so some come back, or the targets of captured nfc-list output,
+ * replayed as they were read. Nothing runs between commands - the timeline is
+ * brought up to date when a command looks at the field.
+ *
+ * Commands take as long as they do on a PN532 on the UART:
+ *  - every command costs a frame each way, SIM_FRAME_MS
+ *  - a poll tries each target type in turn, uiPeriod * 150ms each, until a
+ *    card of that type is in the field when its turn comes
+ *  - a select or list that finds no card times out after SIM_NO_CARD_MS
+ *  - activating a card costs its type's time: anticollision and select for
+ *    type A, plus RATS for ISO 14443-4 cards, ATTRIB for type B...
+ * Waits end early, with NFC_EOPABORTED, when nfc_abort_command() is called.
+ */
+#include <math.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "nfc.h"
+#include "nfc-types.h"
+
+#include "nfc_sim.h"
+
+// Definitions
+#define SIM_FRAME_MS        2       // a command and its answer on the UART
+#define SIM_NO_CARD_MS      5       // a select no card answers
+#define SIM_STEP_MS         5       // how often a wait looks for an abort
+#define SIM_POLL_UNIT_MS  150       // poll period unit of InAutoPoll
+#define SIM_LINE_MAX      512
+#define SIM_BYTES_MAX     256       // hex bytes read from one line of a capture
+
+#define SIM_CAPTURE        -1       // a card's kind: replayed from a capture
+
+// the made up cards
+enum { SIM_MIFARE, SIM_DESFIRE, SIM_FELICA, SIM_TYPEB, SIM_JEWEL };
+static const char *aszKinds[] = { "mifare", "desfire", "felica", "typeb", "jewel" };
+#define SIM_KINDS   (sizeof(aszKinds) / sizeof(aszKinds[0]))
+
+// a card NFC_SIM_CARDS names
+typedef struct {
+  int         nKind;            // SIM_... or SIM_CAPTURE
+  nfc_target  nt;               // with SIM_CAPTURE
+  uint32_t    uiWeight;
+} sim_card;
+
+// a simulated reader
+struct nfc_device {
+  int           nId;
+  char          szName[48];
+  int           nLastError;
+  atomic_bool   bAbort;         // nfc_abort_command() called: the next wait ends
+
+  // configuration
+  sim_card      aCards[NFC_SIM_MAX_CARDS];
+  size_t        szCards;
+  uint32_t      uiTotalWeight;
+  uint32_t      uiRate;
+  uint32_t      uiHoldMs;
+  uint32_t      uiMulti;
+  uint32_t      uiStaggerMs;
+  uint32_t      uiErrors;
+  uint32_t      uiPool;
+  uint64_t      ullRandom;
+
+  // the tap in progress, or the next
+  uint64_t      ullArriveMs;
+  uint64_t      ullSecondMs;    // the second card arrives, with two
+  uint64_t      ullLeaveMs;
+  nfc_target    antField[2];
+  size_t        szField;
+  bool          bSeen;
+
+  nfc_sim_stats stats;
+};
+
+static int nContext;            // what an nfc_context points at
+
+// ---------------------------------------------------------------------------
+// Internal function - milliseconds on CLOCK_MONOTONIC
+//
+static uint64_t monotonicMillisecs( void ){
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return( (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000 );
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - an environment variable as a number, else uiDefault
+//
+static uint32_t envNumber( const char *szName, uint32_t uiDefault ){
+  const char *szValue = getenv( szName );
+
+  return( szValue != NULL && *szValue != '\0' ? (uint32_t)strtoul( szValue, NULL, 10 ) : uiDefault );
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - xorshift64* random numbers, one sequence per reader
+//
+static uint64_t nextRandom( nfc_device *pnd ){
+  pnd->ullRandom ^= pnd->ullRandom >> 12;
+  pnd->ullRandom ^= pnd->ullRandom << 25;
+  pnd->ullRandom ^= pnd->ullRandom >> 27;
+  return( pnd->ullRandom * 0x2545F4914F6CDD1Dull );
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - uniform in [0, 1)
+//
+static double randomFraction( nfc_device *pnd ){
+  return( (double)(nextRandom( pnd ) >> 11) * (1.0 / 9007199254740992.0) );
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - made up card number uiSerial of a kind. The same
+// number is the same card, at any reader
+//
+static void makeCard( int nKind, uint32_t uiSerial, nfc_target *pnt ){
+  static const uint8_t abtDesfireAts[] = { 0x06, 0x75, 0x77, 0x81, 0x02, 0x80 };
+  static const uint8_t abtFelicaPad[] = { 0x03, 0x01, 0x4b, 0x02, 0x4f, 0x49, 0x93, 0xff };
+  uint32_t x = (uiSerial + 1) * 2654435761u + (uint32_t)nKind * 0x01000193u;
+  uint8_t abtSerial[4] = { (uint8_t)(x >> 24), (uint8_t)(x >> 16), (uint8_t)(x >> 8), (uint8_t)x };
+  nfc_iso14443a_info *pnai = &pnt->nti.nai;
+
+  memset( pnt, 0, sizeof(*pnt) );
+  switch( nKind ){
+    case SIM_MIFARE:          // Classic 1K, 4 byte NUID
+      pnt->nm.nmt = NMT_ISO14443A;
+      pnt->nm.nbr = NBR_106;
+      pnai->abtAtqa[1] = 0x04;
+      pnai->btSak = 0x08;
+      pnai->szUidLen = 4;
+      memcpy( pnai->abtUid, abtSerial, 4 );
+      if( pnai->abtUid[0] == 0x88 )     // not the cascade tag
+        pnai->abtUid[0] = 0x89;
+      break;
+    case SIM_DESFIRE:         // EV1, 7 byte UID, ISO 14443-4
+      pnt->nm.nmt = NMT_ISO14443A;
+      pnt->nm.nbr = NBR_106;
+      pnai->abtAtqa[0] = 0x03;
+      pnai->abtAtqa[1] = 0x44;
+      pnai->btSak = 0x20;
+      pnai->szUidLen = 7;
+      pnai->abtUid[0] = 0x04;
+      memcpy( &pnai->abtUid[1], abtSerial, 4 );
+      pnai->abtUid[5] = 0x2b;
+      pnai->abtUid[6] = 0x80;
+      pnai->szAtsLen = sizeof(abtDesfireAts);
+      memcpy( pnai->abtAts, abtDesfireAts, sizeof(abtDesfireAts) );
+      break;
+    case SIM_FELICA:
+      pnt->nm.nmt = NMT_FELICA;
+      pnt->nm.nbr = NBR_212;
+      pnt->nti.nfi.szLen = 18;
+      pnt->nti.nfi.btResCode = 0x01;
+      pnt->nti.nfi.abtId[0] = 0x01;
+      pnt->nti.nfi.abtId[1] = 0x2e;
+      memcpy( &pnt->nti.nfi.abtId[2], abtSerial, 4 );
+      memcpy( pnt->nti.nfi.abtPad, abtFelicaPad, sizeof(abtFelicaPad) );
+      pnt->nti.nfi.abtSysCode[0] = 0x88;
+      pnt->nti.nfi.abtSysCode[1] = 0xb4;
+      break;
+    case SIM_TYPEB:
+      pnt->nm.nmt = NMT_ISO14443B;
+      pnt->nm.nbr = NBR_106;
+      memcpy( pnt->nti.nbi.abtPupi, abtSerial, 4 );
+      pnt->nti.nbi.abtProtocolInfo[1] = 0x81;   // 256 byte frames, ISO 14443-4
+      pnt->nti.nbi.abtProtocolInfo[2] = 0x71;
+      break;
+    default:                  // SIM_JEWEL
+      pnt->nm.nmt = NMT_JEWEL;
+      pnt->nm.nbr = NBR_106;
+      pnt->nti.nji.btSensRes[0] = 0x0c;
+      memcpy( pnt->nti.nji.btId, abtSerial, 4 );
+      break;
+  }
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - a card drawn from NFC_SIM_CARDS, by weight
+//
+static void drawCard( nfc_device *pnd, nfc_target *pnt ){
+  uint32_t uiDraw = (uint32_t)(nextRandom( pnd ) % pnd->uiTotalWeight);
+  size_t i;
+
+  for( i=0 ; uiDraw >= pnd->aCards[i].uiWeight ; i++ )
+    uiDraw -= pnd->aCards[i].uiWeight;
+  if( pnd->aCards[i].nKind == SIM_CAPTURE )
+    *pnt = pnd->aCards[i].nt;
+  else
+    makeCard( pnd->aCards[i].nKind, (uint32_t)(nextRandom( pnd ) % pnd->uiPool), pnt );
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - the tap after the one that ended at ullFromMs
+//
+static void scheduleTap( nfc_device *pnd, uint64_t ullFromMs ){
+  double dGapMs = -log( 1.0 - randomFraction( pnd ) ) * 60000.0 / pnd->uiRate;
+  int nTries;
+
+  pnd->ullArriveMs = ullFromMs + (uint64_t)dGapMs;
+  pnd->ullLeaveMs = pnd->ullArriveMs + 1 +
+                    (uint64_t)(pnd->uiHoldMs * (0.5 + randomFraction( pnd )));
+  pnd->ullSecondMs = pnd->ullArriveMs;
+  pnd->bSeen = false;
+  drawCard( pnd, &pnd->antField[0] );
+  pnd->szField = 1;
+  if( nextRandom( pnd ) % 100 >= pnd->uiMulti )
+    return;
+  // a second card, held with the first. Not the same one again
+  for( nTries=0 ; nTries < 8 && pnd->szField == 1 ; nTries++ ){
+    drawCard( pnd, &pnd->antField[1] );
+    if( memcmp( &pnd->antField[0], &pnd->antField[1], sizeof(nfc_target) ) != 0 )
+      pnd->szField = 2;
+  }
+  // placed a little later, and held as long as the first
+  if( pnd->szField == 2 && pnd->uiStaggerMs > 0 ){
+    dGapMs = pnd->uiStaggerMs * (0.5 + randomFraction( pnd ));
+    pnd->ullSecondMs += (uint64_t)dGapMs;
+    pnd->ullLeaveMs += (uint64_t)dGapMs;
+  }
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - bring the timeline up to ullNowMs
+//
+// returns: number of cards in the field now
+//
+static size_t updateField( nfc_device *pnd, uint64_t ullNowMs ){
+  if( pnd->uiRate == 0 )
+    return( 0 );
+  while( ullNowMs >= pnd->ullLeaveMs ){
+    pnd->stats.uiTaps++;
+    if( !pnd->bSeen )
+      pnd->stats.uiMissed++;
+    scheduleTap( pnd, pnd->ullLeaveMs );
+  }
+  if( ullNowMs < pnd->ullArriveMs )
+    return( 0 );
+  return( ullNowMs >= pnd->ullSecondMs ? pnd->szField : 1 );
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - a card of this tap was found
+//
+static void noteSeen( nfc_device *pnd, uint64_t ullNowMs ){
+  uint32_t uiLatencyMs;
+
+  if( pnd->bSeen )
+    return;
+  pnd->bSeen = true;
+  uiLatencyMs = (uint32_t)(ullNowMs - pnd->ullArriveMs);
+  pnd->stats.uiSeen++;
+  pnd->stats.ullLatencyMs += uiLatencyMs;
+  if( uiLatencyMs > pnd->stats.uiMaxLatencyMs )
+    pnd->stats.uiMaxLatencyMs = uiLatencyMs;
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - does the card answer a request for this target type?
+// A FeliCa card answers at either baud rate
+//
+static bool answers( const nfc_target *pnt, const nfc_modulation nm ){
+  return( pnt->nm.nmt == nm.nmt && (nm.nmt == NMT_FELICA || pnt->nm.nbr == nm.nbr) );
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - milliseconds to activate a card of its type
+//
+static uint32_t activationMs( const nfc_target *pnt ){
+  switch( pnt->nm.nmt ){
+    case NMT_ISO14443A:
+      return( pnt->nti.nai.szAtsLen ? 10 : 5 );      // and RATS
+    case NMT_ISO14443B:
+      return( 8 );
+    case NMT_FELICA:
+      return( pnt->nm.nbr == NBR_424 ? 3 : 4 );
+    case NMT_JEWEL:
+      return( 6 );
+    default:
+      return( 5 );
+  }
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - wait until ullUntilMs, unless aborted
+//
+// returns: 0 if OK, else NFC_EOPABORTED
+//
+static int waitUntil( nfc_device *pnd, uint64_t ullUntilMs ){
+  struct timespec ts;
+  uint64_t ullNowMs, ullStepMs;
+
+  for( ;; ){
+    if( atomic_exchange (&pnd->bAbort, false) ){
+      pnd->nLastError = NFC_EOPABORTED;
+      return( NFC_EOPABORTED );
+    }
+    if( (ullNowMs = monotonicMillisecs()) >= ullUntilMs )
+      return( 0 );
+    ullStepMs = ullUntilMs - ullNowMs < SIM_STEP_MS ? ullUntilMs - ullNowMs : SIM_STEP_MS;
+    ts.tv_sec = 0;
+    ts.tv_nsec = (long)ullStepMs * 1000000;
+    nanosleep( &ts, NULL );
+  }
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - send a command: a frame's time, and NFC_SIM_ERRORS of
+// them fail
+//
+// returns: 0 if OK, else < 0
+//
+static int sendCommand( nfc_device *pnd ){
+  int res;
+
+  pnd->stats.uiCommands++;
+  pnd->nLastError = 0;
+  if( (res = waitUntil( pnd, monotonicMillisecs() + SIM_FRAME_MS )) < 0 )
+    return( res );
+  if( nextRandom( pnd ) % 100 < pnd->uiErrors ){
+    pnd->stats.uiErrors++;
+    pnd->nLastError = NFC_ERFTRANS;
+    return( NFC_ERFTRANS );
+  }
+  return( 0 );
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - activate a card in the field, as the target type asked for
+//
+// returns: 0 if OK, else NFC_EOPABORTED
+//
+static int activateCard( nfc_device *pnd, const nfc_target *pntField, const nfc_modulation nm, nfc_target *pnt ){
+  int res;
+
+  if( (res = waitUntil( pnd, monotonicMillisecs() + activationMs( pntField ) )) < 0 )
+    return( res );
+  if( pnt != NULL ){
+    *pnt = *pntField;
+    pnt->nm.nbr = nm.nbr;
+  }
+  noteSeen( pnd, monotonicMillisecs() );
+  return( 0 );
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - the card's NFC_SIM_CARDS entry, name[:weight], added
+//
+// returns: 0 if OK, else -1
+//
+static int addCards( nfc_device *pnd, char *szEntry ){
+  nfc_target ant[NFC_SIM_MAX_CARDS];
+  char *pColon = strrchr( szEntry, ':' );
+  uint32_t uiWeight = 1;
+  size_t i;
+  int nFound;
+
+  if( pColon != NULL && pColon[1] != '\0' && strspn( pColon + 1, "0123456789" ) == strlen( pColon + 1 ) ){
+    uiWeight = (uint32_t)strtoul( pColon + 1, NULL, 10 );
+    *pColon = '\0';
+  }
+  for( i=0 ; i < SIM_KINDS ; i++ ){
+    if( strcasecmp( szEntry, aszKinds[i] ) == 0 )
+      break;
+  }
+  if( i < SIM_KINDS ){
+    if( pnd->szCards == NFC_SIM_MAX_CARDS )
+      return( -1 );
+    pnd->aCards[pnd->szCards].nKind = (int)i;
+    pnd->aCards[pnd->szCards++].uiWeight = uiWeight;
+    pnd->uiTotalWeight += uiWeight;
+    return( 0 );
+  }
+
+  if( (nFound = parseNFCcapture( szEntry, ant, NFC_SIM_MAX_CARDS - pnd->szCards )) <= 0 ){
+    fprintf(stderr, "nfc_sim: no cards in %s\n", szEntry);
+    return( -1 );
+  }
+  for( i=0 ; i < (size_t)nFound ; i++ ){
+    pnd->aCards[pnd->szCards].nKind = SIM_CAPTURE;
+    pnd->aCards[pnd->szCards].nt = ant[i];
+    pnd->aCards[pnd->szCards++].uiWeight = uiWeight;
+    pnd->uiTotalWeight += uiWeight;
+  }
+  return( 0 );
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - the hex bytes of a line of nfc-list output, e.g.
+// "1f  29  e0  b2"
+//
+// returns: number of bytes written to abt[]
+//
+static size_t parseHex( const char *szHex, uint8_t abt[], size_t szMax ){
+  size_t szBytes = 0;
+  unsigned long ulByte;
+  char *pEnd;
+
+  while( szBytes < szMax ){
+    ulByte = strtoul( szHex, &pEnd, 16 );
+    if( pEnd == szHex || ulByte > 0xff )
+      break;
+    abt[szBytes++] = (uint8_t)ulByte;
+    szHex = pEnd;
+  }
+  return( szBytes );
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - a field of a target, from a line "label: hex bytes"
+//
+static void parseField( nfc_target *pnt, const char *szLabel, const char *szHex ){
+  uint8_t abt[SIM_BYTES_MAX];
+  size_t szBytes = parseHex( szHex, abt, sizeof(abt) );
+  nfc_iso14443a_info *pnai = &pnt->nti.nai;
+
+#define COPY_FIELD( field )     memcpy( field, abt, szBytes < sizeof(field) ? szBytes : sizeof(field) )
+  switch( pnt->nm.nmt ){
+    case NMT_ISO14443A:
+      if( strncmp( szLabel, "ATQA", 4 ) == 0 )
+        COPY_FIELD( pnai->abtAtqa );
+      else if( strncmp( szLabel, "UID", 3 ) == 0 && szBytes <= sizeof(pnai->abtUid) ){
+        pnai->szUidLen = szBytes;
+        COPY_FIELD( pnai->abtUid );
+      }
+      else if( strncmp( szLabel, "SAK", 3 ) == 0 && szBytes == 1 )
+        pnai->btSak = abt[0];
+      else if( strcmp( szLabel, "ATS" ) == 0 && szBytes <= sizeof(pnai->abtAts) ){
+        pnai->szAtsLen = szBytes;
+        COPY_FIELD( pnai->abtAts );
+      }
+      break;
+    case NMT_FELICA:
+      if( strncmp( szLabel, "ID", 2 ) == 0 )
+        COPY_FIELD( pnt->nti.nfi.abtId );
+      else if( strncmp( szLabel, "Parameter", 9 ) == 0 )
+        COPY_FIELD( pnt->nti.nfi.abtPad );
+      else if( strncmp( szLabel, "System Code", 11 ) == 0 )
+        COPY_FIELD( pnt->nti.nfi.abtSysCode );
+      break;
+    case NMT_ISO14443B:
+      if( strcmp( szLabel, "PUPI" ) == 0 )
+        COPY_FIELD( pnt->nti.nbi.abtPupi );
+      else if( strcmp( szLabel, "Application Data" ) == 0 )
+        COPY_FIELD( pnt->nti.nbi.abtApplicationData );
+      else if( strcmp( szLabel, "Protocol Info" ) == 0 )
+        COPY_FIELD( pnt->nti.nbi.abtProtocolInfo );
+      break;
+    case NMT_JEWEL:
+      if( strncmp( szLabel, "ATQA", 4 ) == 0 )
+        COPY_FIELD( pnt->nti.nji.btSensRes );
+      else if( strcmp( szLabel, "4-LSB JEWELID" ) == 0 )
+        COPY_FIELD( pnt->nti.nji.btId );
+      break;
+    default:
+      break;
+  }
+#undef COPY_FIELD
+}
+
+// ---------------------------------------------------------------------------
+// read the targets from a file of nfc-list or nfc-poll output, such as
+// visa.output.txt: each "... target:" line starts one, and its fields follow.
+// Type A, type B, FeliCa and Jewel targets are read; the rest are skipped,
+// as are a type A target without a UID, and the notes starting with "*"
+//
+// returns: number of targets written to ant[], else -1 (can't be read)
+//
+int parseNFCcapture( const char *szPath, nfc_target ant[], size_t szMax ){
+  static const struct {
+    const char          *szHeader;
+    nfc_modulation_type  nmt;
+  } aHeaders[] = {
+    { "ISO/IEC 14443A (", NMT_ISO14443A },
+    { "ISO/IEC 14443-4B (", NMT_ISO14443B },
+    { "FeliCa (", NMT_FELICA },
+    { "Innovision Jewel (", NMT_JEWEL },
+  };
+  char szLine[SIM_LINE_MAX], *pColon, *pLabel, *pEnd;
+  nfc_target *pnt = NULL;
+  size_t szFound = 0, i;
+  FILE *fp;
+
+  if( (fp = fopen( szPath, "r" )) == NULL )
+    return( -1 );
+  while( fgets( szLine, sizeof(szLine), fp ) != NULL ){
+    if( strstr( szLine, " target:" ) != NULL ){
+      // the one before is done: keep it if it has what a target needs
+      if( pnt != NULL && (pnt->nm.nmt != NMT_ISO14443A || pnt->nti.nai.szUidLen > 0) )
+        szFound++;
+      pnt = NULL;
+      for( i=0 ; i < sizeof(aHeaders) / sizeof(aHeaders[0]) ; i++ ){
+        if( strncmp( szLine, aHeaders[i].szHeader, strlen( aHeaders[i].szHeader ) ) == 0 )
+          break;
+      }
+      if( i == sizeof(aHeaders) / sizeof(aHeaders[0]) || szFound == szMax )
+        continue;
+      pnt = &ant[szFound];
+      memset( pnt, 0, sizeof(*pnt) );
+      pnt->nm.nmt = aHeaders[i].nmt;
+      switch( atoi( szLine + strlen( aHeaders[i].szHeader ) ) ){
+        case 212: pnt->nm.nbr = NBR_212; break;
+        case 424: pnt->nm.nbr = NBR_424; break;
+        case 847: pnt->nm.nbr = NBR_847; break;
+        default:  pnt->nm.nbr = NBR_106; break;
+      }
+      if( pnt->nm.nmt == NMT_FELICA ){
+        pnt->nti.nfi.szLen = 18;
+        pnt->nti.nfi.btResCode = 0x01;
+      }
+      continue;
+    }
+
+    pLabel = szLine + strspn( szLine, " \t" );
+    if( pnt == NULL || *pLabel == '*' || (pColon = strchr( pLabel, ':' )) == NULL )
+      continue;
+    for( pEnd = pColon ; pEnd > pLabel && pEnd[-1] == ' ' ; pEnd-- )
+      ;
+    *pEnd = '\0';
+    parseField( pnt, pLabel, pColon + 1 );
+  }
+  if( pnt != NULL && (pnt->nm.nmt != NMT_ISO14443A || pnt->nti.nai.szUidLen > 0) )
+    szFound++;
+  fclose( fp );
+  return( (int)szFound );
+}
+
+// ---------------------------------------------------------------------------
+// what a simulated reader has offered so far, and how soon it was seen. The
+// tap in progress counts once its cards have arrived
+//
+void getNFCsimStats( const nfc_device *pnd, nfc_sim_stats *pStats ){
+  *pStats = pnd->stats;
+  if( pnd->uiRate > 0 && monotonicMillisecs() >= pnd->ullArriveMs )
+    pStats->uiTaps++;
+}
+
+// ===========================================================================
+// the libnfc API
+//
+
+void nfc_init( nfc_context *context ){
+  *context = &nContext;
+}
+
+void nfc_exit( nfc_context *context ){
+  *context = NULL;
+}
+
+size_t nfc_list_devices( nfc_context *context, nfc_connstring connstrings[], size_t connstrings_len ){
+  size_t szReaders = envNumber( "NFC_SIM_READERS", 1 ), i;
+
+  (void)context;
+  for( i=0 ; i < szReaders && i < connstrings_len ; i++ )
+    snprintf( connstrings[i], sizeof(nfc_connstring), "sim:%zu", i );
+  return( i );
+}
+
+// a connstring of NULL opens sim:0
+nfc_device *nfc_open( nfc_context *context, const nfc_connstring connstring ){
+  char szCards[SIM_LINE_MAX], *szEntry, *pSave;
+  nfc_device *pnd;
+  unsigned long ulId = 0;
+  char *pEnd;
+
+  (void)context;
+  if( connstring != NULL ){
+    if( strncmp( connstring, "sim:", 4 ) != 0 )
+      return( NULL );
+    ulId = strtoul( connstring + 4, &pEnd, 10 );
+    if( pEnd == connstring + 4 || *pEnd != '\0' || ulId >= envNumber( "NFC_SIM_READERS", 1 ) )
+      return( NULL );
+  }
+  if( (pnd = calloc( 1, sizeof(*pnd) )) == NULL )
+    return( NULL );
+  pnd->nId = (int)ulId;
+  snprintf( pnd->szName, sizeof(pnd->szName), "sim:%lu - simulated PN532", ulId );
+  atomic_init (&pnd->bAbort, false);
+
+  pnd->uiRate = envNumber( "NFC_SIM_RATE", 20 );
+  pnd->uiHoldMs = envNumber( "NFC_SIM_HOLD", 500 );
+  pnd->uiMulti = envNumber( "NFC_SIM_MULTI", 0 );
+  pnd->uiStaggerMs = envNumber( "NFC_SIM_STAGGER", 0 );
+  pnd->uiErrors = envNumber( "NFC_SIM_ERRORS", 0 );
+  pnd->uiPool = envNumber( "NFC_SIM_POOL", 100 );
+  if( pnd->uiPool == 0 )
+    pnd->uiPool = 1;
+  pnd->ullRandom = (envNumber( "NFC_SIM_SEED", 1 ) + ulId) * 0x9E3779B97F4A7C15ull + 1;
+
+  snprintf( szCards, sizeof(szCards), "%s", getenv( "NFC_SIM_CARDS" ) ? getenv( "NFC_SIM_CARDS" ) : "mifare" );
+  for( szEntry = strtok_r( szCards, ",", &pSave ) ; szEntry != NULL ; szEntry = strtok_r( NULL, ",", &pSave ) ){
+    if( addCards( pnd, szEntry ) != 0 ){
+      free( pnd );
+      return( NULL );
+    }
+  }
+  if( pnd->uiTotalWeight == 0 )
+    pnd->uiRate = 0;            // nothing to tap
+  if( pnd->uiRate > 0 )
+    scheduleTap( pnd, monotonicMillisecs() );
+  return( pnd );
+}
+
+// says what the reader offered, and how soon it was seen
+void nfc_close( nfc_device *pnd ){
+  nfc_sim_stats stats;
+
+  getNFCsimStats( pnd, &stats );
+  if( stats.uiTaps > 0 )
+    fprintf(stderr, "nfc_sim: %s: %u taps, %u seen, %u missed, found after %.0f ms mean (max %u ms);"
+            " %u commands, %u failed\n", pnd->szName, stats.uiTaps, stats.uiSeen, stats.uiMissed,
+            stats.uiSeen ? (double)stats.ullLatencyMs / stats.uiSeen : 0.0, stats.uiMaxLatencyMs,
+            stats.uiCommands, stats.uiErrors);
+  free( pnd );
+}
+
+// safe from a signal handler or another thread: only sets a flag
+int nfc_abort_command( nfc_device *pnd ){
+  atomic_store (&pnd->bAbort, true);
+  return( 0 );
+}
+
+int nfc_idle( nfc_device *pnd ){
+  (void)pnd;
+  return( 0 );
+}
+
+int nfc_initiator_init( nfc_device *pnd ){
+  return( waitUntil( pnd, monotonicMillisecs() + SIM_FRAME_MS ) );
+}
+
+int nfc_device_set_property_bool( nfc_device *pnd, const nfc_property property, const bool bEnable ){
+  (void)pnd;
+  (void)property;
+  (void)bEnable;
+  return( 0 );
+}
+
+// each type in turn, uiPeriod * 150ms each, uiPollNr rounds (0xFF: endless)
+int nfc_initiator_poll_target( nfc_device *pnd, const nfc_modulation *pnmTargetTypes, const size_t szTargetTypes,
+                               const uint8_t uiPollNr, const uint8_t uiPeriod, nfc_target *pnt ){
+  uint64_t ullNowMs;
+  size_t szField, i, j;
+  unsigned int uiRound;
+  int res;
+
+  if( (res = sendCommand( pnd )) < 0 )
+    return( res );
+  for( uiRound=0 ; uiPollNr == 0xFF || uiRound < uiPollNr ; uiRound++ ){
+    for( i=0 ; i < szTargetTypes ; i++ ){
+      ullNowMs = monotonicMillisecs();
+      szField = updateField( pnd, ullNowMs );
+      for( j=0 ; j < szField ; j++ ){
+        if( answers( &pnd->antField[j], pnmTargetTypes[i] ) ){
+          if( (res = activateCard( pnd, &pnd->antField[j], pnmTargetTypes[i], pnt )) < 0 )
+            return( res );
+          return( 1 );
+        }
+      }
+      if( (res = waitUntil( pnd, ullNowMs + SIM_POLL_UNIT_MS * (uiPeriod ? uiPeriod : 1) )) < 0 )
+        return( res );
+    }
+  }
+  pnd->nLastError = NFC_ECHIP;
+  return( NFC_ECHIP );
+}
+
+// every card of the type in the field, through anticollision
+int nfc_initiator_list_passive_targets( nfc_device *pnd, const nfc_modulation nm, nfc_target ant[], const size_t szTargets ){
+  size_t szField, szListed = 0, j;
+  int res;
+
+  if( (res = sendCommand( pnd )) < 0 )
+    return( res );
+  szField = updateField( pnd, monotonicMillisecs() );
+  for( j=0 ; j < szField && szListed < szTargets ; j++ ){
+    if( !answers( &pnd->antField[j], nm ) )
+      continue;
+    if( (res = activateCard( pnd, &pnd->antField[j], nm, &ant[szListed] )) < 0 )
+      return( res );
+    szListed++;
+  }
+  // the last select, that nothing answers
+  if( (res = waitUntil( pnd, monotonicMillisecs() + SIM_NO_CARD_MS )) < 0 )
+    return( res );
+  return( (int)szListed );
+}
+
+// a card of the type - for type A, the one with the UID in pbtInitData if given
+int nfc_initiator_select_passive_target( nfc_device *pnd, const nfc_modulation nm, const uint8_t *pbtInitData,
+                                         const size_t szInitData, nfc_target *pnt ){
+  const nfc_iso14443a_info *pnai;
+  size_t szField, j;
+  int res;
+
+  if( (res = sendCommand( pnd )) < 0 )
+    return( res );
+  szField = updateField( pnd, monotonicMillisecs() );
+  for( j=0 ; j < szField ; j++ ){
+    if( !answers( &pnd->antField[j], nm ) )
+      continue;
+    pnai = &pnd->antField[j].nti.nai;
+    if( nm.nmt == NMT_ISO14443A && szInitData > 0 &&
+        (pnai->szUidLen != szInitData || memcmp( pnai->abtUid, pbtInitData, szInitData ) != 0) )
+      continue;
+    if( (res = activateCard( pnd, &pnd->antField[j], nm, pnt )) < 0 )
+      return( res );
+    return( 1 );
+  }
+  if( (res = waitUntil( pnd, monotonicMillisecs() + SIM_NO_CARD_MS )) < 0 )
+    return( res );
+  return( 0 );
+}
+
+int nfc_initiator_deselect_target( nfc_device *pnd ){
+  return( waitUntil( pnd, monotonicMillisecs() + SIM_FRAME_MS ) );
+}
+
+const char *nfc_device_get_name( nfc_device *pnd ){
+  return( pnd->szName );
+}
+
+int nfc_device_get_last_error( const nfc_device *pnd ){
+  return( pnd->nLastError );
+}
+
+const char *nfc_strerror( const nfc_device *pnd ){
+  switch( pnd->nLastError ){
+    case 0:               return( "Success" );
+    case NFC_EOPABORTED:  return( "Operation aborted" );
+    case NFC_ERFTRANS:    return( "RF Transmission Error" );
+    case NFC_ECHIP:       return( "Device's Internal Chip Error" );
+    default:              return( "Unknown error" );
+  }
+}
+
+void nfc_perror( const nfc_device *pnd, const char *s ){
+  fprintf(stderr, "%s: %s\n", s, nfc_strerror( pnd ));
+}
+
+const char *nfc_version( void ){
+  return( "nfc_sim (libnfc 1.6 API)" );
+}
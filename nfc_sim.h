@@ -0,0 +1,48 @@
+/*
+ * @file nfc_sim.h
+ * @brief public interface of nfc_sim.c - a simulated PN532 behind the libnfc API
+ *
+ * nfc_sim.c is linked in place of -lnfc, so nfc_driver.c and everything above
+ * it run with no reader attached. It is set up by environment variables, read
+ * when a device is opened:
+ *
+ *  NFC_SIM_READERS  readers listed: sim:0, sim:1, ... (default 1)
+ *  NFC_SIM_CARDS    cards tapped, separated by commas, each name[:weight]:
+ *                   mifare, desfire, felica, typeb or jewel for made up cards,
+ *                   or a file of nfc-list output, e.g. visa.output.txt, whose
+ *                   cards are replayed as captured (default mifare)
+ *  NFC_SIM_RATE     taps per minute, per reader, at random (default 20; 0 none)
+ *  NFC_SIM_HOLD     mean milliseconds a card stays on the reader (default 500)
+ *  NFC_SIM_MULTI    percentage of taps with two cards held together (default 0)
+ *  NFC_SIM_STAGGER  mean milliseconds the second of two comes after the first (default 0)
+ *  NFC_SIM_ERRORS   percentage of commands failing with NFC_ERFTRANS (default 0)
+ *  NFC_SIM_POOL     made up cards of each kind, so some are tapped again (default 100)
+ *  NFC_SIM_SEED     random seed; each reader adds its number (default 1)
+ */
+#ifndef _NFC_SIM_H_
+#define _NFC_SIM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "nfc-types.h"
+
+// Definitions
+#define NFC_SIM_MAX_CARDS   32      // cards named in NFC_SIM_CARDS, captures included
+
+// what a simulated reader offered, and how soon its cards were seen
+typedef struct {
+  uint32_t  uiTaps;             // taps begun
+  uint32_t  uiSeen;             // taps a command found a card of
+  uint32_t  uiMissed;           // taps whose cards left without being found
+  uint32_t  uiCommands;
+  uint32_t  uiErrors;           // commands failed on purpose
+  uint64_t  ullLatencyMs;       // from the cards arriving to being found, summed
+  uint32_t  uiMaxLatencyMs;
+} nfc_sim_stats;
+
+// function prototypes
+int  parseNFCcapture( const char *szPath, nfc_target ant[], size_t szMax );
+void getNFCsimStats( const nfc_device *pnd, nfc_sim_stats *pStats );
+
+#endif // _NFC_SIM_H_
@@ -0,0 +1,442 @@
+/*
+ * @file nfc_sim_test.c
+ * @brief unit test for nfc_sim.c, through nfc_driver.c
+ *
+ * runs standalone - no NFC device needed; run it from the source directory,
+ * where the captures are. Reads the captures, then polls, lists, selects and
+ * aborts simulated readers through the driver, and checks the cards found,
+ * the errors, and how long each took against the RF timing model.
+ */
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nfc.h"
+#include "nfc-types.h"
+#include "nfc-utils.h"
+
+#include "nfc_driver.h"
+#include "nfc_encode.h"
+#include "nfc_record.h"
+#include "nfc_sim.h"
+#include "unit_test.h"
+
+// ---------------------------------------------------------------------------
+// milliseconds on CLOCK_MONOTONIC
+//
+uint64_t millisecs( void ){
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return( (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000 );
+}
+
+// ---------------------------------------------------------------------------
+// set up the simulated readers opened from now on
+//
+void simulate( const char *szCards, const char *szRate, const char *szHold, const char *szMulti,
+               const char *szErrors ){
+  setenv( "NFC_SIM_CARDS", szCards, 1 );
+  setenv( "NFC_SIM_RATE", szRate, 1 );
+  setenv( "NFC_SIM_HOLD", szHold, 1 );
+  setenv( "NFC_SIM_MULTI", szMulti, 1 );
+  setenv( "NFC_SIM_ERRORS", szErrors, 1 );
+}
+
+// ---------------------------------------------------------------------------
+// the captures read as nfc-list printed them
+//
+void testCaptures( void ){
+  static const uint8_t abtVisaAts[] = { 0x78, 0x80, 0x82, 0x02, 0x80, 0x31, 0x80, 0x66, 0xb0,
+                                        0x84, 0x12, 0x01, 0x6e, 0x01, 0x83, 0x00, 0x90, 0x00 };
+  static const uint8_t abtSnapperAts[] = { 0x78, 0x77, 0xb9, 0x02, 0x01, 0x11, 0x20, 0x03 };
+  nfc_target ant[4];
+  nfc_iso14443a_info *pnai = &ant[0].nti.nai;
+
+  CHECK( parseNFCcapture( "visa.output.txt", ant, 4 ) == 1 );
+  CHECK( ant[0].nm.nmt == NMT_ISO14443A && ant[0].nm.nbr == NBR_106 );
+  CHECK( pnai->abtAtqa[0] == 0x00 && pnai->abtAtqa[1] == 0x04 && pnai->btSak == 0x28 );
+  CHECK( pnai->szUidLen == 4 && memcmp( pnai->abtUid, "\x1f\x29\xe0\xb2", 4 ) == 0 );
+  CHECK( pnai->szAtsLen == sizeof(abtVisaAts) && memcmp( pnai->abtAts, abtVisaAts, sizeof(abtVisaAts) ) == 0 );
+
+  // a UID labelled NFCID3 is still the UID
+  CHECK( parseNFCcapture( "snapper.output.txt", ant, 4 ) == 1 );
+  CHECK( pnai->szUidLen == 4 && memcmp( pnai->abtUid, "\x08\x22\xc9\x63", 4 ) == 0 );
+  CHECK( pnai->btSak == 0x20 && pnai->szAtsLen == sizeof(abtSnapperAts) &&
+         memcmp( pnai->abtAts, abtSnapperAts, sizeof(abtSnapperAts) ) == 0 );
+
+  // no ATS: not ISO 14443-4
+  CHECK( parseNFCcapture( "white.output.txt", ant, 4 ) == 1 );
+  CHECK( pnai->szUidLen == 4 && memcmp( pnai->abtUid, "\x5d\x17\xd0\x23", 4 ) == 0 );
+  CHECK( pnai->btSak == 0x08 && pnai->szAtsLen == 0 );
+
+  CHECK( parseNFCcapture( "white.output.txt", ant, 0 ) == 0 );
+  CHECK( parseNFCcapture( "no-such.output.txt", ant, 4 ) == -1 );
+}
+
+// ---------------------------------------------------------------------------
+// a target printed as nfc-list does, and read back
+//
+// returns: the number of targets read back, else -1
+//
+int printAndParse( const nfc_target *pnt, nfc_target *pntRead ){
+  char szPath[] = "/tmp/nfc_sim_testXXXXXX";
+  int fd, fdStdout, nRead;
+
+  if( (fd = mkstemp( szPath )) < 0 )
+    return( -1 );
+  fflush( stdout );
+  fdStdout = dup( STDOUT_FILENO );
+  dup2( fd, STDOUT_FILENO );
+  print_nfc_target( *pnt, true );
+  fflush( stdout );
+  dup2( fdStdout, STDOUT_FILENO );
+  close( fdStdout );
+  close( fd );
+  nRead = parseNFCcapture( szPath, pntRead, 1 );
+  unlink( szPath );
+  return( nRead );
+}
+
+// ---------------------------------------------------------------------------
+// each kind of made up card is found as its own type, only by a poll for
+// it, and reads back the same from nfc-list output
+//
+void testKinds( void ){
+  static const struct {
+    const char          *szKind;
+    nfc_modulation_type  nmt;
+  } aKinds[] = {
+    { "mifare", NMT_ISO14443A }, { "desfire", NMT_ISO14443A }, { "felica", NMT_FELICA },
+    { "typeb", NMT_ISO14443B }, { "jewel", NMT_JEWEL },
+  };
+  nfc_modulation anm[NFC_MAX_MODULATIONS];
+  nfc_target nt, ntRead;
+  nfc_reader reader;
+  uint64_t ullStartMs;
+  size_t i;
+
+  for( i=0 ; i < sizeof(aKinds) / sizeof(aKinds[0]) ; i++ ){
+    simulate( aKinds[i].szKind, "6000", "5000", "0", "0" );
+    CHECK( openNFCreader( &reader, 0, "sim:0" ) == 0 );
+    if( reader.pnd == NULL )
+      continue;
+    usleep( 100000 );          // a card is there by now, for certain
+    CHECK( pollNFCreader( &reader, &nt, 1, 1 ) == 1 && nt.nm.nmt == aKinds[i].nmt );
+    CHECK( printAndParse( &nt, &ntRead ) == 1 && memcmp( &nt, &ntRead, sizeof(nt) ) == 0 );
+
+    // polled only for a type it isn't, a round finds nothing
+    CHECK( parseNFCmodulations( aKinds[i].nmt == NMT_JEWEL ? "14443a" : "jewel", anm, NFC_MAX_MODULATIONS ) == 1 );
+    CHECK( setNFCmodulations( &reader, anm, 1, true ) == 0 );
+    ullStartMs = millisecs();
+    CHECK( pollNFCreader( &reader, &nt, 1, 1 ) == 0 );
+    CHECK( millisecs() - ullStartMs >= 150 );
+    closeNFCreader( &reader );
+  }
+
+  // a FeliCa card answers at the baud rate polled for
+  simulate( "felica", "6000", "5000", "0", "0" );
+  CHECK( openNFCreader( &reader, 0, "sim:0" ) == 0 );
+  usleep( 100000 );
+  CHECK( parseNFCmodulations( "felica424", anm, NFC_MAX_MODULATIONS ) == 1 );
+  CHECK( setNFCmodulations( &reader, anm, 1, true ) == 0 );
+  CHECK( pollNFCreader( &reader, &nt, 1, 1 ) == 1 && nt.nm.nmt == NMT_FELICA && nt.nm.nbr == NBR_424 );
+  closeNFCreader( &reader );
+}
+
+// ---------------------------------------------------------------------------
+// a reader that has only seen Jewel tags polls for them alone. An endless
+// poll still gives way to a probe of the other types now and then, so the
+// first MIFARE card is found
+//
+void testLeftOut( void ){
+  nfc_modulation nmJewel = { .nmt = NMT_JEWEL, .nbr = NBR_106 };
+  nfc_modulation anm[NFC_MAX_MODULATIONS];
+  nfc_reader reader;
+  nfc_target nt;
+  uint64_t ullStartMs, ullTookMs;
+
+  simulate( "mifare", "6000", "10000", "0", "0" );
+  CHECK( openNFCreader( &reader, 0, NULL ) == 0 );
+  noteNFChit( &reader, &nmJewel );
+  CHECK( selectNFCmodulations( &reader, anm ) == 5 );      // the first cycle probes
+  ullStartMs = millisecs();
+  CHECK( pollNFCreader( &reader, &nt, NFC_POLL_ENDLESS, 1 ) == 0 );
+  ullTookMs = millisecs() - ullStartMs;
+  CHECK( ullTookMs >= NFC_PROBE_INTERVAL * 150 && ullTookMs < NFC_PROBE_INTERVAL * 150 + 100 );
+  CHECK( pollNFCreader( &reader, &nt, NFC_POLL_ENDLESS, 1 ) == 1 && nt.nm.nmt == NMT_ISO14443A );
+  closeNFCreader( &reader );
+}
+
+// ---------------------------------------------------------------------------
+// readers listed and opened by connstring, and captures replayed
+//
+void testReplay( void ){
+  nfc_connstring aConnstrings[MAX_DEVICE_COUNT];
+  nfc_reader reader;
+  nfc_sim_stats stats;
+  nfc_target nt;
+  const uint8_t *pbtUid;
+  int res, nVisa = 0, nWhite = 0;
+
+  setenv( "NFC_SIM_READERS", "3", 1 );
+  CHECK( listNFCreaders( aConnstrings, MAX_DEVICE_COUNT ) == 3 && strcmp( aConnstrings[2], "sim:2" ) == 0 );
+  simulate( "mifare", "20", "500", "0", "0" );
+  CHECK( openNFCreader( &reader, 3, "sim:3" ) == -1 );
+  CHECK( openNFCreader( &reader, 0, "pn532_uart:/dev/ttyAMA0" ) == -1 );
+  simulate( "visa.output.txt,no-such.output.txt", "20", "500", "0", "0" );
+  CHECK( openNFCreader( &reader, 0, NULL ) == -1 );
+  setenv( "NFC_SIM_READERS", "1", 1 );
+
+  // 3 to 1 by weight. The endless poll finds each card as soon as its
+  // type's turn comes, and the card is followed until it's gone
+  simulate( "visa.output.txt:3,white.output.txt", "600", "300", "0", "0" );
+  CHECK( openNFCreader( &reader, 2, NULL ) == 0 );
+  CHECK( strcmp( getNFCreaderName( &reader ), "sim:0 - simulated PN532" ) == 0 );
+  while( nVisa + nWhite < 16 && (res = pollNFCreader( &reader, &nt, NFC_POLL_ENDLESS, 1 )) >= 0 ){
+    if( res == 0 )
+      continue;               // the first cycles probe every type, one round each
+    CHECK( targetUID( &nt, &pbtUid ) == 4 );
+    nVisa += pbtUid[0] == 0x1f;
+    nWhite += pbtUid[0] == 0x5d;
+    while( checkNFCtarget( &reader, &nt ) == 1 )
+      usleep( 10000 );
+  }
+  CHECK( nVisa + nWhite == 16 && nVisa > nWhite && nWhite > 0 );
+
+  getNFCsimStats( reader.pnd, &stats );
+  CHECK( stats.uiSeen >= 16 && stats.uiErrors == 0 );
+  // after the first, A is polled alone: a card waits 75ms for its turn, on
+  // average. One can come and go unseen while a cycle probes the other types
+  printf("captures replayed: %u taps, %u missed, found after %llu ms mean, %u ms max\n",
+         stats.uiTaps, stats.uiMissed, (unsigned long long)(stats.ullLatencyMs / stats.uiSeen),
+         stats.uiMaxLatencyMs );
+  CHECK( stats.ullLatencyMs / stats.uiSeen < 150 );
+  closeNFCreader( &reader );
+}
+
+// ---------------------------------------------------------------------------
+// two cards held together are both listed, and each is selected by its UID
+// until it's taken away
+//
+void testMultiAndPresence( void ){
+  nfc_target ant[NFC_MAX_TARGETS], nt;
+  nfc_reader reader;
+  uint64_t ullStartMs;
+  int n = 0, i;
+
+  simulate( "mifare,desfire", "6000", "600", "100", "0" );
+  CHECK( openNFCreader( &reader, 0, NULL ) == 0 );
+  for( i=0 ; i < 20 && (n = listNFCtargets( &reader, ant, NFC_MAX_TARGETS )) == 0 ; i++ )
+    usleep( 20000 );
+  CHECK( n == 2 && !sameTarget( &ant[0], &ant[1] ) );
+  if( n != 2 ){
+    closeNFCreader( &reader );
+    return;
+  }
+  CHECK( listNFCtargets( &reader, ant, 1 ) == 1 );
+
+  ullStartMs = millisecs();
+  while( checkNFCtarget( &reader, &ant[1] ) == 1 && millisecs() - ullStartMs < 2000 )
+    usleep( 20000 );
+  CHECK( millisecs() - ullStartMs < 1000 );        // held 300-900ms
+  CHECK( checkNFCtarget( &reader, &ant[0] ) == 0 );
+
+  // another card, with the UID of one that left, isn't that card
+  usleep( 100000 );
+  CHECK( pollNFCreader( &reader, &nt, NFC_POLL_ENDLESS, 1 ) == 1 );
+  if( nt.nm.nmt == NMT_ISO14443A ){
+    CHECK( checkNFCtarget( &reader, &nt ) == 1 );
+    nt.nti.nai.abtUid[1] ^= 0xff;
+    CHECK( checkNFCtarget( &reader, &nt ) == 0 );
+  }
+  closeNFCreader( &reader );
+}
+
+// ---------------------------------------------------------------------------
+// a card placed beside one already followed is picked up at the next list,
+// and both are seen to leave. Following them isn't polling: the reader's
+// counts and the order it polls types in are left alone
+//
+void testStaggeredPresence( void ){
+  nfc_modulation anm[NFC_MAX_MODULATIONS];
+  nfc_transaction atx[2 * NFC_MAX_TARGETS];
+  nfc_target ant[NFC_MAX_TARGETS], ntSecond;
+  nfc_presence presence;
+  nfc_reader reader;
+  uint64_t ullStartMs, ullSecondMs = 0;
+  uint32_t auiDwellMs[2] = { 0, 0 }, uiPolls, uiTargets, uiCycles;
+  int n = 0, i, nRemoved = 0;
+
+  // the second card comes 100-300ms after the first, and both stay 1-3s
+  simulate( "mifare,desfire", "120", "2000", "100", "0" );
+  setenv( "NFC_SIM_STAGGER", "200", 1 );
+  CHECK( openNFCreader( &reader, 0, NULL ) == 0 );
+  CHECK( parseNFCmodulations( "14443a", anm, NFC_MAX_MODULATIONS ) == 1 );
+  CHECK( setNFCmodulations( &reader, anm, 1, true ) == 0 );
+
+  // catch a tap as it starts, with its first card alone
+  for( i=0 ; i < 300 && listNFCtargets( &reader, ant, NFC_MAX_TARGETS ) != 0 ; i++ )
+    usleep( 10000 );
+  for( i=0 ; i < 300 && (n = listNFCtargets( &reader, ant, NFC_MAX_TARGETS )) == 0 ; i++ )
+    usleep( 10000 );
+  CHECK( n == 1 );
+  if( n != 1 ){
+    closeNFCreader( &reader );
+    unsetenv( "NFC_SIM_STAGGER" );
+    return;
+  }
+
+  uiPolls = atomic_load( &reader.uiPolls );
+  uiTargets = atomic_load( &reader.uiTargets );
+  uiCycles = reader.uiCycles;
+  ullStartMs = millisecs();
+  startNFCpresence( &presence, ant, 1, ullStartMs );
+  while( nRemoved < 2 && millisecs() - ullStartMs < 5000 ){
+    usleep( 100000 );
+    CHECK( (n = checkNFCpresence( &reader, &presence, atx )) >= 0 );
+    for( i=0 ; i < n ; i++ ){
+      CHECK( atx[i].btReader == 0 );
+      if( atx[i].btEvent == NFC_EVENT_ARRIVED && ullSecondMs == 0 ){
+        ntSecond = atx[i].nt;
+        ullSecondMs = atx[i].ullDetectedMs;
+      }
+      else if( atx[i].btEvent == NFC_EVENT_REMOVED && sameTarget( &atx[i].nt, &ant[0] ) ){
+        auiDwellMs[0] = atx[i].uiDwellMs;
+        nRemoved++;
+      }
+      else if( atx[i].btEvent == NFC_EVENT_REMOVED && ullSecondMs != 0 && sameTarget( &atx[i].nt, &ntSecond ) ){
+        auiDwellMs[1] = atx[i].uiDwellMs;
+        nRemoved++;
+      }
+    }
+  }
+  CHECK( ullSecondMs - ullStartMs >= 100 * NFC_PRESENCE_LIST && ullSecondMs - ullStartMs < 200 * NFC_PRESENCE_LIST );
+  CHECK( !sameTarget( &ntSecond, &ant[0] ) );
+  CHECK( nRemoved == 2 );
+  CHECK( auiDwellMs[0] > auiDwellMs[1] && auiDwellMs[1] >= 200 );
+  CHECK( atomic_load( &reader.uiPolls ) == uiPolls && atomic_load( &reader.uiTargets ) == uiTargets );
+  CHECK( reader.uiCycles == uiCycles );
+  closeNFCreader( &reader );
+  unsetenv( "NFC_SIM_STAGGER" );
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - aborts the reader after 100ms
+//
+static void *abortLater( void *pArg ){
+  usleep( 100000 );
+  abortNFCreader( (nfc_reader *)pArg );
+  return( NULL );
+}
+
+// ---------------------------------------------------------------------------
+// an endless poll waits for a card until it's aborted; errors are counted
+//
+void testAbortAndErrors( void ){
+  nfc_modulation anm[NFC_MAX_MODULATIONS];
+  nfc_reader reader;
+  nfc_target nt;
+  nfc_sim_stats stats;
+  pthread_t thread;
+  uint64_t ullStartMs, ullTookMs;
+  int i, nErrors = 0;
+
+  simulate( "mifare", "0", "500", "0", "0" );
+  CHECK( openNFCreader( &reader, 0, NULL ) == 0 );
+  ullStartMs = millisecs();
+  pthread_create( &thread, NULL, abortLater, &reader );
+  CHECK( pollNFCreader( &reader, &nt, NFC_POLL_ENDLESS, 1 ) == NFC_EOPABORTED );
+  ullTookMs = millisecs() - ullStartMs;
+  pthread_join( thread, NULL );
+  CHECK( ullTookMs >= 100 && ullTookMs < 150 );
+  CHECK( atomic_load( &reader.uiAborts ) == 1 && atomic_load( &reader.uiErrors ) == 0 );
+  CHECK( pollNFCreader( &reader, &nt, 1, 1 ) == NFC_EOPABORTED );
+  closeNFCreader( &reader );
+
+  // a third of the commands fail. Listing doesn't wait for a card
+  simulate( "mifare", "0", "500", "0", "33" );
+  CHECK( openNFCreader( &reader, 0, NULL ) == 0 );
+  fprintf(stderr, "(failures on purpose follow)\n");
+  CHECK( parseNFCmodulations( "14443a", anm, NFC_MAX_MODULATIONS ) == 1 );
+  CHECK( setNFCmodulations( &reader, anm, 1, true ) == 0 );
+  for( i=0 ; i < 100 ; i++ )
+    nErrors += listNFCtargets( &reader, &nt, 1 ) == NFC_ERFTRANS;
+  getNFCsimStats( reader.pnd, &stats );
+  CHECK( stats.uiErrors == (uint32_t)nErrors && atomic_load( &reader.uiErrors ) == (uint32_t)nErrors );
+  CHECK( nErrors >= 20 && nErrors <= 50 );
+  closeNFCreader( &reader );
+}
+
+// ---------------------------------------------------------------------------
+// a round of polls costs 150ms a type with no card, and activating a card
+// its type's time on top of the frame
+//
+void testTiming( void ){
+  nfc_modulation anm[NFC_MAX_MODULATIONS];
+  nfc_reader reader;
+  nfc_target nt;
+  uint64_t ullStartMs, ullTookMs;
+
+  simulate( "mifare", "0", "500", "0", "0" );
+  CHECK( openNFCreader( &reader, 0, NULL ) == 0 );
+  ullStartMs = millisecs();
+  CHECK( pollNFCreader( &reader, &nt, 1, 1 ) == 0 );
+  ullTookMs = millisecs() - ullStartMs;
+  printf("one round of all 5 types, no card: %llu ms\n", (unsigned long long)ullTookMs );
+  CHECK( ullTookMs >= 750 && ullTookMs < 800 );
+
+  // 2 rounds of 300ms a type
+  CHECK( parseNFCmodulations( "14443a", anm, NFC_MAX_MODULATIONS ) == 1 );
+  CHECK( setNFCmodulations( &reader, anm, 1, true ) == 0 );
+  ullStartMs = millisecs();
+  CHECK( pollNFCreader( &reader, &nt, 2, 2 ) == 0 );
+  ullTookMs = millisecs() - ullStartMs;
+  CHECK( ullTookMs >= 600 && ullTookMs < 650 );
+
+  // a list or a select finding nothing doesn't wait for a card
+  ullStartMs = millisecs();
+  CHECK( listNFCtargets( &reader, &nt, 1 ) == 0 );
+  CHECK( millisecs() - ullStartMs < 20 );
+  closeNFCreader( &reader );
+
+  // a card already there: the frame, then anticollision and select, and RATS
+  simulate( "desfire", "6000", "5000", "0", "0" );
+  CHECK( openNFCreader( &reader, 0, NULL ) == 0 );
+  usleep( 100000 );
+  ullStartMs = millisecs();
+  CHECK( pollNFCreader( &reader, &nt, 1, 1 ) == 1 );
+  ullTookMs = millisecs() - ullStartMs;
+  printf("an ISO 14443-4 card already there: %llu ms\n", (unsigned long long)ullTookMs );
+  CHECK( ullTookMs >= 12 && ullTookMs < 30 );
+  closeNFCreader( &reader );
+}
+
+// ===========================================================================
+// main
+//
+int main( int argc, char *argv[] )
+{
+  setenv( "NFC_SIM_READERS", "1", 1 );
+  setenv( "NFC_SIM_SEED", "1", 1 );
+
+  testCaptures();
+  testKinds();
+  testLeftOut();
+  testReplay();
+  testMultiAndPresence();
+  testStaggeredPresence();
+  testAbortAndErrors();
+  testTiming();
+
+  if( nFailures ){
+    printf("%d check(s) FAILED\n", nFailures );
+    exit( EXIT_FAILURE );
+  }
+  printf("all simulated reader tests passed\n");
+  exit( EXIT_SUCCESS );
+}
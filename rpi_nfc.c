@@ -10,95 +10,1389 @@
  * @author Robert Drummond
  * Copyright (c) 2013 Pink Pelican NZ Ltd <bob@pink-pelican.com>
  */
+#define _GNU_SOURCE             // for memmem()
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 #include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
 
 #include "tcp_client.h"
 #include "led_driver.h"
 #include "nfc_driver.h"
+#include "nfc_encode.h"
+#include "nfc_record.h"
+#include "nfc-utils.h"
+#include "event_loop.h"
+#include "timer_wheel.h"
+#include "spsc_ring.h"
+#include "ack_window.h"
+#include "journal.h"
+#include "frame.h"
+#include "rx_buffer.h"
+#include "endpoint.h"
+#include "uring.h"
+#include "tx_queue.h"
+#include "dedup_cache.h"
 
 
 #define BUFFER_SIZE         1024         // size of TCP write and read buffer in bytes
 #define NFC_POLL_INTERVAL   1000         // pause 1sec between NFC device poll attempts
+#define NFC_AUTOPOLL_PERIOD    1         // with autopoll, 150ms between polls of each type
+#define NFC_PRESENCE_INTERVAL 100        // check a card is still on the reader every 100ms
 #define LED_ON_INTERVAL      500         // turn LED on for 500ms 
-#define TCP_TIMEOUT         5000         // timeout waiting for ACK from server 
+#define TCP_TIMEOUT         5000         // timeout waiting for ACK from server, per message
+#define UDP_TIMEOUT_INITIAL 1000         // over UDP, until the server's round trip is known,
+#define UDP_TIMEOUT_MIN      200         // then its ACK time plus 4 deviations, at least 200ms
+#define UDP_BATCH_MAX       1472         // bytes a datagram batches: one Ethernet frame, no IP fragments
+#define UDP_PAYLOAD_MAX    65507         // largest datagram there is
+#define ACK_WINDOW             8         // default max messages in flight without an ACK
 #define NFC_QUARANTINE_INTERVAL 5000     // don't accept tx from same card within 5s
+#define TX_RING_SLOTS         64         // transactions queued between poller and uplink. power of 2
+#define TX_QUEUE_SLOTS         0         // default taps held in memory while the uplink is down
+#define DEDUP_CACHE_CARDS   1024         // cards remembered for the quarantine
+#define STATS_INTERVAL     60000         // log the queue counters every minute
+#define JOURNAL_DIR  "/var/spool/rpi_nfc" // default directory of the transaction journal
+#define JOURNAL_SYNC_INTERVAL 200        // flush journalled transactions to disk within 200ms
+#define JOURNAL_SYNC_BATCH    16         // or as soon as this many are waiting
+
+// a datagram of one record alone must still go, however it's fragmented
+#if JOURNAL_MAX_RECORD + FRAME_HEADER_SIZE + FRAME_PREFIX_SIZE > UDP_PAYLOAD_MAX
+#error "a journal record can't be sent in one datagram"
+#endif
+#define FRAME_LATENCY          0         // default ms a record may wait for others to share its frame
+#define HELLO_TIMEOUT       2000         // stop waiting for the server to answer HELLO after 2s
+#define ENDPOINT_PROBE_INTERVAL 5000     // time a handshake with one of the servers every 5s
+#define HEARTBEAT_MISSES       3         // the server is gone after 3 heartbeats without a word
+#define HEARTBEAT_PING "{\"msg\":\"PING\"}"
 
 // ---------------------------------------------------------------------------
-// static variables for the async delay timer functions
+// static variables for the async delay timers
 //
-typedef enum{
-    LED_TIMER = 0,
-    NFC_TIMER,
-    TCP_TIMER,
-    QUA_TIMER } timer_type;
+static timer_wheel  timerWheel;
+static timer_entry  ledTimer;       // turns the LED off again after a blink
+static timer_entry  statsTimer;     // next counters log
+static timer_entry  syncTimer;      // next group commit of the journal
+static ack_window   ackWindow;      // messages sent and waiting for an ACK
+static journal      txJournal = { .dirfd = -1, .checkpointfd = -1 };  // transactions not ACKed yet, kept on disk
+static journal_cursor sendCursor;   // next journalled transaction to send
+static timer_entry  flushTimer;     // end of the latency budget of the next frame
+static uint32_t     uiFrameLatencyMs = FRAME_LATENCY;
+static uint32_t     uiFrames;       // frames sent
+static uint32_t     uiFramedRecords;// records sent in them
+static uint32_t     uiSendCalls;    // sendTCPvector() calls for records
+static bool         bSocketOpen;    // connected, and watched by the event loop
+static uring        ioRing;         // socket and journal I/O, if io_uring is in use
+static bool         bUring;
+static rx_buffer    rxBuffer;       // what the server sent, until it's a whole message
+static tx_queue     txQueue;        // taps waiting for the uplink, before the journal
 
-// interval registers. one arrary element for each enum timer_type
-static struct timeval   timeRef[4];    
-static long int         lInterval[4];
-static long int         lNextTriggerTime[4];
+// connection to the servers
+static endpoint_set endpoints;      // health and latency of each server
+static tcp_server   aServers[ENDPOINT_MAX]; // and their addresses
+static int          nServerAddr;    // address of the active server being tried
+static bool         bAwaitingResolve; // connecting once a lookup is done
+static timer_entry  connectTimer;   // deadline of the connect in progress
+static timer_entry  reconnectTimer; // next attempt, once a server is out of backoff
+static uint64_t     ullConnectStartMs; // connection lost (or first attempt)
+static uint64_t     ullAttemptStartMs; // connect() to the current address
+static bool         bWasConnected;
+static bool         bSwitching;     // to a faster server, not after a failure
+static uint32_t     uiSwitches;
+static uint32_t     uiReconnects;
+static uint32_t     uiLastReconnectMs;
+static uint32_t     uiMaxReconnectMs;
+static bool         bOfferBinary;   // formats to offer on each connection
+static bool         bOfferFraming;
+static uint32_t     uiHeartbeatMs;  // heartbeat to offer, 0 for none
+static bool         bHeartbeats;    // the server answers PINGs
+static timer_entry  heartbeatTimer;
+static uint64_t     ullLastSentMs;  // last write to the server
+static uint64_t     ullLastHeardMs; // and last read from it
+static uint64_t     ullUnansweredMs;// first write since then, or 0
+static uint64_t     ullPingSentMs;  // PING waiting for its PONG, or 0
+static timer_entry  probeTimer;     // next probe of a server's round trip time
+static timer_entry  probeDeadline;
+static int          probeFd = -1;   // socket of the probe in progress
+static int          nProbeEndpoint;
+static int          nNextProbe;
+static uint64_t     ullProbeStartMs;
+static uint32_t     uiDeadConnections; // dropped for missing heartbeats
 
+static dedup_cache dedupCache;          // cards seen by each reader, for quarantine
+static bool bBinaryRecords;             // the server accepted the binary format
+static bool bFraming;                   // the server accepted framing
+static timer_entry helloTimer;          // armed while waiting for the answer to HELLO
 
 // ---------------------------------------------------------------------------
-// set timer for async delay
-// 
-void setInterval (  timer_type eTimerID, long int lMilliseconds ){
-    long int lStartTime;
+// static variables shared between the NFC poller threads and the uplink.
+// One thread per reader, each with its own ring, so every ring keeps a
+// single producer
+//
+static nfc_reader   aReaders[MAX_DEVICE_COUNT];
+static int          nReaders;       // opened
+static spsc_ring    aTxRings[MAX_DEVICE_COUNT]; // detected transactions, poller -> uplink
+static int          txEventFd = -1; // signalled by a poller after each push
+static pthread_t    aPollerThreads[MAX_DEVICE_COUNT];
+static int          nPollers;       // threads started, one per reader
+static atomic_bool  bPolling;
+static atomic_bool  bQuit;          // Ctrl-C: stop polling, and shut down
+static int          nMaxTargets = 1;// cards read per poll cycle. more are listed with anticollision
+static bool         bAutopoll;      // the readers poll on their own, without a pause between polls
+static bool         bPresence;      // report cards arriving and leaving, rather than taps
+static nfc_modulation anmProfile[NFC_MAX_MODULATIONS]; // site profile: target types pinned, in order
+static int          nProfile;       // 0 to learn them
 
-    gettimeofday( &timeRef[eTimerID], NULL );
-    lStartTime = (double) (timeRef[eTimerID].tv_sec * 1000); // secs x 1000 = millisecs
-    lStartTime+= (double) (timeRef[eTimerID].tv_usec / 1000); // microsecs/1000 = millisecs
 
-    lInterval[eTimerID] = lMilliseconds;
-    lNextTriggerTime[eTimerID] = lStartTime + lInterval[eTimerID];
+// ---------------------------------------------------------------------------
+// timer callback - end of LED blink
+//
+void onLEDtimer( timer_entry *pTimer, void *pCtx ){
+    turnOffLED();
 }
 
 // ---------------------------------------------------------------------------
-// set timer for async LED blink delay
-// 
-void setLEDinterval ( long int lMilliseconds ){
-    setInterval( LED_TIMER, lMilliseconds );
+// blink LED to acknowledge a transaction to the user
+//
+void blinkLED( void ){
+    turnOnLED();
+    armTimer( &timerWheel, &ledTimer, monotonicMillisecs(), LED_ON_INTERVAL );
 }
 
 // ---------------------------------------------------------------------------
-// set timer for async LED blink delay
-// 
-void setNFCinterval ( long int lMilliseconds ){
-    setInterval( NFC_TIMER, lMilliseconds );
+// Internal function - wait for the reader to find a card, then read all the
+// cards in the field if asked to. The PN532 polls on its own until one comes
+//
+// returns: number of targets written to ant[], else < 0
+//
+static int autopollNFCreader( nfc_reader *pReader, nfc_target ant[] ){
+    int res, nListed;
+
+    res = pollNFCreader( pReader, &ant[0], NFC_POLL_ENDLESS, NFC_AUTOPOLL_PERIOD );
+    if( res > 0 && nMaxTargets > 1 && (nListed = listNFCtargets( pReader, ant, nMaxTargets )) > 0 )
+        res = nListed;
+    return( res );
 }
 
 // ---------------------------------------------------------------------------
-// set timer for async LED blink delay
-// 
-void setTCPtimeout ( long int lMilliseconds ){
-    setInterval( TCP_TIMER, lMilliseconds );
+// Internal function - is the card still on the reader from the last cycle?
+// With autopoll a card held to the reader is found again straight away
+//
+static bool isRepeat( const nfc_target *pnt, const nfc_target antLast[], int nLast ){
+    int i;
+
+    for( i=0 ; i < nLast ; i++ ){
+        if( sameTarget( &antLast[i], pnt ) )
+            return( true );
+    }
+    return( false );
 }
 
 // ---------------------------------------------------------------------------
-// async delay - check if the interval time has elapsed 
-// 
-// returns true if time is up, else false
+// Internal function - queue a transaction for the uplink, from the poller
+// thread of its reader. The uplink is woken by signalUplink()
+//
+static void queueTransaction( const nfc_transaction *pTx ){
+    if( !ringPush( &aTxRings[pTx->btReader], pTx ) )
+        fprintf(stderr,"Non-fatal Error - transaction queue full. transaction dropped\n");
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - wake the uplink for the transactions queued
+//
+static void signalUplink( void ){
+    uint64_t ullSignal = 1;
+
+    if( write( txEventFd, &ullSignal, sizeof(ullSignal) ) < 0 )
+        perror("Non-fatal Error signalling uplink");
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - follow the cards that just arrived at a reader until
+// they have all gone, and any placed with them meanwhile: each is queued as
+// it arrives, and as it leaves with how long it stayed. Returns early when
+// polling stops
+//
+static void trackPresence( int nReader, const nfc_target ant[], int nCards, uint64_t ullArrivedMs ){
+    nfc_transaction atx[2 * NFC_MAX_TARGETS];
+    nfc_presence presence;
+    int i, n;
+
+    startNFCpresence( &presence, ant, nCards, ullArrivedMs );
+    while( presence.nPresent > 0 && atomic_load( &bPolling ) ){
+        usleep( NFC_PRESENCE_INTERVAL * 1000 );
+        if( (n = checkNFCpresence( &aReaders[nReader], &presence, atx )) < 0 )
+            return;         // aborted to stop
+        for( i=0 ; i < n ; i++ )
+            queueTransaction( &atx[i] );
+        if( n > 0 )
+            signalUplink();
+    }
+}
+
+// ---------------------------------------------------------------------------
+// NFC poller thread - polls one NFC device and queues any target card detected
+// for the uplink. Never touches the network, so a slow link can't make it miss
+// taps, and never waits on the other readers. With presence tracking it
+// follows the cards found until they have gone, before polling again.
+//
+void *nfcPollerThread( void *pArg ){
+    int nReader = (int)(intptr_t)pArg;
+    int res, i, nLast = 0, nQueued;
+    uint64_t ullLastMs = 0;
+    nfc_target ant[NFC_MAX_TARGETS], antLast[NFC_MAX_TARGETS];
+    nfc_transaction tx;
+
+    memset( &tx, 0, sizeof(tx) );
+    tx.btReader = (uint8_t)nReader;
+    tx.btEvent = bPresence ? NFC_EVENT_ARRIVED : NFC_EVENT_TAP;
+    while( atomic_load( &bPolling ) ){
+
+        // make one poll attempt of NFC device to detect any target, or
+        // read all the cards in the field at once, or leave the polling
+        // to the reader until a card comes
+        if( bAutopoll )
+            res = autopollNFCreader( &aReaders[nReader], ant );
+        else if( nMaxTargets > 1 )
+            res = listNFCtargets( &aReaders[nReader], ant, nMaxTargets );
+        else
+            res = pollNFCreader( &aReaders[nReader], &ant[0], 1, 1 );
+        if( res < 0 ){
+            if( !atomic_load( &bPolling ) )
+                break;      // aborted to stop
+            fprintf(stderr,"Non-fatal error - polling NFC device %d failed", nReader);
+        }
+
+        // each target card detected is a transaction of its own. With
+        // autopoll, one still held to the reader is left to the quarantine
+        tx.ullDetectedMs = monotonicMillisecs();
+        if( tx.ullDetectedMs - ullLastMs >= NFC_QUARANTINE_INTERVAL )
+            nLast = 0;
+        for( i=0, nQueued=0 ; i < res ; i++ ){
+            if( bAutopoll && !bPresence && isRepeat( &ant[i], antLast, nLast ) )
+                continue;
+            tx.nt = ant[i];
+            queueTransaction( &tx );
+            nQueued++;
+        }
+        if( nQueued > 0 ){
+            memcpy( antLast, ant, res * sizeof(ant[0]) );
+            nLast = res;
+            ullLastMs = tx.ullDetectedMs;
+            signalUplink();
+        }
+
+        // with presence tracking the cards are followed until they go
+        if( bPresence && res > 0 ){
+            trackPresence( nReader, ant, res, tx.ullDetectedMs );
+            continue;
+        }
+
+        // with autopoll the next poll starts at once: the reader does the waiting
+        if( !bAutopoll || res < 0 )
+            usleep( NFC_POLL_INTERVAL * 1000 );
+    }
+    return( NULL );
+}
+
+// ---------------------------------------------------------------------------
+// stop the NFC poller threads. Their polls in progress are aborted, and it
+// returns once the threads have finished.
+//
+void stopNFCpoller( void ){
+    int i;
+
+    atomic_store( &bPolling, false );
+    for( i=0 ; i < nPollers ; i++ )
+        abortNFCreader( &aReaders[i] );
+    while( nPollers > 0 )
+        pthread_join( aPollerThreads[--nPollers], NULL );
+}
+
+// ---------------------------------------------------------------------------
+// open every NFC reader attached, numbered in the order libnfc lists them
+//
+// returns: 0 if at least one opened, else -1
+//
+int openNFCreaders( void ){
+    nfc_connstring aConnstrings[MAX_DEVICE_COUNT];
+    size_t szFound, i;
+
+    szFound = listNFCreaders( aConnstrings, MAX_DEVICE_COUNT );
+    for( i=0 ; i < szFound ; i++ ){
+        if( openNFCreader( &aReaders[nReaders], nReaders, aConnstrings[i] ) == 0 )
+            nReaders++;
+    }
+
+    // a reader libnfc can't scan for (e.g. on a UART) is only found by its config
+    if( szFound == 0 && openNFCreader( &aReaders[0], 0, NULL ) == 0 )
+        nReaders = 1;
+    if( nReaders == 0 )
+        return( -1 );
+    for( i=0 ; nProfile > 0 && i < (size_t)nReaders ; i++ )
+        setNFCmodulations( &aReaders[i], anmProfile, (size_t)nProfile, true );
+    printf("using libnfc %s\n\n", getNFCversion() );
+    return( 0 );
+}
+
+// ---------------------------------------------------------------------------
+// close the NFC readers. Their pollers must have stopped
+//
+void closeNFCreaders( void ){
+    while( nReaders > 0 )
+        closeNFCreader( &aReaders[--nReaders] );
+}
+
+// ---------------------------------------------------------------------------
+// signal handler - Ctrl-C. Cancels the polls in progress and wakes the main
+// loop, which shuts down in its own time
+//
+void onInterrupt( int nSignal ){
+    uint64_t ullSignal = 1;
+    int i;
+
+    atomic_store( &bQuit, true );
+    atomic_store( &bPolling, false );
+    for( i=0 ; i < nPollers ; i++ )
+        abortNFCreader( &aReaders[i] );
+    if( write( txEventFd, &ullSignal, sizeof(ullSignal) ) < 0 )
+        return;     // nothing can be done about it here
+}
+
+// ---------------------------------------------------------------------------
+// start a poller thread for each NFC reader
+//
+// returns: 0 if OK, else -1
+//
+int startNFCpoller( void ){
+    atomic_store( &bPolling, true );
+    for( nPollers=0 ; nPollers < nReaders ; nPollers++ ){
+        if( pthread_create( &aPollerThreads[nPollers], NULL, nfcPollerThread,
+                            (void *)(intptr_t)nPollers ) != 0 ){
+            stopNFCpoller();
+            return( -1 );
+        }
+    }
+    return( 0 );
+}
+
+// ---------------------------------------------------------------------------
+// timer callback - group commit of the journal
+//
+void onSyncTimer( timer_entry *pTimer, void *pCtx ){
+    if( journalSync( &txJournal ) != 0 )
+        perror("Non-fatal Error syncing journal");
+}
+
+// ---------------------------------------------------------------------------
+// make sure recent journal changes reach the disk soon. Syncs straight away
+// once a batch has built up, else within JOURNAL_SYNC_INTERVAL
+//
+void scheduleJournalSync( void ){
+    if( txJournal.uiUnsynced >= JOURNAL_SYNC_BATCH )
+        onSyncTimer( &syncTimer, NULL );
+    else if( !timerIsArmed( &syncTimer ) )
+        armTimer( &timerWheel, &syncTimer, monotonicMillisecs(), JOURNAL_SYNC_INTERVAL );
+}
+
+// ---------------------------------------------------------------------------
+// record a detected transaction in the journal, to be sent to the server
+//
+void journalTransaction( const nfc_transaction *pTx ){
+    char szBuffer[BUFFER_SIZE];
+    char szReader[16] = "";
+    char szEvent[48] = "";
+    uint8_t abtDwell[4];
+    const uint8_t *pbtUid;
+    size_t szUid;
+    int n, r = pTx->btReader;
+
+    // if its the same card detected again by the same reader within the
+    // quarantine period, ignore it - don't send it to the server. Looked up
+    // by UID, before anything is encoded, among all the cards seen lately.
+    // Timed from detection, as taps held in the queue are journalled
+    // together. Cards arriving and leaving are known to be, so they're all sent
+    szUid = targetUID( &pTx->nt, &pbtUid );
+    if( pTx->btEvent == NFC_EVENT_TAP &&
+        dedupRepeat( &dedupCache, pTx->btReader, (uint8_t)pTx->nt.nm.nmt, pbtUid, szUid, pTx->ullDetectedMs ) ){
+        fprintf(stderr,"found same target card within quarantine period. ignoring it.\n");
+        return;
+    }
+
+    // print detailed results from NFC target device to console
+    if( pTx->btEvent == NFC_EVENT_REMOVED )
+        printf("card removed from reader %d after %u ms\n", r, pTx->uiDwellMs );
+    else
+        print_nfc_target ( pTx->nt, true );
+
+    // convert into a binary record if the server takes them, else a JSON string
+    if( bBinaryRecords )
+        n = constructBinaryRecordNFC( &pTx->nt, (uint8_t *)szBuffer, BUFFER_SIZE );
+    else
+        n = constructJSONstringNFC( pTx->nt, szBuffer, BUFFER_SIZE );
+    if( n <= 0 ){
+        fprintf(stderr,"Non-fatal Error - construct message failed");
+        return;
+    }
+
+    // stamp the message with its sequence number, for the server to ACK, and
+    // with more than one reader, the reader that saw the card. With presence
+    // tracking, whether it arrived or left, and after how long
+    if( bBinaryRecords ){
+        abtDwell[0] = (uint8_t)(pTx->uiDwellMs >> 24);
+        abtDwell[1] = (uint8_t)(pTx->uiDwellMs >> 16);
+        abtDwell[2] = (uint8_t)(pTx->uiDwellMs >> 8);
+        abtDwell[3] = (uint8_t)pTx->uiDwellMs;
+        if( (nReaders > 1 &&
+             (n = addNFCrecordField( (uint8_t *)szBuffer, BUFFER_SIZE, NFC_TAG_READER, &pTx->btReader, 1 )) < 0) ||
+            (pTx->btEvent != NFC_EVENT_TAP &&
+             (n = addNFCrecordField( (uint8_t *)szBuffer, BUFFER_SIZE, NFC_TAG_EVENT, &pTx->btEvent, 1 )) < 0) ||
+            (pTx->btEvent == NFC_EVENT_REMOVED &&
+             (n = addNFCrecordField( (uint8_t *)szBuffer, BUFFER_SIZE, NFC_TAG_DWELL, abtDwell, 4 )) < 0) ){
+            fprintf(stderr,"Non-fatal Error - record too long to tag");
+            return;
+        }
+        stampNFCrecordSeq( (uint8_t *)szBuffer, journalNextSeq( &txJournal ) );
+    } else {
+        if( nReaders > 1 )
+            sprintf( szReader, ",\"reader\":%d", r );
+        if( pTx->btEvent == NFC_EVENT_REMOVED )
+            sprintf( szEvent, ",\"event\":\"%s\",\"dwellMs\":%u", nfcEventName( pTx->btEvent ), pTx->uiDwellMs );
+        else if( pTx->btEvent != NFC_EVENT_TAP )
+            sprintf( szEvent, ",\"event\":\"%s\"", nfcEventName( pTx->btEvent ) );
+        if( n + 80 >= BUFFER_SIZE ){
+            fprintf(stderr,"Non-fatal Error - JSON string too long to stamp");
+            return;
+        }
+        n += sprintf( &szBuffer[n-1], "%s%s,\"seq\":%u}", szReader, szEvent, journalNextSeq( &txJournal ) ) - 1;
+    }
+
+    // keep it until it's ACKed, even across a restart
+    if( journalAppend( &txJournal, szBuffer, n ) != 0 ){
+        perror("Non-fatal Error - journal full or failed. transaction dropped");
+        return;
+    }
+    scheduleJournalSync();
+
+    // blink LED to acknowledge successfully recorded transaction to user
+    if( pTx->btEvent != NFC_EVENT_REMOVED )
+        blinkLED();
+}
+
+void onSocketEvent( int fd, uint32_t uiEvents, void *pCtx );
+void onSocketReceived( int32_t nRes, void *pCtx );
+void onConnectEvent( int fd, uint32_t uiEvents, void *pCtx );
+void connectToServer( void );
+void connectionLost( bool bFailed );
+
+// ---------------------------------------------------------------------------
+// show a message on its way to the server
+//
+void printRecord( const uint8_t *pRecord, uint32_t uiSeq, size_t szLen ){
+    if( pRecord[0] == NFC_RECORD_MAGIC )
+        printf("\nSending binary record: seq %u, %zu bytes\n", uiSeq, szLen );
+    else
+        printf("\nSending JSON: %.*s\n", (int)szLen, (const char *)pRecord );
+}
+
+// ---------------------------------------------------------------------------
+// watch the socket for replies, and also for room to write while a send is
+// only partly done
+//
+void watchSocket( void ){
+    uint32_t uiEvents = EPOLLIN | EPOLLRDHUP;
+    char *pRead;
+    size_t szFree;
+
+    if( !bSocketOpen )
+        return;
+
+    // with io_uring a receive is kept queued instead, and sends complete on the ring
+    if( bUring ){
+        pRead = rxWritePtr( &rxBuffer, &szFree );
+        if( startTCPreceive( pRead, szFree, onSocketReceived, NULL ) != 0 )
+            perror("Non-fatal Error queueing TCP receive");
+        return;
+    }
+    if( tcpPendingBytes() > 0 )
+        uiEvents |= EPOLLOUT;
+    if( watchEventFd( getTCPsocketFd(), uiEvents, onSocketEvent, NULL ) != 0 )
+        perror("Non-fatal Error watching TCP socket");
+}
+
+// ---------------------------------------------------------------------------
+// note a write to the server. If it has been quiet since, this starts the
+// clock on its answer (an ACK, or PONG)
+//
+void noteSent( uint64_t ullNow ){
+    ullLastSentMs = ullNow;
+    if( ullUnansweredMs == 0 )
+        ullUnansweredMs = ullNow;
+}
+
+// ---------------------------------------------------------------------------
+// send journalled transactions while the ACK window has room, straight from
+// the journal's mapping with one sendmsg() per batch - in frames if the server
+// takes them. The rest wait in the journal until ACKs open the window.
+//
+void flushJournal( void ){
+    static frame_vector frame;          // the header and prefixes must outlive a partial write
+    static struct iovec aRawIov[ACK_WINDOW_MAX];
+    struct iovec *pIov;
+    journal_cursor cur;
+    const uint8_t *pRecord;
+    uint32_t uiSeq;
+    size_t szLen, szBatch, szRecord;
+    int nIov, nRaw;
+    bool bAdded;
+    bool bDatagram = aServers[endpoints.nActive].transport == TRANSPORT_UDP;
+    uint64_t ullNow = monotonicMillisecs();
+
+    cancelTimer( &timerWheel, &flushTimer );
+
+    // a batch at a time, until the socket or the window is full
+    while( tcpPendingBytes() == 0 && ackWindowHasRoom( &ackWindow ) &&
+           journalUnread( &txJournal, &sendCursor ) > 0 ){
+
+        initFrameVector( &frame );
+        nRaw = 0;
+        szBatch = bFraming ? FRAME_HEADER_SIZE : 0;
+        while( ackWindowHasRoom( &ackWindow ) ){
+            cur = sendCursor;       // only move on once the record is in the batch
+            if( (pRecord = journalRead( &txJournal, &cur, &uiSeq, &szLen )) == NULL )
+                break;
+
+            // over UDP the batch is one datagram: kept to one Ethernet frame,
+            // as a lost fragment would lose all of it. A record too big for
+            // that goes alone
+            szRecord = szLen + (bFraming ? FRAME_PREFIX_SIZE : 0);
+            if( bDatagram && (nRaw > 0 || frame.uiRecords > 0) && szBatch + szRecord > UDP_BATCH_MAX )
+                break;
+            if( bFraming )
+                bAdded = frameVectorAdd( &frame, pRecord, szLen );
+            else if( (bAdded = (nRaw < ACK_WINDOW_MAX)) ){
+                aRawIov[nRaw].iov_base = (void *)pRecord;
+                aRawIov[nRaw++].iov_len = szLen;
+            }
+            if( !bAdded )
+                break;              // full. the rest go in the next batch
+            szBatch += szRecord;
+            sendCursor = cur;
+            printRecord( pRecord, uiSeq, szLen );
+
+            // records stay put in the journal until ACKed, so the window
+            // needn't copy them. if the write fails, it's resent at the deadline
+            trackMessageRef( &ackWindow, (const char *)pRecord, szLen, ullNow );
+        }
+
+        if( bFraming ){
+            szLen = finishFrameVector( &frame );
+            printf("Sending frame: %u record(s), %zu bytes\n", frame.uiRecords, szLen );
+            uiFrames++;
+            uiFramedRecords += frame.uiRecords;
+            pIov = frame.aIov;
+            nIov = frame.nIov;
+        } else {
+            pIov = aRawIov;
+            nIov = nRaw;
+        }
+        uiSendCalls++;
+        noteSent( ullNow );
+        if( sendTCPvector( pIov, nIov ) < 0 ){
+            perror("Non-fatal Error writing to socket. will retry");
+            break;
+        }
+    }
+
+    // the socket didn't take it all. the rest goes when it's writable
+    if( tcpPendingBytes() > 0 )
+        watchSocket();
+}
+
+// ---------------------------------------------------------------------------
+// timer callback - a frame's latency budget is up
+//
+void onFlushTimer( timer_entry *pTimer, void *pCtx ){
+    flushJournal();
+}
+
+// ---------------------------------------------------------------------------
+// is the uplink taking transactions? Not until connected, and the server
+// has said how it wants them
+//
+bool uplinkReady( void ){
+    return( bSocketOpen && !timerIsArmed( &helloTimer ) );
+}
+
+// ---------------------------------------------------------------------------
+// journal the taps held in the queue, oldest first
+//
+void journalQueued( void ){
+    nfc_transaction tx;
+    uint64_t ullNow = monotonicMillisecs();
+
+    while( txQueuePop( &txQueue, &tx, ullNow ) )
+        journalTransaction( &tx );
+}
+
+// ---------------------------------------------------------------------------
+// send journalled transactions while the ACK window has room. The rest wait
+// in the journal until ACKs open the window again.
+//
+void sendJournal( void ){
+    uint32_t uiUnread;
+
+    // nothing goes out until connected, and the server has said how it
+    // wants it. meanwhile transactions wait in the queue or the journal
+    if( !uplinkReady() )
+        return;
+
+    // taps held while the uplink was down go after what's journalled
+    journalQueued();
+
+    // hold a partly filled frame back for up to the latency budget, so
+    // records arriving meanwhile share the write
+    if( bFraming && uiFrameLatencyMs > 0 ){
+        uiUnread = journalUnread( &txJournal, &sendCursor );
+        if( uiUnread == 0 )
+            return;
+        if( uiUnread < ackWindow.uiWindow - ackWindowInFlight( &ackWindow ) ){
+            if( !timerIsArmed( &flushTimer ) )
+                armTimer( &timerWheel, &flushTimer, monotonicMillisecs(), uiFrameLatencyMs );
+            return;
+        }
+    }
+    flushJournal();
+
+    // ACKs from the server are read by onSocketEvent() when they arrive
+}
+
+// ---------------------------------------------------------------------------
+// (re)send everything in the journal the server hasn't ACKed, e.g. at
+// startup or after reconnecting
+//
+void replayJournal( void ){
+    if( journalPending( &txJournal ) > 0 )
+        printf("replaying %u unacknowledged transaction(s) from journal\n",
+               journalPending( &txJournal ) );
+    resetAckWindow( &ackWindow, txJournal.uiAckedSeq );
+    journalSeek( &txJournal, &sendCursor, txJournal.uiAckedSeq );
+    sendJournal();
+}
+
+// ---------------------------------------------------------------------------
+// take everything the poller has queued: journal it if the uplink is up,
+// else hold it in the queue, then send what the window allows
+//
+void drainTransactions( void ){
+    nfc_transaction *pTx, *pHead, spilled;
+    spsc_ring *pRing = NULL;
+    txq_result result;
+    uint64_t ullNow = monotonicMillisecs();
+    bool bBlink;
+    int r;
+
+    while( true ){
+        // oldest first across the readers, so taps are journalled in the order
+        // seen. Every reader's ring, as at shutdown the pollers are gone
+        for( r=0, pTx = NULL ; r < nReaders ; r++ ){
+            if( (pHead = ringPeek( &aTxRings[r] )) != NULL &&
+                (pTx == NULL || pHead->ullDetectedMs < pTx->ullDetectedMs) ){
+                pTx = pHead;
+                pRing = &aTxRings[r];
+            }
+        }
+        if( pTx == NULL )
+            break;
+
+        switch( (result = txQueuePush( &txQueue, pTx, ullNow, &spilled )) ){
+          case TXQ_SPILLED:     // no room to hold it: the oldest goes to the journal
+            journalTransaction( &spilled );
+            break;
+          case TXQ_DROPPED:
+            fprintf(stderr,"Non-fatal Error - tx queue full. oldest transaction dropped\n");
+            break;
+          case TXQ_COALESCED:
+            fprintf(stderr,"found same target card already queued. ignoring it.\n");
+            break;
+          default:
+            break;
+        }
+        bBlink = result != TXQ_COALESCED && pTx->btEvent != NFC_EVENT_REMOVED;
+        ringRelease( pRing );
+
+        // acknowledge a tap that's held to the user now, not when it's journalled
+        if( bBlink && txQueue.uiCapacity > 0 && !uplinkReady() )
+            blinkLED();
+    }
+    sendJournal();
+}
+
+// ---------------------------------------------------------------------------
+// event handler - the poller has queued one or more transactions
+//
+void onTransactionsQueued( int fd, uint32_t uiEvents, void *pCtx ){
+    uint64_t ullSignals;
+
+    if( read( fd, &ullSignals, sizeof(ullSignals) ) < 0 )
+        perror("Non-fatal Error reading transaction signal");
+
+    drainTransactions();
+}
+
+// ---------------------------------------------------------------------------
+// send a message on its own, outside a batch (a retransmission, a PING)
+//
+// returns: number of bytes written, else < 1 on error
+//
+int sendMessage( const char *pMessage, size_t szLen ){
+    uint8_t abtFrame[FRAME_HEADER_SIZE + FRAME_PREFIX_SIZE + ACK_MESSAGE_SIZE];
+    frame_builder frame;
+    int n;
+
+    if( !bFraming )
+        n = sendTCPbuffer( pMessage, szLen );
+    else {
+        // once framing is agreed, everything goes in frames
+        initFrame( &frame, abtFrame, sizeof(abtFrame) );
+        if( !frameAddRecord( &frame, pMessage, szLen ) ){
+            fprintf(stderr,"Non-fatal Error - message too long to frame\n");
+            return( -1 );
+        }
+        n = sendTCPbuffer( (const char *)abtFrame, finishFrame( &frame ) );
+    }
+    if( tcpPendingBytes() > 0 )
+        watchSocket();
+    noteSent( monotonicMillisecs() );
+    return( n );
+}
+
+// ---------------------------------------------------------------------------
+// retransmit function for the ACK window
+//
+int retransmitMessage( const char *pMessage, size_t szLen, void *pCtx ){
+
+    // while reconnecting, the journal replays it anyway
+    if( !bSocketOpen )
+        return( (int)szLen );
+    return( sendMessage( pMessage, szLen ) );
+}
+
+// ---------------------------------------------------------------------------
+// offer the server the binary record format, framing and/or heartbeats. It
+// answers e.g. {"msg":"FORMAT","format":"tlv1","framing":"frame1"} with what
+// it takes; until then, and with servers that don't answer, messages stay
+// plain JSON
 //
-bool intervalTimeIsUp(  timer_type eTimerID ){
+void offerFormats( void ){
+    char szHello[BUFFER_SIZE];
+    int n;
 
-    struct timeval timeNow;
-    long int lCurrentTime;
+    n = sprintf( szHello, "{\"msg\":\"HELLO\"" );
+    if( bOfferBinary )
+        n += sprintf( szHello + n, ",\"formats\":[\"" NFC_RECORD_FORMAT_NAME "\",\"json\"]" );
+    if( bOfferFraming )
+        n += sprintf( szHello + n, ",\"framing\":[\"" FRAMING_NAME "\",\"none\"]" );
+    if( uiHeartbeatMs > 0 )
+        n += sprintf( szHello + n, ",\"heartbeat\":%u", uiHeartbeatMs );
+    n += sprintf( szHello + n, "}" );
 
-    gettimeofday( &timeNow, NULL );
-    lCurrentTime = (double) (timeNow.tv_sec * 1000); // secs x 1000 = millisecs
-    lCurrentTime+= (double) (timeNow.tv_usec / 1000); // microsecs/1000 = millisecs
+    if( sendTCPbuffer( szHello, n ) <= 0 )
+        fprintf(stderr,"Non-fatal Error - unable to offer formats. sending plain JSON\n");
+    else
+        armTimer( &timerWheel, &helloTimer, monotonicMillisecs(), HELLO_TIMEOUT );
+    if( tcpPendingBytes() > 0 )
+        watchSocket();
+}
 
-    // printf("lCurrentTime= %ld\n", lCurrentTime );
+// ---------------------------------------------------------------------------
+// timer callback - the server didn't answer HELLO, so it's an older one
+//
+void onHelloTimer( timer_entry *pTimer, void *pCtx ){
+    fprintf(stderr,"Non-fatal Error - no answer to HELLO. sending plain JSON\n");
+    sendJournal();
+}
 
-    if( lCurrentTime >= lNextTriggerTime[eTimerID] ){
-        lNextTriggerTime[eTimerID] = lCurrentTime + lInterval[eTimerID];
-        return( true);
+// ---------------------------------------------------------------------------
+// set the ACK deadline for the server in use. TCP (or a local socket)
+// retransmits for itself, so the window's deadline is only a backstop. A
+// datagram lost on the LAN is only resent by the window, so over UDP the
+// deadline follows the server's measured ACK time, as TCP's own RTO would
+//
+void updateAckTimeout( void ){
+    const endpoint *pEnd = &endpoints.aEndpoints[endpoints.nActive];
+    uint32_t uiTimeoutMs = TCP_TIMEOUT;
+
+    if( aServers[endpoints.nActive].transport == TRANSPORT_UDP ){
+        if( pEnd->uiRttSamples + pEnd->uiAckSamples == 0 )
+            uiTimeoutMs = UDP_TIMEOUT_INITIAL;
+        else
+            uiTimeoutMs = endpointScore( &endpoints, endpoints.nActive ) + 4 * pEnd->uiRttVarMs;
+        if( uiTimeoutMs < UDP_TIMEOUT_MIN )
+            uiTimeoutMs = UDP_TIMEOUT_MIN;
+        if( uiTimeoutMs > TCP_TIMEOUT )
+            uiTimeoutMs = TCP_TIMEOUT;
     }
+    ackWindow.uiTimeoutMs = uiTimeoutMs;
+}
+
+// ---------------------------------------------------------------------------
+// act on the complete messages the server has sent, e.g. the ACK
+// {"msg":"ACK","seq":12}. A read may hold several, or end partway through
+// one: the rest stays in the receive buffer until a later read completes
+// it. An ACK without a seq (older servers) acknowledges the oldest message
+// in flight.
+//
+void processServerMessages( void ){
+    const char *pObject, *pClose, *pSeq;
+    size_t szLen;
+    int nAcked;
+    uint64_t ullNow = monotonicMillisecs();
+
+    // parsed in place, in the receive buffer
+    while( (pObject = rxNextMessage( &rxBuffer, &szLen )) != NULL ){
+        pClose = pObject + szLen - 1;
+
+        if( memmem( pObject, pClose - pObject, "\"FORMAT\"", 8 ) != NULL ){
+            bBinaryRecords = memmem( pObject, pClose - pObject,
+                                     "\"" NFC_RECORD_FORMAT_NAME "\"", strlen( NFC_RECORD_FORMAT_NAME ) + 2 ) != NULL;
+            bFraming = memmem( pObject, pClose - pObject,
+                               "\"" FRAMING_NAME "\"", strlen( FRAMING_NAME ) + 2 ) != NULL;
+            bHeartbeats = uiHeartbeatMs > 0 &&
+                          memmem( pObject, pClose - pObject, "\"heartbeat\"", 11 ) != NULL;
+            printf("server takes %s messages%s%s\n", bBinaryRecords ? "binary" : "JSON",
+                   bFraming ? ", in frames" : "", bHeartbeats ? ", with heartbeats" : "" );
+            cancelTimer( &timerWheel, &helloTimer );
+            if( bHeartbeats )
+                armTimer( &timerWheel, &heartbeatTimer, ullNow, uiHeartbeatMs / 2 );
+            continue;
+        }
+        if( memmem( pObject, pClose - pObject, "\"PONG\"", 6 ) != NULL ){
+            // only says the server is there - and how far away it is
+            if( ullPingSentMs != 0 ){
+                endpointRttSample( &endpoints, endpoints.nActive, (uint32_t)(ullNow - ullPingSentMs) );
+                ullPingSentMs = 0;
+                updateAckTimeout();
+            }
+            continue;
+        }
+        if( memmem( pObject, pClose - pObject, "\"ACK\"", 5 ) == NULL ){
+            fprintf(stderr, "Non-fatal Error - expected 'ACK' msg, but received: %.*s\n",
+                    (int)(pClose - pObject + 1), pObject );
+            continue;
+        }
+        if( (pSeq = memmem( pObject, pClose - pObject, "\"seq\":", 6 )) != NULL )
+            nAcked = ackReceived( &ackWindow, (uint32_t)strtoul( pSeq + 6, NULL, 10 ), ullNow );
+        else
+            nAcked = ackOldest( &ackWindow, ullNow );
+        if( nAcked > 0 && ackWindow.bRttFresh ){
+            endpointAckSample( &endpoints, endpoints.nActive, ackWindow.uiLastRttMs );
+            updateAckTimeout();
+        }
+    }
+
+    // ACKed transactions can go from the journal. If the new watermark is
+    // lost in a power cut they are only sent again, so it's synced lazily
+    journalTrim( &txJournal, ackWindow.uiUnacked );
+    if( txJournal.uiCheckpointSeq != txJournal.uiAckedSeq )
+        scheduleJournalSync();
+}
+
+// ---------------------------------------------------------------------------
+// timer callback - log the transaction queue counters
+//
+void onStatsTimer( timer_entry *pTimer, void *pCtx ){
+    ring_stats stats;
+    const endpoint *pEnd;
+    char szFound[NFC_MAX_MODULATIONS * 20];
+    uint32_t uiPolls;
+    size_t m;
+    int i, n;
+
+    for( i=0 ; i < nPollers ; i++ ){
+        getRingStats( &aTxRings[i], &stats );
+        uiPolls = atomic_load( &aReaders[i].uiPolls );
+        for( m=0, n=0 ; m < aReaders[i].szModulations ; m++ )
+            n += snprintf( szFound + n, sizeof(szFound) - n, " %s:%u",
+                           getNFCmodulationName( &aReaders[i].aModulations[m] ),
+                           atomic_load( &aReaders[i].auiHits[m] ) );
+        fprintf(stderr, "reader %d: polls %u, targets %u, errors %u, mean cycle %.1f ms, %s%s\n",
+                i, uiPolls, atomic_load( &aReaders[i].uiTargets ), atomic_load( &aReaders[i].uiErrors ),
+                uiPolls ? atomic_load( &aReaders[i].ullPollUs ) / 1000.0 / uiPolls : 0.0,
+                aReaders[i].bPinned ? "pinned" : "found", szFound );
+        fprintf(stderr, "tx queue %d: depth %u/%u, high-water %u, queued %u, sent %u, dropped %u\n",
+                i, stats.uiDepth, stats.uiCapacity, stats.uiHighWater,
+                stats.uiPushed, stats.uiPopped, stats.uiOverflows );
+    }
+    if( txQueue.uiCapacity > 0 )
+        fprintf(stderr, "held: depth %u/%u (%s), high-water %u, queued %u, spilled %u, dropped %u, coalesced %u\n",
+                txQueueDepth( &txQueue ), txQueue.uiCapacity, txPolicyName( txQueue.policy ),
+                txQueue.uiHighWater, txQueue.uiQueued, txQueue.uiSpilled, txQueue.uiDropped,
+                txQueue.uiCoalesced );
+    fprintf(stderr, "quarantine: cards %u, repeats ignored %u, forgotten %u\n",
+            dedupCount( &dedupCache ), dedupCache.uiRepeats, dedupCache.uiEvictions );
+    fprintf(stderr, "tx wait: p50 %u ms, p90 %u ms, p99 %u ms, max %u ms\n",
+            txQueueLatency( &txQueue, 50 ), txQueueLatency( &txQueue, 90 ),
+            txQueueLatency( &txQueue, 99 ), txQueue.uiMaxLatencyMs );
+    fprintf(stderr, "ACKs: in flight %u/%u, sent %u, acked %u, retransmitted %u, last RTT %u ms\n",
+            ackWindowInFlight( &ackWindow ), ackWindow.uiWindow, ackWindow.uiSent,
+            ackWindow.uiAcked, ackWindow.uiRetransmits, ackWindow.uiLastRttMs );
+    fprintf(stderr, "connection: %s, reconnects %u, last took %u ms, longest %u ms, missed heartbeats %u, switches %u\n",
+            bSocketOpen ? "up" : "down", uiReconnects, uiLastReconnectMs, uiMaxReconnectMs,
+            uiDeadConnections, uiSwitches );
+    for( i=0 ; i < endpoints.nEndpoints ; i++ ){
+        pEnd = &endpoints.aEndpoints[i];
+        fprintf(stderr, "  %c %s:%d: srtt %u ms (+/- %u), ACK %u ms extra, failures %u, selected %u, failed %u\n",
+                i == endpoints.nActive ? '*' : ' ', aServers[i].szHost, aServers[i].nPort,
+                pEnd->uiSrttMs, pEnd->uiRttVarMs, pEnd->uiAckExtraMs, pEnd->uiFailures,
+                pEnd->uiSelected, pEnd->uiFailed );
+    }
+    if( uiSendCalls > 0 )
+        fprintf(stderr, "uplink: %u send calls, %.2f per record\n",
+                uiSendCalls, (double)uiSendCalls / ackWindow.uiSent );
+    if( bUring && ackWindow.uiSent > 0 )
+        fprintf(stderr, "io_uring: %u system calls for %u operations, %.2f per record\n",
+                ioRing.uiEnters, ioRing.uiSubmitted, (double)ioRing.uiEnters / ackWindow.uiSent );
+    if( uiFrames > 0 )
+        fprintf(stderr, "frames: sent %u, %.1f records per frame\n",
+                uiFrames, (double)uiFramedRecords / uiFrames );
+    fprintf(stderr, "journal: pending %u, segments %d, appended %u, syncs %u\n",
+            journalPending( &txJournal ), txJournal.nSegments,
+            txJournal.uiAppended, txJournal.uiSyncs );
+    armTimer( &timerWheel, pTimer, monotonicMillisecs(), STATS_INTERVAL );
+}
+
+// ---------------------------------------------------------------------------
+// n bytes have been read from the server into the receive buffer, or it
+// hung up (0), or the read failed (< 0, errno says why)
+//
+void serverDataRead( int n ){
+    if( n > 0 ){
+        rxCommit( &rxBuffer, n );
+        ullLastHeardMs = monotonicMillisecs();
+        ullUnansweredMs = 0;
+        processServerMessages();
+
+        // ACKs opened the window - send anything that was waiting
+        sendJournal();
+        return;
+    }
+    if( n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) )
+        return;
+    if( n < 0 )
+        perror("Non-fatal Error reading from socket");
     else
-        return( false );
+        fprintf(stderr, "Non-fatal Error - connection closed by server\n");
+
+    connectionLost( true );
+}
+
+// ---------------------------------------------------------------------------
+// event handler - the server has sent something (e.g. an ACK) or hung up,
+// or there's room again to write what a send left pending.
+// only called when the socket is ready, so neither read nor write blocks
+//
+void onSocketEvent( int fd, uint32_t uiEvents, void *pCtx ){
+    char *pRead;
+    size_t szFree;
+    long nPending;
+    int n;
+
+    (void) pCtx;
+
+    if( uiEvents & EPOLLOUT ){
+        if( (nPending = flushTCPpending()) < 0 )
+            perror("Non-fatal Error writing to socket. will retry");
+        if( nPending <= 0 ){
+            watchSocket();      // stop waiting for EPOLLOUT
+            sendJournal();
+        }
+        if( !(uiEvents & (EPOLLIN | EPOLLHUP | EPOLLRDHUP | EPOLLERR)) )
+            return;
+    }
+
+    // read straight into the receive buffer, after anything partial
+    pRead = rxWritePtr( &rxBuffer, &szFree );
+    n = readTCPmessage( pRead, (int)szFree );
+    serverDataRead( n );
+}
+
+// ---------------------------------------------------------------------------
+// io_uring completion - the receive queued by watchSocket() is done
+//
+void onSocketReceived( int32_t nRes, void *pCtx ){
+    if( nRes < 0 ){
+        errno = -nRes;
+        nRes = -1;
+    }
+    serverDataRead( nRes );
+    watchSocket();      // queue the next one
+}
+
+// ---------------------------------------------------------------------------
+// io_uring completion - a send is done, as on EPOLLOUT
+//
+void onSocketSent( int32_t nRes, void *pCtx ){
+    if( nRes < 0 ){
+        errno = -nRes;
+        perror("Non-fatal Error writing to socket. will retry");
+    }
+    sendJournal();
+}
+
+// ---------------------------------------------------------------------------
+// io_uring completion - a group commit of the journal is done
+//
+void onJournalSynced( int32_t nRes, void *pCtx ){
+    if( nRes < 0 ){
+        errno = -nRes;
+        perror("Non-fatal Error syncing journal");
+    }
+
+    // the journal kept the file open for it. A segment trimmed meanwhile can go
+    journalSyncDone( &txJournal, (int)(intptr_t)pCtx );
+}
+
+// ---------------------------------------------------------------------------
+// journal syncer - queue the group commit's fdatasync()s on the ring, to go
+// with the next submit along with the sends and receives
+//
+// returns: 0 if queued, else -1 to sync in place
+//
+int queueJournalSync( int fd, void *pCtx ){
+    struct io_uring_sqe *pSqe;
+
+    if( (pSqe = uringPrepare( &ioRing, IORING_OP_FSYNC, fd, onJournalSynced, (void *)(intptr_t)fd )) == NULL )
+        return( -1 );
+    pSqe->fsync_flags = IORING_FSYNC_DATASYNC;
+    return( 0 );
+}
+
+// ---------------------------------------------------------------------------
+// event handler - io_uring operations have completed
+//
+void onRingEvent( int fd, uint32_t uiEvents, void *pCtx ){
+    reapUring( &ioRing );
+}
+
+// ---------------------------------------------------------------------------
+// timer callback - runs every half heartbeat while heartbeats are agreed.
+// PINGs the server when nothing else has been sent for a heartbeat; it
+// answers {"msg":"PONG"}. If another server is healthy, a PING or message
+// unanswered for one heartbeat is enough to fail over to it. With nowhere
+// else to go, the server gets HEARTBEAT_MISSES heartbeats to say something
+//
+void onHeartbeatTimer( timer_entry *pTimer, void *pCtx ){
+    uint64_t ullNow = monotonicMillisecs();
+    bool bStandby;
+
+    if( !bSocketOpen || !bHeartbeats )
+        return;
+    bStandby = healthyStandbys( &endpoints, ullNow ) > 0;
+    if( (bStandby && ullUnansweredMs != 0 && ullNow - ullUnansweredMs >= uiHeartbeatMs) ||
+        ullNow - ullLastHeardMs > (uint64_t)HEARTBEAT_MISSES * uiHeartbeatMs ){
+        fprintf(stderr, "Non-fatal Error - nothing from %s for %u ms. %s\n",
+                aServers[endpoints.nActive].szHost, (uint32_t)(ullNow - ullLastHeardMs),
+                bStandby ? "failing over" : "reconnecting" );
+        uiDeadConnections++;
+        connectionLost( true );
+        return;
+    }
+    if( ullNow - ullLastSentMs >= uiHeartbeatMs && tcpPendingBytes() == 0 ){
+        ullPingSentMs = ullNow;
+        sendMessage( HEARTBEAT_PING, strlen( HEARTBEAT_PING ) );
+    }
+    armTimer( &timerWheel, pTimer, ullNow, uiHeartbeatMs / 2 );
+}
+
+// ---------------------------------------------------------------------------
+// timer callback - time to try connecting again
+//
+void onReconnectTimer( timer_entry *pTimer, void *pCtx ){
+    connectToServer();
+}
+
+// ---------------------------------------------------------------------------
+// no server is healthy: wait until the first is out of its backoff (see
+// endpointFailed())
+//
+void scheduleReconnect( void ){
+    uint64_t ullNow = monotonicMillisecs();
+    uint64_t ullRetryAt = nextEndpointRetry( &endpoints );
+    uint32_t uiDelayMs = ullRetryAt > ullNow ? (uint32_t)(ullRetryAt - ullNow) : 0;
+
+    fprintf(stderr, "reconnecting in %u ms\n", uiDelayMs );
+    armTimer( &timerWheel, &reconnectTimer, ullNow, uiDelayMs );
+}
+
+// ---------------------------------------------------------------------------
+// the connection is up: offer the formats again, and replay whatever the
+// server hasn't ACKed
+//
+void onConnected( void ){
+    char szAddr[64];
+    uint64_t ullNow = monotonicMillisecs();
+    uint32_t uiTookMs = (uint32_t)(ullNow - ullConnectStartMs);
+
+    printf("connected to %s (%s) in %u ms\n", aServers[endpoints.nActive].szHost,
+           tcpAddressString( &aServers[endpoints.nActive], nServerAddr, szAddr, sizeof(szAddr) ),
+           uiTookMs );
+    if( bWasConnected && !bSwitching ){
+        uiReconnects++;
+        uiLastReconnectMs = uiTookMs;
+        if( uiTookMs > uiMaxReconnectMs )
+            uiMaxReconnectMs = uiTookMs;
+    }
+    bWasConnected = true;
+    bSwitching = false;
+    endpointSucceeded( &endpoints, endpoints.nActive );
+    if( aServers[endpoints.nActive].transport == TRANSPORT_TCP )   // the others connect at once
+        endpointRttSample( &endpoints, endpoints.nActive, (uint32_t)(ullNow - ullAttemptStartMs) );
+    updateAckTimeout();
+    bSocketOpen = true;
+    ullLastHeardMs = ullNow;
+    ullUnansweredMs = 0;
+    watchSocket();
+
+    // the new connection may be to a different server. ask again
+    bBinaryRecords = false;
+    bFraming = false;
+    bHeartbeats = false;
+    if( bOfferBinary || bOfferFraming || uiHeartbeatMs > 0 )
+        offerFormats();
+
+    // carry on from the journal's watermark. It only moves on ACKs, and
+    // the records after it go to this server with the seqs they had, so
+    // whichever server a record reached, it's never skipped
+    replayJournal();
+}
+
+// ---------------------------------------------------------------------------
+// start connecting to cached address nAddr of the chosen server. If
+// they've all been tried, it has failed: move on to the next best
+//
+void tryServerAddress( int nAddr ){
+    tcp_server *pServer = &aServers[endpoints.nActive];
+    char szAddr[64];
+    int nRet;
+
+    for( nServerAddr = nAddr ; nServerAddr < pServer->nAddrs ; nServerAddr++ ){
+        ullAttemptStartMs = monotonicMillisecs();
+        if( (nRet = connectTCPaddress( pServer, nServerAddr )) == 0 ){
+            onConnected();
+            return;
+        }
+        if( nRet > 0 ){
+            // the socket becomes writable when connect() is done either way
+            if( watchEventFd( getTCPsocketFd(), EPOLLOUT, onConnectEvent, NULL ) != 0 )
+                perror("Non-fatal Error watching TCP socket");
+            armTimer( &timerWheel, &connectTimer, ullAttemptStartMs, TCP_CONNECT_TIMEOUT );
+            return;
+        }
+        fprintf(stderr, "Non-fatal Error connecting to %s: %s\n",
+                tcpAddressString( pServer, nServerAddr, szAddr, sizeof(szAddr) ), strerror( errno ) );
+    }
+
+    // none answered. maybe the server moved: look it up again next time
+    expireTCPaddresses( pServer );
+    endpointFailed( &endpoints, endpoints.nActive, monotonicMillisecs() );
+    connectToServer();
+}
+
+// ---------------------------------------------------------------------------
+// event handler - a connect in progress has finished
+//
+void onConnectEvent( int fd, uint32_t uiEvents, void *pCtx ){
+    char szAddr[64];
+
+    cancelTimer( &timerWheel, &connectTimer );
+    unwatchEventFd( fd );
+    if( finishTCPconnect() == 0 ){
+        onConnected();
+        return;
+    }
+    fprintf(stderr, "Non-fatal Error connecting to %s: %s\n",
+            tcpAddressString( &aServers[endpoints.nActive], nServerAddr, szAddr, sizeof(szAddr) ),
+            strerror( errno ) );
+    closeTCPsocket();
+    tryServerAddress( nServerAddr + 1 );
+}
+
+// ---------------------------------------------------------------------------
+// timer callback - an address took too long to answer. try the next one
+//
+void onConnectTimer( timer_entry *pTimer, void *pCtx ){
+    char szAddr[64];
+
+    fprintf(stderr, "Non-fatal Error - timed out connecting to %s\n",
+            tcpAddressString( &aServers[endpoints.nActive], nServerAddr, szAddr, sizeof(szAddr) ) );
+    unwatchEventFd( getTCPsocketFd() );
+    closeTCPsocket();
+    tryServerAddress( nServerAddr + 1 );
+}
+
+// ---------------------------------------------------------------------------
+// event handler - a lookup of a server's addresses is done. It may have
+// been for a probe rather than for connecting
+//
+void onServerResolved( int fd, uint32_t uiEvents, void *pCtx ){
+    tcp_server *pServer;
+
+    unwatchEventFd( fd );
+    if( finishTCPresolve( &pServer ) <= 0 && pServer != NULL ){
+        fprintf(stderr, "Non-fatal Error - no such host %s\n", pServer->szHost );
+        endpointFailed( &endpoints, (int)(pServer - aServers), monotonicMillisecs() );
+    }
+    if( bAwaitingResolve ){
+        bAwaitingResolve = false;
+        connectToServer();
+    }
+}
+
+// ---------------------------------------------------------------------------
+// connect without blocking the event loop to the best healthy server: look
+// it up (addresses are cached for TCP_RESOLVE_TTL) then try its addresses
+// in turn, each for up to TCP_CONNECT_TIMEOUT. If none is healthy, wait
+//
+void connectToServer( void ){
+    int n, nRet;
+
+    if( (n = chooseEndpoint( &endpoints, monotonicMillisecs() )) < 0 ){
+        scheduleReconnect();
+        return;
+    }
+    if( (nRet = resolveTCPhost( &aServers[n] )) > 0 ){
+        tryServerAddress( 0 );
+        return;
+    }
+    if( nRet == 0 && watchEventFd( getTCPresolveFd(), EPOLLIN, onServerResolved, NULL ) == 0 ){
+        bAwaitingResolve = true;    // this lookup, or one running for a probe
+        return;
+    }
+    perror("Non-fatal Error looking up server");
+    endpointFailed( &endpoints, n, monotonicMillisecs() );
+    connectToServer();
+}
+
+// ---------------------------------------------------------------------------
+// the server hung up, or the connection failed (bFailed), or a faster
+// server was found: close it and connect again in the background, to
+// another server if one is healthy. Transactions keep being journalled
+// meanwhile
+//
+void connectionLost( bool bFailed ){
+    uint64_t ullNow = monotonicMillisecs();
+
+    // stop watching, or epoll keeps reporting the dead socket as readable
+    unwatchEventFd( getTCPsocketFd() );
+    closeTCPsocket();
+    bSocketOpen = false;
+    rxDiscard( &rxBuffer );
+    cancelTimer( &timerWheel, &helloTimer );
+    cancelTimer( &timerWheel, &flushTimer );
+    cancelTimer( &timerWheel, &heartbeatTimer );
+
+    ullConnectStartMs = ullNow;
+    if( bFailed )
+        endpointFailed( &endpoints, endpoints.nActive, ullNow );
+    connectToServer();
+}
+
+// ---------------------------------------------------------------------------
+// move to a server that has become clearly faster, but only between taps:
+// with nothing in flight, none of them is sent twice
+//
+void considerSwitching( void ){
+    uint64_t ullNow = monotonicMillisecs();
+    int n;
+
+    if( !bSocketOpen || timerIsArmed( &helloTimer ) || ackWindowInFlight( &ackWindow ) > 0 ||
+        tcpPendingBytes() > 0 || (n = fasterEndpoint( &endpoints, ullNow )) < 0 )
+        return;
+    printf("switching from %s (%u ms) to %s (%u ms)\n",
+           aServers[endpoints.nActive].szHost, endpointScore( &endpoints, endpoints.nActive ),
+           aServers[n].szHost, endpointScore( &endpoints, n ) );
+    uiSwitches++;
+    bSwitching = true;
+    connectionLost( false );
+}
+
+// ---------------------------------------------------------------------------
+// a probe of server nProbeEndpoint is done: it connected after uiRttMs, or not
+//
+void finishProbe( bool bConnected, uint32_t uiRttMs ){
+    cancelTimer( &timerWheel, &probeDeadline );
+    unwatchEventFd( probeFd );
+    close( probeFd );
+    probeFd = -1;
+
+    if( bConnected )
+        endpointRttSample( &endpoints, nProbeEndpoint, uiRttMs );
+    else if( nProbeEndpoint != endpoints.nActive ){
+        // (the connection in use shows for itself whether it still works)
+        fprintf(stderr, "Non-fatal Error - probe of %s failed\n", aServers[nProbeEndpoint].szHost );
+        endpointFailed( &endpoints, nProbeEndpoint, monotonicMillisecs() );
+    }
+    considerSwitching();
+}
+
+// ---------------------------------------------------------------------------
+// event handler - a probe's handshake is done
+//
+void onProbeEvent( int fd, uint32_t uiEvents, void *pCtx ){
+    finishProbe( tcpConnectResult( fd ) == 0,
+                 (uint32_t)(monotonicMillisecs() - ullProbeStartMs) );
+}
+
+// ---------------------------------------------------------------------------
+// timer callback - a probe took longer than a connect may
+//
+void onProbeDeadline( timer_entry *pTimer, void *pCtx ){
+    finishProbe( false, 0 );
+}
+
+// ---------------------------------------------------------------------------
+// timer callback - time the handshake with the next healthy server in turn
+// (the one in use too), so a faster one is noticed, and one that's down is
+// known before it's needed
+//
+void onProbeTimer( timer_entry *pTimer, void *pCtx ){
+    uint64_t ullNow = monotonicMillisecs();
+    tcp_server *pServer;
+    int n, nRet;
+
+    armTimer( &timerWheel, pTimer, ullNow, ENDPOINT_PROBE_INTERVAL );
+    if( probeFd >= 0 )
+        return;
+    n = nNextProbe;
+    nNextProbe = (nNextProbe + 1) % endpoints.nEndpoints;
+    if( !endpointHealthy( &endpoints, n, ullNow ) )
+        return;
+
+    pServer = &aServers[n];
+    if( pServer->transport != TRANSPORT_TCP )
+        return;     // no handshake to time. PONGs and ACKs do, once in use
+    if( (nRet = resolveTCPhost( pServer )) == 0 )
+        watchEventFd( getTCPresolveFd(), EPOLLIN, onServerResolved, NULL );
+    if( nRet <= 0 )
+        return;     // probed next time round, once looked up
+    if( (probeFd = probeTCPaddress( pServer, 0 )) < 0 ){
+        perror("Non-fatal Error starting probe");
+        return;
+    }
+    nProbeEndpoint = n;
+    ullProbeStartMs = ullNow;
+    if( watchEventFd( probeFd, EPOLLOUT, onProbeEvent, NULL ) != 0 ){
+        close( probeFd );
+        probeFd = -1;
+        return;
+    }
+    armTimer( &timerWheel, &probeDeadline, ullNow, TCP_CONNECT_TIMEOUT );
 }
 
 // ---------------------------------------------------------------------------
@@ -107,9 +1401,23 @@ bool intervalTimeIsUp(  timer_type eTimerID ){
 //
 void error(const char *msg)
 {
+    int i;
+
     perror(msg);
+    stopNFCpoller();
+    drainTransactions();    // what the pollers queued before they stopped
+    for( i=0 ; i < nReaders ; i++ )
+        freeRing( &aTxRings[i] );
+    journalQueued();        // and the taps held, so a restart sends them
     closeTCPsocket();
-    closeNFC();
+    closeNFCreaders();
+    closeEventLoop();
+    closeJournal( &txJournal );
+    if( bUring )
+        closeUring( &ioRing );
+    freeRxBuffer( &rxBuffer );
+    freeTxQueue( &txQueue );
+    freeDedupCache( &dedupCache );
 
     turnOffLED();
     exit(0);
@@ -139,133 +1447,181 @@ void delay ( int nDelayMilliSeconds )
 // Commandline arguments:
 // argv[1]  Host name of server to connect to
 // argv[2]: port number 
+// argv[3..]: more host name and port pairs, of standby servers
 //
 int main(int argc, char *argv[])
 {
-    int nPortNo, n, res;
-    char szBuffer[BUFFER_SIZE];
-    char szPrevBuffer[BUFFER_SIZE];
-    char szReadBuffer[BUFFER_SIZE];
-    char *szHostName;
-    nfc_target nfcTarget;
+    int opt, i;
+    int nWindow = ACK_WINDOW;
+    struct sigaction action;
+    uint32_t uiHeld = TX_QUEUE_SLOTS;
+    txq_policy policy = TXQ_SPILL;
+    const char *szJournalDir = JOURNAL_DIR;
 
     // parse command line arguments
-    if (argc < 3) {
-       printf("usage %s hostname port\n", argv[0]);
+    while( (opt = getopt( argc, argv, "w:j:bfl:k:uq:o:m:p:ad" )) != -1 ){
+      switch(opt){
+        case 'w': nWindow = atoi(optarg); break;
+        case 'j': szJournalDir = optarg; break;
+        case 'b': bOfferBinary = true; break;
+        case 'f': bOfferFraming = true; break;
+        case 'l': uiFrameLatencyMs = (uint32_t)atoi(optarg); break;
+        case 'k': uiHeartbeatMs = (uint32_t)atoi(optarg); break;
+        case 'u': bUring = true; break;
+        case 'a': bAutopoll = true; break;
+        case 'd': bPresence = true; break;
+        case 'm': nMaxTargets = atoi(optarg); break;
+        case 'p': if( (nProfile = parseNFCmodulations( optarg, anmProfile, NFC_MAX_MODULATIONS )) < 0 ) argc = 0; break;
+        case 'q': uiHeld = (uint32_t)atoi(optarg); break;
+        case 'o': if( parseTxPolicy( optarg, &policy ) != 0 ) argc = 0; break;
+        default:  argc = 0;     // print usage
+      }
+    }
+    if( nMaxTargets < 1 || nMaxTargets > NFC_MAX_TARGETS ){
+       fprintf(stderr, "targets per cycle must be 1..%d\n", NFC_MAX_TARGETS );
+       argc = 0;
+    }
+    if (argc - optind < 2 || (argc - optind) % 2 != 0 || argc - optind > 2 * ENDPOINT_MAX) {
+       printf("usage %s [-w ack_window] [-j journal_dir] [-b] [-f [-l frame_latency_ms]] [-k heartbeat_ms] [-u] [-a] [-d] [-m targets] [-p types] [-q held_taps [-o spill|drop|coalesce]] hostname port [hostname port ...]\n", argv[0]);
+       printf("      hostname may be unix:/path (a local aggregator) or udp:hostname\n");
+       printf("      types are polled in the order given, from 14443a,14443b,felica212,felica424,jewel\n");
+       printf("      held taps aren't on disk until journalled: a power cut loses them, and drop or coalesce discards some\n");
        exit(0);
     }
-    nPortNo = atoi(argv[2]);
-    szHostName = argv[1];
-
-
-    // Open Socket
-    printf("opening TCP socket to %s:%d\n", szHostName, nPortNo );
-
-    if ( (n= openTCPSocket( szHostName, nPortNo )) != 0 ){
-      switch(n){
-        case 1: error("unable to open a socket");
-        case 2: error("no such host");
-        case 3: error("unable to connect to server");
-        default: error("<unknown>");
-      }
-    } // if
+    initEndpoints( &endpoints );
+    for( i=optind ; i < argc ; i += 2 ){
+        initTCPserver( &aServers[addEndpoint( &endpoints )], argv[i], atoi(argv[i+1]) );
+    }
 
     // Init NFC device 
-    if( initNFC() != 0 )
+    if( openNFCreaders() != 0 )
         error("unable to initialise NFC device");
 
     // Init GPIO for LED display
     if( initLED() != 0 )
         error("unable to initialise GPIO for LED display");
 
-    // blink LED
-    turnOnLED();
-    setLEDinterval( LED_ON_INTERVAL ); // blink LED     
+    // Init the event loop the session sleeps in between timer deadlines
+    if( initEventLoop() != 0 )
+        error("unable to initialise event loop");
+    if( initRxBuffer( &rxBuffer, RX_BUFFER_SIZE ) != 0 )
+        error("unable to allocate receive buffer");
+
+    // start the timers
+    initTimerWheel( &timerWheel, monotonicMillisecs() );
+    initTimer( &ledTimer, onLEDtimer, NULL );
+    initTimer( &statsTimer, onStatsTimer, NULL );
+    initTimer( &syncTimer, onSyncTimer, NULL );
+    initTimer( &flushTimer, onFlushTimer, NULL );
+    initTimer( &helloTimer, onHelloTimer, NULL );
+    initTimer( &connectTimer, onConnectTimer, NULL );
+    initTimer( &reconnectTimer, onReconnectTimer, NULL );
+    initTimer( &heartbeatTimer, onHeartbeatTimer, NULL );
+    initTimer( &probeTimer, onProbeTimer, NULL );
+    initTimer( &probeDeadline, onProbeDeadline, NULL );
+    srand( (unsigned)(time( NULL ) ^ getpid()) );   // reconnect jitter
+
+    blinkLED();
+    armTimer( &timerWheel, &statsTimer, monotonicMillisecs(), STATS_INTERVAL );
 
+    // up to nWindow messages may wait for an ACK at once
+    if( initAckWindow( &ackWindow, nWindow, TCP_TIMEOUT, &timerWheel, retransmitMessage, NULL ) != 0 ){
+        fprintf(stderr, "ack_window must be 1..%d\n", ACK_WINDOW_MAX );
+        error("invalid ACK window");
+    }
 
-    setNFCinterval( NFC_POLL_INTERVAL ); 
-    setTCPtimeout( TCP_TIMEOUT );   
 
-    strcpy(szBuffer, "" );
-    strcpy(szPrevBuffer, "" );
+    // transactions not ACKed before the last shutdown are sent first, once connected
+    if( openJournal( &txJournal, szJournalDir, 0 ) != 0 )
+        error("unable to open transaction journal");
 
-    // session. send TCP messages to server
-    while(1){
+    // with io_uring, sends, receives and journal syncs are batched into one
+    // system call per pass of the main loop. Without it, epoll as before
+    if( bUring && initUring( &ioRing, 0 ) != 0 ){
+        perror("Non-fatal Error - io_uring not available. using epoll");
+        bUring = false;
+    }
+    if( bUring ){
+        if( watchEventFd( getUringFd( &ioRing ), EPOLLIN, onRingEvent, NULL ) != 0 )
+            error("unable to watch io_uring");
+        useTCPuring( &ioRing, onSocketSent, NULL );
+        setJournalSyncer( &txJournal, queueJournalSync, NULL );
+    }
 
-      if( isLEDon() )
-        if( intervalTimeIsUp(LED_TIMER) )
-            turnOffLED();
+    // queues between the NFC poller threads and the uplink, one per reader
+    for( i=0 ; i < nReaders ; i++ ){
+        if( initRing( &aTxRings[i], sizeof(nfc_transaction), TX_RING_SLOTS ) != 0 )
+            error("unable to allocate transaction queue");
+    }
+    if( (txEventFd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC )) < 0 )
+        error("unable to create transaction queue eventfd");
+    if( watchEventFd( txEventFd, EPOLLIN, onTransactionsQueued, NULL ) != 0 )
+        error("unable to watch transaction queue");
 
-      if( intervalTimeIsUp( NFC_TIMER) ) {
+    // and while the server can't be reached, up to uiHeld taps wait in memory
+    if( uiHeld == 0 && policy != TXQ_SPILL )
+        error("overflow policy needs -q");
+    if( initTxQueue( &txQueue, uiHeld, policy ) != 0 )
+        error("unable to allocate held transactions");
+    if( initDedupCache( &dedupCache, DEDUP_CACHE_CARDS, NFC_QUARANTINE_INTERVAL ) != 0 )
+        error("unable to allocate quarantine");
 
-        // make one poll attempt of NFC device to detect any target
-        if( (res= pollNFC( &nfcTarget, 1, 1 )) < 0 ) {
-            fprintf(stderr,"Non-fatal error - polling NFC device failed");
-            continue;
-        } 
+    // start polling the NFC devices, each on a thread of its own
+    if( startNFCpoller() != 0 )
+        error("unable to start NFC poller thread");
 
-        if( res == 0 )  // no target card detected
-            continue;
+    // Ctrl-C stops the pollers and the session, rather than exiting on the spot
+    memset( &action, 0, sizeof(action) );
+    action.sa_handler = onInterrupt;
+    sigemptyset( &action.sa_mask );
+    if( sigaction( SIGINT, &action, NULL ) != 0 )
+        perror("ERROR: can't catch SIGINT");
 
-        // a target card was detected, process the transaction
+    // connect in the background. taps are held or journalled until it's up, and if
+    // the connection drops it's made again the same way
+    for( i=0 ; i < endpoints.nEndpoints ; i++ )
+        printf("%s %s:%d\n", i == 0 ? "opening TCP socket to" : "  or standby", aServers[i].szHost, aServers[i].nPort );
+    ullConnectStartMs = monotonicMillisecs();
+    connectToServer();
 
-        // print detailed results from NFC target device to console
-        print_nfc_target ( nfcTarget, true );
+    // with standbys, keep timing each server, to move to one that's faster
+    if( endpoints.nEndpoints > 1 )
+        armTimer( &timerWheel, &probeTimer, monotonicMillisecs(), ENDPOINT_PROBE_INTERVAL );
 
-        // convert into a JSON string
-        if( constructJSONstringNFC( nfcTarget, szBuffer, BUFFER_SIZE ) <= 0 ){
-            fprintf(stderr,"Non-fatal Error - construct JSON string failed");
-            continue;
-        }
+    // session. send TCP messages to server, until Ctrl-C
+    while( !atomic_load( &bQuit ) ){
 
-        // if its the same target detected again within the quarantine period, 
-        // ignore it - don't send it to the server
-        if(  strcmp( szBuffer, szPrevBuffer ) == 0 ){ // same card again
-            if( !intervalTimeIsUp(QUA_TIMER) ){  // its still within quarantine period
-                fprintf(stderr,"found same target card within quarantine period. ignoring it.\n");
-                continue;
-            }
-        } 
-        // save the JSON string to compare with the next card event, 
-        // so we dont double-scan a card
-        strcpy(szPrevBuffer, szBuffer );
-        setInterval( QUA_TIMER, NFC_QUARANTINE_INTERVAL );
+      // hand the kernel everything queued on the ring since the last pass
+      if( bUring && uringSubmit( &ioRing, 0 ) < 0 )
+        perror("Non-fatal Error submitting to io_uring");
 
-        printf("\nSending JSON: %s\n", szBuffer );
+      // sleep until the next timer deadline, or until the socket is readable
+      setEventTimeout( millisecsToNextTimer( &timerWheel, monotonicMillisecs() ) );
+      if( runEventLoopOnce() < 0 )
+        error("event loop failed");
 
-        // send JSON string as TCP message to the server
-        if( sendTCPmessage( szBuffer ) <= 0 ){
-            fprintf(stderr,"Non-fatal Error writing to socket. retrying\n");
-            continue;
-        }   
-
-        // blink LED to acknowledge successfully recorded transaction to user
-        turnOnLED();
-        setLEDinterval( LED_ON_INTERVAL );
-
-        // wait for ACK from server
-        // NB socket in tcp_client.c is NOT initialized for non-blocking read !
-        // setInterval( TCP_TIMER, TCP_TIMEOUT );
-        /* TODO: sometimes after a period of downtime, the RPi doesnt get the ACK 
-           so hangs in the read function. so i've disabled reading the ACK.
-        if( (n= readTCPmessage(szReadBuffer, BUFFER_SIZE)) < 0 ){
-            fprintf(stderr,"Non-fatal Error reading from socket. (ACK not received). retrying.\n");
-            continue;
-        }            
-        else if( strcmp(&szReadBuffer[3], "{\"msg\":\"ACK\"}") == 0 )
-            fprintf(stderr, "ACK received from server\n");
-        else 
-            fprintf(stderr, "Non-fatal Error - expected 'ACK' msg, but received %d bytes from server: %s\n",
-                    n, szReadBuffer);
-        */
-        } // if NFC poll interval time is up - poll NFC device
+      // run the callbacks of the timers that are due
+      expireTimers( &timerWheel, monotonicMillisecs() );
 
-    } // while(1)
+    } // while
 
 
+    fprintf(stderr,"\nNFC polling aborted by user\n");
+    stopNFCpoller();
+    drainTransactions();    // what the pollers queued before they stopped
+    for( i=0 ; i < nReaders ; i++ )
+        freeRing( &aTxRings[i] );
+    journalQueued();        // and the taps held, so a restart sends them
     turnOffLED();
     closeTCPsocket();
-    closeNFC();
+    closeNFCreaders();
+    closeEventLoop();
+    closeJournal( &txJournal );
+    if( bUring )
+        closeUring( &ioRing );
+    freeRxBuffer( &rxBuffer );
+    freeTxQueue( &txQueue );
+    freeDedupCache( &dedupCache );
 
 } // main()
 
@@ -0,0 +1,157 @@
+/*
+ * @file rx_buffer.c
+ * @brief receive buffer that reassembles the server's messages from a stream
+ *
+ * TCP delivers bytes, not messages: one read may end halfway through an ACK,
+ * or hold several. Reads go into a ring whose memory is mapped twice in a
+ * row (a memfd mapped at p and at p + size), so whatever the head and tail,
+ * the free space and the unread bytes are each one contiguous run. A partial
+ * message simply stays in the ring until the rest arrives; complete ones are
+ * handed out as pointers into the ring. Nothing is zeroed or copied.
+ *
+ * Messages from the server are JSON objects without nesting, e.g.
+ * {"msg":"ACK","seq":12}. Bytes between them are skipped.
+ */
+#define _GNU_SOURCE             // for memfd_create()
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "rx_buffer.h"
+
+// ---------------------------------------------------------------------------
+// map a ring of at least szSize bytes (rounded up to whole pages)
+//
+// returns: 0 if OK, else -1 on error
+//
+int initRxBuffer( rx_buffer *pRx, size_t szSize ){
+    size_t szPage = (size_t)sysconf( _SC_PAGESIZE );
+    char *pMap;
+    int fd;
+
+    memset( pRx, 0, sizeof(*pRx) );
+    szSize = (szSize + szPage - 1) / szPage * szPage;
+    if( szSize == 0 )
+        return( -1 );
+
+    if( (fd = memfd_create( "rx_buffer", MFD_CLOEXEC )) < 0 )
+        return( -1 );
+    if( ftruncate( fd, szSize ) < 0 ){
+        close( fd );
+        return( -1 );
+    }
+
+    // reserve room for both views, then map the same pages into each half
+    pMap = mmap( NULL, 2 * szSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if( pMap == MAP_FAILED ||
+        mmap( pMap, szSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0 ) == MAP_FAILED ||
+        mmap( pMap + szSize, szSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0 ) == MAP_FAILED ){
+        if( pMap != MAP_FAILED )
+            munmap( pMap, 2 * szSize );
+        close( fd );
+        return( -1 );
+    }
+    close( fd );        // the mappings keep the memory
+
+    pRx->pData = pMap;
+    pRx->szSize = szSize;
+    return( 0 );
+}
+
+// ---------------------------------------------------------------------------
+// unmap the ring
+//
+void freeRxBuffer( rx_buffer *pRx ){
+    if( pRx->pData != NULL )
+        munmap( pRx->pData, 2 * pRx->szSize );
+    pRx->pData = NULL;
+}
+
+// ---------------------------------------------------------------------------
+// where the next read should go, and how much fits there. The space is
+// contiguous even where it wraps
+//
+// returns: pointer to the free space (*pszFree bytes, possibly 0)
+//
+char *rxWritePtr( rx_buffer *pRx, size_t *pszFree ){
+    *pszFree = pRx->szSize - (size_t)(pRx->ullHead - pRx->ullTail);
+    return( pRx->pData + (pRx->ullHead % pRx->szSize) );
+}
+
+// ---------------------------------------------------------------------------
+// szLen bytes were read into the space from rxWritePtr()
+//
+void rxCommit( rx_buffer *pRx, size_t szLen ){
+    pRx->ullHead += szLen;
+}
+
+// ---------------------------------------------------------------------------
+// bytes received but not consumed yet (e.g. a partial message)
+//
+size_t rxPending( const rx_buffer *pRx ){
+    return( (size_t)(pRx->ullHead - pRx->ullTail) );
+}
+
+// ---------------------------------------------------------------------------
+// forget whatever hasn't been consumed, e.g. part of a message from a
+// connection that has closed
+//
+void rxDiscard( rx_buffer *pRx ){
+    pRx->ullTail = pRx->ullHead;
+    pRx->szScanned = 0;
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - drop szLen bytes from the tail
+//
+static void consume( rx_buffer *pRx, size_t szLen ){
+    pRx->ullTail += szLen;
+    pRx->szScanned = 0;
+}
+
+// ---------------------------------------------------------------------------
+// take the next complete message out of the ring. Bytes before its '{' are
+// skipped. Each byte is searched once, however it arrives: a partial
+// message remembers how far it has been searched. A message that can't
+// fit in the ring is discarded, so the stream can recover
+//
+// returns: pointer to the message in the ring (*pszLen bytes, from '{' to
+//          '}'), valid until more is read into the ring; or NULL if there's no
+//          complete message yet
+//
+const char *rxNextMessage( rx_buffer *pRx, size_t *pszLen ){
+    size_t szUsed = rxPending( pRx );
+    const char *pStart = pRx->pData + (pRx->ullTail % pRx->szSize);
+    const char *pOpen, *pClose;
+    size_t szLen;
+
+    if( pRx->szScanned == 0 ){
+        if( (pOpen = memchr( pStart, '{', szUsed )) == NULL ){
+            pRx->uiSkipped += szUsed;
+            consume( pRx, szUsed );
+            return( NULL );
+        }
+        pRx->uiSkipped += pOpen - pStart;
+        consume( pRx, pOpen - pStart );
+        szUsed -= pOpen - pStart;
+        pStart = pOpen;
+        pRx->szScanned = 1;
+    }
+
+    pClose = memchr( pStart + pRx->szScanned, '}', szUsed - pRx->szScanned );
+    if( pClose == NULL ){
+        pRx->szScanned = szUsed;
+        if( szUsed == pRx->szSize ){
+            pRx->uiOverflows++;
+            consume( pRx, szUsed );
+        }
+        return( NULL );
+    }
+
+    szLen = pClose - pStart + 1;
+    consume( pRx, szLen );
+    pRx->uiMessages++;
+    *pszLen = szLen;
+    return( pStart );
+}
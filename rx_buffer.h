@@ -0,0 +1,39 @@
+/*
+ * @file rx_buffer.h
+ * @brief public interface of rx_buffer.c
+ */
+#ifndef _RX_BUFFER_H_
+#define _RX_BUFFER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Definitions
+#define RX_BUFFER_SIZE  4096    // default size. rounded up to whole pages
+
+// A ring of bytes received from the server. Its memory is mapped twice, back
+// to back, so the free space and every message in it are contiguous even
+// where they wrap: reads go straight in, and messages are parsed in place.
+typedef struct {
+    char     *pData;            // szSize bytes, then the same bytes again
+    size_t    szSize;
+    uint64_t  ullHead;          // bytes received so far
+    uint64_t  ullTail;          // bytes consumed so far
+    size_t    szScanned;        // of the message at the tail, bytes already searched
+
+    // counters
+    uint32_t  uiMessages;
+    uint32_t  uiSkipped;        // bytes discarded between messages
+    uint32_t  uiOverflows;      // messages longer than the buffer, discarded
+} rx_buffer;
+
+// function prototypes
+int    initRxBuffer( rx_buffer *pRx, size_t szSize );
+void   freeRxBuffer( rx_buffer *pRx );
+char  *rxWritePtr( rx_buffer *pRx, size_t *pszFree );
+void   rxCommit( rx_buffer *pRx, size_t szLen );
+size_t rxPending( const rx_buffer *pRx );
+void   rxDiscard( rx_buffer *pRx );
+const char *rxNextMessage( rx_buffer *pRx, size_t *pszLen );
+
+#endif // _RX_BUFFER_H_
@@ -0,0 +1,207 @@
+/*
+ * @file rx_buffer_test.c
+ * @brief unit test for rx_buffer.c
+ *
+ * runs standalone - no server needed. Feeds a stream of server messages in
+ * every way TCP may deliver it (a byte at a time, several per read, split
+ * across the end of the ring) and checks each comes out whole, once, in
+ * order.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rx_buffer.h"
+#include "unit_test.h"
+
+#define STREAM_MESSAGES 2000    // enough to wrap the ring many times
+
+static rx_buffer rx;
+static char      acStream[STREAM_MESSAGES * 32];
+static size_t    szStream;
+static uint32_t  uiNextSeq;     // seq of the next ACK expected out
+
+// ---------------------------------------------------------------------------
+// a stream of ACKs {"msg":"ACK","seq":N}, with a PONG every so often
+//
+void buildStream( void ){
+    int i;
+
+    szStream = 0;
+    for( i=0 ; i < STREAM_MESSAGES ; i++ ){
+        szStream += sprintf( acStream + szStream, "{\"msg\":\"ACK\",\"seq\":%d}", i );
+        if( i % 7 == 0 )
+            szStream += sprintf( acStream + szStream, "{\"msg\":\"PONG\"}" );
+    }
+}
+
+// ---------------------------------------------------------------------------
+// take out every complete message, checking each is the next expected
+//
+// returns: number of messages
+//
+int drain( void ){
+    const char *pMessage;
+    char szExpected[32];
+    size_t szLen;
+    int n = 0;
+
+    while( (pMessage = rxNextMessage( &rx, &szLen )) != NULL ){
+        n++;
+        if( szLen == 14 && memcmp( pMessage, "{\"msg\":\"PONG\"}", 14 ) == 0 )
+            continue;
+        sprintf( szExpected, "{\"msg\":\"ACK\",\"seq\":%u}", uiNextSeq++ );
+        if( szLen != strlen(szExpected) || memcmp( pMessage, szExpected, szLen ) != 0 ){
+            fprintf(stderr,"FAILED: got %.*s, expected %s\n", (int)szLen, pMessage, szExpected );
+            nFailures++;
+            return( n );
+        }
+    }
+    return( n );
+}
+
+// ---------------------------------------------------------------------------
+// feed the stream in reads of nChunk bytes (as much as fits, if less)
+//
+void feed( size_t szChunk ){
+    size_t szDone = 0, szFree, szLen;
+    char *pWrite;
+
+    uiNextSeq = 0;
+    while( szDone < szStream ){
+        pWrite = rxWritePtr( &rx, &szFree );
+        szLen = szStream - szDone;
+        if( szLen > szChunk )
+            szLen = szChunk;
+        if( szLen > szFree )
+            szLen = szFree;
+        memcpy( pWrite, acStream + szDone, szLen );
+        rxCommit( &rx, szLen );
+        szDone += szLen;
+        drain();
+    }
+    CHECK( uiNextSeq == STREAM_MESSAGES );
+    CHECK( rxPending( &rx ) == 0 );
+}
+
+// ---------------------------------------------------------------------------
+// one byte per read: every message is partial until its last byte
+//
+void testByteAtATime( void ){
+    initRxBuffer( &rx, RX_BUFFER_SIZE );
+    feed( 1 );
+    CHECK( rx.uiMessages == STREAM_MESSAGES + (STREAM_MESSAGES + 6) / 7 );
+    CHECK( rx.uiSkipped == 0 );
+    freeRxBuffer( &rx );
+}
+
+// ---------------------------------------------------------------------------
+// many messages per read, ending at arbitrary points. Odd sizes put the
+// split messages across the end of the ring
+//
+void testCoalesced( void ){
+    size_t aszChunks[] = { 23, 100, 1000, 4095, 4096, 65536 };
+    int i;
+
+    for( i=0 ; i < (int)(sizeof(aszChunks) / sizeof(aszChunks[0])) ; i++ ){
+        CHECK( initRxBuffer( &rx, RX_BUFFER_SIZE ) == 0 );
+        feed( aszChunks[i] );
+        CHECK( rx.uiOverflows == 0 );
+        freeRxBuffer( &rx );
+    }
+}
+
+// ---------------------------------------------------------------------------
+// a message split across the end of the ring reads back contiguously
+//
+void testWrap( void ){
+    const char *pMessage;
+    size_t szFree, szLen;
+    char *pWrite;
+
+    CHECK( initRxBuffer( &rx, 100 ) == 0 );     // rounds up to a page
+    CHECK( rx.szSize >= 100 && rx.szSize % 4096 == 0 );
+
+    // move the head and tail to 5 bytes before the end
+    pWrite = rxWritePtr( &rx, &szFree );
+    CHECK( szFree == rx.szSize );
+    memset( pWrite, ' ', rx.szSize - 5 );
+    rxCommit( &rx, rx.szSize - 5 );
+    CHECK( rxNextMessage( &rx, &szLen ) == NULL );
+    CHECK( rx.uiSkipped == rx.szSize - 5 );
+
+    pWrite = rxWritePtr( &rx, &szFree );
+    CHECK( szFree == rx.szSize );
+    memcpy( pWrite, "{\"msg\":\"ACK\",\"seq\":9}", 21 );
+    rxCommit( &rx, 21 );
+    CHECK( (pMessage = rxNextMessage( &rx, &szLen )) != NULL );
+    CHECK( szLen == 21 && memcmp( pMessage, "{\"msg\":\"ACK\",\"seq\":9}", 21 ) == 0 );
+    CHECK( pMessage == rx.pData + rx.szSize - 5 );
+    CHECK( rx.pData[3] == 'A' );                // the same bytes, through the first view
+    freeRxBuffer( &rx );
+}
+
+// ---------------------------------------------------------------------------
+// junk between messages is skipped, and a message too long for the ring
+// is dropped without losing the ones after it
+//
+void testJunkAndOverflow( void ){
+    const char *pMessage;
+    size_t szFree, szLen;
+    char *pWrite;
+
+    CHECK( initRxBuffer( &rx, RX_BUFFER_SIZE ) == 0 );
+    pWrite = rxWritePtr( &rx, &szFree );
+    memcpy( pWrite, "\r\nOK{\"msg\":\"ACK\"}\n", 18 );
+    rxCommit( &rx, 18 );
+    CHECK( (pMessage = rxNextMessage( &rx, &szLen )) != NULL && szLen == 13 );
+    CHECK( rxNextMessage( &rx, &szLen ) == NULL );
+    CHECK( rx.uiSkipped == 5 );
+
+    // fill the ring with one unterminated message
+    pWrite = rxWritePtr( &rx, &szFree );
+    pWrite[0] = '{';
+    memset( pWrite + 1, 'x', szFree - 1 );
+    rxCommit( &rx, szFree );
+    CHECK( rxNextMessage( &rx, &szLen ) == NULL );
+    CHECK( rx.uiOverflows == 1 );
+    CHECK( rxPending( &rx ) == 0 );
+
+    pWrite = rxWritePtr( &rx, &szFree );
+    memcpy( pWrite, "x\"}{\"msg\":\"PONG\"}", 17 );
+    rxCommit( &rx, 17 );
+    CHECK( (pMessage = rxNextMessage( &rx, &szLen )) != NULL );
+    CHECK( szLen == 14 && memcmp( pMessage, "{\"msg\":\"PONG\"}", 14 ) == 0 );
+
+    // what's left of a closed connection goes
+    pWrite = rxWritePtr( &rx, &szFree );
+    memcpy( pWrite, "{\"msg\":\"AC", 10 );
+    rxCommit( &rx, 10 );
+    CHECK( rxNextMessage( &rx, &szLen ) == NULL );
+    rxDiscard( &rx );
+    CHECK( rxPending( &rx ) == 0 );
+    pWrite = rxWritePtr( &rx, &szFree );
+    memcpy( pWrite, "K\"}{\"msg\":\"PONG\"}", 17 );
+    rxCommit( &rx, 17 );
+    CHECK( (pMessage = rxNextMessage( &rx, &szLen )) != NULL && szLen == 14 );
+    freeRxBuffer( &rx );
+}
+
+// ===========================================================================
+// main
+//
+int main( int argc, char *argv[] )
+{
+    buildStream();
+    testByteAtATime();
+    testCoalesced();
+    testWrap();
+    testJunkAndOverflow();
+
+    if( nFailures ){
+        printf("%d check(s) FAILED\n", nFailures );
+        exit( EXIT_FAILURE );
+    }
+    printf("all receive buffer tests passed\n");
+    exit( EXIT_SUCCESS );
+}
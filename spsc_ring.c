@@ -0,0 +1,128 @@
+/*
+ * @file spsc_ring.c
+ * @brief lock-free single-producer/single-consumer ring of fixed-size records
+ *
+ * Hands NFC transactions from the poller thread to the uplink without a lock,
+ * so a tap never waits on the network. Head and tail are free-running 32-bit
+ * counters; the slot index is the counter masked by the (power of 2) size.
+ * The producer publishes a slot with a release store of the head, and the
+ * consumer gives it back with a release store of the tail.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "spsc_ring.h"
+
+// ---------------------------------------------------------------------------
+// allocate a ring of uiSlots records of szSlotSize bytes each
+//
+// returns: 0 if OK, else -1 (uiSlots not a power of 2, or out of memory)
+//
+int initRing( spsc_ring *pRing, size_t szSlotSize, uint32_t uiSlots ){
+    memset( pRing, 0, sizeof(*pRing) );
+
+    if( uiSlots < 2 || (uiSlots & (uiSlots - 1)) != 0 )
+        return( -1 );
+    if( (pRing->pbtSlots = calloc( uiSlots, szSlotSize )) == NULL )
+        return( -1 );
+
+    pRing->szSlotSize = szSlotSize;
+    pRing->uiMask = uiSlots - 1;
+    return( 0 );
+}
+
+// ---------------------------------------------------------------------------
+// free the ring's slots. Both threads must have stopped using it.
+//
+void freeRing( spsc_ring *pRing ){
+    free( pRing->pbtSlots );
+    pRing->pbtSlots = NULL;
+}
+
+// ---------------------------------------------------------------------------
+// producer: copy a record into the ring
+//
+// returns: true if queued, false if the ring is full
+//
+bool ringPush( spsc_ring *pRing, const void *pRecord ){
+    uint32_t uiHead = atomic_load_explicit( &pRing->uiHead, memory_order_relaxed );
+    uint32_t uiTail = atomic_load_explicit( &pRing->uiTail, memory_order_acquire );
+    uint32_t uiDepth = uiHead - uiTail;
+
+    if( uiDepth > pRing->uiMask ){
+        atomic_fetch_add_explicit( &pRing->uiOverflows, 1, memory_order_relaxed );
+        return( false );
+    }
+
+    memcpy( pRing->pbtSlots + (uiHead & pRing->uiMask) * pRing->szSlotSize, pRecord, pRing->szSlotSize );
+    atomic_store_explicit( &pRing->uiHead, uiHead + 1, memory_order_release );
+
+    // only the producer writes these, so plain load/store is enough
+    atomic_store_explicit( &pRing->uiPushed,
+        atomic_load_explicit( &pRing->uiPushed, memory_order_relaxed ) + 1, memory_order_relaxed );
+    if( uiDepth + 1 > atomic_load_explicit( &pRing->uiHighWater, memory_order_relaxed ) )
+        atomic_store_explicit( &pRing->uiHighWater, uiDepth + 1, memory_order_relaxed );
+    return( true );
+}
+
+// ---------------------------------------------------------------------------
+// consumer: pointer to the oldest record, left in place in the ring
+//
+// returns: pointer to the record, or NULL if the ring is empty
+//
+void *ringPeek( spsc_ring *pRing ){
+    uint32_t uiTail = atomic_load_explicit( &pRing->uiTail, memory_order_relaxed );
+    uint32_t uiHead = atomic_load_explicit( &pRing->uiHead, memory_order_acquire );
+
+    if( uiHead == uiTail )
+        return( NULL );
+    return( pRing->pbtSlots + (uiTail & pRing->uiMask) * pRing->szSlotSize );
+}
+
+// ---------------------------------------------------------------------------
+// consumer: hand the slot returned by ringPeek() back to the producer
+//
+void ringRelease( spsc_ring *pRing ){
+    uint32_t uiTail = atomic_load_explicit( &pRing->uiTail, memory_order_relaxed );
+
+    atomic_store_explicit( &pRing->uiTail, uiTail + 1, memory_order_release );
+    atomic_store_explicit( &pRing->uiPopped,
+        atomic_load_explicit( &pRing->uiPopped, memory_order_relaxed ) + 1, memory_order_relaxed );
+}
+
+// ---------------------------------------------------------------------------
+// consumer: copy the oldest record out of the ring
+//
+// returns: true if a record was copied, false if the ring is empty
+//
+bool ringPop( spsc_ring *pRing, void *pRecord ){
+    void *pSlot = ringPeek( pRing );
+
+    if( pSlot == NULL )
+        return( false );
+    memcpy( pRecord, pSlot, pRing->szSlotSize );
+    ringRelease( pRing );
+    return( true );
+}
+
+// ---------------------------------------------------------------------------
+// number of records queued. Exact from either thread's own point of view.
+//
+uint32_t ringDepth( spsc_ring *pRing ){
+    // tail first: the head can only have moved further on by the time it's read
+    uint32_t uiTail = atomic_load_explicit( &pRing->uiTail, memory_order_acquire );
+
+    return( atomic_load_explicit( &pRing->uiHead, memory_order_acquire ) - uiTail );
+}
+
+// ---------------------------------------------------------------------------
+// snapshot of the ring counters. Safe to call from any thread.
+//
+void getRingStats( spsc_ring *pRing, ring_stats *pStats ){
+    pStats->uiDepth     = ringDepth( pRing );
+    pStats->uiCapacity  = pRing->uiMask + 1;
+    pStats->uiHighWater = atomic_load_explicit( &pRing->uiHighWater, memory_order_relaxed );
+    pStats->uiPushed    = atomic_load_explicit( &pRing->uiPushed, memory_order_relaxed );
+    pStats->uiPopped    = atomic_load_explicit( &pRing->uiPopped, memory_order_relaxed );
+    pStats->uiOverflows = atomic_load_explicit( &pRing->uiOverflows, memory_order_relaxed );
+}
@@ -0,0 +1,56 @@
+/*
+ * @file spsc_ring.h
+ * @brief public interface of spsc_ring.c
+ */
+#ifndef _SPSC_RING_H_
+#define _SPSC_RING_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#define RING_CACHE_LINE 64
+
+// A ring of fixed-size records with one producer thread and one consumer thread.
+// Head and tail live on separate cache lines so the two threads don't contend.
+typedef struct {
+    // written by the producer
+    _Atomic uint32_t uiHead;                // next slot to write
+    _Atomic uint32_t uiHighWater;           // deepest the ring has been
+    _Atomic uint32_t uiPushed;
+    _Atomic uint32_t uiOverflows;           // pushes refused because the ring was full
+    char             acPad1[RING_CACHE_LINE - 4 * sizeof(uint32_t)];
+
+    // written by the consumer
+    _Atomic uint32_t uiTail;                // next slot to read
+    _Atomic uint32_t uiPopped;
+    char             acPad2[RING_CACHE_LINE - 2 * sizeof(uint32_t)];
+
+    // read-only after initRing()
+    uint8_t         *pbtSlots;
+    size_t           szSlotSize;
+    uint32_t         uiMask;                // number of slots - 1
+} spsc_ring;
+
+// snapshot of the ring counters
+typedef struct {
+    uint32_t uiDepth;
+    uint32_t uiCapacity;
+    uint32_t uiHighWater;
+    uint32_t uiPushed;
+    uint32_t uiPopped;
+    uint32_t uiOverflows;
+} ring_stats;
+
+// function prototypes
+int   initRing( spsc_ring *pRing, size_t szSlotSize, uint32_t uiSlots );
+void  freeRing( spsc_ring *pRing );
+bool  ringPush( spsc_ring *pRing, const void *pRecord );
+bool  ringPop( spsc_ring *pRing, void *pRecord );
+void *ringPeek( spsc_ring *pRing );
+void  ringRelease( spsc_ring *pRing );
+uint32_t ringDepth( spsc_ring *pRing );
+void  getRingStats( spsc_ring *pRing, ring_stats *pStats );
+
+#endif // _SPSC_RING_H_
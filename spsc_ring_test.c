@@ -0,0 +1,138 @@
+/*
+ * @file spsc_ring_test.c
+ * @brief unit test for spsc_ring.c
+ *
+ * runs standalone - no hardware needed. A producer thread pushes numbered
+ * records while the main thread pops them and checks none are lost,
+ * duplicated or reordered.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "spsc_ring.h"
+#include "unit_test.h"
+
+#define RING_SLOTS      64
+#define TEST_RECORDS    1000000
+
+// a record about the size of a queued transaction's header
+typedef struct {
+    uint32_t uiSeq;
+    uint32_t uiCheck;
+    uint8_t  abtPayload[24];
+} test_record;
+
+static spsc_ring ring;
+
+// ---------------------------------------------------------------------------
+// producer thread - push numbered records, spinning while the ring is full
+//
+void *producer( void *pArg ){
+    test_record rec;
+    uint32_t i;
+
+    memset( &rec, 0, sizeof(rec) );
+    for( i=0 ; i < TEST_RECORDS ; i++ ){
+        rec.uiSeq = i;
+        rec.uiCheck = ~i;
+        rec.abtPayload[i % sizeof(rec.abtPayload)] = (uint8_t)i;
+        while( !ringPush( &ring, &rec ) )
+            sched_yield();
+    }
+    return( NULL );
+}
+
+// ---------------------------------------------------------------------------
+// single-threaded behaviour: empty, full, overflow counters
+//
+void testFillAndDrain( void ){
+    test_record rec;
+    ring_stats stats;
+    uint32_t i;
+
+    CHECK( initRing( &ring, sizeof(test_record), 6 ) != 0 );   // not a power of 2
+    CHECK( initRing( &ring, sizeof(test_record), 8 ) == 0 );
+    CHECK( ringPeek( &ring ) == NULL );
+    CHECK( !ringPop( &ring, &rec ) );
+
+    memset( &rec, 0, sizeof(rec) );
+    for( i=0 ; i < 8 ; i++ ){
+        rec.uiSeq = i;
+        CHECK( ringPush( &ring, &rec ) );
+    }
+    CHECK( !ringPush( &ring, &rec ) );          // full
+    CHECK( ringDepth( &ring ) == 8 );
+
+    CHECK( ((test_record *)ringPeek( &ring ))->uiSeq == 0 );
+    ringRelease( &ring );
+    for( i=1 ; i < 5 ; i++ ){
+        CHECK( ringPop( &ring, &rec ) );
+        CHECK( rec.uiSeq == i );
+    }
+
+    getRingStats( &ring, &stats );
+    CHECK( stats.uiDepth == 3 );
+    CHECK( stats.uiCapacity == 8 );
+    CHECK( stats.uiHighWater == 8 );
+    CHECK( stats.uiPushed == 8 );
+    CHECK( stats.uiPopped == 5 );
+    CHECK( stats.uiOverflows == 1 );
+    freeRing( &ring );
+}
+
+// ---------------------------------------------------------------------------
+// one producer thread, one consumer thread
+//
+void testConcurrent( void ){
+    pthread_t thread;
+    test_record rec;
+    ring_stats stats;
+    uint32_t uiExpected = 0;
+    int nBad = 0;
+
+    CHECK( initRing( &ring, sizeof(test_record), RING_SLOTS ) == 0 );
+    if( pthread_create( &thread, NULL, producer, NULL ) != 0 ){
+        perror("pthread_create");
+        exit(EXIT_FAILURE);
+    }
+    while( uiExpected < TEST_RECORDS ){
+        if( !ringPop( &ring, &rec ) ){
+            sched_yield();
+            continue;
+        }
+        if( rec.uiSeq != uiExpected || rec.uiCheck != ~uiExpected ||
+            rec.abtPayload[uiExpected % sizeof(rec.abtPayload)] != (uint8_t)uiExpected )
+            nBad++;
+        uiExpected++;
+    }
+    pthread_join( thread, NULL );
+
+    CHECK( nBad == 0 );
+    getRingStats( &ring, &stats );
+    CHECK( stats.uiDepth == 0 );
+    CHECK( stats.uiPushed == TEST_RECORDS );
+    CHECK( stats.uiPopped == TEST_RECORDS );
+    CHECK( stats.uiHighWater <= RING_SLOTS );
+    printf("%u records passed through a %u slot ring. high-water %u, %u pushes refused while full\n",
+           stats.uiPopped, stats.uiCapacity, stats.uiHighWater, stats.uiOverflows );
+    freeRing( &ring );
+}
+
+// ===========================================================================
+// main
+//
+int main( int argc, char *argv[] )
+{
+    testFillAndDrain();
+    testConcurrent();
+
+    if( nFailures ){
+        printf("%d check(s) FAILED\n", nFailures );
+        exit( EXIT_FAILURE );
+    }
+    printf("all SPSC ring tests passed\n");
+    exit( EXIT_SUCCESS );
+}
@@ -7,6 +7,12 @@
  * The client connects to that remote server, then sends messages over the socket
  * and listens for an ACK from server.
  *
+ * A collector on the same box or LAN needn't cost a TCP connection: a host
+ * name "unix:/path" is a local SOCK_SEQPACKET socket, and "udp:name" sends
+ * datagrams. The calls are the same for all three; with the packet
+ * transports each send is one packet holding whole messages, and each read
+ * returns one.
+ *
  * @author Robert Drummond
  * Copyright (c) 2013 Pink Pelican NZ Ltd <bob@pink-pelican.com>
  */
@@ -14,9 +20,19 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+#include <sys/un.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
 #include <netdb.h> 
 
 #include "tcp_client.h"
@@ -25,38 +41,439 @@
 // STATIC GLOBALS (referenceable within this file only) 
 static int sockfd = -1;
 
+// what's left of the last sendTCPvector(), if the socket didn't take it all
+static struct iovec aPendingIov[TCP_MAX_IOV];
+static int    nPendingIov;
+static size_t szPendingBytes;
+static char   acPendingTail[TCP_TAIL_SIZE];   // rest of a sendTCPbuffer() the socket didn't take
+
+// the io_uring backend, if in use (see useTCPuring())
+static uring        *pTCPring;
+static uring_handler fnSentHandler;     // told when a send is done
+static void         *pSentCtx;
+static uring_handler fnReceivedHandler; // and when a receive is
+static void         *pReceivedCtx;
+static struct msghdr sendMsg;           // of the send in flight, read by the kernel
+static bool          bSendInFlight;
+static bool          bReceiveInFlight;
+static uintptr_t     uiSocketGen;       // bumped on close: completions for an old socket are dropped
+
+static int writePending( void );
+
+
+// the resolver thread, and what it found. read only after it's joined
+static pthread_t resolverThread;
+static tcp_server *pResolving;          // server being looked up, if any
+static int      resolveFd = -1;         // eventfd, signalled when it's done
+static struct sockaddr_storage aResolved[TCP_MAX_ADDRS];
+static socklen_t aResolvedLens[TCP_MAX_ADDRS];
+static int      nResolved;
+static int      nResolveError;          // getaddrinfo() result
+static int      nResolveSocktype;
+static char     szResolveHost[256];
+static char     szResolvePort[8];
+
 
 // ---------------------------------------------------------------------------
-// open a socket and connect to a remote server
+// Internal function - milliseconds on the monotonic clock
 //
-// returns : 0 if OK, else error code
-// 
-int openTCPSocket(char *szHostName, int nPort ){
+static uint64_t nowMillisecs( void ){
+    struct timespec ts;
 
-    struct sockaddr_in serv_addr;
-    struct hostent *server;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return( (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000 );
+}
+
+// ---------------------------------------------------------------------------
+// a server to connect to. Its addresses are looked up when first needed.
+// The host name's prefix, if any, picks the transport (see tcp_client.h)
+//
+void initTCPserver( tcp_server *pServer, const char *szHostName, int nPort ){
+    memset( pServer, 0, sizeof(*pServer) );
+    snprintf( pServer->szHost, sizeof(pServer->szHost), "%s", szHostName );
+    pServer->nPort = nPort;
+    if( strncmp( szHostName, TCP_UNIX_PREFIX, strlen( TCP_UNIX_PREFIX ) ) == 0 )
+        pServer->transport = TRANSPORT_UNIX;
+    else if( strncmp( szHostName, TCP_UDP_PREFIX, strlen( TCP_UDP_PREFIX ) ) == 0 )
+        pServer->transport = TRANSPORT_UDP;
+    else
+        pServer->transport = TRANSPORT_TCP;
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - the server's host name (or path) without the prefix
+//
+static const char *hostPart( const tcp_server *pServer ){
+    switch( pServer->transport ){
+      case TRANSPORT_UNIX: return( pServer->szHost + strlen( TCP_UNIX_PREFIX ) );
+      case TRANSPORT_UDP:  return( pServer->szHost + strlen( TCP_UDP_PREFIX ) );
+      default:             return( pServer->szHost );
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - socket type of the server's transport
+//
+static int socketType( const tcp_server *pServer ){
+    switch( pServer->transport ){
+      case TRANSPORT_UNIX: return( SOCK_SEQPACKET );
+      case TRANSPORT_UDP:  return( SOCK_DGRAM );
+      default:             return( SOCK_STREAM );
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - a local aggregator's address is its path: nothing to
+// look up, and it never expires
+//
+// returns: 1, else -1 if the path is too long
+//
+static int setUnixAddress( tcp_server *pServer ){
+    struct sockaddr_un *pAddr = (struct sockaddr_un *)&pServer->aAddrs[0];
+    const char *szPath = hostPart( pServer );
+
+    if( strlen( szPath ) >= sizeof(pAddr->sun_path) ){
+        errno = ENAMETOOLONG;
+        return( -1 );
+    }
+    memset( pAddr, 0, sizeof(*pAddr) );
+    pAddr->sun_family = AF_UNIX;
+    strcpy( pAddr->sun_path, szPath );
+    pServer->aAddrLens[0] = sizeof(*pAddr);
+    pServer->nAddrs = 1;
+    pServer->ullExpireMs = UINT64_MAX;
+    return( 1 );
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - look up szResolveHost with getaddrinfo(), IPv6 and
+// IPv4. Addresses come back in the order RFC 6724 prefers; they're
+// reordered to alternate between the families (as RFC 8305 does), so if
+// one family is unreachable the fallback is the next address tried
+//
+// returns: getaddrinfo() result, 0 if OK
+//
+static int resolveNow( void ){
+    struct addrinfo hints, *pList, *pAi;
+    struct addrinfo *apFamily[2][TCP_MAX_ADDRS];
+    int anFamily[2] = { 0, 0 };
+    int nFirst, nFamily, nRet, i;
+
+    memset( &hints, 0, sizeof(hints) );
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = nResolveSocktype;
+    hints.ai_flags = AI_ADDRCONFIG;
+    nResolved = 0;
+    if( (nRet = getaddrinfo( szResolveHost, szResolvePort, &hints, &pList )) != 0 )
+        return( nRet );
+
+    nFirst = pList->ai_family;
+    for( pAi = pList ; pAi != NULL ; pAi = pAi->ai_next ){
+        nFamily = (pAi->ai_family == nFirst) ? 0 : 1;
+        if( anFamily[nFamily] < TCP_MAX_ADDRS && pAi->ai_addrlen <= sizeof(struct sockaddr_storage) )
+            apFamily[nFamily][anFamily[nFamily]++] = pAi;
+    }
+    for( i=0 ; nResolved < TCP_MAX_ADDRS && i < TCP_MAX_ADDRS ; i++ ){
+        for( nFamily = 0 ; nFamily < 2 && nResolved < TCP_MAX_ADDRS ; nFamily++ ){
+            if( i >= anFamily[nFamily] )
+                continue;
+            pAi = apFamily[nFamily][i];
+            memcpy( &aResolved[nResolved], pAi->ai_addr, pAi->ai_addrlen );
+            aResolvedLens[nResolved++] = pAi->ai_addrlen;
+        }
+    }
+    freeaddrinfo( pList );
+    return( 0 );
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - body of the resolver thread. getaddrinfo() can block
+// for seconds, so it never runs on the event loop
+//
+static void *resolverThreadMain( void *pArg ){
+    uint64_t ullOne = 1;
+
+    nResolveError = resolveNow();
+    if( write( resolveFd, &ullOne, sizeof(ullOne) ) < 0 )
+        perror("Non-fatal Error signalling resolver");
+    return( NULL );
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - take the resolver's addresses into the server's cache
+//
+// returns: number of addresses, else -1 if the host wasn't found
+//
+static int cacheResolved( tcp_server *pServer ){
+    if( nResolveError != 0 || nResolved == 0 ){
+        // keep trying the stale addresses, if any, rather than none at all
+        pServer->ullExpireMs = nowMillisecs() + TCP_RESOLVE_RETRY;
+        return( pServer->nAddrs > 0 ? pServer->nAddrs : -1 );
+    }
+    memcpy( pServer->aAddrs, aResolved, nResolved * sizeof(aResolved[0]) );
+    memcpy( pServer->aAddrLens, aResolvedLens, nResolved * sizeof(aResolvedLens[0]) );
+    pServer->nAddrs = nResolved;
+    pServer->ullExpireMs = nowMillisecs() + TCP_RESOLVE_TTL;
+    return( pServer->nAddrs );
+}
+
+// ---------------------------------------------------------------------------
+// make sure the addresses of a server are known. If they're missing or
+// older than TCP_RESOLVE_TTL, they're looked up on a thread of their own:
+// wait for getTCPresolveFd() to be readable, then call finishTCPresolve().
+// One lookup runs at a time
+//
+// returns: 1 if the cached addresses can be used now, 0 if a lookup (of
+//          this server or another) is running, else -1 on error
+//
+int resolveTCPhost( tcp_server *pServer ){
+    if( pServer->nAddrs > 0 && nowMillisecs() < pServer->ullExpireMs )
+        return( 1 );
+    if( pServer->transport == TRANSPORT_UNIX )
+        return( setUnixAddress( pServer ) );
+    if( pResolving != NULL )
+        return( 0 );
+
+    if( resolveFd < 0 && (resolveFd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC )) < 0 )
+        return( -1 );
+    snprintf( szResolveHost, sizeof(szResolveHost), "%s", hostPart( pServer ) );
+    snprintf( szResolvePort, sizeof(szResolvePort), "%d", pServer->nPort );
+    nResolveSocktype = socketType( pServer );
+    if( pthread_create( &resolverThread, NULL, resolverThreadMain, NULL ) != 0 )
+        return( -1 );
+    pResolving = pServer;
+    return( 0 );
+}
+
+// ---------------------------------------------------------------------------
+// file descriptor that becomes readable when a lookup started by
+// resolveTCPhost() is done, for the caller's event loop
+//
+// returns: eventfd, or -1 if no lookup was ever started
+//
+int getTCPresolveFd( void ){
+    return( resolveFd );
+}
+
+// ---------------------------------------------------------------------------
+// collect the result of the lookup started by resolveTCPhost(). If the host
+// can't be resolved now, stale addresses are still better than none
+//
+// returns: number of addresses of the server looked up (*ppServer), else
+//          -1 if it wasn't found
+//
+int finishTCPresolve( tcp_server **ppServer ){
+    uint64_t ullSignals;
+    tcp_server *pServer = pResolving;
+
+    *ppServer = pServer;
+    if( pServer == NULL )
+        return( -1 );
+    pthread_join( resolverThread, NULL );
+    pResolving = NULL;
+    if( read( resolveFd, &ullSignals, sizeof(ullSignals) ) < 0 )
+        perror("Non-fatal Error reading resolver signal");
+    return( cacheResolved( pServer ) );
+}
+
+// ---------------------------------------------------------------------------
+// make the next resolveTCPhost() look the server up again, e.g. when none
+// of its addresses answer any more
+//
+void expireTCPaddresses( tcp_server *pServer ){
+    pServer->ullExpireMs = 0;
+}
+
+// ---------------------------------------------------------------------------
+// cached address nAddr of a server as text, for logging
+//
+// returns: szBuffer
+//
+const char *tcpAddressString( const tcp_server *pServer, int nAddr, char *szBuffer, size_t szLen ){
+    const struct sockaddr_storage *pAddr = &pServer->aAddrs[nAddr];
+    char szIp[INET6_ADDRSTRLEN] = "?";
+
+    if( pAddr->ss_family == AF_UNIX )
+        snprintf( szBuffer, szLen, "%s", ((const struct sockaddr_un *)pAddr)->sun_path );
+    else if( pAddr->ss_family == AF_INET6 ){
+        inet_ntop( AF_INET6, &((const struct sockaddr_in6 *)pAddr)->sin6_addr, szIp, sizeof(szIp) );
+        snprintf( szBuffer, szLen, "[%s]:%d", szIp, pServer->nPort );
+    } else {
+        inet_ntop( AF_INET, &((const struct sockaddr_in *)pAddr)->sin_addr, szIp, sizeof(szIp) );
+        snprintf( szBuffer, szLen, "%s:%d", szIp, pServer->nPort );
+    }
+    return( szBuffer );
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - have the kernel notice a server that has silently
+// gone (power cut, cable pulled, NAT state dropped) within seconds: probe
+// it when the connection is idle, and fail the connection if data sent
+// isn't acknowledged in time. Either way epoll reports an error on the
+// socket, rather than the next tap finding a dead link
+//
+// returns: 0 if OK, else -1 on error
+//
+static int setDeadPeerDetection( int fd ){
+    int nOn = 1, nIdle = TCP_PROBE_IDLE, nInterval = TCP_PROBE_INTERVAL;
+    int nCount = TCP_PROBE_COUNT;
+    unsigned int uiTimeout = TCP_DEAD_PEER_TIMEOUT;
+
+    if( setsockopt( fd, SOL_SOCKET, SO_KEEPALIVE, &nOn, sizeof(nOn) ) < 0 ||
+        setsockopt( fd, IPPROTO_TCP, TCP_KEEPIDLE, &nIdle, sizeof(nIdle) ) < 0 ||
+        setsockopt( fd, IPPROTO_TCP, TCP_KEEPINTVL, &nInterval, sizeof(nInterval) ) < 0 ||
+        setsockopt( fd, IPPROTO_TCP, TCP_KEEPCNT, &nCount, sizeof(nCount) ) < 0 ||
+        setsockopt( fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &uiTimeout, sizeof(uiTimeout) ) < 0 )
+        return( -1 );
+    return( 0 );
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - a non-blocking socket, connecting to address nAddr
+//
+// returns: socket fd, else -1 on error. *pnRet is 0 if connected already,
+//          1 if in progress
+//
+static int startConnect( const tcp_server *pServer, int nAddr, int *pnRet ){
+    int fd;
+
+    if( nAddr < 0 || nAddr >= pServer->nAddrs ){
+        errno = EINVAL;
+        return( -1 );
+    }
+    fd = socket( pServer->aAddrs[nAddr].ss_family, socketType( pServer ) | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+    if( fd < 0 )
+        return( -1 );
+    if( connect( fd, (const struct sockaddr *)&pServer->aAddrs[nAddr], pServer->aAddrLens[nAddr] ) == 0 ){
+        *pnRet = 0;
+        return( fd );
+    }
+    if( errno == EINPROGRESS ){
+        *pnRet = 1;
+        return( fd );
+    }
+    close( fd );
+    return( -1 );
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - the socket has connected. With io_uring, sends and
+// receives wait in the kernel rather than failing with EAGAIN, which they'd
+// do on a non-blocking socket; the event loop never waits on it then
+//
+static void connectedTCPsocket( void ){
+    if( pTCPring != NULL )
+        fcntl( sockfd, F_SETFL, fcntl( sockfd, F_GETFL ) & ~O_NONBLOCK );
+}
+
+// ---------------------------------------------------------------------------
+// start connecting to cached address nAddr of a server without blocking.
+// If it's in progress, wait for the socket (getTCPsocketFd()) to be
+// writable, then call finishTCPconnect(). The caller keeps the deadline
+//
+// returns: 0 if connected already, 1 if in progress, else -1 on error
+//
+int connectTCPaddress( const tcp_server *pServer, int nAddr ){
+    int nRet;
+
+    closeTCPsocket();
+    if( (sockfd = startConnect( pServer, nAddr, &nRet )) < 0 )
+        return( -1 );
+    if( pServer->transport == TRANSPORT_TCP && setDeadPeerDetection( sockfd ) < 0 )
+        perror("Non-fatal Error setting TCP keepalive");
+    if( nRet == 0 )
+        connectedTCPsocket();
+    return( nRet );
+}
+
+// ---------------------------------------------------------------------------
+// start a connection to cached address nAddr of a server, only to time
+// the handshake: a measure of its round trip time that doesn't disturb
+// the connection in use. Wait for the socket to be writable, then call
+// tcpConnectResult() and close it
+//
+// returns: socket fd of the probe, else -1 on error
+//
+int probeTCPaddress( const tcp_server *pServer, int nAddr ){
+    int nRet;
+
+    // a datagram or local "connection" is made at once, and times nothing
+    if( pServer->transport != TRANSPORT_TCP ){
+        errno = EOPNOTSUPP;
+        return( -1 );
+    }
+    return( startConnect( pServer, nAddr, &nRet ) );
+}
+
+// ---------------------------------------------------------------------------
+// a socket connecting without blocking became writable: did it connect?
+//
+// returns: 0 if connected, else -1 (errno says why)
+//
+int tcpConnectResult( int fd ){
+    int nError = 0;
+    socklen_t len = sizeof(nError);
 
-    sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sockfd < 0) 
-        return(1); // error("ERROR opening socket");
-    server = gethostbyname( szHostName );
-    if (server == NULL) {
-        return(2); // error no such host
+    if( getsockopt( fd, SOL_SOCKET, SO_ERROR, &nError, &len ) < 0 )
+        return( -1 );
+    if( nError != 0 ){
+        errno = nError;
+        return( -1 );
     }
+    return( 0 );
+}
 
-    // connect to server
-    bzero((char *) &serv_addr, sizeof(serv_addr));
-    serv_addr.sin_family = AF_INET;
-    bcopy((char *)server->h_addr, 
-         (char *)&serv_addr.sin_addr.s_addr,
-         server->h_length);
-    serv_addr.sin_port = htons( nPort );
+// ---------------------------------------------------------------------------
+// the socket of a connect in progress became writable: did it connect?
+//
+// returns: 0 if connected, else -1 (errno says why)
+//
+int finishTCPconnect( void ){
+    if( tcpConnectResult( sockfd ) < 0 )
+        return( -1 );
+    connectedTCPsocket();
+    return( 0 );
+}
+
+// ---------------------------------------------------------------------------
+// open a socket and connect to a remote server, trying each of its
+// addresses for up to TCP_CONNECT_TIMEOUT. Blocks: for simple clients and
+// tests. The application connects with the calls above instead
+//
+// returns : 0 if OK, else error code
+// 
+int openTCPSocket(char *szHostName, int nPort ){
+    static tcp_server server;
+    struct pollfd pfd;
+    int i, nRet;
 
-    // try connect to server
-    if (connect(sockfd,(struct sockaddr *) &serv_addr,sizeof(serv_addr)) < 0) 
-        return(3); // error("ERROR connecting");
+    initTCPserver( &server, szHostName, nPort );
+    if( server.transport == TRANSPORT_UNIX ){
+        if( setUnixAddress( &server ) < 0 )
+            return(2); // error no such host
+    } else {
+        snprintf( szResolveHost, sizeof(szResolveHost), "%s", hostPart( &server ) );
+        snprintf( szResolvePort, sizeof(szResolvePort), "%d", nPort );
+        nResolveSocktype = socketType( &server );
+        nResolveError = resolveNow();
+        if( cacheResolved( &server ) < 0 )
+            return(2); // error no such host
+    }
 
-    return(0); // return OK
+    for( i=0 ; i < server.nAddrs ; i++ ){
+        if( (nRet = connectTCPaddress( &server, i )) > 0 ){
+            pfd.fd = sockfd;
+            pfd.events = POLLOUT;
+            nRet = (poll( &pfd, 1, TCP_CONNECT_TIMEOUT ) == 1) ? finishTCPconnect() : -1;
+        }
+        if( nRet == 0 ){
+            // simple clients expect writes to block
+            fcntl( sockfd, F_SETFL, fcntl( sockfd, F_GETFL ) & ~O_NONBLOCK );
+            return(0); // return OK
+        }
+    }
+    closeTCPsocket();
+    return(3); // error("ERROR connecting");
 }
 
 // ---------------------------------------------------------------------------
@@ -66,26 +483,277 @@ int openTCPSocket(char *szHostName, int nPort ){
 //
 int sendTCPmessage( char *message ) {
 
-    return( write(sockfd,message,strlen(message)) );
+    return( sendTCPbuffer( message, strlen(message) ) );
+}
+
+// ---------------------------------------------------------------------------
+// send szLen bytes to server. The socket doesn't block: if it takes only
+// part, a copy of the rest is kept pending like the rest of a vector, so a
+// message is never cut short on the wire. Hence at most TCP_TAIL_SIZE bytes
+//
+// returns: number of bytes written or kept pending,  else < 1 on error
+//          (errno EMSGSIZE if szLen > TCP_TAIL_SIZE)
+//
+int sendTCPbuffer( const char *pBuffer, size_t szLen ) {
+    ssize_t n;
+
+    // don't cut into the middle of a vector still being written
+    if( nPendingIov > 0 ){
+        errno = EAGAIN;
+        return( -1 );
+    }
+
+    // too big to keep the rest of, should the socket take only part
+    if( szLen > sizeof(acPendingTail) ){
+        errno = EMSGSIZE;
+        return( -1 );
+    }
+
+    // with io_uring, a copy goes with the next submit
+    if( pTCPring != NULL ){
+        memcpy( acPendingTail, pBuffer, szLen );
+        aPendingIov[0].iov_base = acPendingTail;
+        aPendingIov[0].iov_len = szLen;
+        nPendingIov = 1;
+        szPendingBytes = szLen;
+        return( writePending() < 0 ? -1 : (int)szLen );
+    }
+    if( (n= send( sockfd, pBuffer, szLen, MSG_DONTWAIT | MSG_NOSIGNAL )) < 0 ){
+        if( errno != EAGAIN && errno != EWOULDBLOCK )
+            return( -1 );
+        n = 0;
+    }
+    if( (size_t)n == szLen )
+        return( (int)n );
+
+    memcpy( acPendingTail, pBuffer + n, szLen - n );
+    aPendingIov[0].iov_base = acPendingTail;
+    aPendingIov[0].iov_len = szLen - n;
+    nPendingIov = 1;
+    szPendingBytes = szLen - n;
+    return( (int)szLen );
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - drop n bytes written from the pending iovecs: whole
+// iovecs from the front, and the written part of the next one
+//
+static void dropWritten( size_t n ){
+    int i;
+
+    szPendingBytes -= n;
+    for( i=0 ; i < nPendingIov && n >= aPendingIov[i].iov_len ; i++ )
+        n -= aPendingIov[i].iov_len;
+    if( i < nPendingIov ){
+        aPendingIov[i].iov_base = (char *)aPendingIov[i].iov_base + n;
+        aPendingIov[i].iov_len -= n;
+    }
+    nPendingIov -= i;
+    memmove( aPendingIov, aPendingIov + i, nPendingIov * sizeof(struct iovec) );
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - io_uring completion of a send: carry on with what the
+// socket didn't take, else tell the caller it's done
+//
+static void onSendCompleted( int32_t nRes, void *pCtx ){
+    if( (uintptr_t)pCtx != uiSocketGen )
+        return;     // for a socket since closed
+    bSendInFlight = false;
+    if( nRes < 0 ){
+        nPendingIov = 0;
+        szPendingBytes = 0;
+    }
+    else {
+        dropWritten( (size_t)nRes );
+        if( nPendingIov > 0 && writePending() == 0 )
+            return;
+    }
+    if( fnSentHandler != NULL )
+        fnSentHandler( nRes, pSentCtx );
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - write as much of the pending iovecs as the socket
+// takes without blocking, then drop what was written. With io_uring the
+// whole of them is queued as one sendmsg instead, submitted by the caller
+//
+// returns: 0 if OK (even if some is still pending), else -1 on error
+//
+static int writePending( void ){
+    struct io_uring_sqe *pSqe;
+    struct msghdr msg;
+    ssize_t n;
+
+    if( pTCPring != NULL ){
+        if( bSendInFlight )
+            return( 0 );
+        if( (pSqe = uringPrepare( pTCPring, IORING_OP_SENDMSG, sockfd,
+                                  onSendCompleted, (void *)uiSocketGen )) == NULL ){
+            nPendingIov = 0;
+            szPendingBytes = 0;
+            return( -1 );
+        }
+        memset( &sendMsg, 0, sizeof(sendMsg) );
+        sendMsg.msg_iov = aPendingIov;
+        sendMsg.msg_iovlen = nPendingIov;
+        pSqe->addr = (uint64_t)(uintptr_t)&sendMsg;
+        pSqe->len = 1;
+        pSqe->msg_flags = MSG_NOSIGNAL;
+        bSendInFlight = true;
+        return( 0 );
+    }
+
+    memset( &msg, 0, sizeof(msg) );
+    msg.msg_iov = aPendingIov;
+    msg.msg_iovlen = nPendingIov;
+    if( (n= sendmsg( sockfd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL )) < 0 ){
+        if( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR )
+            return( 0 );
+        nPendingIov = 0;
+        szPendingBytes = 0;
+        return( -1 );
+    }
+    dropWritten( (size_t)n );
+    return( 0 );
+}
+
+// ---------------------------------------------------------------------------
+// send the buffers of an iovec array to server in one system call, straight
+// from where they are. If the socket can't take it all now, the rest is kept
+// pending: the buffers must stay valid until tcpPendingBytes() is 0, and
+// flushTCPpending() be called when the socket is writable.
+//
+// returns: 0 if OK, else -1 on error (errno EAGAIN if the previous vector is
+//          still pending, EMSGSIZE if nIov > TCP_MAX_IOV)
+//
+int sendTCPvector( const struct iovec *pIov, int nIov ){
+    int i;
+
+    if( nPendingIov > 0 ){
+        errno = EAGAIN;
+        return( -1 );
+    }
+    if( nIov > TCP_MAX_IOV ){
+        errno = EMSGSIZE;
+        return( -1 );
+    }
+    memcpy( aPendingIov, pIov, nIov * sizeof(struct iovec) );
+    nPendingIov = nIov;
+    for( i=0, szPendingBytes = 0 ; i < nIov ; i++ )
+        szPendingBytes += pIov[i].iov_len;
+
+    return( writePending() );
+}
+
+// ---------------------------------------------------------------------------
+// carry on writing a vector the socket didn't take all at once
+//
+// returns: bytes still pending, else -1 on error
+//
+long flushTCPpending( void ){
+    if( nPendingIov > 0 && !bSendInFlight && writePending() < 0 )
+        return( -1 );
+    return( (long)szPendingBytes );
 }
 
 // ---------------------------------------------------------------------------
-// read from the socket - wait for response from server
+// bytes of the last sendTCPvector() not written yet
 //
-// returns: number of bytes read or < 1 on error. 
+size_t tcpPendingBytes( void ){
+    return( szPendingBytes );
+}
+
+// ---------------------------------------------------------------------------
+// read whatever the server has sent, up to buflen bytes. It may be part of
+// a message, or several: see rx_buffer.c. Never blocks: call it when the
+// socket is readable. The buffer is not NUL-terminated.
+//
+// returns: number of bytes read, 0 if the server closed the connection, 
+//          or < 0 on error (errno EAGAIN if there was nothing to read)
 //
 int readTCPmessage( char *buffer, int buflen ){
 
-    bzero(buffer,buflen);
-    return( read(sockfd,buffer,buflen-1) );
+    return( recv(sockfd,buffer,buflen,MSG_DONTWAIT) );
+}
+
+// ---------------------------------------------------------------------------
+// file descriptor of the connected socket, for the caller's event loop
+//
+// returns: socket fd, or -1 if not open
+//
+int getTCPsocketFd( void ){
+    return( sockfd );
+}
+
+// ---------------------------------------------------------------------------
+// send and receive through io_uring rather than with a system call each.
+// Sends are queued on pRing and go with the caller's next uringSubmit();
+// fnSent is called from reapUring() once one is done (or failed: nRes < 0),
+// as flushTCPpending() would be called on EPOLLOUT. Receives are started
+// with startTCPreceive(). The socket then needn't be in the event loop at
+// all, only the ring. Set it before connecting. pRing NULL goes back to
+// plain system calls
+//
+void useTCPuring( uring *pRing, uring_handler fnSent, void *pCtx ){
+    pTCPring = pRing;
+    fnSentHandler = fnSent;
+    pSentCtx = pCtx;
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - io_uring completion of a receive
+//
+static void onReceiveCompleted( int32_t nRes, void *pCtx ){
+    if( (uintptr_t)pCtx != uiSocketGen )
+        return;     // for a socket since closed
+    bReceiveInFlight = false;
+    if( fnReceivedHandler != NULL )
+        fnReceivedHandler( nRes, pReceivedCtx );
+}
+
+// ---------------------------------------------------------------------------
+// with io_uring (see useTCPuring()), queue a receive of up to szLen bytes
+// into pBuffer, which must stay valid until it completes. fnReceived is
+// called from reapUring() with what readTCPmessage() would have returned,
+// or -errno. Start another from it to keep receiving
+//
+// returns: 0 if queued (or one already is), else -1 on error
+//
+int startTCPreceive( char *pBuffer, size_t szLen, uring_handler fnReceived, void *pCtx ){
+    struct io_uring_sqe *pSqe;
+
+    if( pTCPring == NULL || sockfd < 0 ){
+        errno = EINVAL;
+        return( -1 );
+    }
+    if( bReceiveInFlight )
+        return( 0 );
+    if( (pSqe = uringPrepare( pTCPring, IORING_OP_RECV, sockfd,
+                              onReceiveCompleted, (void *)uiSocketGen )) == NULL )
+        return( -1 );
+    pSqe->addr = (uint64_t)(uintptr_t)pBuffer;
+    pSqe->len = (uint32_t)szLen;
+    fnReceivedHandler = fnReceived;
+    pReceivedCtx = pCtx;
+    bReceiveInFlight = true;
+    return( 0 );
 }
 
 // ---------------------------------------------------------------------------
 // close socket
 //
 void closeTCPsocket(void){
+    if( sockfd >= 0 && pTCPring != NULL )
+      shutdown(sockfd, SHUT_RDWR);  // or a receive in flight keeps it open
     if( sockfd >= 0 )    
       close(sockfd);
+    sockfd = -1;
+    nPendingIov = 0;
+    szPendingBytes = 0;
+    bSendInFlight = false;
+    bReceiveInFlight = false;
+    uiSocketGen++;
 }
 
 
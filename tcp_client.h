@@ -6,10 +6,67 @@
  * Copyright (c) 2013 Pink Pelican NZ Ltd <bob@pink-pelican.com>
  */
 
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+
+#include "uring.h"
+
+// Definitions
+#define TCP_MAX_IOV     256     // most iovecs in one sendTCPvector()
+#define TCP_TAIL_SIZE  4096     // most of a sendTCPbuffer() kept pending when the socket is full
+#define TCP_MAX_ADDRS     8     // addresses of the server kept, IPv6 and IPv4
+#define TCP_RESOLVE_TTL 300000  // look the server up again after 5 minutes
+#define TCP_RESOLVE_RETRY 10000 // or after 10s, if the last lookup failed
+#define TCP_CONNECT_TIMEOUT 3000 // give up on an address after 3s and try the next
+#define TCP_PROBE_IDLE      2   // idle seconds before the kernel probes the server,
+#define TCP_PROBE_INTERVAL  1   // then every second,
+#define TCP_PROBE_COUNT     3   // and the connection fails after 3 unanswered probes
+#define TCP_DEAD_PEER_TIMEOUT 5000 // or after data goes unacknowledged for 5s
+#define TCP_UNIX_PREFIX "unix:"    // host "unix:/path": a local aggregator's SOCK_SEQPACKET socket
+#define TCP_UDP_PREFIX  "udp:"     // host "udp:name": datagrams, ACKed and resent by the caller
+
+// how messages get to a server, by the prefix of its host name
+typedef enum {
+    TRANSPORT_TCP,              // a byte stream: messages may be split or joined
+    TRANSPORT_UNIX,             // AF_UNIX SOCK_SEQPACKET: reliable, each send one packet
+    TRANSPORT_UDP               // each send one datagram, which may be lost
+} tcp_transport;
+
+// a server, and its addresses once looked up
+typedef struct {
+    char      szHost[256];      // as given, with any prefix
+    int       nPort;
+    tcp_transport transport;
+    struct sockaddr_storage aAddrs[TCP_MAX_ADDRS];  // most preferred first
+    socklen_t aAddrLens[TCP_MAX_ADDRS];
+    int       nAddrs;
+    uint64_t  ullExpireMs;      // when they go stale, on the monotonic clock
+} tcp_server;
+
 // function prototypes
-int  openTCPsocket( char *, int );
+int  openTCPSocket( char *, int );
+void initTCPserver( tcp_server *pServer, const char *szHostName, int nPort );
+int  resolveTCPhost( tcp_server *pServer );
+int  getTCPresolveFd( void );
+int  finishTCPresolve( tcp_server **ppServer );
+void expireTCPaddresses( tcp_server *pServer );
+const char *tcpAddressString( const tcp_server *pServer, int nAddr, char *szBuffer, size_t szLen );
+int  connectTCPaddress( const tcp_server *pServer, int nAddr );
+int  probeTCPaddress( const tcp_server *pServer, int nAddr );
+int  tcpConnectResult( int fd );
+int  finishTCPconnect( void );
 void closeTCPsocket( void );
 int  readTCPmessage( char * , int );
-int  writeTCPmessage( char * );
+int  sendTCPmessage( char * );
+int  sendTCPbuffer( const char *, size_t );
+int  sendTCPvector( const struct iovec *pIov, int nIov );
+long flushTCPpending( void );
+size_t tcpPendingBytes( void );
+int  getTCPsocketFd( void );
+void useTCPuring( uring *pRing, uring_handler fnSent, void *pCtx );
+int  startTCPreceive( char *pBuffer, size_t szLen, uring_handler fnReceived, void *pCtx );
 
 
@@ -7,6 +7,13 @@
  * The client connects to that remote server, then sends messages over the socket
  * and listens for an ACK from server.
  *
+ * With -v instead, runs standalone: checks that sendTCPvector() resumes a
+ * partial write correctly, against a loopback listener of its own.
+ * With -c, checks the non-blocking lookup and connect the same way.
+ * With -t, checks the unix-domain and UDP transports against local sockets.
+ * With -u, benchmarks the epoll and io_uring backends against a loopback
+ * server that ACKs every record: system calls per record, and throughput.
+ *
  * @author Robert Drummond
  * Copyright (c) 2013 Pink Pelican NZ Ltd <bob@pink-pelican.com>
  */
@@ -14,15 +21,29 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <arpa/inet.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netdb.h> 
+#include <poll.h>
 #include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/un.h>
 
 #include "tcp_client.h"
 
 #define LIST_SIZE 5
+#define VECTOR_IOVS     200         // iovecs in the partial write test
+#define VECTOR_IOV_SIZE 1000        // bytes each - far more than the socket buffers hold
+#define BENCH_RECORDS  20000        // records sent by each backend in the benchmark
+#define BENCH_RECORD_SIZE 120       // about a JSON tap
+#define BENCH_ACK_SIZE   24         // about {"msg":"ACK","seq":N}
+#define BENCH_WINDOW      8         // records in flight, as rpi_nfc's default ACK window
+#define BENCH_SYNC_BATCH 16         // records per journal group commit
 
 char *szJSONstringList[] = {
     "{\"nfcModulationType\":\"ISO/IEC 14443-a\",\"baudRate\":\"100\",\"ATQA\":\"0\",\"UID\":\"01 FF FF FF\"}",
@@ -58,6 +79,499 @@ void delay ( int nDelaySeconds )
     
 }
 
+// ---------------------------------------------------------------------------
+// send more than the socket buffers hold in one sendTCPvector(), then drain
+// the other end a little at a time, resuming with flushTCPpending()
+//
+int testVectorSend( void ){
+    static char acData[VECTOR_IOVS][VECTOR_IOV_SIZE];
+    static char acReceived[VECTOR_IOVS * VECTOR_IOV_SIZE];
+    struct iovec aIov[VECTOR_IOVS];
+    struct sockaddr_in addr;
+    socklen_t addrLen = sizeof(addr);
+    int listenfd, serverfd, nBufSize = 4096, i;
+    size_t szReceived = 0;
+    long nPending;
+    ssize_t n;
+
+    // a listener on any free loopback port
+    listenfd = socket( AF_INET, SOCK_STREAM, 0 );
+    memset( &addr, 0, sizeof(addr) );
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+    if( bind( listenfd, (struct sockaddr *)&addr, sizeof(addr) ) < 0 || listen( listenfd, 1 ) < 0 ||
+        getsockname( listenfd, (struct sockaddr *)&addr, &addrLen ) < 0 )
+        error("unable to listen on loopback");
+    if( openTCPSocket( "127.0.0.1", ntohs( addr.sin_port ) ) != 0 )
+        error("unable to connect to loopback");
+    if( (serverfd = accept( listenfd, NULL, NULL )) < 0 )
+        error("unable to accept");
+    setsockopt( getTCPsocketFd(), SOL_SOCKET, SO_SNDBUF, &nBufSize, sizeof(nBufSize) );
+    setsockopt( serverfd, SOL_SOCKET, SO_RCVBUF, &nBufSize, sizeof(nBufSize) );
+
+    for( i=0 ; i < VECTOR_IOVS ; i++ ){
+        memset( acData[i], 'A' + i % 26, VECTOR_IOV_SIZE );
+        acData[i][0] = (char)i;
+        aIov[i].iov_base = acData[i];
+        aIov[i].iov_len = VECTOR_IOV_SIZE;
+    }
+
+    if( sendTCPvector( aIov, VECTOR_IOVS ) < 0 )
+        error("sendTCPvector failed");
+    memset( aIov, 0, sizeof(aIov) );       // it keeps its own copy of the iovecs
+    nPending = (long)tcpPendingBytes();
+    printf("first sendmsg() took %ld of %d bytes\n", VECTOR_IOVS * VECTOR_IOV_SIZE - nPending,
+           VECTOR_IOVS * VECTOR_IOV_SIZE );
+    if( nPending == 0 ){
+        fprintf(stderr,"FAILED: expected a partial write\n");
+        return( 1 );
+    }
+
+    // nothing may cut in while a vector is pending
+    if( sendTCPbuffer( "x", 1 ) != -1 || errno != EAGAIN ||
+        sendTCPvector( aIov, 1 ) != -1 || errno != EAGAIN ){
+        fprintf(stderr,"FAILED: a send cut into a pending vector\n");
+        return( 1 );
+    }
+
+    while( szReceived < sizeof(acReceived) ){
+        if( (n= recv( serverfd, acReceived + szReceived, 1500, 0 )) <= 0 )
+            error("loopback read failed");
+        szReceived += n;
+        if( (nPending = flushTCPpending()) < 0 )
+            error("flushTCPpending failed");
+    }
+    if( nPending != 0 || memcmp( acReceived, acData, sizeof(acReceived) ) != 0 ){
+        fprintf(stderr,"FAILED: bytes received don't match those sent\n");
+        return( 1 );
+    }
+
+    // one buffer too big to keep the rest of isn't started, rather than cut short
+    if( sendTCPbuffer( acReceived, TCP_TAIL_SIZE + 1 ) != -1 || errno != EMSGSIZE ||
+        tcpPendingBytes() != 0 || recv( serverfd, acReceived, 1, MSG_DONTWAIT ) != -1 ){
+        fprintf(stderr,"FAILED: an oversized buffer was sent in part\n");
+        return( 1 );
+    }
+
+    close( serverfd );
+    close( listenfd );
+    closeTCPsocket();
+    printf("vector send test passed\n");
+    return( 0 );
+}
+
+// ---------------------------------------------------------------------------
+// look up "localhost" in the background, connect to a loopback listener
+// without blocking, and check the addresses are cached until expired
+//
+int testConnect( void ){
+    static tcp_server server;
+    tcp_server *pResolved;
+    struct sockaddr_in addr;
+    socklen_t addrLen = sizeof(addr);
+    struct pollfd pfd;
+    char szAddr[64];
+    int listenfd, serverfd, probefd, nPort, nAddrs, nRet, i;
+
+    listenfd = socket( AF_INET, SOCK_STREAM, 0 );
+    memset( &addr, 0, sizeof(addr) );
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+    if( bind( listenfd, (struct sockaddr *)&addr, sizeof(addr) ) < 0 || listen( listenfd, 4 ) < 0 ||
+        getsockname( listenfd, (struct sockaddr *)&addr, &addrLen ) < 0 )
+        error("unable to listen on loopback");
+    nPort = ntohs( addr.sin_port );
+    initTCPserver( &server, "localhost", nPort );
+
+    if( resolveTCPhost( &server ) != 0 ){
+        fprintf(stderr,"FAILED: expected the lookup to start in the background\n");
+        return( 1 );
+    }
+    if( resolveTCPhost( &server ) != 0 ){
+        fprintf(stderr,"FAILED: a second lookup started while one is running\n");
+        return( 1 );
+    }
+    pfd.fd = getTCPresolveFd();
+    pfd.events = POLLIN;
+    if( poll( &pfd, 1, 5000 ) != 1 || (nAddrs = finishTCPresolve( &pResolved )) <= 0 ||
+        pResolved != &server ){
+        fprintf(stderr,"FAILED: localhost wasn't resolved\n");
+        return( 1 );
+    }
+    printf("localhost has %d address(es)\n", nAddrs );
+    if( resolveTCPhost( &server ) != 1 ){
+        fprintf(stderr,"FAILED: the addresses weren't cached\n");
+        return( 1 );
+    }
+
+    // e.g. ::1 is refused (only 127.0.0.1 listens): fall back to the next
+    for( i=0, nRet = -1 ; nRet != 0 && i < nAddrs ; i++ ){
+        if( (nRet = connectTCPaddress( &server, i )) > 0 ){
+            pfd.fd = getTCPsocketFd();
+            pfd.events = POLLOUT;
+            nRet = (poll( &pfd, 1, TCP_CONNECT_TIMEOUT ) == 1) ? finishTCPconnect() : -1;
+        }
+        printf("connect to %s: %s\n", tcpAddressString( &server, i, szAddr, sizeof(szAddr) ),
+               nRet == 0 ? "OK" : strerror( errno ) );
+    }
+    if( nRet != 0 || (serverfd = accept( listenfd, NULL, NULL )) < 0 ){
+        fprintf(stderr,"FAILED: no address of localhost connected\n");
+        return( 1 );
+    }
+    if( sendTCPmessage( "hello" ) != 5 || recv( serverfd, szAddr, sizeof(szAddr), 0 ) != 5 ){
+        fprintf(stderr,"FAILED: nothing arrived over the connection\n");
+        return( 1 );
+    }
+
+    // a probe connects on a socket of its own
+    if( (probefd = probeTCPaddress( &server, i - 1 )) < 0 || probefd == getTCPsocketFd() ){
+        fprintf(stderr,"FAILED: unable to probe\n");
+        return( 1 );
+    }
+    pfd.fd = probefd;
+    pfd.events = POLLOUT;
+    if( poll( &pfd, 1, TCP_CONNECT_TIMEOUT ) != 1 || tcpConnectResult( probefd ) != 0 ){
+        fprintf(stderr,"FAILED: probe didn't connect\n");
+        return( 1 );
+    }
+    close( probefd );
+    close( serverfd );
+    closeTCPsocket();
+
+    // once expired, the host is looked up again
+    expireTCPaddresses( &server );
+    if( resolveTCPhost( &server ) != 0 ){
+        fprintf(stderr,"FAILED: expired addresses were used\n");
+        return( 1 );
+    }
+    pfd.fd = getTCPresolveFd();
+    pfd.events = POLLIN;
+    poll( &pfd, 1, 5000 );
+    finishTCPresolve( &pResolved );
+
+    // a closed port is refused, without blocking
+    close( listenfd );
+    if( (nRet = connectTCPaddress( &server, nAddrs - 1 )) > 0 ){
+        pfd.fd = getTCPsocketFd();
+        pfd.events = POLLOUT;
+        nRet = (poll( &pfd, 1, TCP_CONNECT_TIMEOUT ) == 1) ? finishTCPconnect() : -1;
+    }
+    if( nRet == 0 ){
+        fprintf(stderr,"FAILED: connected to a closed port\n");
+        return( 1 );
+    }
+    closeTCPsocket();
+    printf("connect test passed\n");
+    return( 0 );
+}
+
+// ---------------------------------------------------------------------------
+// a local aggregator on SOCK_SEQPACKET, and a LAN one on UDP: a vector goes
+// as one packet, replies come back a packet per read, and probing is refused
+//
+int testTransports( void ){
+    static tcp_server server;
+    static const char szSocket[] = "/tmp/tcp_client_test.sock";
+    struct sockaddr_un unixAddr;
+    struct sockaddr_in addr, from;
+    socklen_t addrLen = sizeof(addr), fromLen = sizeof(from);
+    struct iovec aIov[2] = { { "{\"seq\":0}", 9 }, { "{\"seq\":1}", 9 } };
+    struct pollfd pfd;
+    tcp_server *pResolved;
+    char acBuffer[64];
+    int listenfd, serverfd, udpfd, nRet;
+
+    // unix domain: no lookup, and the connection is made at once
+    unlink( szSocket );
+    listenfd = socket( AF_UNIX, SOCK_SEQPACKET, 0 );
+    memset( &unixAddr, 0, sizeof(unixAddr) );
+    unixAddr.sun_family = AF_UNIX;
+    strcpy( unixAddr.sun_path, szSocket );
+    if( bind( listenfd, (struct sockaddr *)&unixAddr, sizeof(unixAddr) ) < 0 || listen( listenfd, 1 ) < 0 )
+        error("unable to listen on unix socket");
+    initTCPserver( &server, TCP_UNIX_PREFIX "/tmp/tcp_client_test.sock", 0 );
+    if( server.transport != TRANSPORT_UNIX || resolveTCPhost( &server ) != 1 ||
+        connectTCPaddress( &server, 0 ) != 0 || (serverfd = accept( listenfd, NULL, NULL )) < 0 ){
+        fprintf(stderr,"FAILED: no unix domain connection\n");
+        return( 1 );
+    }
+    printf("connected to %s\n", tcpAddressString( &server, 0, acBuffer, sizeof(acBuffer) ) );
+    if( sendTCPvector( aIov, 2 ) != 0 || recv( serverfd, acBuffer, sizeof(acBuffer), 0 ) != 18 ){
+        fprintf(stderr,"FAILED: the vector didn't arrive as one packet\n");
+        return( 1 );
+    }
+    send( serverfd, "{\"msg\":\"ACK\"}", 13, 0 );
+    send( serverfd, "{\"msg\":\"ACK\"}", 13, 0 );
+    pfd.fd = getTCPsocketFd();
+    pfd.events = POLLIN;
+    if( poll( &pfd, 1, 1000 ) != 1 || readTCPmessage( acBuffer, sizeof(acBuffer) ) != 13 ){
+        fprintf(stderr,"FAILED: a read took more than one packet\n");
+        return( 1 );
+    }
+    if( probeTCPaddress( &server, 0 ) != -1 || errno != EOPNOTSUPP ){
+        fprintf(stderr,"FAILED: a unix domain server was probed\n");
+        return( 1 );
+    }
+    close( serverfd );
+    if( poll( &pfd, 1, 1000 ) != 1 || readTCPmessage( acBuffer, sizeof(acBuffer) ) != 13 ||
+        poll( &pfd, 1, 1000 ) != 1 || readTCPmessage( acBuffer, sizeof(acBuffer) ) != 0 ){
+        fprintf(stderr,"FAILED: hangup not seen\n");
+        return( 1 );
+    }
+    closeTCPsocket();
+    close( listenfd );
+    unlink( szSocket );
+
+    // UDP: looked up like TCP, "connected" at once
+    udpfd = socket( AF_INET, SOCK_DGRAM, 0 );
+    memset( &addr, 0, sizeof(addr) );
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+    if( bind( udpfd, (struct sockaddr *)&addr, sizeof(addr) ) < 0 ||
+        getsockname( udpfd, (struct sockaddr *)&addr, &addrLen ) < 0 )
+        error("unable to bind UDP socket");
+    initTCPserver( &server, TCP_UDP_PREFIX "127.0.0.1", ntohs( addr.sin_port ) );
+    if( server.transport != TRANSPORT_UDP || resolveTCPhost( &server ) != 0 ){
+        fprintf(stderr,"FAILED: UDP server not looked up\n");
+        return( 1 );
+    }
+    pfd.fd = getTCPresolveFd();
+    pfd.events = POLLIN;
+    if( poll( &pfd, 1, 5000 ) != 1 || finishTCPresolve( &pResolved ) != 1 ||
+        connectTCPaddress( &server, 0 ) != 0 ){
+        fprintf(stderr,"FAILED: no UDP socket\n");
+        return( 1 );
+    }
+    if( sendTCPvector( aIov, 2 ) != 0 ||
+        recvfrom( udpfd, acBuffer, sizeof(acBuffer), 0, (struct sockaddr *)&from, &fromLen ) != 18 ){
+        fprintf(stderr,"FAILED: the vector didn't arrive as one datagram\n");
+        return( 1 );
+    }
+    sendto( udpfd, "{\"msg\":\"ACK\"}", 13, 0, (struct sockaddr *)&from, fromLen );
+    pfd.fd = getTCPsocketFd();
+    if( poll( &pfd, 1, 1000 ) != 1 || readTCPmessage( acBuffer, sizeof(acBuffer) ) != 13 ){
+        fprintf(stderr,"FAILED: no reply datagram\n");
+        return( 1 );
+    }
+    if( probeTCPaddress( &server, 0 ) != -1 ){
+        fprintf(stderr,"FAILED: a UDP server was probed\n");
+        return( 1 );
+    }
+
+    // with nobody there, the port unreachable comes back as an error
+    close( udpfd );
+    sendTCPmessage( "{\"seq\":2}" );
+    nRet = poll( &pfd, 1, 1000 );
+    if( nRet != 1 || readTCPmessage( acBuffer, sizeof(acBuffer) ) != -1 || errno != ECONNREFUSED ){
+        fprintf(stderr,"FAILED: a closed UDP port wasn't noticed\n");
+        return( 1 );
+    }
+    closeTCPsocket();
+    printf("transport test passed\n");
+    return( 0 );
+}
+
+// ---------------------------------------------------------------------------
+// the benchmark's loopback server: ACKs every whole record it reads
+//
+void *ackServerMain( void *pArg ){
+    static char acAcks[(65536 / BENCH_RECORD_SIZE + 1) * BENCH_ACK_SIZE];
+    char acBuffer[65536];
+    size_t szPartial = 0;
+    int serverfd = *(int *)pArg, nAcks;
+    ssize_t n;
+
+    memset( acAcks, 'A', sizeof(acAcks) );
+    while( (n= recv( serverfd, acBuffer, sizeof(acBuffer), 0 )) > 0 ){
+        nAcks = (int)((szPartial + n) / BENCH_RECORD_SIZE);
+        szPartial = (szPartial + n) % BENCH_RECORD_SIZE;
+        if( nAcks > 0 && send( serverfd, acAcks, nAcks * BENCH_ACK_SIZE, MSG_NOSIGNAL ) < 0 )
+            break;
+    }
+    close( serverfd );
+    return( NULL );
+}
+
+// the benchmark's uplink: like rpi_nfc's, a window of records in flight,
+// sent straight from a mapped journal, group-committed every few records
+typedef struct {
+    uring    ring;
+    bool     bUring;
+    char    *pbtJournal;            // mapped scratch file standing in for the journal
+    int      journalfd;
+    int      nSent, nAckBytes, nSynced;
+    bool     bSendDone;
+    char     acAcks[4096];
+    uint32_t uiSysCalls;            // with epoll. the ring counts its own
+} bench_uplink;
+
+static bench_uplink bench;
+
+// ---------------------------------------------------------------------------
+// io_uring completions of the benchmark's sends, receives and syncs
+//
+void onBenchSent( int32_t nRes, void *pCtx ){
+    if( nRes < 0 )
+        error("benchmark send failed");
+    bench.bSendDone = true;
+}
+
+void onBenchReceived( int32_t nRes, void *pCtx ){
+    if( nRes <= 0 )
+        error("benchmark receive failed");
+    bench.nAckBytes += nRes;
+    startTCPreceive( bench.acAcks, sizeof(bench.acAcks), onBenchReceived, NULL );
+}
+
+void onBenchSynced( int32_t nRes, void *pCtx ){
+    if( nRes < 0 )
+        error("benchmark sync failed");
+}
+
+// ---------------------------------------------------------------------------
+// send whatever the window has room for in one vector, and group-commit the
+// journal every BENCH_SYNC_BATCH records
+//
+void benchSendWindow( void ){
+    struct iovec aIov[BENCH_WINDOW];
+    struct io_uring_sqe *pSqe;
+    int nAcked = bench.nAckBytes / BENCH_ACK_SIZE, nIov = 0;
+
+    while( bench.nSent + nIov < BENCH_RECORDS && bench.nSent + nIov - nAcked < BENCH_WINDOW ){
+        aIov[nIov].iov_base = bench.pbtJournal + (size_t)(bench.nSent + nIov) * BENCH_RECORD_SIZE;
+        aIov[nIov].iov_len = BENCH_RECORD_SIZE;
+        nIov++;
+    }
+    if( nIov == 0 )
+        return;
+    bench.bSendDone = false;
+    if( sendTCPvector( aIov, nIov ) < 0 )
+        error("benchmark sendTCPvector failed");
+    if( !bench.bUring ){
+        bench.uiSysCalls++;
+        bench.bSendDone = tcpPendingBytes() == 0;
+    }
+    bench.nSent += nIov;
+
+    if( bench.nSent - bench.nSynced >= BENCH_SYNC_BATCH ){
+        bench.nSynced = bench.nSent;
+        if( !bench.bUring ){
+            bench.uiSysCalls++;
+            fdatasync( bench.journalfd );
+        }
+        else if( (pSqe = uringPrepare( &bench.ring, IORING_OP_FSYNC, bench.journalfd,
+                                       onBenchSynced, NULL )) != NULL )
+            pSqe->fsync_flags = IORING_FSYNC_DATASYNC;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// run BENCH_RECORDS records through one backend to a loopback server
+//
+// returns: records per second
+//
+double benchmarkBackend( bool bUring ){
+    struct sockaddr_in addr;
+    socklen_t addrLen = sizeof(addr);
+    struct pollfd pfd;
+    struct timespec tsStart, tsEnd;
+    pthread_t serverThread;
+    int listenfd, serverfd, n;
+    double fdSecs;
+
+    memset( &bench, 0, sizeof(bench) );
+    bench.bUring = bUring;
+    if( bUring && initUring( &bench.ring, 0 ) != 0 )
+        return( 0 );
+    useTCPuring( bUring ? &bench.ring : NULL, onBenchSent, NULL );
+
+    // the journal: a scratch file, mapped
+    bench.journalfd = open( "/tmp/tcp_client_bench.jnl", O_RDWR | O_CREAT | O_TRUNC, 0644 );
+    if( bench.journalfd < 0 || ftruncate( bench.journalfd, (off_t)BENCH_RECORDS * BENCH_RECORD_SIZE ) < 0 )
+        error("unable to create benchmark journal");
+    unlink( "/tmp/tcp_client_bench.jnl" );
+    bench.pbtJournal = mmap( NULL, (size_t)BENCH_RECORDS * BENCH_RECORD_SIZE, PROT_READ | PROT_WRITE,
+                             MAP_SHARED, bench.journalfd, 0 );
+    if( bench.pbtJournal == MAP_FAILED )
+        error("unable to map benchmark journal");
+    memset( bench.pbtJournal, 'x', (size_t)BENCH_RECORDS * BENCH_RECORD_SIZE );
+    fdatasync( bench.journalfd );
+
+    listenfd = socket( AF_INET, SOCK_STREAM, 0 );
+    memset( &addr, 0, sizeof(addr) );
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+    if( bind( listenfd, (struct sockaddr *)&addr, sizeof(addr) ) < 0 || listen( listenfd, 1 ) < 0 ||
+        getsockname( listenfd, (struct sockaddr *)&addr, &addrLen ) < 0 )
+        error("unable to listen on loopback");
+    if( openTCPSocket( "127.0.0.1", ntohs( addr.sin_port ) ) != 0 )
+        error("unable to connect to loopback");
+    if( (serverfd = accept( listenfd, NULL, NULL )) < 0 )
+        error("unable to accept");
+    pthread_create( &serverThread, NULL, ackServerMain, &serverfd );
+
+    clock_gettime( CLOCK_MONOTONIC, &tsStart );
+    if( bUring )
+        startTCPreceive( bench.acAcks, sizeof(bench.acAcks), onBenchReceived, NULL );
+    while( bench.nAckBytes < BENCH_RECORDS * BENCH_ACK_SIZE ){
+        if( bench.bSendDone || bench.nSent == 0 )
+            benchSendWindow();
+
+        if( bUring ){
+            // the send, the next receive and any sync go in, and
+            // completions come out, in one system call
+            if( uringSubmit( &bench.ring, 1 ) < 0 )
+                error("io_uring_enter failed");
+            reapUring( &bench.ring );
+            continue;
+        }
+
+        pfd.fd = getTCPsocketFd();
+        pfd.events = POLLIN | (bench.bSendDone ? 0 : POLLOUT);
+        bench.uiSysCalls++;
+        if( poll( &pfd, 1, 5000 ) != 1 )
+            error("benchmark stalled");
+        if( pfd.revents & POLLOUT ){
+            bench.uiSysCalls++;
+            bench.bSendDone = flushTCPpending() == 0;
+        }
+        if( pfd.revents & POLLIN ){
+            bench.uiSysCalls++;
+            if( (n= readTCPmessage( bench.acAcks, sizeof(bench.acAcks) )) <= 0 )
+                error("benchmark read failed");
+            bench.nAckBytes += n;
+        }
+    }
+    clock_gettime( CLOCK_MONOTONIC, &tsEnd );
+    fdSecs = (tsEnd.tv_sec - tsStart.tv_sec) + (tsEnd.tv_nsec - tsStart.tv_nsec) / 1e9;
+
+    printf("  %-8s %6.2f system calls/record  %9.0f records/s\n", bUring ? "io_uring" : "epoll",
+           (double)(bUring ? bench.ring.uiEnters : bench.uiSysCalls) / BENCH_RECORDS,
+           BENCH_RECORDS / fdSecs );
+
+    closeTCPsocket();
+    pthread_join( serverThread, NULL );
+    close( listenfd );
+    useTCPuring( NULL, NULL, NULL );
+    if( bUring )
+        closeUring( &bench.ring );
+    munmap( bench.pbtJournal, (size_t)BENCH_RECORDS * BENCH_RECORD_SIZE );
+    close( bench.journalfd );
+    return( BENCH_RECORDS / fdSecs );
+}
+
+// ---------------------------------------------------------------------------
+// compare the backends
+//
+int benchmarkBackends( void ){
+    printf("benchmark: %d records of %d bytes, window %d, group commit of %d\n",
+           BENCH_RECORDS, BENCH_RECORD_SIZE, BENCH_WINDOW, BENCH_SYNC_BATCH );
+    benchmarkBackend( false );
+    if( benchmarkBackend( true ) == 0 )
+        perror("  io_uring not available");
+    return( 0 );
+}
+
 // ===========================================================================
 // main
 //
@@ -72,8 +586,20 @@ int main(int argc, char *argv[])
     char *szHostName;
 
     // parse command line arguments
+    if (argc == 2 && strcmp( argv[1], "-v" ) == 0)
+       exit( testVectorSend() );
+    if (argc == 2 && strcmp( argv[1], "-c" ) == 0)
+       exit( testConnect() );
+    if (argc == 2 && strcmp( argv[1], "-t" ) == 0)
+       exit( testTransports() );
+    if (argc == 2 && strcmp( argv[1], "-u" ) == 0)
+       exit( benchmarkBackends() );
     if (argc < 3) {
        printf("usage %s hostname port\n", argv[0]);
+       printf("      %s -v    (standalone test of sendTCPvector)\n", argv[0]);
+       printf("      %s -c    (standalone test of the non-blocking lookup and connect)\n", argv[0]);
+       printf("      %s -t    (standalone test of the unix domain and UDP transports)\n", argv[0]);
+       printf("      %s -u    (benchmark of the epoll and io_uring backends)\n", argv[0]);
        exit(0);
     }
     nPortNo = atoi(argv[2]);
@@ -101,11 +627,11 @@ int main(int argc, char *argv[])
             exit(1);
         }
         else{
-            if( (res= readTCPmessage(buffer, 256)) < 0 ){
+            if( (res= readTCPmessage(buffer, sizeof(buffer) - 1)) < 0 ){
                 fprintf(stderr,"ERROR reading from socket\n");
                 exit(2);
             } else if ( res > 0 )
-                printf("Received %d bytes from server: %s\n", res, buffer);
+                printf("Received %d bytes from server: %.*s\n", res, res, buffer);
         } // else
         delay(1); // pause for a second
  
@@ -0,0 +1,200 @@
+/*
+ * @file timer_wheel.c
+ * @brief hashed timer wheel for the async delay timers
+ *
+ * Replaces the fixed timeRef/lInterval/lNextTriggerTime arrays, which only
+ * allowed four hard-coded timers and overflowed a 32-bit long when computing
+ * milliseconds since the epoch.
+ *
+ * Time is kept as 64-bit milliseconds of CLOCK_MONOTONIC, so it neither wraps
+ * nor jumps when NTP sets the clock. Each timer hashes into the slot of its
+ * expiry tick; timers more than one revolution away stay in their slot and are
+ * skipped until their tick comes round. Arm, cancel and expire are O(1).
+ */
+#include <string.h>
+#include <time.h>
+
+#include "timer_wheel.h"
+
+#define SLOT_MASK   (TIMER_WHEEL_SLOTS - 1)
+
+// ---------------------------------------------------------------------------
+// Internal function to link a timer at the head of a list
+//
+static void linkTimer( timer_entry **ppHead, timer_entry *pTimer ){
+    pTimer->pNext = *ppHead;
+    if( pTimer->pNext != NULL )
+        pTimer->pNext->ppPrev = &pTimer->pNext;
+    pTimer->ppPrev = ppHead;
+    *ppHead = pTimer;
+}
+
+// ---------------------------------------------------------------------------
+// Internal function to unlink a timer from whichever list it is in
+//
+static void unlinkTimer( timer_entry *pTimer ){
+    *pTimer->ppPrev = pTimer->pNext;
+    if( pTimer->pNext != NULL )
+        pTimer->pNext->ppPrev = pTimer->ppPrev;
+    pTimer->pNext = NULL;
+    pTimer->ppPrev = NULL;
+}
+
+// ---------------------------------------------------------------------------
+// Internal function to keep the occupied-slot bitmap in step with a slot
+//
+static void updateOccupied( timer_wheel *pWheel, int nSlot ){
+    if( pWheel->apSlots[nSlot] != NULL )
+        pWheel->auiOccupied[nSlot >> 5] |= (1u << (nSlot & 31));
+    else
+        pWheel->auiOccupied[nSlot >> 5] &= ~(1u << (nSlot & 31));
+}
+
+// ---------------------------------------------------------------------------
+// current time in milliseconds from the monotonic clock
+//
+uint64_t monotonicMillisecs( void ){
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return( (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000 );
+}
+
+// ---------------------------------------------------------------------------
+// initialise an empty wheel starting at time ullNowMs
+//
+void initTimerWheel( timer_wheel *pWheel, uint64_t ullNowMs ){
+    memset( pWheel, 0, sizeof(*pWheel) );
+    pWheel->ullNowTick = ullNowMs / TIMER_TICK_MS;
+}
+
+// ---------------------------------------------------------------------------
+// initialise a timer (disarmed) with the callback to run when it expires
+//
+void initTimer( timer_entry *pTimer, timer_callback fnCallback, void *pCtx ){
+    memset( pTimer, 0, sizeof(*pTimer) );
+    pTimer->fnCallback = fnCallback;
+    pTimer->pCtx = pCtx;
+    pTimer->nSlot = -1;
+}
+
+// ---------------------------------------------------------------------------
+// arm a timer to expire uiMilliseconds after ullNowMs. (Re)arming an armed
+// timer moves its deadline.
+//
+void armTimer( timer_wheel *pWheel, timer_entry *pTimer, uint64_t ullNowMs, uint32_t uiMilliseconds ){
+    uint64_t ullTick;
+
+    if( timerIsArmed( pTimer ) )
+        cancelTimer( pWheel, pTimer );
+
+    // round up, so a timer never fires early
+    ullTick = (ullNowMs + uiMilliseconds + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    if( ullTick <= pWheel->ullNowTick )
+        ullTick = pWheel->ullNowTick + 1;   // that tick was already processed
+
+    pTimer->ullExpiryTick = ullTick;
+    pTimer->nSlot = (int)(ullTick & SLOT_MASK);
+    linkTimer( &pWheel->apSlots[pTimer->nSlot], pTimer );
+    updateOccupied( pWheel, pTimer->nSlot );
+    pWheel->szArmed++;
+}
+
+// ---------------------------------------------------------------------------
+// disarm a timer. Harmless if it isn't armed.
+//
+void cancelTimer( timer_wheel *pWheel, timer_entry *pTimer ){
+    if( !timerIsArmed( pTimer ) )
+        return;
+
+    unlinkTimer( pTimer );
+    if( pTimer->nSlot >= 0 )
+        updateOccupied( pWheel, pTimer->nSlot );
+    pTimer->nSlot = -1;
+    pWheel->szArmed--;
+}
+
+// ---------------------------------------------------------------------------
+// returns true if the timer is armed and hasn't expired yet
+//
+bool timerIsArmed( const timer_entry *pTimer ){
+    return( pTimer->ppPrev != NULL );
+}
+
+// ---------------------------------------------------------------------------
+// advance the wheel to ullNowMs and run the callbacks of all due timers
+//
+// returns: number of timers expired
+//
+int expireTimers( timer_wheel *pWheel, uint64_t ullNowMs ){
+    uint64_t ullNowTick = ullNowMs / TIMER_TICK_MS;
+    uint64_t ullTick;
+    timer_entry *pTimer, *pNext;
+    int nSlot, nExpired = 0;
+
+    while( pWheel->ullNowTick < ullNowTick ){
+
+        // after a long sleep every slot is visited at most once
+        ullTick = pWheel->ullNowTick + 1;
+        if( ullNowTick - pWheel->ullNowTick > TIMER_WHEEL_SLOTS )
+            ullTick = ullNowTick - TIMER_WHEEL_SLOTS + 1;
+        pWheel->ullNowTick = ullTick;
+
+        // move the due timers onto the expiring list first, so the callbacks
+        // are free to arm or cancel any timer, including those still to run
+        nSlot = (int)(ullTick & SLOT_MASK);
+        for( pTimer = pWheel->apSlots[nSlot] ; pTimer != NULL ; pTimer = pNext ){
+            pNext = pTimer->pNext;
+            if( pTimer->ullExpiryTick <= ullNowTick ){
+                unlinkTimer( pTimer );
+                pTimer->nSlot = -1;
+                linkTimer( &pWheel->pExpiring, pTimer );
+            }
+        }
+        updateOccupied( pWheel, nSlot );
+
+        while( (pTimer = pWheel->pExpiring) != NULL ){
+            unlinkTimer( pTimer );
+            pWheel->szArmed--;
+            nExpired++;
+            if( pTimer->fnCallback != NULL )
+                pTimer->fnCallback( pTimer, pTimer->pCtx );
+        }
+    }
+    return( nExpired );
+}
+
+// ---------------------------------------------------------------------------
+// how long the caller may sleep before expireTimers() has work to do.
+// Found from the occupied-slot bitmap, so it costs at most one pass over
+// TIMER_WHEEL_SLOTS/32 words. A slot holding only timers from a later
+// revolution makes the caller wake early once; that is harmless.
+//
+// returns: milliseconds until the next occupied tick, 0 if due now,
+//          or -1 if no timer is armed
+//
+long millisecsToNextTimer( const timer_wheel *pWheel, uint64_t ullNowMs ){
+    uint64_t ullNowTick = ullNowMs / TIMER_TICK_MS;
+    uint64_t ullTick;
+    uint32_t uiWord;
+    int nSlot, nWord, i;
+
+    if( pWheel->szArmed == 0 )
+        return( -1 );
+
+    // scan forward from the first unprocessed tick, one bitmap word at a time
+    ullTick = pWheel->ullNowTick + 1;
+    for( i=0 ; i <= TIMER_WHEEL_SLOTS ; ){
+        nSlot = (int)((ullTick + i) & SLOT_MASK);
+        nWord = nSlot >> 5;
+        uiWord = pWheel->auiOccupied[nWord] >> (nSlot & 31);
+        if( uiWord != 0 ){
+            ullTick += i + __builtin_ctz( uiWord );
+            if( ullTick <= ullNowTick )
+                return( 0 );
+            return( (long)(ullTick * TIMER_TICK_MS - ullNowMs) );
+        }
+        i += 32 - (nSlot & 31);
+    }
+    return( 0 );    // armed but not found: only possible from inside a callback
+}
@@ -0,0 +1,51 @@
+/*
+ * @file timer_wheel.h
+ * @brief public interface of timer_wheel.c
+ */
+#ifndef _TIMER_WHEEL_H_
+#define _TIMER_WHEEL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Definitions
+#define TIMER_TICK_MS          10          // wheel resolution
+#define TIMER_WHEEL_SLOTS    1024          // must be a power of 2. one revolution = 10.24s
+
+typedef struct timer_entry timer_entry;
+
+// called from expireTimers() when a timer is due. The timer is already
+// disarmed, so the callback may re-arm it.
+typedef void (*timer_callback)( timer_entry *pTimer, void *pCtx );
+
+// a timer. The caller owns the storage (embed it in whatever it times out),
+// so any number of timers can be armed without allocation.
+struct timer_entry {
+    timer_entry    *pNext;
+    timer_entry   **ppPrev;         // NULL when not armed
+    uint64_t        ullExpiryTick;
+    timer_callback  fnCallback;
+    void           *pCtx;
+    int             nSlot;          // slot index, -1 while expiring
+};
+
+typedef struct {
+    timer_entry    *apSlots[TIMER_WHEEL_SLOTS];
+    uint32_t        auiOccupied[TIMER_WHEEL_SLOTS / 32];    // one bit per non-empty slot
+    timer_entry    *pExpiring;      // due timers whose callbacks haven't run yet
+    uint64_t        ullNowTick;     // last tick processed by expireTimers()
+    size_t          szArmed;
+} timer_wheel;
+
+// function prototypes
+uint64_t monotonicMillisecs( void );
+void initTimerWheel( timer_wheel *pWheel, uint64_t ullNowMs );
+void initTimer( timer_entry *pTimer, timer_callback fnCallback, void *pCtx );
+void armTimer( timer_wheel *pWheel, timer_entry *pTimer, uint64_t ullNowMs, uint32_t uiMilliseconds );
+void cancelTimer( timer_wheel *pWheel, timer_entry *pTimer );
+bool timerIsArmed( const timer_entry *pTimer );
+int  expireTimers( timer_wheel *pWheel, uint64_t ullNowMs );
+long millisecsToNextTimer( const timer_wheel *pWheel, uint64_t ullNowMs );
+
+#endif // _TIMER_WHEEL_H_
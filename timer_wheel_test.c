@@ -0,0 +1,214 @@
+/*
+ * @file timer_wheel_test.c
+ * @brief unit test and microbenchmark for timer_wheel.c
+ *
+ * runs standalone - no hardware needed. The wheel is driven with a simulated
+ * clock, so the tests are deterministic.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "timer_wheel.h"
+#include "unit_test.h"
+
+#define BENCH_TIMERS   100000       // timers armed and expired by the benchmark
+#define BENCH_SPAN_MS   30000       // spread of their deadlines
+
+typedef struct {
+    timer_entry timer;
+    uint64_t    ullDeadlineMs;
+    uint64_t    ullFiredMs;
+    int         nFired;
+} test_timer;
+
+static uint64_t ullClockMs;         // simulated time
+
+// ---------------------------------------------------------------------------
+// callback - record when the timer fired
+//
+void onExpired( timer_entry *pTimer, void *pCtx ){
+    test_timer *pTest = (test_timer *)pCtx;
+
+    (void) pTimer;
+    pTest->ullFiredMs = ullClockMs;
+    pTest->nFired++;
+}
+
+// ---------------------------------------------------------------------------
+// callback - re-arms itself, like the NFC poll timer
+//
+static timer_wheel *pRearmWheel;
+void onRearm( timer_entry *pTimer, void *pCtx ){
+    ((test_timer *)pCtx)->nFired++;
+    armTimer( pRearmWheel, pTimer, ullClockMs, 1000 );
+}
+
+// ---------------------------------------------------------------------------
+// step the simulated clock in 1ms increments, expiring timers as we go
+//
+void advanceTo( timer_wheel *pWheel, uint64_t ullUntilMs ){
+    while( ullClockMs < ullUntilMs ){
+        ullClockMs++;
+        expireTimers( pWheel, ullClockMs );
+    }
+}
+
+// ---------------------------------------------------------------------------
+// timers fire once, never early, and no later than one tick late
+//
+void testExpiry( void ){
+    static timer_wheel wheel;
+    test_timer aTimers[4];
+    uint32_t auiDelays[4] = { 0, 500, 5000, 25000 };  // the last one laps the wheel
+    int i;
+
+    ullClockMs = 1000;
+    initTimerWheel( &wheel, ullClockMs );
+    for( i=0 ; i < 4 ; i++ ){
+        memset( &aTimers[i], 0, sizeof(aTimers[i]) );
+        initTimer( &aTimers[i].timer, onExpired, &aTimers[i] );
+        armTimer( &wheel, &aTimers[i].timer, ullClockMs, auiDelays[i] );
+        aTimers[i].ullDeadlineMs = ullClockMs + auiDelays[i];
+        CHECK( timerIsArmed( &aTimers[i].timer ) );
+    }
+    CHECK( millisecsToNextTimer( &wheel, ullClockMs ) <= TIMER_TICK_MS );
+
+    advanceTo( &wheel, ullClockMs + 30000 );
+    for( i=0 ; i < 4 ; i++ ){
+        CHECK( aTimers[i].nFired == 1 );
+        CHECK( aTimers[i].ullFiredMs >= aTimers[i].ullDeadlineMs );
+        CHECK( aTimers[i].ullFiredMs <= aTimers[i].ullDeadlineMs + TIMER_TICK_MS );
+        CHECK( !timerIsArmed( &aTimers[i].timer ) );
+    }
+    CHECK( wheel.szArmed == 0 );
+    CHECK( millisecsToNextTimer( &wheel, ullClockMs ) == -1 );
+}
+
+// ---------------------------------------------------------------------------
+// cancelled timers don't fire, re-arming moves the deadline
+//
+void testCancelAndRearm( void ){
+    static timer_wheel wheel;
+    test_timer a, b, c;
+
+    ullClockMs = 0;
+    initTimerWheel( &wheel, ullClockMs );
+    memset( &a, 0, sizeof(a) ); memset( &b, 0, sizeof(b) ); memset( &c, 0, sizeof(c) );
+    initTimer( &a.timer, onExpired, &a );
+    initTimer( &b.timer, onExpired, &b );
+    initTimer( &c.timer, onRearm, &c );
+    pRearmWheel = &wheel;
+
+    armTimer( &wheel, &a.timer, ullClockMs, 100 );
+    armTimer( &wheel, &b.timer, ullClockMs, 100 );
+    armTimer( &wheel, &c.timer, ullClockMs, 1000 );
+    cancelTimer( &wheel, &a.timer );
+    cancelTimer( &wheel, &a.timer );        // harmless twice
+    armTimer( &wheel, &b.timer, ullClockMs, 300 );
+    CHECK( millisecsToNextTimer( &wheel, ullClockMs ) == 300 );
+
+    advanceTo( &wheel, 299 );
+    CHECK( b.nFired == 0 );
+    advanceTo( &wheel, 5500 );
+    CHECK( a.nFired == 0 );
+    CHECK( b.nFired == 1 && b.ullFiredMs == 300 );
+    CHECK( c.nFired == 5 );                 // fired at 1000..5000 and re-armed each time
+    CHECK( timerIsArmed( &c.timer ) );
+    CHECK( millisecsToNextTimer( &wheel, ullClockMs ) == 500 );
+    cancelTimer( &wheel, &c.timer );
+    CHECK( wheel.szArmed == 0 );
+}
+
+// ---------------------------------------------------------------------------
+// a long sleep between expireTimers() calls doesn't lose timers
+//
+void testLongSleep( void ){
+    static timer_wheel wheel;
+    test_timer a;
+
+    ullClockMs = 0;
+    initTimerWheel( &wheel, ullClockMs );
+    memset( &a, 0, sizeof(a) );
+    initTimer( &a.timer, onExpired, &a );
+    armTimer( &wheel, &a.timer, ullClockMs, 7000 );
+
+    ullClockMs = 60000;
+    CHECK( millisecsToNextTimer( &wheel, ullClockMs ) == 0 );
+    CHECK( expireTimers( &wheel, ullClockMs ) == 1 );
+    CHECK( a.nFired == 1 );
+}
+
+// ---------------------------------------------------------------------------
+// wall time in nanoseconds, for the benchmark
+//
+uint64_t nanosecs( void ){
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return( (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec );
+}
+
+// ---------------------------------------------------------------------------
+// time a block of arms, cancels and expiries
+//
+void benchmark( void ){
+    static timer_wheel wheel;
+    test_timer *pTimers;
+    uint64_t ullStart, ullArm, ullCancel, ullExpire;
+    int i, nExpired = 0;
+
+    pTimers = calloc( BENCH_TIMERS, sizeof(test_timer) );
+    if( pTimers == NULL ){
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    srand(1);
+    ullClockMs = 0;
+    initTimerWheel( &wheel, ullClockMs );
+    for( i=0 ; i < BENCH_TIMERS ; i++ )
+        initTimer( &pTimers[i].timer, onExpired, &pTimers[i] );
+
+    ullStart = nanosecs();
+    for( i=0 ; i < BENCH_TIMERS ; i++ )
+        armTimer( &wheel, &pTimers[i].timer, ullClockMs, rand() % BENCH_SPAN_MS );
+    ullArm = nanosecs() - ullStart;
+
+    ullStart = nanosecs();
+    for( i=0 ; i < BENCH_TIMERS ; i += 10 )  // cancel 10%, like ACKed deadlines
+        cancelTimer( &wheel, &pTimers[i].timer );
+    ullCancel = nanosecs() - ullStart;
+
+    ullStart = nanosecs();
+    for( ullClockMs = 0 ; ullClockMs <= BENCH_SPAN_MS + TIMER_TICK_MS ; ullClockMs += TIMER_TICK_MS )
+        nExpired += expireTimers( &wheel, ullClockMs );
+    ullExpire = nanosecs() - ullStart;
+
+    CHECK( nExpired == BENCH_TIMERS - BENCH_TIMERS / 10 );
+    CHECK( wheel.szArmed == 0 );
+
+    printf("benchmark: %d timers over %d ms\n", BENCH_TIMERS, BENCH_SPAN_MS );
+    printf("  arm    %8.3f ms total  %6.1f ns/timer\n", ullArm / 1e6, (double)ullArm / BENCH_TIMERS );
+    printf("  cancel %8.3f ms total  %6.1f ns/timer\n", ullCancel / 1e6, (double)ullCancel / (BENCH_TIMERS / 10) );
+    printf("  expire %8.3f ms total  %6.1f ns/timer\n", ullExpire / 1e6, (double)ullExpire / nExpired );
+    free( pTimers );
+}
+
+// ===========================================================================
+// main
+//
+int main( int argc, char *argv[] )
+{
+    testExpiry();
+    testCancelAndRearm();
+    testLongSleep();
+    benchmark();
+
+    if( nFailures ){
+        printf("%d check(s) FAILED\n", nFailures );
+        exit( EXIT_FAILURE );
+    }
+    printf("all timer wheel tests passed\n");
+    exit( EXIT_SUCCESS );
+}
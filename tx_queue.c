@@ -0,0 +1,203 @@
+/*
+ * @file tx_queue.c
+ * @brief bounded queue of transactions waiting for the uplink
+ *
+ * While the server can't be reached, taps wait here in memory rather than
+ * going to the journal one by one, and go on to the journal and the server
+ * together once it's back. The queue never grows: when it's full the
+ * overflow policy decides which tap gives way - the oldest spills to the
+ * journal, or is dropped, or a repeat tap of a card already waiting at that
+ * reader is folded into it. With a capacity of 0 every tap spills at once,
+ * which is journalling each one as it arrives.
+ *
+ * How long taps waited is kept as a histogram of power-of-2 millisecond
+ * buckets, so percentiles cost no memory however long the outage.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "nfc_encode.h"
+#include "nfc_record.h"
+#include "tx_queue.h"
+
+static const char *aszPolicyNames[] = { "spill", "drop", "coalesce" };
+
+// ---------------------------------------------------------------------------
+// allocate a queue of up to uiCapacity transactions
+//
+// returns: 0 if OK, else -1 (out of memory)
+//
+int initTxQueue( tx_queue *pQ, uint32_t uiCapacity, txq_policy policy ){
+    memset( pQ, 0, sizeof(*pQ) );
+    pQ->uiCapacity = uiCapacity;
+    pQ->policy = policy;
+    if( uiCapacity > 0 && (pQ->aSlots = calloc( uiCapacity, sizeof(nfc_transaction) )) == NULL )
+        return( -1 );
+    return( 0 );
+}
+
+// ---------------------------------------------------------------------------
+// free the queue, and anything still in it
+//
+void freeTxQueue( tx_queue *pQ ){
+    free( pQ->aSlots );
+    pQ->aSlots = NULL;
+    pQ->uiCount = 0;
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - count a transaction leaving for the journal after
+// waiting since it was detected
+//
+static void noteLatency( tx_queue *pQ, const nfc_transaction *pTx, uint64_t ullNow ){
+    uint64_t ullWait = ullNow > pTx->ullDetectedMs ? ullNow - pTx->ullDetectedMs : 0;
+    unsigned uiBucket = 0;
+
+    while( uiBucket < TXQ_LATENCY_BUCKETS - 1 && ullWait >= (1ull << uiBucket) )
+        uiBucket++;
+    pQ->auiLatency[uiBucket]++;
+    pQ->uiLatencySamples++;
+    if( ullWait > pQ->uiMaxLatencyMs )
+        pQ->uiMaxLatencyMs = ullWait > UINT32_MAX ? UINT32_MAX : (uint32_t)ullWait;
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - is the card of pTx already waiting in the queue, from
+// the same reader? Arrivals and removals are never folded: they pair up
+//
+static bool isQueued( const tx_queue *pQ, const nfc_transaction *pTx ){
+    uint32_t i;
+    const nfc_transaction *pQueued;
+
+    if( pTx->btEvent != NFC_EVENT_TAP )
+        return( false );
+
+    for( i=0 ; i < pQ->uiCount ; i++ ){
+        pQueued = &pQ->aSlots[(pQ->uiHead + i) % pQ->uiCapacity];
+        if( pQueued->btReader == pTx->btReader && sameTarget( &pQueued->nt, &pTx->nt ) )
+            return( true );
+    }
+    return( false );
+}
+
+// ---------------------------------------------------------------------------
+// queue a transaction. If the queue is full the policy makes room: with
+// TXQ_SPILL the oldest transaction is copied to *pSpilled for the caller to
+// journal straight away (with no room at all, it's pTx itself)
+//
+// returns: what was done with it
+//
+txq_result txQueuePush( tx_queue *pQ, const nfc_transaction *pTx, uint64_t ullNow,
+                        nfc_transaction *pSpilled ){
+    txq_result result = TXQ_QUEUED;
+
+    if( pQ->policy == TXQ_COALESCE && isQueued( pQ, pTx ) ){
+        pQ->uiCoalesced++;
+        return( TXQ_COALESCED );
+    }
+
+    if( pQ->uiCapacity == 0 ){
+        *pSpilled = *pTx;
+        noteLatency( pQ, pTx, ullNow );
+        pQ->uiSpilled++;
+        return( TXQ_SPILLED );
+    }
+
+    if( pQ->uiCount == pQ->uiCapacity ){
+        if( pQ->policy == TXQ_SPILL ){
+            *pSpilled = pQ->aSlots[pQ->uiHead];
+            noteLatency( pQ, pSpilled, ullNow );
+            pQ->uiSpilled++;
+            result = TXQ_SPILLED;
+        } else {
+            pQ->uiDropped++;
+            result = TXQ_DROPPED;
+        }
+        pQ->uiHead = (pQ->uiHead + 1) % pQ->uiCapacity;
+        pQ->uiCount--;
+    }
+
+    pQ->aSlots[(pQ->uiHead + pQ->uiCount) % pQ->uiCapacity] = *pTx;
+    pQ->uiCount++;
+    pQ->uiQueued++;
+    if( pQ->uiCount > pQ->uiHighWater )
+        pQ->uiHighWater = pQ->uiCount;
+    return( result );
+}
+
+// ---------------------------------------------------------------------------
+// take the oldest transaction off the queue, for the journal
+//
+// returns: true if there was one
+//
+bool txQueuePop( tx_queue *pQ, nfc_transaction *pTx, uint64_t ullNow ){
+    if( pQ->uiCount == 0 )
+        return( false );
+    *pTx = pQ->aSlots[pQ->uiHead];
+    pQ->uiHead = (pQ->uiHead + 1) % pQ->uiCapacity;
+    pQ->uiCount--;
+    pQ->uiDequeued++;
+    noteLatency( pQ, pTx, ullNow );
+    return( true );
+}
+
+// ---------------------------------------------------------------------------
+// transactions waiting
+//
+uint32_t txQueueDepth( const tx_queue *pQ ){
+    return( pQ->uiCount );
+}
+
+// ---------------------------------------------------------------------------
+// how long transactions waited, e.g. uiPercentile 99 for p99. Good to the
+// power of 2 above: the answer is the top of the bucket the percentile
+// falls in, but never more than the longest wait seen
+//
+// returns: milliseconds, 0 if nothing has left the queue yet
+//
+uint32_t txQueueLatency( const tx_queue *pQ, unsigned uiPercentile ){
+    uint64_t ullRank, ullSeen = 0;
+    uint32_t uiMs;
+    unsigned i;
+
+    if( pQ->uiLatencySamples == 0 )
+        return( 0 );
+    if( uiPercentile > 100 )
+        uiPercentile = 100;
+    ullRank = ((uint64_t)pQ->uiLatencySamples * uiPercentile + 99) / 100;
+    if( ullRank == 0 )
+        ullRank = 1;
+    for( i=0 ; i < TXQ_LATENCY_BUCKETS - 1 ; i++ ){
+        ullSeen += pQ->auiLatency[i];
+        if( ullSeen >= ullRank )
+            break;
+    }
+    uiMs = i == 0 ? 0 : (1u << i) - 1;
+    return( uiMs < pQ->uiMaxLatencyMs ? uiMs : pQ->uiMaxLatencyMs );
+}
+
+// ---------------------------------------------------------------------------
+// overflow policy from its name: spill, drop or coalesce
+//
+// returns: 0 if OK, else -1 (unknown name)
+//
+int parseTxPolicy( const char *szName, txq_policy *pPolicy ){
+    unsigned i;
+
+    for( i=0 ; i < sizeof(aszPolicyNames) / sizeof(aszPolicyNames[0]) ; i++ ){
+        if( strcasecmp( szName, aszPolicyNames[i] ) == 0 ){
+            *pPolicy = (txq_policy)i;
+            return( 0 );
+        }
+    }
+    return( -1 );
+}
+
+// ---------------------------------------------------------------------------
+// name of an overflow policy, for logs
+//
+const char *txPolicyName( txq_policy policy ){
+    return( (unsigned)policy < sizeof(aszPolicyNames) / sizeof(aszPolicyNames[0]) ?
+            aszPolicyNames[policy] : "?" );
+}
@@ -0,0 +1,66 @@
+/*
+ * @file tx_queue.h
+ * @brief public interface of tx_queue.c
+ */
+#ifndef _TX_QUEUE_H_
+#define _TX_QUEUE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "nfc_driver.h"
+
+// Definitions
+#define TXQ_LATENCY_BUCKETS   32    // bucket n holds waits of under 2^n ms
+
+// what happens to a transaction that finds the queue full
+typedef enum {
+    TXQ_SPILL,          // the oldest goes on to the journal anyway, so nothing is lost
+    TXQ_DROP_OLDEST,    // the oldest is dropped
+    TXQ_COALESCE,       // a card already queued isn't queued again. else drop the oldest
+} txq_policy;
+
+// what txQueuePush() did with a transaction
+typedef enum {
+    TXQ_QUEUED,         // queued
+    TXQ_SPILLED,        // queued, and the oldest handed back to journal now
+    TXQ_DROPPED,        // queued, and the oldest dropped
+    TXQ_COALESCED,      // not queued: the same card is already waiting
+} txq_result;
+
+// Bounded FIFO of transactions waiting for the uplink. Only touched by the
+// uplink thread
+typedef struct {
+    nfc_transaction *aSlots;
+    uint32_t    uiCapacity;
+    uint32_t    uiHead;             // oldest
+    uint32_t    uiCount;
+    txq_policy  policy;
+
+    // counters
+    uint32_t    uiQueued;
+    uint32_t    uiDequeued;
+    uint32_t    uiSpilled;
+    uint32_t    uiDropped;
+    uint32_t    uiCoalesced;
+    uint32_t    uiHighWater;
+
+    // time from detection to leaving for the journal (dequeued or spilled)
+    uint32_t    auiLatency[TXQ_LATENCY_BUCKETS];
+    uint32_t    uiLatencySamples;
+    uint32_t    uiMaxLatencyMs;
+} tx_queue;
+
+// function prototypes
+int   initTxQueue( tx_queue *pQ, uint32_t uiCapacity, txq_policy policy );
+void  freeTxQueue( tx_queue *pQ );
+txq_result txQueuePush( tx_queue *pQ, const nfc_transaction *pTx, uint64_t ullNow,
+                        nfc_transaction *pSpilled );
+bool  txQueuePop( tx_queue *pQ, nfc_transaction *pTx, uint64_t ullNow );
+uint32_t txQueueDepth( const tx_queue *pQ );
+uint32_t txQueueLatency( const tx_queue *pQ, unsigned uiPercentile );
+int   parseTxPolicy( const char *szName, txq_policy *pPolicy );
+const char *txPolicyName( txq_policy policy );
+
+#endif // _TX_QUEUE_H_
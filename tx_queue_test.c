@@ -0,0 +1,208 @@
+/*
+ * @file tx_queue_test.c
+ * @brief unit test for tx_queue.c
+ *
+ * runs standalone - no NFC device needed. Fills the queue past its capacity
+ * under each overflow policy, and checks the latency percentiles.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nfc_record.h"
+#include "tx_queue.h"
+#include "unit_test.h"
+
+#define QUEUE_SLOTS     4
+
+// ---------------------------------------------------------------------------
+// a MIFARE tap of card number btCard, detected at ullMs
+//
+void makeTap( nfc_transaction *pTx, uint8_t btCard, uint64_t ullMs ){
+    memset( pTx, 0, sizeof(*pTx) );
+    pTx->nt.nm.nmt = NMT_ISO14443A;
+    pTx->nt.nm.nbr = NBR_106;
+    pTx->nt.nti.nai.szUidLen = 4;
+    pTx->nt.nti.nai.abtUid[0] = 0x04;
+    pTx->nt.nti.nai.abtUid[3] = btCard;
+    pTx->ullDetectedMs = ullMs;
+}
+
+// ---------------------------------------------------------------------------
+// card number of a queued tap
+//
+uint8_t cardOf( const nfc_transaction *pTx ){
+    return( pTx->nt.nti.nai.abtUid[3] );
+}
+
+// ---------------------------------------------------------------------------
+// taps come out in order. Full, the oldest spills to the caller
+//
+void testSpill( void ){
+    tx_queue q;
+    nfc_transaction tx, spilled;
+    int i;
+
+    CHECK( initTxQueue( &q, QUEUE_SLOTS, TXQ_SPILL ) == 0 );
+    for( i=0 ; i < QUEUE_SLOTS ; i++ ){
+        makeTap( &tx, (uint8_t)i, 0 );
+        CHECK( txQueuePush( &q, &tx, 0, &spilled ) == TXQ_QUEUED );
+    }
+    CHECK( txQueueDepth( &q ) == QUEUE_SLOTS );
+
+    makeTap( &tx, 9, 0 );
+    CHECK( txQueuePush( &q, &tx, 0, &spilled ) == TXQ_SPILLED );
+    CHECK( cardOf( &spilled ) == 0 );
+    CHECK( txQueueDepth( &q ) == QUEUE_SLOTS );
+
+    for( i=1 ; i < QUEUE_SLOTS ; i++ ){
+        CHECK( txQueuePop( &q, &tx, 0 ) );
+        CHECK( cardOf( &tx ) == i );
+    }
+    CHECK( txQueuePop( &q, &tx, 0 ) && cardOf( &tx ) == 9 );
+    CHECK( !txQueuePop( &q, &tx, 0 ) );
+
+    CHECK( q.uiQueued == QUEUE_SLOTS + 1 && q.uiDequeued == QUEUE_SLOTS );
+    CHECK( q.uiSpilled == 1 && q.uiDropped == 0 && q.uiHighWater == QUEUE_SLOTS );
+    freeTxQueue( &q );
+
+    // with no room at all, each tap spills as it comes
+    CHECK( initTxQueue( &q, 0, TXQ_SPILL ) == 0 );
+    makeTap( &tx, 5, 0 );
+    CHECK( txQueuePush( &q, &tx, 0, &spilled ) == TXQ_SPILLED );
+    CHECK( cardOf( &spilled ) == 5 && txQueueDepth( &q ) == 0 );
+    freeTxQueue( &q );
+}
+
+// ---------------------------------------------------------------------------
+// full, the oldest is dropped
+//
+void testDropOldest( void ){
+    tx_queue q;
+    nfc_transaction tx, spilled;
+    int i;
+
+    CHECK( initTxQueue( &q, QUEUE_SLOTS, TXQ_DROP_OLDEST ) == 0 );
+    for( i=0 ; i < 2 * QUEUE_SLOTS ; i++ ){
+        makeTap( &tx, (uint8_t)i, 0 );
+        CHECK( txQueuePush( &q, &tx, 0, &spilled ) == (i < QUEUE_SLOTS ? TXQ_QUEUED : TXQ_DROPPED) );
+    }
+    CHECK( q.uiDropped == QUEUE_SLOTS && q.uiSpilled == 0 );
+    for( i=QUEUE_SLOTS ; i < 2 * QUEUE_SLOTS ; i++ )
+        CHECK( txQueuePop( &q, &tx, 0 ) && cardOf( &tx ) == i );
+    CHECK( txQueueDepth( &q ) == 0 );
+    freeTxQueue( &q );
+}
+
+// ---------------------------------------------------------------------------
+// a card already waiting isn't queued again
+//
+void testCoalesce( void ){
+    tx_queue q;
+    nfc_transaction tx, spilled;
+
+    CHECK( initTxQueue( &q, QUEUE_SLOTS, TXQ_COALESCE ) == 0 );
+    makeTap( &tx, 1, 0 );
+    CHECK( txQueuePush( &q, &tx, 0, &spilled ) == TXQ_QUEUED );
+    makeTap( &tx, 2, 10 );
+    CHECK( txQueuePush( &q, &tx, 10, &spilled ) == TXQ_QUEUED );
+    makeTap( &tx, 1, 20 );
+    CHECK( txQueuePush( &q, &tx, 20, &spilled ) == TXQ_COALESCED );
+    CHECK( txQueueDepth( &q ) == 2 && q.uiCoalesced == 1 );
+
+    // at another reader, it's another tap
+    tx.btReader = 1;
+    CHECK( txQueuePush( &q, &tx, 20, &spilled ) == TXQ_QUEUED );
+    CHECK( txQueuePop( &q, &tx, 20 ) && cardOf( &tx ) == 1 );
+    CHECK( txQueuePop( &q, &tx, 20 ) && cardOf( &tx ) == 2 );
+    CHECK( txQueuePop( &q, &tx, 20 ) && tx.btReader == 1 );
+    makeTap( &tx, 1, 0 );
+    CHECK( txQueuePush( &q, &tx, 20, &spilled ) == TXQ_QUEUED );
+    makeTap( &tx, 2, 10 );
+    CHECK( txQueuePush( &q, &tx, 20, &spilled ) == TXQ_QUEUED );
+    makeTap( &tx, 1, 20 );
+
+    // the same UID on another type of card is another card
+    tx.nt.nm.nmt = NMT_JEWEL;
+    memcpy( tx.nt.nti.nji.btId, "\x04\x00\x00\x01", 4 );
+    CHECK( txQueuePush( &q, &tx, 20, &spilled ) == TXQ_QUEUED );
+
+    // the first tap keeps its place, and its time
+    CHECK( txQueuePop( &q, &tx, 30 ) && cardOf( &tx ) == 1 && tx.ullDetectedMs == 0 );
+
+    // once it has gone, the card queues again
+    makeTap( &tx, 1, 40 );
+    CHECK( txQueuePush( &q, &tx, 40, &spilled ) == TXQ_QUEUED );
+
+    // full of different cards, the oldest is dropped
+    makeTap( &tx, 3, 50 );
+    CHECK( txQueuePush( &q, &tx, 50, &spilled ) == TXQ_QUEUED );
+    makeTap( &tx, 4, 60 );
+    CHECK( txQueuePush( &q, &tx, 60, &spilled ) == TXQ_DROPPED );
+    CHECK( txQueuePop( &q, &tx, 70 ) && tx.nt.nm.nmt == NMT_JEWEL );
+    freeTxQueue( &q );
+
+    // a card arriving and leaving isn't a repeat tap
+    CHECK( initTxQueue( &q, QUEUE_SLOTS, TXQ_COALESCE ) == 0 );
+    makeTap( &tx, 1, 0 );
+    tx.btEvent = NFC_EVENT_ARRIVED;
+    CHECK( txQueuePush( &q, &tx, 0, &spilled ) == TXQ_QUEUED );
+    tx.btEvent = NFC_EVENT_REMOVED;
+    CHECK( txQueuePush( &q, &tx, 10, &spilled ) == TXQ_QUEUED );
+    tx.btEvent = NFC_EVENT_ARRIVED;
+    CHECK( txQueuePush( &q, &tx, 20, &spilled ) == TXQ_QUEUED );
+    CHECK( txQueuePop( &q, &tx, 30 ) && tx.btEvent == NFC_EVENT_ARRIVED );
+    CHECK( txQueuePop( &q, &tx, 30 ) && tx.btEvent == NFC_EVENT_REMOVED );
+    freeTxQueue( &q );
+}
+
+// ---------------------------------------------------------------------------
+// waits are summarised by percentile, to the power of 2
+//
+void testLatency( void ){
+    tx_queue q;
+    nfc_transaction tx, spilled;
+    txq_policy policy;
+    int i;
+
+    CHECK( initTxQueue( &q, 100, TXQ_SPILL ) == 0 );
+    CHECK( txQueueLatency( &q, 50 ) == 0 );
+
+    // 90 taps wait 3ms, 9 wait 100ms and one 5s
+    for( i=0 ; i < 100 ; i++ ){
+        makeTap( &tx, (uint8_t)i, 1000 );
+        txQueuePush( &q, &tx, 1000, &spilled );
+    }
+    for( i=0 ; i < 100 ; i++ )
+        txQueuePop( &q, &tx, i < 90 ? 1003 : i < 99 ? 1100 : 6000 );
+    CHECK( q.uiLatencySamples == 100 && q.uiMaxLatencyMs == 5000 );
+    CHECK( txQueueLatency( &q, 50 ) == 3 );
+    CHECK( txQueueLatency( &q, 90 ) == 3 );
+    CHECK( txQueueLatency( &q, 95 ) == 127 );
+    CHECK( txQueueLatency( &q, 99 ) == 127 );
+    CHECK( txQueueLatency( &q, 100 ) == 5000 );
+    freeTxQueue( &q );
+
+    CHECK( parseTxPolicy( "drop", &policy ) == 0 && policy == TXQ_DROP_OLDEST );
+    CHECK( parseTxPolicy( "Coalesce", &policy ) == 0 && policy == TXQ_COALESCE );
+    CHECK( parseTxPolicy( "lifo", &policy ) == -1 );
+    CHECK( strcmp( txPolicyName( TXQ_SPILL ), "spill" ) == 0 );
+}
+
+// ===========================================================================
+// main
+//
+int main( int argc, char *argv[] )
+{
+    testSpill();
+    testDropOldest();
+    testCoalesce();
+    testLatency();
+
+    if( nFailures ){
+        printf("%d check(s) FAILED\n", nFailures );
+        exit( EXIT_FAILURE );
+    }
+    printf("all tx queue tests passed\n");
+    exit( EXIT_SUCCESS );
+}
@@ -0,0 +1,19 @@
+/*
+ * @file unit_test.h
+ * @brief the checks shared by the unit test programs
+ *
+ * Each *_test.c is a program of its own, so each gets its own count. A failed
+ * CHECK prints where it was and carries on; main() exits with EXIT_FAILURE
+ * if nFailures isn't 0 at the end.
+ */
+#ifndef _UNIT_TEST_H_
+#define _UNIT_TEST_H_
+
+#include <stdio.h>
+
+static int nFailures = 0;
+
+#define CHECK(cond) do{ if( !(cond) ){ \
+    fprintf(stderr,"FAILED %s:%d: %s\n", __FILE__, __LINE__, #cond); nFailures++; } }while(0)
+
+#endif // _UNIT_TEST_H_
@@ -0,0 +1,245 @@
+/*
+ * @file uring.c
+ * @brief minimal io_uring: batched socket and disk I/O in one system call
+ *
+ * With epoll every send, receive and sync is a system call of its own, plus
+ * the epoll_wait() that says the socket is ready. With io_uring they are
+ * written as entries into a ring shared with the kernel, and a single
+ * io_uring_enter() submits all of them; the results come back in a second
+ * ring, read without a system call. The ring's fd is readable while
+ * results are waiting, so it goes into the event loop like any other.
+ *
+ * Talks to the kernel directly (io_uring_setup/io_uring_enter), so it needs
+ * no liburing. Kernels before 5.1, or with io_uring disabled, fail
+ * initUring(): the caller then carries on with epoll.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+// the shared ring indexes are written by the kernel on another CPU
+#define loadAcquire(p)      __atomic_load_n( (p), __ATOMIC_ACQUIRE )
+#define storeRelease(p, v)  __atomic_store_n( (p), (v), __ATOMIC_RELEASE )
+
+
+// ---------------------------------------------------------------------------
+// Internal function - io_uring_setup(2), which has no glibc wrapper
+//
+static int uringSetup( unsigned uiEntries, struct io_uring_params *pParams ){
+#ifdef __NR_io_uring_setup
+    return( (int)syscall( __NR_io_uring_setup, uiEntries, pParams ) );
+#else
+    errno = ENOSYS;
+    return( -1 );
+#endif
+}
+
+// ---------------------------------------------------------------------------
+// Internal function - io_uring_enter(2)
+//
+static int uringEnter( int fd, unsigned uiSubmit, unsigned uiWait, unsigned uiFlags ){
+#ifdef __NR_io_uring_enter
+    return( (int)syscall( __NR_io_uring_enter, fd, uiSubmit, uiWait, uiFlags, NULL, 0 ) );
+#else
+    errno = ENOSYS;
+    return( -1 );
+#endif
+}
+
+// ---------------------------------------------------------------------------
+// set up a ring of uiEntries submission entries (0 means URING_ENTRIES)
+//
+// returns: 0 if OK, else -1 (errno ENOSYS or EPERM if the kernel has no
+//          io_uring for us: use epoll instead)
+//
+int initUring( uring *pRing, unsigned uiEntries ){
+    struct io_uring_params params;
+    uint8_t *pbtSq, *pbtCq;
+
+    memset( pRing, 0, sizeof(*pRing) );
+    memset( &params, 0, sizeof(params) );
+    pRing->fd = -1;
+    if( (pRing->fd = uringSetup( uiEntries ? uiEntries : URING_ENTRIES, &params )) < 0 )
+        return( -1 );
+    pRing->uiEntries = params.sq_entries;
+
+    // map the two rings - one mapping on kernels that share it - and the entries
+    pRing->szSqMap = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    pRing->szCqMap = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if( params.features & IORING_FEAT_SINGLE_MMAP ){
+        if( pRing->szCqMap > pRing->szSqMap )
+            pRing->szSqMap = pRing->szCqMap;
+        pRing->szCqMap = 0;
+    }
+    pRing->pSqMap = mmap( NULL, pRing->szSqMap, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          pRing->fd, IORING_OFF_SQ_RING );
+    if( pRing->pSqMap == MAP_FAILED ){
+        pRing->pSqMap = NULL;
+        closeUring( pRing );
+        return( -1 );
+    }
+    if( pRing->szCqMap == 0 )
+        pRing->pCqMap = pRing->pSqMap;
+    else if( (pRing->pCqMap = mmap( NULL, pRing->szCqMap, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                    pRing->fd, IORING_OFF_CQ_RING )) == MAP_FAILED ){
+        pRing->pCqMap = NULL;
+        closeUring( pRing );
+        return( -1 );
+    }
+    pRing->szSqes = params.sq_entries * sizeof(struct io_uring_sqe);
+    pRing->pSqes = mmap( NULL, pRing->szSqes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         pRing->fd, IORING_OFF_SQES );
+    if( pRing->pSqes == MAP_FAILED ){
+        pRing->pSqes = NULL;
+        closeUring( pRing );
+        return( -1 );
+    }
+
+    pbtSq = (uint8_t *)pRing->pSqMap;
+    pRing->puiSqHead = (unsigned *)(pbtSq + params.sq_off.head);
+    pRing->puiSqTail = (unsigned *)(pbtSq + params.sq_off.tail);
+    pRing->uiSqMask = *(unsigned *)(pbtSq + params.sq_off.ring_mask);
+    pRing->puiSqArray = (unsigned *)(pbtSq + params.sq_off.array);
+
+    pbtCq = (uint8_t *)pRing->pCqMap;
+    pRing->puiCqHead = (unsigned *)(pbtCq + params.cq_off.head);
+    pRing->puiCqTail = (unsigned *)(pbtCq + params.cq_off.tail);
+    pRing->uiCqMask = *(unsigned *)(pbtCq + params.cq_off.ring_mask);
+    pRing->pCqes = (struct io_uring_cqe *)(pbtCq + params.cq_off.cqes);
+    return( 0 );
+}
+
+// ---------------------------------------------------------------------------
+// tear the ring down. Operations still in flight are cancelled by the kernel
+//
+void closeUring( uring *pRing ){
+    if( pRing->pSqes != NULL )
+        munmap( pRing->pSqes, pRing->szSqes );
+    if( pRing->pCqMap != NULL && pRing->pCqMap != pRing->pSqMap )
+        munmap( pRing->pCqMap, pRing->szCqMap );
+    if( pRing->pSqMap != NULL )
+        munmap( pRing->pSqMap, pRing->szSqMap );
+    if( pRing->fd >= 0 )
+        close( pRing->fd );
+    pRing->pSqes = NULL;
+    pRing->pSqMap = pRing->pCqMap = NULL;
+    pRing->fd = -1;
+}
+
+// ---------------------------------------------------------------------------
+// take the next submission entry for an operation on fd, cleared except for
+// the opcode and fd: the caller fills in the rest (addr, len, flags...).
+// It goes to the kernel with the next uringSubmit(), and fnHandler is called
+// from reapUring() when it is done
+//
+// returns: the entry, or NULL if the ring is full (errno EBUSY)
+//
+struct io_uring_sqe *uringPrepare( uring *pRing, uint8_t btOpcode, int fd,
+                                   uring_handler fnHandler, void *pCtx ){
+    struct io_uring_sqe *pSqe;
+    unsigned uiTail = *pRing->puiSqTail;
+    int i, nOp;
+
+    if( uiTail - loadAcquire( pRing->puiSqHead ) >= pRing->uiEntries ){
+        errno = EBUSY;
+        return( NULL );
+    }
+    for( i=0, nOp = -1 ; i < URING_MAX_OPS ; i++ ){
+        if( pRing->aOps[(pRing->nFreeOp + i) % URING_MAX_OPS].fnHandler == NULL ){
+            nOp = (pRing->nFreeOp + i) % URING_MAX_OPS;
+            break;
+        }
+    }
+    if( nOp < 0 ){
+        errno = EBUSY;
+        return( NULL );
+    }
+    pRing->aOps[nOp].fnHandler = fnHandler;
+    pRing->aOps[nOp].pCtx = pCtx;
+    pRing->nFreeOp = (nOp + 1) % URING_MAX_OPS;
+
+    pSqe = &pRing->pSqes[uiTail & pRing->uiSqMask];
+    memset( pSqe, 0, sizeof(*pSqe) );
+    pSqe->opcode = btOpcode;
+    pSqe->fd = fd;
+    pSqe->user_data = (uint64_t)nOp;
+    pRing->puiSqArray[uiTail & pRing->uiSqMask] = uiTail & pRing->uiSqMask;
+    storeRelease( pRing->puiSqTail, uiTail + 1 );
+    pRing->uiQueued++;
+    return( pSqe );
+}
+
+// ---------------------------------------------------------------------------
+// hand everything prepared since the last call to the kernel, in one system
+// call, and optionally wait there until uiWait operations have completed
+//
+// returns: number of entries submitted, else -1 on error
+//
+int uringSubmit( uring *pRing, unsigned uiWait ){
+    int n;
+
+    if( pRing->uiQueued == 0 && uiWait == 0 )
+        return( 0 );
+    do{
+        pRing->uiEnters++;
+        n = uringEnter( pRing->fd, pRing->uiQueued, uiWait, uiWait ? IORING_ENTER_GETEVENTS : 0 );
+    } while( n < 0 && errno == EINTR );
+    if( n < 0 )
+        return( -1 );
+    pRing->uiQueued -= (unsigned)n;
+    pRing->uiSubmitted += (unsigned)n;
+    return( n );
+}
+
+// ---------------------------------------------------------------------------
+// call the handler of every operation that has completed. No system call:
+// the results are read straight from the completion ring
+//
+// returns: number of operations completed
+//
+int reapUring( uring *pRing ){
+    const struct io_uring_cqe *pCqe;
+    uring_op op;
+    int32_t nRes;
+    unsigned uiHead = *pRing->puiCqHead;
+    int n = 0;
+
+    while( uiHead != loadAcquire( pRing->puiCqTail ) ){
+        pCqe = &pRing->pCqes[uiHead & pRing->uiCqMask];
+        nRes = pCqe->res;
+        op = pRing->aOps[pCqe->user_data % URING_MAX_OPS];
+        pRing->aOps[pCqe->user_data % URING_MAX_OPS].fnHandler = NULL;
+
+        // free the entry before the handler runs, so it can queue more
+        storeRelease( pRing->puiCqHead, ++uiHead );
+        pRing->uiCompleted++;
+        n++;
+        if( op.fnHandler != NULL )
+            op.fnHandler( nRes, op.pCtx );
+        uiHead = *pRing->puiCqHead;
+    }
+    return( n );
+}
+
+// ---------------------------------------------------------------------------
+// entries prepared but not submitted yet
+//
+unsigned uringQueued( const uring *pRing ){
+    return( pRing->uiQueued );
+}
+
+// ---------------------------------------------------------------------------
+// file descriptor of the ring, for the caller's event loop: it is readable
+// while completions are waiting to be reaped
+//
+// returns: fd, or -1 if not set up
+//
+int getUringFd( const uring *pRing ){
+    return( pRing->fd );
+}
@@ -0,0 +1,60 @@
+/*
+ * @file uring.h
+ * @brief public interface of uring.c
+ */
+#ifndef _URING_H_
+#define _URING_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+// Definitions
+#define URING_ENTRIES      32       // submission queue entries
+#define URING_MAX_OPS      64       // operations in flight at any one time
+
+// called from reapUring() when an operation completes, with its result:
+// what the system call would have returned, or -errno
+typedef void (*uring_handler)( int32_t nRes, void *pCtx );
+
+typedef struct {
+    uring_handler fnHandler;        // NULL if the slot is free
+    void         *pCtx;
+} uring_op;
+
+typedef struct {
+    int       fd;                   // -1 if not set up
+    unsigned  uiEntries;
+
+    // the rings, shared with the kernel
+    void     *pSqMap, *pCqMap;
+    size_t    szSqMap, szCqMap, szSqes;
+    unsigned *puiSqHead, *puiSqTail, *puiSqArray;
+    unsigned  uiSqMask;
+    struct io_uring_sqe *pSqes;
+    unsigned *puiCqHead, *puiCqTail;
+    unsigned  uiCqMask;
+    struct io_uring_cqe *pCqes;
+
+    unsigned  uiQueued;             // prepared since the last submit
+    uring_op  aOps[URING_MAX_OPS];  // indexed by the entry's user_data
+    int       nFreeOp;              // where to start looking for a free one
+
+    // counters
+    uint32_t  uiEnters;             // io_uring_enter() calls
+    uint32_t  uiSubmitted;
+    uint32_t  uiCompleted;
+} uring;
+
+// function prototypes
+int  initUring( uring *pRing, unsigned uiEntries );
+void closeUring( uring *pRing );
+struct io_uring_sqe *uringPrepare( uring *pRing, uint8_t btOpcode, int fd,
+                                   uring_handler fnHandler, void *pCtx );
+int  uringSubmit( uring *pRing, unsigned uiWait );
+int  reapUring( uring *pRing );
+unsigned uringQueued( const uring *pRing );
+int  getUringFd( const uring *pRing );
+
+#endif // _URING_H_
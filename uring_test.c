@@ -0,0 +1,158 @@
+/*
+ * @file uring_test.c
+ * @brief unit test for uring.c
+ *
+ * runs standalone. Sends and receives over a socketpair, syncs a scratch
+ * file, and fills the ring. Where the kernel has no io_uring the tests are
+ * skipped, as rpi_nfc then falls back to epoll.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#include "uring.h"
+#include "unit_test.h"
+
+static uring   ring;
+static int     nCompleted;
+static int32_t nLastRes;
+
+// ---------------------------------------------------------------------------
+// completion handler: note the result
+//
+void onDone( int32_t nRes, void *pCtx ){
+    nCompleted++;
+    nLastRes = nRes;
+    if( pCtx != NULL )
+        *(int32_t *)pCtx = nRes;
+}
+
+// ---------------------------------------------------------------------------
+// completion handler that queues another operation, as the uplink does
+//
+void onDoneQueueNop( int32_t nRes, void *pCtx ){
+    nCompleted++;
+    CHECK( uringPrepare( &ring, IORING_OP_NOP, -1, onDone, NULL ) != NULL );
+}
+
+// ---------------------------------------------------------------------------
+// a send and a receive go to the kernel in one system call
+//
+void testSendReceive( void ){
+    static const char szMessage[] = "{\"msg\":\"ACK\",\"seq\":12}";
+    struct io_uring_sqe *pSqe;
+    struct pollfd pfd;
+    char acBuffer[64];
+    int32_t nSent = 0, nReceived = 0;
+    uint32_t uiEnters;
+    int sv[2];
+
+    CHECK( socketpair( AF_UNIX, SOCK_STREAM, 0, sv ) == 0 );
+    nCompleted = 0;
+    uiEnters = ring.uiEnters;
+
+    // the receive is queued first, and waits for the send
+    CHECK( (pSqe = uringPrepare( &ring, IORING_OP_RECV, sv[1], onDone, &nReceived )) != NULL );
+    pSqe->addr = (uint64_t)(uintptr_t)acBuffer;
+    pSqe->len = sizeof(acBuffer);
+    CHECK( (pSqe = uringPrepare( &ring, IORING_OP_SEND, sv[0], onDone, &nSent )) != NULL );
+    pSqe->addr = (uint64_t)(uintptr_t)szMessage;
+    pSqe->len = strlen( szMessage );
+    CHECK( uringQueued( &ring ) == 2 );
+
+    CHECK( uringSubmit( &ring, 2 ) == 2 );
+    CHECK( ring.uiEnters == uiEnters + 1 );
+    CHECK( uringQueued( &ring ) == 0 );
+
+    // the ring's fd says there are completions, and they're reaped without a system call
+    pfd.fd = getUringFd( &ring );
+    pfd.events = POLLIN;
+    CHECK( poll( &pfd, 1, 1000 ) == 1 );
+    CHECK( reapUring( &ring ) == 2 );
+    CHECK( nCompleted == 2 );
+    CHECK( nSent == (int32_t)strlen( szMessage ) );
+    CHECK( nReceived == (int32_t)strlen( szMessage ) );
+    CHECK( memcmp( acBuffer, szMessage, strlen( szMessage ) ) == 0 );
+    CHECK( reapUring( &ring ) == 0 );
+
+    // errors come back as -errno
+    close( sv[1] );
+    CHECK( (pSqe = uringPrepare( &ring, IORING_OP_SEND, sv[0], onDone, NULL )) != NULL );
+    pSqe->addr = (uint64_t)(uintptr_t)szMessage;
+    pSqe->len = strlen( szMessage );
+    pSqe->msg_flags = MSG_NOSIGNAL;
+    CHECK( uringSubmit( &ring, 1 ) == 1 );
+    CHECK( reapUring( &ring ) == 1 );
+    CHECK( nLastRes == -EPIPE );
+    close( sv[0] );
+}
+
+// ---------------------------------------------------------------------------
+// fdatasync of a file, as the journal's group commit does
+//
+void testSync( void ){
+    struct io_uring_sqe *pSqe;
+    char szPath[] = "/tmp/uring_testXXXXXX";
+    int32_t nRes = -1;
+    int fd;
+
+    CHECK( (fd = mkstemp( szPath )) >= 0 );
+    unlink( szPath );
+    CHECK( write( fd, "tap", 3 ) == 3 );
+    CHECK( (pSqe = uringPrepare( &ring, IORING_OP_FSYNC, fd, onDone, &nRes )) != NULL );
+    pSqe->fsync_flags = IORING_FSYNC_DATASYNC;
+    CHECK( uringSubmit( &ring, 1 ) == 1 );
+    CHECK( reapUring( &ring ) == 1 );
+    CHECK( nRes == 0 );
+    close( fd );
+}
+
+// ---------------------------------------------------------------------------
+// a full ring says so, and handlers can queue more
+//
+void testFull( void ){
+    unsigned i;
+
+    nCompleted = 0;
+    for( i=0 ; i < ring.uiEntries ; i++ )
+        CHECK( uringPrepare( &ring, IORING_OP_NOP, -1, onDoneQueueNop, NULL ) != NULL );
+    CHECK( uringPrepare( &ring, IORING_OP_NOP, -1, onDone, NULL ) == NULL && errno == EBUSY );
+    CHECK( uringSubmit( &ring, ring.uiEntries ) == (int)ring.uiEntries );
+    CHECK( reapUring( &ring ) == (int)ring.uiEntries );
+    CHECK( uringQueued( &ring ) == ring.uiEntries );
+
+    CHECK( uringSubmit( &ring, ring.uiEntries ) == (int)ring.uiEntries );
+    CHECK( reapUring( &ring ) == (int)ring.uiEntries );
+    CHECK( nCompleted == 2 * (int)ring.uiEntries );
+    CHECK( ring.uiSubmitted == ring.uiCompleted );
+}
+
+// ===========================================================================
+// main
+//
+int main( int argc, char *argv[] )
+{
+    if( initUring( &ring, 8 ) != 0 ){
+        perror("io_uring not available. skipping tests");
+        exit( EXIT_SUCCESS );
+    }
+    CHECK( ring.uiEntries == 8 );
+
+    testSendReceive();
+    testSync();
+    testFull();
+    closeUring( &ring );
+    CHECK( getUringFd( &ring ) == -1 );
+
+    if( nFailures ){
+        printf("%d check(s) FAILED\n", nFailures );
+        exit( EXIT_FAILURE );
+    }
+    printf("all uring tests passed\n");
+    exit( EXIT_SUCCESS );
+}